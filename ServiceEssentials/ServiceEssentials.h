@@ -22,9 +22,22 @@ FOUNDATION_EXPORT const unsigned char ServiceEssentialsVersionString[];
 #import <ServiceEssentials/NSArray+SEJSONExtensions.h>
 #import <ServiceEssentials/NSDictionary+SEJSONExtensions.h>
 #import <ServiceEssentials/NSString+SEExtensions.h>
+#import <ServiceEssentials/SETimeline.h>
 #import <ServiceEssentials/SECancellableToken.h>
 #import <ServiceEssentials/SECancellableTokenImpl.h>
+#import <ServiceEssentials/SEFuture.h>
 #import <ServiceEssentials/SEDataRequestJSONDeserializable.h>
+#import <ServiceEssentials/SEDataRequestLinkPolicy.h>
+#import <ServiceEssentials/SEDataRequestNetworkEstimator.h>
+#import <ServiceEssentials/SEDataRequestCircuitBreakers.h>
+#import <ServiceEssentials/SEDataRequestRateLimiter.h>
+#import <ServiceEssentials/SEDataRequestOutbox.h>
+#import <ServiceEssentials/SEDataRequestContentCache.h>
+#import <ServiceEssentials/SEDataRequestScope.h>
+#import <ServiceEssentials/SEDataRequestPreparation.h>
+#import <ServiceEssentials/SEDataRequestResumableUploader.h>
+#import <ServiceEssentials/SEDataRequestPageSequence.h>
+#import <ServiceEssentials/SEDataRequestServerSentEvent.h>
 #import <ServiceEssentials/SEDataRequestService.h>
 #import <ServiceEssentials/SEDataRequestServiceImpl.h>
 #import <ServiceEssentials/SEDataRequestServiceSecurityHelper.h>
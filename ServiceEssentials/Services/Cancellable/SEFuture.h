@@ -0,0 +1,69 @@
+//
+//  SEFuture.h
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <Foundation/Foundation.h>
+
+#import <ServiceEssentials/SECancellableToken.h>
+
+/** Future has been cancelled before it was resolved */
+extern NSInteger const SEFutureCancelled;
+/** Future has not been resolved within the time given to `timeout:` */
+extern NSInteger const SEFutureTimedOut;
+
+/** Resolves a future, with an error or with a result when error is `nil`. Only the first call has an effect. */
+typedef void (^ SEFutureResolver)(id _Nullable result, NSError * _Nullable error);
+
+/**
+ Result of an asynchronous operation, such as a data request, that can be composed with other futures.
+ Continuations run on the thread that resolves the future unless a queue is given, so a chain of requests does not hop between queues.
+ Cancelling a future cancels the operation it waits for, and for composed futures the whole chain of operations behind it.
+ A future several others depend on, or that is observed directly, is only cancelled by a dependent once nothing else waits for it.
+ A cancelled future is resolved with `SEFutureCancelled` error. Futures are thread-safe.
+ */
+@interface SEFuture<__covariant ResultType> : NSObject<SECancellableToken>
+
+/** Future that is already resolved with the result */
++ (nonnull SEFuture<ResultType> *) futureWithResult: (nullable ResultType) result;
+/** Future that is already resolved with the error */
++ (nonnull SEFuture<ResultType> *) futureWithError: (nonnull NSError *) error;
+/**
+ Creates a future for an operation started by the block.
+ The block is called right away with a resolver and returns the token of the operation, which is cancelled when the future is cancelled.
+ */
++ (nonnull SEFuture<ResultType> *) futureWithBlock: (id<SECancellableToken> _Nullable (^ _Nonnull)(SEFutureResolver _Nonnull resolve)) block;
+
+/** Resolves with an array of results in the order of futures, `NSNull` standing for `nil`. Fails with the first error and cancels the rest. */
++ (nonnull SEFuture<NSArray *> *) all: (nonnull NSArray<SEFuture *> *) futures;
+/** Resolves with the first result and cancels the rest. Fails with the last error when all futures fail. */
++ (nonnull SEFuture *) any: (nonnull NSArray<SEFuture *> *) futures;
+
+@property (atomic, readonly, assign) BOOL isResolved;
+/** Result of a resolved future, `nil` until then */
+@property (atomic, readonly, strong, nullable) ResultType result;
+/** Error of a failed future, `nil` until then */
+@property (atomic, readonly, strong, nullable) NSError *error;
+
+/** Chains a dependent operation started with the result. Errors skip the block and are passed along. Block runs inline. */
+- (nonnull SEFuture *) then: (SEFuture * _Nullable (^ _Nonnull)(ResultType _Nullable result)) block;
+/** Chains a dependent operation started with the result. Block runs on the queue, or inline when queue is `nil`. */
+- (nonnull SEFuture *) then: (SEFuture * _Nullable (^ _Nonnull)(ResultType _Nullable result)) block queue: (nullable dispatch_queue_t) queue;
+
+/** Transforms the result. Errors skip the block and are passed along. Block runs inline. */
+- (nonnull SEFuture *) map: (id _Nullable (^ _Nonnull)(ResultType _Nullable result)) block;
+/** Transforms the result. Block runs on the queue, or inline when queue is `nil`. */
+- (nonnull SEFuture *) map: (id _Nullable (^ _Nonnull)(ResultType _Nullable result)) block queue: (nullable dispatch_queue_t) queue;
+
+/** Future that fails with `SEFutureTimedOut` when this one is not resolved in time, and then cancels this future unless something else waits for it */
+- (nonnull SEFuture<ResultType> *) timeout: (NSTimeInterval) interval;
+
+/** Observes the outcome. Callbacks run on the queue, or inline when queue is `nil`. Cancellation is reported as a failure. */
+- (void) onSuccess: (nullable void (^)(ResultType _Nullable result)) success failure: (nullable void (^)(NSError * _Nonnull error)) failure queue: (nullable dispatch_queue_t) queue;
+
+@end
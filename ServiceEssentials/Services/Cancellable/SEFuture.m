@@ -0,0 +1,497 @@
+//
+//  SEFuture.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <ServiceEssentials/SEFuture.h>
+
+#include <pthread.h>
+
+#import <ServiceEssentials/SEConstants.h>
+#import <ServiceEssentials/SETools.h>
+
+static NSInteger const SEFutureErrorStart = 1100;
+NSInteger const SEFutureCancelled = SEFutureErrorStart;
+NSInteger const SEFutureTimedOut = SEFutureErrorStart + 1;
+
+typedef void (^ SEFutureCallback)(id result, NSError *error);
+
+@interface SEFuture ()
+- (void) removeObserver: (SEFutureCallback) observer;
+@end
+
+// Observation of a future by a dependent one. Neither the future nor the dependent is kept alive by it.
+@interface SEFutureDependency : NSObject<SECancellableToken>
+- (instancetype) initWithFuture: (SEFuture *) future observer: (SEFutureCallback) observer;
+@end
+
+@implementation SEFutureDependency
+{
+    __weak SEFuture *_future;
+    __weak SEFutureCallback _observer;
+}
+
+- (instancetype)initWithService:(id<SECancellableItemService>)service
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithFuture:(SEFuture *)future observer:(SEFutureCallback)observer
+{
+    self = [super init];
+    if (self)
+    {
+        _future = future;
+        _observer = observer;
+    }
+    return self;
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+    return self;
+}
+
+// Stops observing; the future is only cancelled when nothing else observes it
+- (void)cancel
+{
+    SEFuture *future = _future;
+    SEFutureCallback observer = _observer;
+    if (future != nil && observer != nil) [future removeObserver:observer];
+}
+
+@end
+
+// Cancels a set of dependencies at once, used by the combinators
+@interface SEFutureGroup : NSObject<SECancellableToken>
+- (void) addToken: (id<SECancellableToken>) token;
+@end
+
+@implementation SEFutureGroup
+{
+    NSMutableArray<id<SECancellableToken>> *_tokens;
+    BOOL _cancelled;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self)
+    {
+        _tokens = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (instancetype)initWithService:(id<SECancellableItemService>)service
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+    return self;
+}
+
+- (void)addToken:(id<SECancellableToken>)token
+{
+    BOOL cancelled = NO;
+    @synchronized (self)
+    {
+        cancelled = _cancelled;
+        if (!cancelled) [_tokens addObject:token];
+    }
+    
+    // an item may fail the group before the rest are observed
+    if (cancelled) [token cancel];
+}
+
+- (void)cancel
+{
+    NSArray<id<SECancellableToken>> *tokens = nil;
+    @synchronized (self)
+    {
+        _cancelled = YES;
+        tokens = [_tokens copy];
+        [_tokens removeAllObjects];
+    }
+    for (id<SECancellableToken> token in tokens) [token cancel];
+}
+
+@end
+
+@implementation SEFuture
+{
+    pthread_mutex_t _lock;
+    BOOL _resolved;
+    BOOL _cancelled;
+    id _result;
+    NSError *_error;
+    NSMutableArray<SEFutureCallback> *_callbacks;
+    // operation or future this one waits for, released once resolved so that chains do not outlive their results
+    id<SECancellableToken> _cancellationTarget;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self)
+    {
+        pthread_mutex_init(&_lock, NULL);
+    }
+    return self;
+}
+
+- (instancetype)initWithService:(id<SECancellableItemService>)service
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&_lock);
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+    return self;
+}
+
+#pragma mark - Creation
+
++ (SEFuture *)futureWithResult:(id)result
+{
+    SEFuture *future = [SEFuture new];
+    [future resolveWithResult:result error:nil];
+    return future;
+}
+
++ (SEFuture *)futureWithError:(NSError *)error
+{
+    if (error == nil) THROW_INVALID_PARAM(error, nil);
+    
+    SEFuture *future = [SEFuture new];
+    [future resolveWithResult:nil error:error];
+    return future;
+}
+
++ (SEFuture *)futureWithBlock:(id<SECancellableToken> (^)(SEFutureResolver))block
+{
+    if (block == nil) THROW_INVALID_PARAM(block, nil);
+    
+    SEFuture *future = [SEFuture new];
+    id<SECancellableToken> token = block(^(id result, NSError *error) {
+        [future resolveWithResult:result error:error];
+    });
+    if (token != nil) [future setCancellationTarget:token];
+    return future;
+}
+
++ (SEFuture<NSArray *> *)all:(NSArray<SEFuture *> *)futures
+{
+    if (futures == nil) THROW_INVALID_PARAM(futures, nil);
+    if (futures.count == 0) return [SEFuture futureWithResult:@[]];
+    
+    SEFuture *future = [SEFuture new];
+    SEFutureGroup *group = [SEFutureGroup new];
+    [future setCancellationTarget:group];
+    
+    NSMutableArray *results = [[NSMutableArray alloc] initWithCapacity:futures.count];
+    for (NSUInteger i = 0; i < futures.count; ++i) [results addObject:[NSNull null]];
+    __block NSUInteger remaining = futures.count;
+    
+    [futures enumerateObjectsUsingBlock:^(SEFuture *item, NSUInteger index, BOOL *stop) {
+        [group addToken:[item observeAsDependencyOnQueue:nil callback:^(id result, NSError *error) {
+            if (error != nil)
+            {
+                if ([future resolveWithResult:nil error:error]) [group cancel];
+                return;
+            }
+            
+            NSArray *completeResults = nil;
+            @synchronized (results)
+            {
+                if (result != nil) [results replaceObjectAtIndex:index withObject:result];
+                if (--remaining == 0) completeResults = [results copy];
+            }
+            if (completeResults != nil) [future resolveWithResult:completeResults error:nil];
+        }]];
+    }];
+    return future;
+}
+
++ (SEFuture *)any:(NSArray<SEFuture *> *)futures
+{
+    if (futures.count == 0) THROW_INVALID_PARAM(futures, nil);
+    
+    SEFuture *future = [SEFuture new];
+    SEFutureGroup *group = [SEFutureGroup new];
+    [future setCancellationTarget:group];
+    
+    __block NSUInteger remaining = futures.count;
+    NSObject *lock = [NSObject new];
+    for (SEFuture *item in futures)
+    {
+        [group addToken:[item observeAsDependencyOnQueue:nil callback:^(id result, NSError *error) {
+            if (error == nil)
+            {
+                if ([future resolveWithResult:result error:nil]) [group cancel];
+                return;
+            }
+            
+            BOOL isLast = NO;
+            @synchronized (lock)
+            {
+                isLast = (--remaining == 0);
+            }
+            if (isLast) [future resolveWithResult:nil error:error];
+        }]];
+    }
+    return future;
+}
+
+#pragma mark - State
+
+- (BOOL)isResolved
+{
+    pthread_mutex_lock(&_lock);
+    BOOL resolved = _resolved;
+    pthread_mutex_unlock(&_lock);
+    return resolved;
+}
+
+- (id)result
+{
+    pthread_mutex_lock(&_lock);
+    id result = _result;
+    pthread_mutex_unlock(&_lock);
+    return result;
+}
+
+- (NSError *)error
+{
+    pthread_mutex_lock(&_lock);
+    NSError *error = _error;
+    pthread_mutex_unlock(&_lock);
+    return error;
+}
+
+- (BOOL)resolveWithResult:(id)result error:(NSError *)error
+{
+    NSArray<SEFutureCallback> *callbacks = nil;
+    pthread_mutex_lock(&_lock);
+    if (_resolved)
+    {
+        pthread_mutex_unlock(&_lock);
+        return NO;
+    }
+    _resolved = YES;
+    _result = (error == nil) ? result : nil;
+    _error = error;
+    callbacks = _callbacks;
+    _callbacks = nil;
+    _cancellationTarget = nil;
+    pthread_mutex_unlock(&_lock);
+    
+    for (SEFutureCallback callback in callbacks) callback(result, error);
+    return YES;
+}
+
+- (void)setCancellationTarget:(id<SECancellableToken>)target
+{
+    BOOL cancelTarget = NO;
+    pthread_mutex_lock(&_lock);
+    if (_cancelled) cancelTarget = YES;
+    else if (!_resolved) _cancellationTarget = target;
+    pthread_mutex_unlock(&_lock);
+    
+    // cancelled before the operation has been attached
+    if (cancelTarget) [target cancel];
+}
+
+- (void)observeOnQueue:(dispatch_queue_t)queue callback:(SEFutureCallback)callback
+{
+    [self addObserverOnQueue:queue callback:callback];
+}
+
+// Observes on behalf of a dependent future, returns the token that stops observing
+- (id<SECancellableToken>)observeAsDependencyOnQueue:(dispatch_queue_t)queue callback:(SEFutureCallback)callback
+{
+    return [[SEFutureDependency alloc] initWithFuture:self observer:[self addObserverOnQueue:queue callback:callback]];
+}
+
+// Returns the registered observer, `nil` when the future is resolved and the callback has already been called
+- (SEFutureCallback)addObserverOnQueue:(dispatch_queue_t)queue callback:(SEFutureCallback)callback
+{
+    SEFutureCallback queuedCallback = [callback copy];
+    if (queue != nil)
+    {
+        queuedCallback = [^(id result, NSError *error) {
+            dispatch_async(queue, ^{ callback(result, error); });
+        } copy];
+    }
+    
+    BOOL resolved = NO;
+    id result = nil;
+    NSError *error = nil;
+    pthread_mutex_lock(&_lock);
+    if (_resolved)
+    {
+        resolved = YES;
+        result = _result;
+        error = _error;
+    }
+    else
+    {
+        if (_callbacks == nil) _callbacks = [[NSMutableArray alloc] initWithCapacity:1];
+        [_callbacks addObject:queuedCallback];
+    }
+    pthread_mutex_unlock(&_lock);
+    
+    if (resolved)
+    {
+        queuedCallback(result, error);
+        return nil;
+    }
+    return queuedCallback;
+}
+
+- (void)removeObserver:(SEFutureCallback)observer
+{
+    id<SECancellableToken> target = nil;
+    pthread_mutex_lock(&_lock);
+    if (_resolved || [_callbacks indexOfObjectIdenticalTo:observer] == NSNotFound)
+    {
+        pthread_mutex_unlock(&_lock);
+        return;
+    }
+    [_callbacks removeObjectIdenticalTo:observer];
+    // other dependents and observers still wait for the outcome
+    BOOL observed = (_callbacks.count > 0);
+    if (!observed)
+    {
+        _cancelled = YES;
+        target = _cancellationTarget;
+    }
+    pthread_mutex_unlock(&_lock);
+    
+    if (!observed) [self resolveCancelledWithTarget:target];
+}
+
+#pragma mark - SECancellableToken
+
+- (void)cancel
+{
+    id<SECancellableToken> target = nil;
+    pthread_mutex_lock(&_lock);
+    if (_resolved)
+    {
+        pthread_mutex_unlock(&_lock);
+        return;
+    }
+    _cancelled = YES;
+    target = _cancellationTarget;
+    pthread_mutex_unlock(&_lock);
+    
+    [self resolveCancelledWithTarget:target];
+}
+
+- (void)resolveCancelledWithTarget:(id<SECancellableToken>)target
+{
+    // resolve first, so that a late outcome of the operation is ignored
+    NSError *error = [NSError errorWithDomain:SEErrorDomain code:SEFutureCancelled userInfo:@{ NSLocalizedDescriptionKey: @"Cancelled" }];
+    [self resolveWithResult:nil error:error];
+    [target cancel];
+}
+
+#pragma mark - Composition
+
+- (SEFuture *)then:(SEFuture * (^)(id))block
+{
+    return [self then:block queue:nil];
+}
+
+- (SEFuture *)then:(SEFuture * (^)(id))block queue:(dispatch_queue_t)queue
+{
+    if (block == nil) THROW_INVALID_PARAM(block, nil);
+    
+    SEFuture *future = [SEFuture new];
+    [future setCancellationTarget:[self observeAsDependencyOnQueue:queue callback:^(id result, NSError *error) {
+        if (error != nil)
+        {
+            [future resolveWithResult:nil error:error];
+            return;
+        }
+        // nothing to start for a cancelled chain
+        if (future.isResolved) return;
+        
+        SEFuture *next = block(result);
+        if (next == nil)
+        {
+            [future resolveWithResult:nil error:nil];
+            return;
+        }
+        [future setCancellationTarget:[next observeAsDependencyOnQueue:nil callback:^(id nextResult, NSError *nextError) {
+            [future resolveWithResult:nextResult error:nextError];
+        }]];
+    }]];
+    return future;
+}
+
+- (SEFuture *)map:(id (^)(id))block
+{
+    return [self map:block queue:nil];
+}
+
+- (SEFuture *)map:(id (^)(id))block queue:(dispatch_queue_t)queue
+{
+    if (block == nil) THROW_INVALID_PARAM(block, nil);
+    
+    SEFuture *future = [SEFuture new];
+    [future setCancellationTarget:[self observeAsDependencyOnQueue:queue callback:^(id result, NSError *error) {
+        if (error != nil) [future resolveWithResult:nil error:error];
+        else if (!future.isResolved) [future resolveWithResult:block(result) error:nil];
+    }]];
+    return future;
+}
+
+- (SEFuture *)timeout:(NSTimeInterval)interval
+{
+    if (interval <= 0) THROW_INVALID_PARAM(interval, nil);
+    
+    SEFuture *future = [SEFuture new];
+    id<SECancellableToken> dependency = [self observeAsDependencyOnQueue:nil callback:^(id result, NSError *error) {
+        [future resolveWithResult:result error:error];
+    }];
+    [future setCancellationTarget:dependency];
+    
+    // neither future is kept alive for the interval by the timer, the dependency only references them weakly
+    __weak SEFuture *weakFuture = future;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(interval * NSEC_PER_SEC)), dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        NSError *timeoutError = [NSError errorWithDomain:SEErrorDomain code:SEFutureTimedOut userInfo:@{ NSLocalizedDescriptionKey: @"Timed out" }];
+        // this future is only cancelled when nothing else waits for it
+        if ([weakFuture resolveWithResult:nil error:timeoutError]) [dependency cancel];
+    });
+    return future;
+}
+
+- (void)onSuccess:(void (^)(id))success failure:(void (^)(NSError *))failure queue:(dispatch_queue_t)queue
+{
+    [self observeOnQueue:queue callback:^(id result, NSError *error) {
+        if (error != nil)
+        {
+            if (failure != nil) failure(error);
+        }
+        else if (success != nil)
+        {
+            success(result);
+        }
+    }];
+}
+
+@end
@@ -0,0 +1,64 @@
+//
+//  SEDataRequestCircuitBreakers.h
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+@import Foundation;
+
+typedef enum
+{
+    // requests go through, outcomes are tracked
+    SEDataRequestCircuitStateClosed = 0,
+    // requests fail immediately until the open interval passes
+    SEDataRequestCircuitStateOpen = 1,
+    // a limited number of probe requests go through to decide whether to close the circuit
+    SEDataRequestCircuitStateHalfOpen = 2
+} SEDataRequestCircuitState;
+
+/**
+ Circuit breakers keyed by endpoint, that is, a host and a path template.
+ A circuit opens when the share of failed or slow requests among the recent ones reaches `failureRateThreshold`.
+ After `openInterval` it lets `probeCount` requests through, and closes once they all succeed or opens again on the first failure.
+ Breakers are thread-safe.
+ */
+@interface SEDataRequestCircuitBreakers : NSObject
+
+/** Number of recent outcomes considered per endpoint. Defaults to 20. */
+@property (atomic, assign) NSUInteger windowSize;
+/** Minimum number of outcomes in the window before a circuit may open. Defaults to 10. */
+@property (atomic, assign) NSUInteger minimumRequestCount;
+/** Share of failed requests that opens a circuit. Defaults to 0.5. */
+@property (atomic, assign) double failureRateThreshold;
+/** Requests that take longer than this are counted as failed. Defaults to 10 seconds. */
+@property (atomic, assign) NSTimeInterval slowRequestThreshold;
+/** Time a circuit stays open before probing. Defaults to 30 seconds. */
+@property (atomic, assign) NSTimeInterval openInterval;
+/** Number of concurrent probes in half-open state, as well as the number of successes required to close. Defaults to 1. */
+@property (atomic, assign) NSUInteger probeCount;
+
+/** Called outside of the internal lock whenever a circuit changes state. May be called on any thread. */
+@property (atomic, copy, nullable) void (^stateChangeHandler)(NSString * _Nonnull endpoint, SEDataRequestCircuitState state);
+
+/** Endpoint key of a URL: host and path, with identifier-like path segments (numbers, UUIDs, hashes) replaced by a placeholder */
++ (nonnull NSString *) endpointForURL: (nonnull NSURL *) url;
+
+/** Returns `NO` if the request to the endpoint must fail fast. A `YES` must be balanced by one of the record methods. */
+- (BOOL) shouldAllowRequestToEndpoint: (nonnull NSString *) endpoint;
+- (void) recordSuccessForEndpoint: (nonnull NSString *) endpoint duration: (NSTimeInterval) duration;
+- (void) recordFailureForEndpoint: (nonnull NSString *) endpoint;
+/** Records that an allowed request did not produce an outcome, for example it was cancelled */
+- (void) recordNoOutcomeForEndpoint: (nonnull NSString *) endpoint;
+
+- (SEDataRequestCircuitState) stateForEndpoint: (nonnull NSString *) endpoint;
+/** Endpoints which circuits are not closed, mapped to their states */
+- (nonnull NSDictionary<NSString *, NSNumber *> *) openCircuits;
+
+/** Closes all circuits and forgets their history */
+- (void) reset;
+
+@end
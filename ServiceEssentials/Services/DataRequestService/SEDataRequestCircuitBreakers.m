@@ -0,0 +1,266 @@
+//
+//  SEDataRequestCircuitBreakers.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <ServiceEssentials/SEDataRequestCircuitBreakers.h>
+
+#include <pthread.h>
+
+static NSString * const SEDataRequestCircuitPlaceholder = @"{}";
+static const NSUInteger SEDataRequestCircuitIdentifierMinimumLength = 16;
+
+// Per endpoint state, only accessed in the lock of the breakers
+@interface SEDataRequestCircuit : NSObject
+{
+@public
+    SEDataRequestCircuitState _state;
+    NSMutableArray<NSNumber *> *_outcomes;
+    NSUInteger _failureCount;
+    NSTimeInterval _openedAt;
+    NSUInteger _probesInFlight;
+    NSUInteger _probeSuccesses;
+}
+@end
+
+@implementation SEDataRequestCircuit
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self)
+    {
+        _outcomes = [NSMutableArray new];
+    }
+    return self;
+}
+
+- (void)clearOutcomes
+{
+    [_outcomes removeAllObjects];
+    _failureCount = 0;
+}
+
+@end
+
+static inline BOOL SEDataRequestCircuitIsIdentifierSegment(NSString *segment)
+{
+    if (segment.length == 0) return NO;
+    
+    static NSCharacterSet *nonDigits;
+    static NSCharacterSet *nonIdentifierCharacters;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        nonDigits = [[NSCharacterSet decimalDigitCharacterSet] invertedSet];
+        nonIdentifierCharacters = [[NSCharacterSet characterSetWithCharactersInString:@"0123456789abcdefABCDEF-"] invertedSet];
+    });
+    
+    if ([segment rangeOfCharacterFromSet:nonDigits].location == NSNotFound) return YES;
+    return segment.length >= SEDataRequestCircuitIdentifierMinimumLength && [segment rangeOfCharacterFromSet:nonIdentifierCharacters].location == NSNotFound;
+}
+
+@implementation SEDataRequestCircuitBreakers
+{
+    pthread_mutex_t _lock;
+    NSMutableDictionary<NSString *, SEDataRequestCircuit *> *_circuits;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self)
+    {
+        _windowSize = 20;
+        _minimumRequestCount = 10;
+        _failureRateThreshold = 0.5;
+        _slowRequestThreshold = 10.0;
+        _openInterval = 30.0;
+        _probeCount = 1;
+        _circuits = [NSMutableDictionary new];
+        pthread_mutex_init(&_lock, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&_lock);
+}
+
++ (NSString *)endpointForURL:(NSURL *)url
+{
+    NSArray<NSString *> *segments = [url.path componentsSeparatedByString:@"/"];
+    NSMutableArray<NSString *> *templateSegments = [[NSMutableArray alloc] initWithCapacity:segments.count];
+    for (NSString *segment in segments)
+    {
+        [templateSegments addObject:SEDataRequestCircuitIsIdentifierSegment(segment) ? SEDataRequestCircuitPlaceholder : segment];
+    }
+    return [NSString stringWithFormat:@"%@%@", url.host.lowercaseString ?: @"", [templateSegments componentsJoinedByString:@"/"]];
+}
+
+- (BOOL)shouldAllowRequestToEndpoint:(NSString *)endpoint
+{
+    BOOL allowed = YES;
+    BOOL changed = NO;
+    NSTimeInterval openInterval = self.openInterval;
+    NSUInteger probeCount = MAX(self.probeCount, (NSUInteger)1);
+    
+    pthread_mutex_lock(&_lock);
+    SEDataRequestCircuit *circuit = [_circuits objectForKey:endpoint];
+    if (circuit != nil && circuit->_state == SEDataRequestCircuitStateOpen)
+    {
+        if ([NSProcessInfo processInfo].systemUptime - circuit->_openedAt >= openInterval)
+        {
+            circuit->_state = SEDataRequestCircuitStateHalfOpen;
+            circuit->_probesInFlight = 0;
+            circuit->_probeSuccesses = 0;
+            changed = YES;
+        }
+        else
+        {
+            allowed = NO;
+        }
+    }
+    if (circuit != nil && circuit->_state == SEDataRequestCircuitStateHalfOpen)
+    {
+        allowed = circuit->_probesInFlight < probeCount;
+        if (allowed) circuit->_probesInFlight++;
+    }
+    pthread_mutex_unlock(&_lock);
+    
+    if (changed) [self notifyEndpoint:endpoint state:SEDataRequestCircuitStateHalfOpen];
+    return allowed;
+}
+
+- (void)recordSuccessForEndpoint:(NSString *)endpoint duration:(NSTimeInterval)duration
+{
+    // slow responses tie up connections as much as failed ones
+    [self recordOutcomeForEndpoint:endpoint failed:(duration > self.slowRequestThreshold)];
+}
+
+- (void)recordFailureForEndpoint:(NSString *)endpoint
+{
+    [self recordOutcomeForEndpoint:endpoint failed:YES];
+}
+
+- (void)recordNoOutcomeForEndpoint:(NSString *)endpoint
+{
+    pthread_mutex_lock(&_lock);
+    SEDataRequestCircuit *circuit = [_circuits objectForKey:endpoint];
+    if (circuit != nil && circuit->_state == SEDataRequestCircuitStateHalfOpen && circuit->_probesInFlight > 0) circuit->_probesInFlight--;
+    pthread_mutex_unlock(&_lock);
+}
+
+- (void)recordOutcomeForEndpoint:(NSString *)endpoint failed:(BOOL)failed
+{
+    NSUInteger windowSize = MAX(self.windowSize, (NSUInteger)1);
+    NSUInteger minimumRequestCount = self.minimumRequestCount;
+    double failureRateThreshold = self.failureRateThreshold;
+    NSUInteger probeCount = MAX(self.probeCount, (NSUInteger)1);
+    BOOL changed = NO;
+    SEDataRequestCircuitState newState = SEDataRequestCircuitStateClosed;
+    
+    pthread_mutex_lock(&_lock);
+    SEDataRequestCircuit *circuit = [_circuits objectForKey:endpoint];
+    if (circuit == nil)
+    {
+        // healthy endpoints are not tracked until the first failure
+        if (failed)
+        {
+            circuit = [SEDataRequestCircuit new];
+            [_circuits setObject:circuit forKey:endpoint];
+        }
+    }
+    
+    if (circuit != nil) switch (circuit->_state)
+    {
+        case SEDataRequestCircuitStateClosed:
+            [circuit->_outcomes addObject:@(failed)];
+            if (failed) circuit->_failureCount++;
+            while (circuit->_outcomes.count > windowSize)
+            {
+                if ([circuit->_outcomes.firstObject boolValue]) circuit->_failureCount--;
+                [circuit->_outcomes removeObjectAtIndex:0];
+            }
+            
+            if (circuit->_outcomes.count >= MAX(minimumRequestCount, (NSUInteger)1) && (double)circuit->_failureCount / circuit->_outcomes.count >= failureRateThreshold)
+            {
+                circuit->_state = newState = SEDataRequestCircuitStateOpen;
+                circuit->_openedAt = [NSProcessInfo processInfo].systemUptime;
+                [circuit clearOutcomes];
+                changed = YES;
+            }
+            else if (circuit->_failureCount == 0)
+            {
+                // no failures in the window, nothing worth remembering
+                [_circuits removeObjectForKey:endpoint];
+            }
+            break;
+            
+        case SEDataRequestCircuitStateHalfOpen:
+            if (circuit->_probesInFlight > 0) circuit->_probesInFlight--;
+            if (failed)
+            {
+                circuit->_state = newState = SEDataRequestCircuitStateOpen;
+                circuit->_openedAt = [NSProcessInfo processInfo].systemUptime;
+                changed = YES;
+            }
+            else if (++circuit->_probeSuccesses >= probeCount)
+            {
+                newState = SEDataRequestCircuitStateClosed;
+                [_circuits removeObjectForKey:endpoint];
+                changed = YES;
+            }
+            break;
+            
+        case SEDataRequestCircuitStateOpen:
+            // late outcomes of requests sent before the circuit opened
+            break;
+    }
+    pthread_mutex_unlock(&_lock);
+    
+    if (changed) [self notifyEndpoint:endpoint state:newState];
+}
+
+- (SEDataRequestCircuitState)stateForEndpoint:(NSString *)endpoint
+{
+    pthread_mutex_lock(&_lock);
+    SEDataRequestCircuit *circuit = [_circuits objectForKey:endpoint];
+    SEDataRequestCircuitState state = (circuit != nil) ? circuit->_state : SEDataRequestCircuitStateClosed;
+    pthread_mutex_unlock(&_lock);
+    return state;
+}
+
+- (NSDictionary<NSString *,NSNumber *> *)openCircuits
+{
+    NSMutableDictionary<NSString *, NSNumber *> *openCircuits = [NSMutableDictionary new];
+    pthread_mutex_lock(&_lock);
+    [_circuits enumerateKeysAndObjectsUsingBlock:^(NSString *endpoint, SEDataRequestCircuit *circuit, BOOL *stop) {
+        if (circuit->_state != SEDataRequestCircuitStateClosed) [openCircuits setObject:@(circuit->_state) forKey:endpoint];
+    }];
+    pthread_mutex_unlock(&_lock);
+    return [openCircuits copy];
+}
+
+- (void)reset
+{
+    NSDictionary<NSString *, NSNumber *> *openCircuits = [self openCircuits];
+    pthread_mutex_lock(&_lock);
+    [_circuits removeAllObjects];
+    pthread_mutex_unlock(&_lock);
+    
+    for (NSString *endpoint in openCircuits) [self notifyEndpoint:endpoint state:SEDataRequestCircuitStateClosed];
+}
+
+- (void)notifyEndpoint:(NSString *)endpoint state:(SEDataRequestCircuitState)state
+{
+    void (^stateChangeHandler)(NSString *, SEDataRequestCircuitState) = self.stateChangeHandler;
+    if (stateChangeHandler != nil) stateChangeHandler(endpoint, state);
+}
+
+@end
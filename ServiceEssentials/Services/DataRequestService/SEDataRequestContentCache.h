@@ -0,0 +1,84 @@
+//
+//  SEDataRequestContentCache.h
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+@import Foundation;
+
+/** Response and body served from the content cache. Immutable. */
+@interface SEDataRequestCachedContent : NSObject
+@property (nonatomic, readonly, strong, nonnull) NSHTTPURLResponse *response;
+/** Response body, memory-mapped when it comes from the disk */
+@property (nonatomic, readonly, strong, nonnull) NSData *data;
+/** Time the content stays fresh until */
+@property (nonatomic, readonly, strong, nonnull) NSDate *expirationDate;
+@end
+
+/**
+ Two-tier cache of responses to unsafe URL requests, such as avatars, CDN images and third-party content.
+
+ The memory tier is a least recently used list bounded by the total length of bodies.
+ The disk tier keeps every body in a separate file, exactly as received, so that it is served memory-mapped without copying,
+ and keeps response metadata in a single index. When the disk tier grows over its capacity, the least recently used
+ entries are evicted in the background.
+
+ Only HTTP 200 responses are stored. `Cache-Control: no-store` and `no-cache` responses are never stored, freshness is taken
+ from `max-age`, or from `Expires`, or `defaultTimeToLive` is used. Stale entries are not revalidated, they are removed.
+ Entries are keyed by URL. When `deduplicatesContent` is set, identical bodies of different URLs are stored on disk once.
+
+ The cache is thread-safe. Disk operations are performed on a private queue.
+ */
+@interface SEDataRequestContentCache : NSObject
+
+/**
+ Initializes a cache in a directory. Entries stored by a previous instance in the directory are loaded.
+ @param directoryURL directory owned by the cache, such as a subdirectory of Caches. It is created when missing.
+ @param memoryCapacity total length of bodies kept in memory, in bytes. 0 disables the memory tier.
+ Bodies longer than a quarter of the capacity are not kept in memory.
+ @param diskCapacity total length of files kept on disk, in bytes
+ */
+- (nonnull instancetype) initWithDirectoryURL: (nonnull NSURL *) directoryURL memoryCapacity: (NSUInteger) memoryCapacity diskCapacity: (uint64_t) diskCapacity;
+
+@property (nonatomic, readonly, strong, nonnull) NSURL *directoryURL;
+@property (nonatomic, readonly, assign) NSUInteger memoryCapacity;
+@property (nonatomic, readonly, assign) uint64_t diskCapacity;
+
+/** Freshness lifetime of responses without `max-age` and `Expires`. 0, the default, means such responses are not stored. */
+@property (atomic, assign) NSTimeInterval defaultTimeToLive;
+
+/** Whether identical bodies are stored on disk once, by their SHA-256 digest. Disabled by default. */
+@property (atomic, assign) BOOL deduplicatesContent;
+
+/** Total length of bodies in the memory tier */
+@property (nonatomic, readonly, assign) NSUInteger memoryCost;
+/** Total length of files in the disk tier, including those being written */
+@property (nonatomic, readonly, assign) uint64_t diskSize;
+/** Number of lookups served from the cache */
+@property (nonatomic, readonly, assign) NSUInteger hitCount;
+/** Number of lookups that found no fresh entry */
+@property (nonatomic, readonly, assign) NSUInteger missCount;
+
+/** Returns fresh content for the URL, or `nil`. Content found on disk is moved to the memory tier if it fits. */
+- (nullable SEDataRequestCachedContent *) cachedContentForURL: (nonnull NSURL *) url;
+
+/** Stores a response body for the URL, if the response can be stored. The body is written to disk in the background. */
+- (void) storeData: (nonnull NSData *) data response: (nonnull NSHTTPURLResponse *) response forURL: (nonnull NSURL *) url;
+
+/**
+ Stores a downloaded file for the URL, if the response can be stored. Only the disk tier is used.
+ The file is copied before the method returns, so it may be moved or removed right after.
+ */
+- (void) storeContentOfFileAtURL: (nonnull NSURL *) fileURL response: (nonnull NSHTTPURLResponse *) response forURL: (nonnull NSURL *) url;
+
+- (void) removeContentForURL: (nonnull NSURL *) url;
+- (void) removeAllContent;
+
+/** Waits for pending disk writes and writes the index, for example before the application is terminated */
+- (void) synchronize;
+
+@end
@@ -0,0 +1,727 @@
+//
+//  SEDataRequestContentCache.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <ServiceEssentials/SEDataRequestContentCache.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <CommonCrypto/CommonDigest.h>
+
+#import <ServiceEssentials/SETools.h>
+
+static NSString * const SEDataRequestContentCacheIndexName = @"index.plist";
+static NSString * const SEDataRequestContentCacheContentDirectoryName = @"content";
+static NSString * const SEDataRequestContentCacheIncomingDirectoryName = @"incoming";
+
+static NSString * const SEDataRequestContentCacheKeyFile = @"f";
+static NSString * const SEDataRequestContentCacheKeyHeaders = @"h";
+static NSString * const SEDataRequestContentCacheKeyExpiration = @"e";
+static NSString * const SEDataRequestContentCacheKeyLength = @"l";
+static NSString * const SEDataRequestContentCacheKeyAccess = @"a";
+
+// Changes of the index are written at most once per this interval
+static NSTimeInterval const SEDataRequestContentCacheIndexWriteDelay = 1.0;
+// Digest is computed in chunks so that files of any length can be hashed
+static NSUInteger const SEDataRequestContentCacheDigestChunkLength = 1024 * 1024;
+
+static inline NSString *SEDataRequestContentCacheDigest(NSData *data)
+{
+    CC_SHA256_CTX context;
+    CC_SHA256_Init(&context);
+    const uint8_t *bytes = data.bytes;
+    for (NSUInteger offset = 0; offset < data.length; offset += SEDataRequestContentCacheDigestChunkLength)
+    {
+        CC_SHA256_Update(&context, bytes + offset, (CC_LONG)MIN(SEDataRequestContentCacheDigestChunkLength, data.length - offset));
+    }
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256_Final(digest, &context);
+
+    NSMutableString *string = [[NSMutableString alloc] initWithCapacity:CC_SHA256_DIGEST_LENGTH * 2];
+    for (int i = 0; i < CC_SHA256_DIGEST_LENGTH; ++i) [string appendFormat:@"%02x", digest[i]];
+    return string;
+}
+
+static inline NSDate *SEDataRequestContentCacheHTTPDate(NSString *string)
+{
+    if (string == nil) return nil;
+
+    static NSDateFormatter *formatter = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        formatter = [[NSDateFormatter alloc] init];
+        formatter.locale = [NSLocale localeWithLocaleIdentifier:@"en_US_POSIX"];
+        formatter.timeZone = [NSTimeZone timeZoneWithAbbreviation:@"GMT"];
+        formatter.dateFormat = @"EEE, dd MMM yyyy HH:mm:ss zzz";
+    });
+    return [formatter dateFromString:string];
+}
+
+// Freshness lifetime of a response in seconds, 0 if the response must not be stored
+static inline NSTimeInterval SEDataRequestContentCacheFreshnessLifetime(NSHTTPURLResponse *response, NSTimeInterval defaultTimeToLive)
+{
+    if (response.statusCode != 200) return 0;
+
+    NSDictionary *headers = response.allHeaderFields;
+    NSTimeInterval lifetime = -1;
+    NSString *cacheControl = [headers objectForKey:@"Cache-Control"];
+    for (NSString *component in [cacheControl.lowercaseString componentsSeparatedByString:@","])
+    {
+        NSString *directive = [component stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+        // stale entries are never revalidated, so responses that require revalidation are not stored at all
+        if ([directive isEqualToString:@"no-store"] || [directive hasPrefix:@"no-cache"]) return 0;
+        if ([directive hasPrefix:@"max-age="]) lifetime = [directive substringFromIndex:8].doubleValue;
+    }
+
+    if (lifetime < 0)
+    {
+        NSString *expires = [headers objectForKey:@"Expires"];
+        if (expires != nil)
+        {
+            // an invalid date, such as "0", means the response has already expired
+            NSDate *expirationDate = SEDataRequestContentCacheHTTPDate(expires);
+            NSDate *date = SEDataRequestContentCacheHTTPDate([headers objectForKey:@"Date"]) ?: [NSDate date];
+            lifetime = (expirationDate != nil) ? [expirationDate timeIntervalSinceDate:date] : 0;
+        }
+        else
+        {
+            lifetime = defaultTimeToLive;
+        }
+    }
+
+    // time the response has already spent in caches on the way
+    lifetime -= [[headers objectForKey:@"Age"] doubleValue];
+    return MAX(lifetime, 0);
+}
+
+#pragma mark - Cached content
+
+@interface SEDataRequestCachedContent ()
+- (instancetype) initWithResponse: (NSHTTPURLResponse *) response data: (NSData *) data expirationDate: (NSDate *) expirationDate;
+@end
+
+@implementation SEDataRequestCachedContent
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithResponse:(NSHTTPURLResponse *)response data:(NSData *)data expirationDate:(NSDate *)expirationDate
+{
+    self = [super init];
+    if (self)
+    {
+        _response = response;
+        _data = data;
+        _expirationDate = expirationDate;
+    }
+    return self;
+}
+
+@end
+
+#pragma mark - Entries
+
+/** Entry of the memory tier. Entries are owned by the dictionary of the cache, links of the recency list are not retained. */
+@interface SEDataRequestContentCacheMemoryEntry : NSObject
+@property (nonatomic, strong) NSString *key;
+@property (nonatomic, strong) SEDataRequestCachedContent *content;
+@property (nonatomic, unsafe_unretained) SEDataRequestContentCacheMemoryEntry *previous;
+@property (nonatomic, unsafe_unretained) SEDataRequestContentCacheMemoryEntry *next;
+@end
+
+@implementation SEDataRequestContentCacheMemoryEntry
+@end
+
+/** Entry of the disk tier, as it is stored in the index */
+@interface SEDataRequestContentCacheDiskEntry : NSObject
+- (instancetype) initWithFile: (NSString *) file headers: (NSDictionary *) headers expiration: (NSTimeInterval) expiration length: (uint64_t) length;
+- (instancetype) initWithDictionary: (NSDictionary *) dictionary;
+- (NSDictionary *) dictionaryRepresentation;
+@property (nonatomic, readonly, strong) NSString *file;
+@property (nonatomic, readonly, strong) NSDictionary<NSString *, NSString *> *headers;
+/** Expiration time, since 1970 */
+@property (nonatomic, readonly, assign) NSTimeInterval expiration;
+@property (nonatomic, readonly, assign) uint64_t length;
+/** Last access time, since 1970 */
+@property (nonatomic, assign) NSTimeInterval access;
+@end
+
+@implementation SEDataRequestContentCacheDiskEntry
+
+- (instancetype)initWithFile:(NSString *)file headers:(NSDictionary *)headers expiration:(NSTimeInterval)expiration length:(uint64_t)length
+{
+    self = [super init];
+    if (self)
+    {
+        _file = file;
+        _headers = headers;
+        _expiration = expiration;
+        _length = length;
+        _access = [[NSDate date] timeIntervalSince1970];
+    }
+    return self;
+}
+
+- (instancetype)initWithDictionary:(NSDictionary *)dictionary
+{
+    NSString *file = [dictionary objectForKey:SEDataRequestContentCacheKeyFile];
+    NSDictionary *headers = [dictionary objectForKey:SEDataRequestContentCacheKeyHeaders];
+    if (![file isKindOfClass:[NSString class]] || ![headers isKindOfClass:[NSDictionary class]]) return nil;
+
+    self = [self initWithFile:file headers:headers expiration:[[dictionary objectForKey:SEDataRequestContentCacheKeyExpiration] doubleValue] length:[[dictionary objectForKey:SEDataRequestContentCacheKeyLength] unsignedLongLongValue]];
+    if (self)
+    {
+        _access = [[dictionary objectForKey:SEDataRequestContentCacheKeyAccess] doubleValue];
+    }
+    return self;
+}
+
+- (NSDictionary *)dictionaryRepresentation
+{
+    return @{
+             SEDataRequestContentCacheKeyFile: _file,
+             SEDataRequestContentCacheKeyHeaders: _headers,
+             SEDataRequestContentCacheKeyExpiration: @(_expiration),
+             SEDataRequestContentCacheKeyLength: @(_length),
+             SEDataRequestContentCacheKeyAccess: @(_access)
+             };
+}
+
+@end
+
+#pragma mark - Cache
+
+@implementation SEDataRequestContentCache
+{
+    pthread_mutex_t _lock;
+    // disk operations, serial
+    dispatch_queue_t _queue;
+    NSURL *_contentDirectoryURL;
+    NSURL *_incomingDirectoryURL;
+    NSURL *_indexURL;
+
+    // memory tier, the most recently used entry is the head
+    NSMutableDictionary<NSString *, SEDataRequestContentCacheMemoryEntry *> *_memoryEntries;
+    __unsafe_unretained SEDataRequestContentCacheMemoryEntry *_head;
+    __unsafe_unretained SEDataRequestContentCacheMemoryEntry *_tail;
+    NSUInteger _memoryCost;
+
+    // disk tier, files are shared by entries when content is deduplicated
+    NSMutableDictionary<NSString *, SEDataRequestContentCacheDiskEntry *> *_diskEntries;
+    NSCountedSet<NSString *> *_fileReferences;
+    uint64_t _diskSize;
+    BOOL _indexWriteScheduled;
+
+    NSUInteger _hitCount;
+    NSUInteger _missCount;
+}
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithDirectoryURL:(NSURL *)directoryURL memoryCapacity:(NSUInteger)memoryCapacity diskCapacity:(uint64_t)diskCapacity
+{
+    if (directoryURL == nil || !directoryURL.isFileURL) THROW_INVALID_PARAM(directoryURL, nil);
+    if (diskCapacity == 0) THROW_INVALID_PARAM(diskCapacity, nil);
+
+    self = [super init];
+    if (self)
+    {
+        _directoryURL = directoryURL;
+        _memoryCapacity = memoryCapacity;
+        _diskCapacity = diskCapacity;
+        _contentDirectoryURL = [directoryURL URLByAppendingPathComponent:SEDataRequestContentCacheContentDirectoryName isDirectory:YES];
+        _incomingDirectoryURL = [directoryURL URLByAppendingPathComponent:SEDataRequestContentCacheIncomingDirectoryName isDirectory:YES];
+        _indexURL = [directoryURL URLByAppendingPathComponent:SEDataRequestContentCacheIndexName isDirectory:NO];
+        _queue = dispatch_queue_create("com.service-essentials.DataRequestContentCache", dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0));
+        _memoryEntries = [[NSMutableDictionary alloc] init];
+        _diskEntries = [[NSMutableDictionary alloc] init];
+        _fileReferences = [[NSCountedSet alloc] init];
+        pthread_mutex_init(&_lock, NULL);
+
+        [self loadIndex];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&_lock);
+}
+
+- (NSUInteger)memoryCost
+{
+    NSUInteger memoryCost;
+    pthread_mutex_lock(&_lock);
+    memoryCost = _memoryCost;
+    pthread_mutex_unlock(&_lock);
+    return memoryCost;
+}
+
+- (uint64_t)diskSize
+{
+    uint64_t diskSize;
+    pthread_mutex_lock(&_lock);
+    diskSize = _diskSize;
+    pthread_mutex_unlock(&_lock);
+    return diskSize;
+}
+
+- (NSUInteger)hitCount
+{
+    NSUInteger hitCount;
+    pthread_mutex_lock(&_lock);
+    hitCount = _hitCount;
+    pthread_mutex_unlock(&_lock);
+    return hitCount;
+}
+
+- (NSUInteger)missCount
+{
+    NSUInteger missCount;
+    pthread_mutex_lock(&_lock);
+    missCount = _missCount;
+    pthread_mutex_unlock(&_lock);
+    return missCount;
+}
+
+- (SEDataRequestCachedContent *)cachedContentForURL:(NSURL *)url
+{
+    if (url == nil) THROW_INVALID_PARAM(url, nil);
+
+    NSString *key = url.absoluteString;
+    NSTimeInterval now = [[NSDate date] timeIntervalSince1970];
+    SEDataRequestCachedContent *content = nil;
+    SEDataRequestContentCacheDiskEntry *diskEntry = nil;
+    NSString *unreferencedFile = nil;
+
+    pthread_mutex_lock(&_lock);
+    SEDataRequestContentCacheMemoryEntry *memoryEntry = [_memoryEntries objectForKey:key];
+    if (memoryEntry != nil)
+    {
+        if (memoryEntry.content.expirationDate.timeIntervalSince1970 > now)
+        {
+            content = memoryEntry.content;
+            [self moveMemoryEntryToFront:memoryEntry];
+        }
+        else
+        {
+            [self removeMemoryEntry:memoryEntry];
+        }
+    }
+
+    diskEntry = [_diskEntries objectForKey:key];
+    if (diskEntry != nil && diskEntry.expiration <= now)
+    {
+        unreferencedFile = [self removeDiskEntryForKey:key];
+        diskEntry = nil;
+    }
+    else if (diskEntry != nil)
+    {
+        // memory hits keep the entry from being evicted from the disk as well
+        diskEntry.access = now;
+        [self scheduleIndexWrite];
+    }
+    if (content != nil) ++_hitCount;
+    pthread_mutex_unlock(&_lock);
+
+    if (unreferencedFile != nil) [self removeFilesIfUnreferenced:@[ unreferencedFile ]];
+    if (content != nil || diskEntry == nil)
+    {
+        if (content == nil)
+        {
+            pthread_mutex_lock(&_lock);
+            ++_missCount;
+            pthread_mutex_unlock(&_lock);
+        }
+        return content;
+    }
+
+    // mapping is cheap, pages are read when the data is accessed
+    NSURL *fileURL = [_contentDirectoryURL URLByAppendingPathComponent:diskEntry.file isDirectory:NO];
+    NSData *data = [NSData dataWithContentsOfURL:fileURL options:NSDataReadingMappedIfSafe error:nil];
+    if (data != nil)
+    {
+        NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:url statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:diskEntry.headers];
+        content = [[SEDataRequestCachedContent alloc] initWithResponse:response data:data expirationDate:[NSDate dateWithTimeIntervalSince1970:diskEntry.expiration]];
+    }
+
+    pthread_mutex_lock(&_lock);
+    if (content != nil)
+    {
+        ++_hitCount;
+        [self setMemoryContent:content forKey:key];
+    }
+    else
+    {
+        // the file has been removed behind the back of the cache
+        ++_missCount;
+        if ([_diskEntries objectForKey:key] == diskEntry) unreferencedFile = [self removeDiskEntryForKey:key];
+    }
+    pthread_mutex_unlock(&_lock);
+
+    if (unreferencedFile != nil) [self removeFilesIfUnreferenced:@[ unreferencedFile ]];
+    return content;
+}
+
+- (void)storeData:(NSData *)data response:(NSHTTPURLResponse *)response forURL:(NSURL *)url
+{
+    if (data == nil) THROW_INVALID_PARAM(data, nil);
+    if (response == nil) THROW_INVALID_PARAM(response, nil);
+    if (url == nil) THROW_INVALID_PARAM(url, nil);
+
+    NSTimeInterval lifetime = SEDataRequestContentCacheFreshnessLifetime(response, self.defaultTimeToLive);
+    if (lifetime <= 0)
+    {
+        // whatever has been stored before is outdated by this response
+        [self removeContentForURL:url];
+        return;
+    }
+
+    NSString *key = url.absoluteString;
+    data = [data copy];
+    NSDate *expirationDate = [NSDate dateWithTimeIntervalSinceNow:lifetime];
+    SEDataRequestCachedContent *content = [[SEDataRequestCachedContent alloc] initWithResponse:response data:data expirationDate:expirationDate];
+    NSDictionary *headers = response.allHeaderFields;
+
+    pthread_mutex_lock(&_lock);
+    [self setMemoryContent:content forKey:key];
+    pthread_mutex_unlock(&_lock);
+
+    BOOL deduplicates = self.deduplicatesContent;
+    dispatch_async(_queue, ^{
+        NSString *file = SEDataRequestContentCacheDigest(deduplicates ? data : [key dataUsingEncoding:NSUTF8StringEncoding]);
+        if (!deduplicates || ![self isFileReferenced:file])
+        {
+            NSURL *fileURL = [_contentDirectoryURL URLByAppendingPathComponent:file isDirectory:NO];
+            NSError *error = nil;
+            if (![data writeToURL:fileURL options:NSDataWritingAtomic error:&error])
+            {
+                SELog(@"Content cache failed to write %@: %@", key, error);
+                return;
+            }
+        }
+
+        SEDataRequestContentCacheDiskEntry *entry = [[SEDataRequestContentCacheDiskEntry alloc] initWithFile:file headers:headers expiration:expirationDate.timeIntervalSince1970 length:data.length];
+        [self addDiskEntry:entry forKey:key];
+    });
+}
+
+- (void)storeContentOfFileAtURL:(NSURL *)fileURL response:(NSHTTPURLResponse *)response forURL:(NSURL *)url
+{
+    if (fileURL == nil || !fileURL.isFileURL) THROW_INVALID_PARAM(fileURL, nil);
+    if (response == nil) THROW_INVALID_PARAM(response, nil);
+    if (url == nil) THROW_INVALID_PARAM(url, nil);
+
+    NSTimeInterval lifetime = SEDataRequestContentCacheFreshnessLifetime(response, self.defaultTimeToLive);
+    if (lifetime <= 0)
+    {
+        [self removeContentForURL:url];
+        return;
+    }
+
+    // copying is a clone on file systems that support it, so it is cheap even for large files
+    NSURL *incomingURL = [_incomingDirectoryURL URLByAppendingPathComponent:[NSUUID UUID].UUIDString isDirectory:NO];
+    NSError *error = nil;
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    if (![fileManager copyItemAtURL:fileURL toURL:incomingURL error:&error])
+    {
+        SELog(@"Content cache failed to copy %@: %@", fileURL, error);
+        return;
+    }
+
+    NSString *key = url.absoluteString;
+    NSTimeInterval expiration = [[NSDate date] timeIntervalSince1970] + lifetime;
+    NSDictionary *headers = response.allHeaderFields;
+    BOOL deduplicates = self.deduplicatesContent;
+    dispatch_async(_queue, ^{
+        NSData *data = [NSData dataWithContentsOfURL:incomingURL options:NSDataReadingMappedIfSafe error:nil];
+        if (data == nil)
+        {
+            [fileManager removeItemAtURL:incomingURL error:nil];
+            return;
+        }
+
+        NSString *file = SEDataRequestContentCacheDigest(deduplicates ? data : [key dataUsingEncoding:NSUTF8StringEncoding]);
+        if (deduplicates && [self isFileReferenced:file])
+        {
+            [fileManager removeItemAtURL:incomingURL error:nil];
+        }
+        else
+        {
+            NSURL *contentURL = [_contentDirectoryURL URLByAppendingPathComponent:file isDirectory:NO];
+            // atomically replaces content being replaced, readers that have mapped it keep the previous file
+            if (rename(incomingURL.fileSystemRepresentation, contentURL.fileSystemRepresentation) != 0)
+            {
+                SELog(@"Content cache failed to store %@: %d", key, errno);
+                [fileManager removeItemAtURL:incomingURL error:nil];
+                return;
+            }
+        }
+
+        SEDataRequestContentCacheDiskEntry *entry = [[SEDataRequestContentCacheDiskEntry alloc] initWithFile:file headers:headers expiration:expiration length:data.length];
+        [self addDiskEntry:entry forKey:key];
+    });
+}
+
+- (void)removeContentForURL:(NSURL *)url
+{
+    if (url == nil) THROW_INVALID_PARAM(url, nil);
+
+    NSString *key = url.absoluteString;
+    NSString *unreferencedFile = nil;
+    pthread_mutex_lock(&_lock);
+    SEDataRequestContentCacheMemoryEntry *memoryEntry = [_memoryEntries objectForKey:key];
+    if (memoryEntry != nil) [self removeMemoryEntry:memoryEntry];
+    if ([_diskEntries objectForKey:key] != nil) unreferencedFile = [self removeDiskEntryForKey:key];
+    pthread_mutex_unlock(&_lock);
+
+    if (unreferencedFile != nil) [self removeFilesIfUnreferenced:@[ unreferencedFile ]];
+}
+
+- (void)removeAllContent
+{
+    pthread_mutex_lock(&_lock);
+    [_memoryEntries removeAllObjects];
+    _head = nil;
+    _tail = nil;
+    _memoryCost = 0;
+    [_diskEntries removeAllObjects];
+    [_fileReferences removeAllObjects];
+    _diskSize = 0;
+    pthread_mutex_unlock(&_lock);
+
+    dispatch_async(_queue, ^{
+        NSFileManager *fileManager = [NSFileManager defaultManager];
+        [fileManager removeItemAtURL:_contentDirectoryURL error:nil];
+        [fileManager createDirectoryAtURL:_contentDirectoryURL withIntermediateDirectories:YES attributes:nil error:nil];
+        [self writeIndex];
+    });
+}
+
+- (void)synchronize
+{
+    dispatch_sync(_queue, ^{
+        [self writeIndex];
+    });
+}
+
+#pragma mark - Memory tier
+
+// Must be called in the lock
+- (void)setMemoryContent:(SEDataRequestCachedContent *)content forKey:(NSString *)key
+{
+    SEDataRequestContentCacheMemoryEntry *entry = [_memoryEntries objectForKey:key];
+    if (entry != nil) [self removeMemoryEntry:entry];
+
+    // a single large body would push everything else out
+    NSUInteger cost = content.data.length;
+    if (cost > _memoryCapacity / 4) return;
+
+    entry = [[SEDataRequestContentCacheMemoryEntry alloc] init];
+    entry.key = key;
+    entry.content = content;
+    [_memoryEntries setObject:entry forKey:key];
+    entry.next = _head;
+    if (_head != nil) _head.previous = entry;
+    _head = entry;
+    if (_tail == nil) _tail = entry;
+    _memoryCost += cost;
+
+    while (_memoryCost > _memoryCapacity && _tail != nil) [self removeMemoryEntry:_tail];
+}
+
+// Must be called in the lock
+- (void)moveMemoryEntryToFront:(SEDataRequestContentCacheMemoryEntry *)entry
+{
+    if (entry == _head) return;
+
+    entry.previous.next = entry.next;
+    if (entry.next != nil) entry.next.previous = entry.previous;
+    else _tail = entry.previous;
+
+    entry.previous = nil;
+    entry.next = _head;
+    _head.previous = entry;
+    _head = entry;
+}
+
+// Must be called in the lock
+- (void)removeMemoryEntry:(SEDataRequestContentCacheMemoryEntry *)entry
+{
+    if (entry.previous != nil) entry.previous.next = entry.next;
+    else _head = entry.next;
+    if (entry.next != nil) entry.next.previous = entry.previous;
+    else _tail = entry.previous;
+    entry.previous = nil;
+    entry.next = nil;
+
+    _memoryCost -= entry.content.data.length;
+    // the dictionary owns the entry, so it goes last
+    [_memoryEntries removeObjectForKey:entry.key];
+}
+
+#pragma mark - Disk tier
+
+- (BOOL)isFileReferenced:(NSString *)file
+{
+    BOOL referenced;
+    pthread_mutex_lock(&_lock);
+    referenced = [_fileReferences countForObject:file] > 0;
+    pthread_mutex_unlock(&_lock);
+    return referenced;
+}
+
+// Must be called on the queue
+- (void)addDiskEntry:(SEDataRequestContentCacheDiskEntry *)entry forKey:(NSString *)key
+{
+    NSString *unreferencedFile = nil;
+    BOOL overCapacity;
+    pthread_mutex_lock(&_lock);
+    SEDataRequestContentCacheDiskEntry *previousEntry = [_diskEntries objectForKey:key];
+    if ([_fileReferences countForObject:entry.file] == 0) _diskSize += entry.length;
+    else if ([previousEntry.file isEqualToString:entry.file]) _diskSize = _diskSize - previousEntry.length + entry.length;
+    [_fileReferences addObject:entry.file];
+    if (previousEntry != nil) unreferencedFile = [self removeDiskEntryForKey:key];
+    [_diskEntries setObject:entry forKey:key];
+    [self scheduleIndexWrite];
+    overCapacity = _diskSize > _diskCapacity;
+    pthread_mutex_unlock(&_lock);
+
+    if (unreferencedFile != nil) [self removeFilesIfUnreferenced:@[ unreferencedFile ]];
+    if (overCapacity) [self evictDiskEntries];
+}
+
+// Must be called in the lock. Returns the file of the entry if no other entry references it.
+- (NSString *)removeDiskEntryForKey:(NSString *)key
+{
+    SEDataRequestContentCacheDiskEntry *entry = [_diskEntries objectForKey:key];
+    [_diskEntries removeObjectForKey:key];
+    [self scheduleIndexWrite];
+
+    [_fileReferences removeObject:entry.file];
+    if ([_fileReferences countForObject:entry.file] > 0) return nil;
+    _diskSize -= MIN(_diskSize, entry.length);
+    return entry.file;
+}
+
+// Must be called on the queue
+- (void)evictDiskEntries
+{
+    NSMutableArray<NSString *> *unreferencedFiles = [[NSMutableArray alloc] init];
+    pthread_mutex_lock(&_lock);
+    if (_diskSize > _diskCapacity)
+    {
+        // expired entries go first, then the least recently used ones
+        NSTimeInterval now = [[NSDate date] timeIntervalSince1970];
+        NSArray<NSString *> *keys = [_diskEntries keysSortedByValueUsingComparator:^NSComparisonResult(SEDataRequestContentCacheDiskEntry *entry1, SEDataRequestContentCacheDiskEntry *entry2) {
+            NSTimeInterval access1 = (entry1.expiration > now) ? entry1.access : 0;
+            NSTimeInterval access2 = (entry2.expiration > now) ? entry2.access : 0;
+            if (access1 < access2) return NSOrderedAscending;
+            if (access1 > access2) return NSOrderedDescending;
+            return NSOrderedSame;
+        }];
+        for (NSString *key in keys)
+        {
+            if (_diskSize <= _diskCapacity) break;
+            NSString *file = [self removeDiskEntryForKey:key];
+            if (file != nil) [unreferencedFiles addObject:file];
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+
+    if (unreferencedFiles.count > 0) [self removeFilesIfUnreferenced:unreferencedFiles];
+}
+
+- (void)removeFilesIfUnreferenced:(NSArray<NSString *> *)files
+{
+    dispatch_async(_queue, ^{
+        NSFileManager *fileManager = [NSFileManager defaultManager];
+        for (NSString *file in files)
+        {
+            // the same content may have been stored again meanwhile
+            if ([self isFileReferenced:file]) continue;
+            [fileManager removeItemAtURL:[_contentDirectoryURL URLByAppendingPathComponent:file isDirectory:NO] error:nil];
+        }
+    });
+}
+
+#pragma mark - Index
+
+// Must be called in the lock
+- (void)scheduleIndexWrite
+{
+    if (_indexWriteScheduled) return;
+    _indexWriteScheduled = YES;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(SEDataRequestContentCacheIndexWriteDelay * NSEC_PER_SEC)), _queue, ^{
+        [self writeIndex];
+    });
+}
+
+// Must be called on the queue
+- (void)writeIndex
+{
+    NSMutableDictionary *index = [[NSMutableDictionary alloc] init];
+    pthread_mutex_lock(&_lock);
+    _indexWriteScheduled = NO;
+    [_diskEntries enumerateKeysAndObjectsUsingBlock:^(NSString *key, SEDataRequestContentCacheDiskEntry *entry, BOOL *stop) {
+        [index setObject:[entry dictionaryRepresentation] forKey:key];
+    }];
+    pthread_mutex_unlock(&_lock);
+
+    NSError *error = nil;
+    NSData *data = [NSPropertyListSerialization dataWithPropertyList:index format:NSPropertyListBinaryFormat_v1_0 options:0 error:&error];
+    if (data == nil || ![data writeToURL:_indexURL options:NSDataWritingAtomic error:&error])
+    {
+        SELog(@"Content cache failed to write the index: %@", error);
+    }
+}
+
+- (void)loadIndex
+{
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    [fileManager createDirectoryAtURL:_contentDirectoryURL withIntermediateDirectories:YES attributes:nil error:nil];
+    // copies left by a previous run were never stored
+    [fileManager removeItemAtURL:_incomingDirectoryURL error:nil];
+    [fileManager createDirectoryAtURL:_incomingDirectoryURL withIntermediateDirectories:YES attributes:nil error:nil];
+
+    NSData *data = [NSData dataWithContentsOfURL:_indexURL];
+    NSDictionary *index = (data != nil) ? [NSPropertyListSerialization propertyListWithData:data options:NSPropertyListImmutable format:NULL error:nil] : nil;
+    if ([index isKindOfClass:[NSDictionary class]])
+    {
+        NSTimeInterval now = [[NSDate date] timeIntervalSince1970];
+        [index enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSDictionary *dictionary, BOOL *stop) {
+            if (![dictionary isKindOfClass:[NSDictionary class]]) return;
+            SEDataRequestContentCacheDiskEntry *entry = [[SEDataRequestContentCacheDiskEntry alloc] initWithDictionary:dictionary];
+            if (entry == nil || entry.expiration <= now) return;
+            if (![fileManager fileExistsAtPath:[_contentDirectoryURL URLByAppendingPathComponent:entry.file isDirectory:NO].path]) return;
+
+            if ([_fileReferences countForObject:entry.file] == 0) _diskSize += entry.length;
+            [_fileReferences addObject:entry.file];
+            [_diskEntries setObject:entry forKey:key];
+        }];
+    }
+
+    dispatch_async(_queue, ^{
+        // files of dropped entries and leftovers of interrupted writes
+        NSArray<NSURL *> *fileURLs = [fileManager contentsOfDirectoryAtURL:_contentDirectoryURL includingPropertiesForKeys:nil options:0 error:nil];
+        for (NSURL *fileURL in fileURLs)
+        {
+            if (![self isFileReferenced:fileURL.lastPathComponent]) [fileManager removeItemAtURL:fileURL error:nil];
+        }
+        [self writeIndex];
+        [self evictDiskEntries];
+    });
+}
+
+@end
@@ -0,0 +1,37 @@
+//
+//  SEDataRequestContext.h
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+@import Foundation;
+
+#import <ServiceEssentials/SEDataRequestService.h>
+
+/**
+ Immutable snapshot of the settings shared by all secure requests of a service.
+ Service publishes a new snapshot whenever any of the settings change, so a request built from a single snapshot
+ is always consistent, even if environment or authorization is switched concurrently.
+ */
+@interface SEDataRequestContext : NSObject
+
+- (nonnull instancetype) initWithBaseURL: (nonnull NSURL *) baseURL
+                     authorizationHeader: (nullable NSString *) authorizationHeader
+                             pinningType: (SEDataRequestCertificatePinningType) pinningType;
+
+@property (nonatomic, readonly, strong, nonnull) NSURL *baseURL;
+@property (nonatomic, readonly, strong, nullable) NSString *authorizationHeader;
+@property (nonatomic, readonly, assign) SEDataRequestCertificatePinningType pinningType;
+/** Incremented with every derived snapshot, allows to tell if settings changed between two points in time */
+@property (nonatomic, readonly, assign) uint64_t generation;
+
+/** Creates the next generation with a different base URL */
+- (nonnull instancetype) contextWithBaseURL: (nonnull NSURL *) baseURL;
+/** Creates the next generation with a different authorization header */
+- (nonnull instancetype) contextWithAuthorizationHeader: (nullable NSString *) authorizationHeader;
+
+@end
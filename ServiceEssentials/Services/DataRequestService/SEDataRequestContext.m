@@ -0,0 +1,53 @@
+//
+//  SEDataRequestContext.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <ServiceEssentials/SEDataRequestContext.h>
+
+#import <ServiceEssentials/SETools.h>
+
+@implementation SEDataRequestContext
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithBaseURL:(NSURL *)baseURL authorizationHeader:(NSString *)authorizationHeader pinningType:(SEDataRequestCertificatePinningType)pinningType
+{
+    return [self initWithBaseURL:baseURL authorizationHeader:authorizationHeader pinningType:pinningType generation:0];
+}
+
+- (instancetype)initWithBaseURL:(NSURL *)baseURL authorizationHeader:(NSString *)authorizationHeader pinningType:(SEDataRequestCertificatePinningType)pinningType generation:(uint64_t)generation
+{
+    if (baseURL == nil) THROW_INVALID_PARAM(baseURL, nil);
+
+    self = [super init];
+    if (self)
+    {
+        // copies are made once per generation, so that readers never need to copy
+        _baseURL = [baseURL copy];
+        _authorizationHeader = [authorizationHeader copy];
+        _pinningType = pinningType;
+        _generation = generation;
+    }
+    return self;
+}
+
+- (instancetype)contextWithBaseURL:(NSURL *)baseURL
+{
+    return [[[self class] alloc] initWithBaseURL:baseURL authorizationHeader:_authorizationHeader pinningType:_pinningType generation:_generation + 1];
+}
+
+- (instancetype)contextWithAuthorizationHeader:(NSString *)authorizationHeader
+{
+    return [[[self class] alloc] initWithBaseURL:_baseURL authorizationHeader:authorizationHeader pinningType:_pinningType generation:_generation + 1];
+}
+
+@end
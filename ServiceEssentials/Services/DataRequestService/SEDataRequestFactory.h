@@ -12,36 +12,62 @@
 #import <ServiceEssentials/SEDataRequestService.h>
 #import "SEDataRequestServicePrivate.h"
 
+@class SEDataRequestContext;
 @class SEInternalDataRequestBuilder;
+@class SEInternalDataRequestTemplate;
 
 @interface SEDataRequestFactory : NSObject
 
 - (nonnull instancetype)initWithService:(nonnull id<SEDataRequestServicePrivate>)service secure:(BOOL)secure userAgent:(nonnull NSString *)userAgent requestPreparationDelegate:(nullable id<SEDataRequestPreparationDelegate>)requestDelegate;
 
 @property (nonatomic, readonly, strong, nonnull) NSString *userAgent;
-@property (atomic, strong, nullable) NSString *authorizationHeader;
 
 - (nonnull NSURLRequest *)createRequestWithMethod:(nonnull NSString *)method
-                                          baseURL:(nonnull NSURL *)baseURL
+                                          context:(nonnull SEDataRequestContext *)context
                                              path:(nullable NSString *)path
                                              body:(nullable id)body
                                          mimeType:(nullable NSString *)mimeType
                                             error:(NSError * __autoreleasing _Nullable * _Nullable)error;
 
-- (nonnull NSURLRequest *)createDownloadRequestWithBaseURL:(nonnull NSURL *)baseURL
+- (nonnull NSURLRequest *)createDownloadRequestWithContext:(nonnull SEDataRequestContext *)context
                                                       path:(nullable NSString *)path
                                                       body:(nullable id)body
                                                      error:(NSError * __autoreleasing _Nullable * _Nullable)error;
 
 - (nonnull NSURLRequest *)createRequestWithBuilder:(nonnull SEInternalDataRequestBuilder *)builder
-                                           baseURL:(nonnull NSURL *)baseURL
+                                           context:(nonnull SEDataRequestContext *)context
                                              error:(NSError * __autoreleasing _Nullable * _Nullable)error;
 
 - (nonnull NSURLRequest *)createMultipartRequestWithBuilder:(nonnull SEInternalDataRequestBuilder *)builder
-                                                    baseURL:(nonnull NSURL *)baseURL
+                                                    context:(nonnull SEDataRequestContext *)context
                                                    boundary:(nonnull NSString *)boundary
                                                       error:(NSError * __autoreleasing _Nullable * _Nullable)error;
 
+/** Creates a request without a body, `body` returns the object to stream as the body, with additional parameters of the delegate merged in */
+- (nonnull NSURLRequest *)createStreamedRequestWithBuilder:(nonnull SEInternalDataRequestBuilder *)builder
+                                                   context:(nonnull SEDataRequestContext *)context
+                                                      body:(id __autoreleasing _Nullable * _Nonnull)body
+                                                     error:(NSError * __autoreleasing _Nullable * _Nullable)error;
+
+- (nonnull SEInternalDataRequestTemplate *)createTemplateWithMethod:(nonnull NSString *)method
+                                                        pathPattern:(nonnull NSString *)pathPattern
+                                                            headers:(nullable NSDictionary<NSString *, NSString *> *)headers
+                                                    contentEncoding:(nullable NSString *)contentEncoding
+                                                   deserializeClass:(nullable Class)deserializeClass
+                                                   qualityOfService:(SEDataRequestQualityOfService)qualityOfService;
+
+- (nonnull NSURLRequest *)createRequestWithTemplate:(nonnull SEInternalDataRequestTemplate *)requestTemplate
+                                            context:(nonnull SEDataRequestContext *)context
+                                     pathParameters:(nullable NSDictionary<NSString *, id> *)pathParameters
+                                         parameters:(nullable NSDictionary<NSString *, id> *)parameters
+                                              error:(NSError * __autoreleasing _Nullable * _Nullable)error;
+
+/** Discards preparations of a caching preparation delegate */
+- (void)invalidatePreparations;
+
+/** Applies headers of the preparation delegate to a request restored from the outbox journal, which does not keep them */
+- (void)applyDelegateHeadersToRestoredRequest:(nonnull NSMutableURLRequest *)request context:(nonnull SEDataRequestContext *)context;
+
 - (nonnull NSURLRequest *)createUnsafeRequestWithMethod:(nonnull NSString *)method
                                                     URL:(nonnull NSURL *)url
                                              parameters:(nullable NSDictionary<NSString *, id> *)parameters
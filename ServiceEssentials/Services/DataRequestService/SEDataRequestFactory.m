@@ -12,11 +12,15 @@
 
 #include <pthread.h>
 
+#import <ServiceEssentials/SEDataRequestContext.h>
+#import <ServiceEssentials/SEDataRequestPreparation.h>
 #import <ServiceEssentials/SEDataRequestServicePrivate.h>
 #import <ServiceEssentials/SEDataSerializer.h>
 #import <ServiceEssentials/SEJSONDataSerializer.h>
 #import <ServiceEssentials/SEInternalDataRequestBuilder.h>
+#import <ServiceEssentials/SEInternalDataRequestTemplate.h>
 #import <ServiceEssentials/SEMultipartRequestContentStream.h>
+#import <ServiceEssentials/SETimeline.h>
 #import <ServiceEssentials/SETools.h>
 #import <ServiceEssentials/SEWebFormSerializer.h>
 
@@ -60,9 +64,8 @@ static inline NSURL *SEDataRequestMakeURL(NSURL *baseURL, NSString *path, NSDict
     return SEDataRequestValidateAndCreateURL(baseURL, [NSString stringWithFormat:@"%@%@%@", path, appendString, urEncodedParameters]);
 }
 
-static inline NSDictionary *SEDataRequestDictionaryWithAdditionalParameters(NSDictionary *parameters, id service, id<SEDataRequestPreparationDelegate> requestDelegate, NSString *method, NSString *path)
+static inline NSDictionary *SEDataRequestDictionaryWithAdditionalParameters(NSDictionary *parameters, NSDictionary *additionalParameters)
 {
-    NSDictionary *additionalParameters = [requestDelegate dataRequestService:service additionalParametersForRequestMethod:method path:path];
     if (additionalParameters != nil && additionalParameters.count > 0)
     {
         if (parameters == nil)
@@ -80,11 +83,68 @@ static inline NSDictionary *SEDataRequestDictionaryWithAdditionalParameters(NSDi
     return parameters;
 }
 
-static inline BOOL SEDataRequestMethodURLEncodesBody(NSString *method)
+// Path placeholder values must not change the path structure, so reserved path characters are escaped too
+static inline NSString *SEDataRequestEncodePathValue(id value)
 {
-    return !([method isEqualToString:SEDataRequestMethodGET] || [method isEqualToString:SEDataRequestMethodHEAD] || [method isEqualToString:SEDataRequestMethodDELETE]);
+    static NSCharacterSet *allowedCharacters;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSMutableCharacterSet *characters = [[NSCharacterSet URLPathAllowedCharacterSet] mutableCopy];
+        [characters removeCharactersInString:@"/?#;:"];
+        allowedCharacters = [characters copy];
+    });
+
+    NSString *string = [value isKindOfClass:[NSString class]] ? value : [value description];
+    return [string stringByAddingPercentEncodingWithAllowedCharacters:allowedCharacters];
 }
 
+// Resolves template path against the base URL once and splits the result into absolute literals around placeholders
+static inline SEDataRequestTemplateURL *SEDataRequestResolveTemplateURL(SEInternalDataRequestTemplate *requestTemplate, NSURL *baseURL)
+{
+    NSString *absoluteString = [SEDataRequestValidateAndCreateURL(baseURL, requestTemplate.markedPath) absoluteString];
+    NSMutableArray<NSString *> *literals = [[NSMutableArray alloc] initWithCapacity:requestTemplate.markers.count + 1];
+
+    NSRange searchRange = NSMakeRange(0, absoluteString.length);
+    for (NSString *marker in requestTemplate.markers)
+    {
+        NSRange markerRange = [absoluteString rangeOfString:marker options:NSLiteralSearch range:searchRange];
+        if (markerRange.location == NSNotFound) THROW_INCONSISTENCY((@{ NSLocalizedDescriptionKey: @"Path placeholder marker was lost during URL resolution." }));
+
+        [literals addObject:[absoluteString substringWithRange:NSMakeRange(searchRange.location, markerRange.location - searchRange.location)]];
+        searchRange.location = NSMaxRange(markerRange);
+        searchRange.length = absoluteString.length - searchRange.location;
+    }
+    [literals addObject:[absoluteString substringWithRange:searchRange]];
+
+    return [[SEDataRequestTemplateURL alloc] initWithBaseURL:baseURL literals:literals];
+}
+
+// Number of preparations of a caching delegate kept at once, the least recently created ones are dropped first
+static NSUInteger const SEDataRequestFactoryPreparationCapacity = 32;
+
+/** Preparation of a caching delegate kept until it expires */
+@interface SEDataRequestCachedPreparation : NSObject
+- (instancetype) initWithPreparation: (SEDataRequestPreparation *) preparation expiration: (NSTimeInterval) expiration;
+@property (nonatomic, readonly, strong) SEDataRequestPreparation *preparation;
+/** System uptime when the preparation expires */
+@property (nonatomic, readonly, assign) NSTimeInterval expiration;
+@end
+
+@implementation SEDataRequestCachedPreparation
+
+- (instancetype)initWithPreparation:(SEDataRequestPreparation *)preparation expiration:(NSTimeInterval)expiration
+{
+    self = [super init];
+    if (self)
+    {
+        _preparation = preparation;
+        _expiration = expiration;
+    }
+    return self;
+}
+
+@end
+
 // Macro for generic handling of an error while building data requests (graceful in Release, crash in Debug)
 #ifdef DEBUG
 #define HANDLE_BUILD_REQUEST_ERROR(message) do { THROW_INVALID_PARAM(body, @{ NSLocalizedDescriptionKey: message }); } while(0)
@@ -97,9 +157,16 @@ static inline BOOL SEDataRequestMethodURLEncodesBody(NSString *method)
     __weak id<SEDataRequestServicePrivate> _service;
     BOOL _isSecure;
     NSString *_userAgent;
-    NSString *_authorizationHeader;
-    pthread_mutex_t _authorizationHeaderLock;
     id<SEDataRequestPreparationDelegate> _requestDelegate;
+    
+    // Delegate capabilities, resolved once
+    BOOL _delegateProvidesPreparations;
+    BOOL _delegateProvidesHeaders;
+    BOOL _delegateProvidesParameters;
+    
+    // Preparations of a caching delegate, the most recent first, guarded by `_preparationLock`
+    NSMutableArray<SEDataRequestCachedPreparation *> *_preparations;
+    pthread_mutex_t _preparationLock;
 }
 
 @synthesize userAgent = _userAgent;
@@ -120,55 +187,26 @@ static inline BOOL SEDataRequestMethodURLEncodesBody(NSString *method)
         _service = service;
         _requestDelegate = requestDelegate;
         _userAgent = [userAgent copy];
-        
         _isSecure = secure;
-        if (secure)
-        {
-            pthread_mutex_init(&_authorizationHeaderLock, NULL);
-        }
+        
+        _delegateProvidesPreparations = [requestDelegate conformsToProtocol:@protocol(SEDataRequestCachingPreparationDelegate)];
+        _delegateProvidesHeaders = !_delegateProvidesPreparations && [requestDelegate respondsToSelector:@selector(dataRequestService:additionalHeadersForRequestMethod:path:)];
+        _delegateProvidesParameters = !_delegateProvidesPreparations && [requestDelegate respondsToSelector:@selector(dataRequestService:additionalParametersForRequestMethod:path:)];
+        _preparations = [[NSMutableArray alloc] init];
+        pthread_mutex_init(&_preparationLock, NULL);
     }
     return self;
 }
 
 - (void)dealloc
 {
-    if (_isSecure)
-    {
-        pthread_mutex_destroy(&_authorizationHeaderLock);
-    }
-}
-
-#pragma mark - Properties
-
-- (NSString *)authorizationHeader
-{
-    CHECK_IF_SECURE;
-    
-    NSString *value;
-    
-    pthread_mutex_lock(&_authorizationHeaderLock);
-    value = _authorizationHeader;
-    pthread_mutex_unlock(&_authorizationHeaderLock);
-
-    return value;
-}
-
-- (void)setAuthorizationHeader:(NSString *)authorizationHeader
-{
-    CHECK_IF_SECURE;
-
-    pthread_mutex_lock(&_authorizationHeaderLock);
-    if (authorizationHeader != _authorizationHeader)
-    {
-        _authorizationHeader = [authorizationHeader copy];
-    }
-    pthread_mutex_unlock(&_authorizationHeaderLock);
+    pthread_mutex_destroy(&_preparationLock);
 }
 
 #pragma mark - Interface methods
 
 - (NSURLRequest *)createRequestWithMethod:(NSString *)method
-                                  baseURL:(NSURL *)baseURL
+                                  context:(SEDataRequestContext *)context
                                      path:(NSString *)path
                                      body:(id)body
                                  mimeType:(NSString *)mimeType
@@ -182,16 +220,17 @@ static inline BOOL SEDataRequestMethodURLEncodesBody(NSString *method)
 
     return [self buildRequestWithService:service
                                   method:method
-                                 baseURL:baseURL
+                                 context:context
                                     path:path
                                     body:body
                                 mimeType:mimeType
                                  headers:nil
                        acceptContentType:SEDataRequestAcceptContentTypeJSON
+                             preparation:NULL
                                    error:error];
 }
 
-- (NSURLRequest *)createDownloadRequestWithBaseURL:(NSURL *)baseURL
+- (NSURLRequest *)createDownloadRequestWithContext:(SEDataRequestContext *)context
                                               path:(NSString *)path
                                               body:(id)body
                                              error:(NSError * _Nullable __autoreleasing *)error
@@ -204,17 +243,18 @@ static inline BOOL SEDataRequestMethodURLEncodesBody(NSString *method)
     
     return [self buildRequestWithService:service
                                   method:SEDataRequestMethodGET
-                                 baseURL:baseURL
+                                 context:context
                                     path:path
                                     body:body
                                 mimeType:nil
                                  headers:nil
                        acceptContentType:SEDataRequestAcceptContentTypeData
+                             preparation:NULL
                                    error:error];
 }
 
 - (NSURLRequest *)createRequestWithBuilder:(SEInternalDataRequestBuilder *)builder
-                                   baseURL:(NSURL *)baseURL
+                                   context:(SEDataRequestContext *)context
                                      error:(NSError * _Nullable __autoreleasing *)error
 {
     CHECK_IF_SECURE;
@@ -225,17 +265,18 @@ static inline BOOL SEDataRequestMethodURLEncodesBody(NSString *method)
     
     return [self buildRequestWithService:service
                                   method:builder.method
-                                 baseURL:baseURL
+                                 context:context
                                     path:builder.path
                                     body:builder.bodyParameters ?: builder.body
                                 mimeType:builder.contentEncoding
                                  headers:builder.headers
                        acceptContentType:builder.acceptContentType
+                             preparation:NULL
                                    error:error];
 }
 
 - (NSURLRequest *)createMultipartRequestWithBuilder:(SEInternalDataRequestBuilder *)builder
-                                            baseURL:(NSURL *)baseURL
+                                            context:(SEDataRequestContext *)context
                                            boundary:(NSString *)boundary
                                               error:(NSError * _Nullable __autoreleasing *)error
 {
@@ -247,12 +288,13 @@ static inline BOOL SEDataRequestMethodURLEncodesBody(NSString *method)
 
     NSMutableURLRequest *request = [self buildRequestWithService:service
                                                           method:builder.method
-                                                         baseURL:baseURL
+                                                         context:context
                                                             path:builder.path
                                                             body:nil
                                                         mimeType:nil
                                                          headers:builder.headers
                                                acceptContentType:builder.acceptContentType
+                                                     preparation:NULL
                                                            error:error];
 
     // Setting content-type and content-length in the very end to ensure they are consistent with the request.
@@ -265,6 +307,45 @@ static inline BOOL SEDataRequestMethodURLEncodesBody(NSString *method)
     return request;
 }
 
+- (NSURLRequest *)createStreamedRequestWithBuilder:(SEInternalDataRequestBuilder *)builder
+                                           context:(SEDataRequestContext *)context
+                                              body:(id __autoreleasing *)body
+                                             error:(NSError * _Nullable __autoreleasing *)error
+{
+    CHECK_IF_SECURE;
+    if (body == nil) THROW_INVALID_PARAM(body, nil);
+    
+    // since service is weak-referenced, retain it for the duration of request making and pass around
+    id<SEDataRequestServicePrivate> service = _service;
+    if (service == nil) return nil;
+    
+    SEDataRequestPreparation *preparation = nil;
+    NSMutableURLRequest *request = [self buildRequestWithService:service
+                                                          method:builder.method
+                                                         context:context
+                                                            path:builder.path
+                                                            body:nil
+                                                        mimeType:nil
+                                                         headers:builder.headers
+                                               acceptContentType:builder.acceptContentType
+                                                     preparation:&preparation
+                                                           error:error];
+    if (request == nil) return nil;
+    
+    // parameters of the delegate are merged the same way as into a JSON body built in memory; no Content-Length, the body is chunked
+    id streamedBody = builder.streamedBody;
+    if (_isSecure && _requestDelegate && [streamedBody isKindOfClass:[NSDictionary class]])
+    {
+        streamedBody = SEDataRequestDictionaryWithAdditionalParameters(streamedBody, [self additionalParametersWithService:service method:builder.method path:builder.path preparation:preparation]);
+    }
+    *body = streamedBody;
+    
+    NSString *charset = (__bridge NSString *)CFStringConvertEncodingToIANACharSetName(CFStringConvertNSStringEncodingToEncoding([service stringEncoding]));
+    [request setValue:[NSString stringWithFormat:@"%@; charset=%@", SEDataRequestServiceContentTypeJSON, charset] forHTTPHeaderField:@"Content-Type"];
+    
+    return request;
+}
+
 - (NSURLRequest *)createUnsafeRequestWithMethod:(NSString *)method
                                             URL:(NSURL *)url
                                      parameters:(NSDictionary<NSString *, id> *)parameters
@@ -287,7 +368,7 @@ static inline BOOL SEDataRequestMethodURLEncodesBody(NSString *method)
         else
         {
             NSString *charset = (__bridge NSString *)CFStringConvertEncodingToIANACharSetName(CFStringConvertNSStringEncodingToEncoding(encoding));
-            data = [self buildRequestDataWithService:_service method:method path:nil body:parameters mimeType:mimeType charset:charset contentTypeOut:&contentType error:error];
+            data = [self buildRequestDataWithService:_service method:method path:nil body:parameters mimeType:mimeType charset:charset preparation:nil contentTypeOut:&contentType error:error];
             
             if (data == nil) return nil;
         }
@@ -309,13 +390,184 @@ static inline BOOL SEDataRequestMethodURLEncodesBody(NSString *method)
     return request;
 }
 
+#pragma mark - Templates
+
+- (SEInternalDataRequestTemplate *)createTemplateWithMethod:(NSString *)method
+                                                pathPattern:(NSString *)pathPattern
+                                                    headers:(NSDictionary<NSString *,NSString *> *)headers
+                                            contentEncoding:(NSString *)contentEncoding
+                                           deserializeClass:(Class)deserializeClass
+                                           qualityOfService:(SEDataRequestQualityOfService)qualityOfService
+{
+    CHECK_IF_SECURE;
+
+    id<SEDataRequestServicePrivate> service = _service;
+    if (service == nil) return nil;
+
+    NSString *charset = (__bridge NSString *)CFStringConvertEncodingToIANACharSetName(CFStringConvertNSStringEncodingToEncoding([service stringEncoding]));
+
+    // static headers are composed exactly the same way as for regular requests, but only once
+    NSMutableURLRequest *prototype = [[NSMutableURLRequest alloc] init];
+    if (_userAgent) [prototype setValue:_userAgent forHTTPHeaderField:@"User-Agent"];
+    [prototype setValue:[NSString stringWithFormat:@"application/json; charset=%@", charset] forHTTPHeaderField:@"Accept"];
+    SEAssignHeadersToURLRequest(prototype, headers);
+
+    SEDataSerializer *serializer = nil;
+    NSString *contentType = nil;
+    if (SEDataRequestMethodURLEncodesBody(method))
+    {
+        if (contentEncoding != nil)
+        {
+            serializer = [service explicitSerializerForMIMEType:contentEncoding];
+            if (serializer == nil) THROW_INVALID_PARAM(contentEncoding, @{ NSLocalizedDescriptionKey: [NSString stringWithFormat:@"Serializer not found for type %@", contentEncoding] });
+            contentType = serializer.shouldAppendCharsetToContentType ? [NSString stringWithFormat:@"%@; charset=%@", contentEncoding, charset] : contentEncoding;
+        }
+        else
+        {
+            contentType = [NSString stringWithFormat:@"%@; charset=%@", SEDataRequestServiceContentTypeJSON, charset];
+        }
+    }
+
+    return [[SEInternalDataRequestTemplate alloc] initWithDataRequestService:service
+                                                                      method:method
+                                                                 pathPattern:pathPattern
+                                                               staticHeaders:prototype.allHTTPHeaderFields ?: @{}
+                                                              bodySerializer:serializer
+                                                             contentEncoding:contentEncoding
+                                                                 contentType:contentType
+                                                            deserializeClass:deserializeClass
+                                                            qualityOfService:qualityOfService];
+}
+
+- (NSURLRequest *)createRequestWithTemplate:(SEInternalDataRequestTemplate *)requestTemplate
+                                    context:(SEDataRequestContext *)context
+                             pathParameters:(NSDictionary<NSString *,id> *)pathParameters
+                                 parameters:(NSDictionary<NSString *,id> *)parameters
+                                      error:(NSError * _Nullable __autoreleasing *)error
+{
+    CHECK_IF_SECURE;
+
+    NSTimeInterval buildTime = SETimelineBegin();
+    NSURLRequest *request = [self buildRequestWithTemplate:requestTemplate context:context pathParameters:pathParameters parameters:parameters error:error];
+    SETimelineEnd(buildTime, "build", SEDataRequestTimelineCategory, 0);
+    return request;
+}
+
+- (NSURLRequest *)buildRequestWithTemplate:(SEInternalDataRequestTemplate *)requestTemplate context:(SEDataRequestContext *)context pathParameters:(NSDictionary<NSString *,id> *)pathParameters parameters:(NSDictionary<NSString *,id> *)parameters error:(NSError * __autoreleasing *)error
+{
+    // since service is weak-referenced, retain it for the duration of request making and pass around
+    id<SEDataRequestServicePrivate> service = _service;
+    if (service == nil) return nil;
+
+    // URL literals are resolved once per base URL
+    NSURL *baseURL = context.baseURL;
+    SEDataRequestTemplateURL *resolvedURL = requestTemplate.resolvedURL;
+    if (resolvedURL == nil || ![resolvedURL.baseURL isEqual:baseURL])
+    {
+        resolvedURL = SEDataRequestResolveTemplateURL(requestTemplate, baseURL);
+        requestTemplate.resolvedURL = resolvedURL;
+    }
+
+    // substitute placeholders; relative path is only needed by the preparation delegate
+    NSArray<NSString *> *placeholders = requestTemplate.placeholders;
+    NSArray<NSString *> *literals = resolvedURL.literals;
+    NSArray<NSString *> *pathLiterals = requestTemplate.pathLiterals;
+    NSMutableString *urlString = [literals[0] mutableCopy];
+    NSMutableString *path = (_requestDelegate != nil) ? [pathLiterals[0] mutableCopy] : nil;
+    for (NSUInteger i = 0; i < placeholders.count; ++i)
+    {
+        id value = pathParameters[placeholders[i]];
+        if (value == nil)
+        {
+            NSString *message = [NSString stringWithFormat:@"Missing value for path placeholder {%@} in [%@]", placeholders[i], requestTemplate.pathPattern];
+            return SEDataRequestAssignErrorFromMessage(message, error);
+        }
+
+        NSString *encodedValue = SEDataRequestEncodePathValue(value);
+        [urlString appendString:encodedValue];
+        [urlString appendString:literals[i + 1]];
+        [path appendString:encodedValue];
+        [path appendString:pathLiterals[i + 1]];
+    }
+
+    NSString *method = requestTemplate.method;
+    NSStringEncoding stringEncoding = [service stringEncoding];
+    NSData *data = nil;
+
+    // a caching delegate is asked once for both parameters and headers of the request
+    SEDataRequestPreparation *preparation = [self preparationWithService:service method:method path:path];
+
+    if (requestTemplate.encodesParametersInURL)
+    {
+        if (_requestDelegate)
+        {
+            parameters = SEDataRequestDictionaryWithAdditionalParameters(parameters, [self additionalParametersWithService:service method:method path:path preparation:preparation]);
+        }
+        if (parameters.count > 0)
+        {
+            [urlString appendString:([urlString rangeOfString:@"?"].location == NSNotFound) ? @"?" : @"&"];
+            [urlString appendString:[SEWebFormSerializer webFormEncodedStringFromDictionary:parameters withEncoding:stringEncoding]];
+        }
+    }
+    else if (parameters != nil)
+    {
+        SEDataSerializer *serializer = requestTemplate.bodySerializer;
+        if (_requestDelegate && (serializer == nil || serializer.supportsAdditionalParameters))
+        {
+            parameters = SEDataRequestDictionaryWithAdditionalParameters(parameters, [self additionalParametersWithService:service method:method path:path preparation:preparation]);
+        }
+
+        NSError *serializationError = nil;
+        data = (serializer != nil) ? [serializer serializeObject:parameters mimeType:requestTemplate.contentEncoding error:&serializationError]
+                                   : [SEJSONDataSerializer serializeObject:parameters error:&serializationError];
+        if (serializationError != nil)
+        {
+            return SEDataRequestAssignSerializationError(serializationError, error);
+        }
+    }
+
+    NSURL *url = [NSURL URLWithString:urlString];
+    if (url == nil)
+    {
+        NSString *message = [NSString stringWithFormat:@"Not a valid request URL: %@", urlString];
+        return SEDataRequestAssignErrorFromMessage(message, error);
+    }
+
+    NSMutableURLRequest *request = [[NSMutableURLRequest alloc] initWithURL:url];
+    [request setHTTPMethod:method];
+    [request setAllHTTPHeaderFields:requestTemplate.staticHeaders];
+
+    [self applyGlobalAndDelegateSettingsForAuthorizedRequest:request withService:service context:context method:method path:path preparation:preparation];
+
+    if (data)
+    {
+        [request setValue:requestTemplate.contentType forHTTPHeaderField:@"Content-Type"];
+        [request setHTTPBody:data];
+    }
+
+    return request;
+}
+
 #pragma mark - Internal building functions
 
-- (NSMutableURLRequest *)buildRequestWithService:(id)service method:(NSString *)method baseURL:(NSURL *)baseURL path:(NSString *)path body:(id)body mimeType:(NSString *)mimeType headers:(NSDictionary<NSString *, NSString *> *)headers acceptContentType:(SEDataRequestAcceptContentType)acceptType error:(NSError * __autoreleasing *)error
+- (NSMutableURLRequest *)buildRequestWithService:(id)service method:(NSString *)method context:(SEDataRequestContext *)context path:(NSString *)path body:(id)body mimeType:(NSString *)mimeType headers:(NSDictionary<NSString *, NSString *> *)headers acceptContentType:(SEDataRequestAcceptContentType)acceptType preparation:(SEDataRequestPreparation * __autoreleasing *)preparationOut error:(NSError * __autoreleasing *)error
+{
+    // the span includes the preparation delegate and the serialization of the body
+    NSTimeInterval buildTime = SETimelineBegin();
+    // a caching delegate is asked once for both parameters and headers of the request
+    SEDataRequestPreparation *preparation = [self preparationWithService:service method:method path:path];
+    if (preparationOut != NULL) *preparationOut = preparation;
+    NSMutableURLRequest *request = [self composeRequestWithService:service method:method context:context path:path body:body mimeType:mimeType headers:headers acceptContentType:acceptType preparation:preparation error:error];
+    SETimelineEnd(buildTime, "build", SEDataRequestTimelineCategory, 0);
+    return request;
+}
+
+- (NSMutableURLRequest *)composeRequestWithService:(id)service method:(NSString *)method context:(SEDataRequestContext *)context path:(NSString *)path body:(id)body mimeType:(NSString *)mimeType headers:(NSDictionary<NSString *, NSString *> *)headers acceptContentType:(SEDataRequestAcceptContentType)acceptType preparation:(SEDataRequestPreparation *)preparation error:(NSError * __autoreleasing *)error
 {
     // compose the URL
     BOOL needsBody = NO;
-    NSURL *fullUrl = [self buildURLWithService:service path:path baseURL:baseURL forMethod:method body:body needsBodyData:&needsBody error:error];
+    NSURL *baseURL = context.baseURL;
+    NSURL *fullUrl = [self buildURLWithService:service path:path baseURL:baseURL forMethod:method body:body preparation:preparation needsBodyData:&needsBody error:error];
 
     if (fullUrl == nil)
     {
@@ -330,15 +582,15 @@ static inline BOOL SEDataRequestMethodURLEncodesBody(NSString *method)
 
     if (needsBody && (body != nil))
     {
-        data = [self buildRequestDataWithService:service method:method path:path body:body mimeType:mimeType charset:charset contentTypeOut:&contentType error:error];
+        data = [self buildRequestDataWithService:service method:method path:path body:body mimeType:mimeType charset:charset preparation:preparation contentTypeOut:&contentType error:error];
         if (data == nil) return nil;
     }
 
     // assign everything to a request
-    return [self createRequestWithService:service method:method path:path url:fullUrl data:data contentType:contentType headers:headers acceptContentType:acceptType charset:charset];
+    return [self createRequestWithService:service context:context method:method path:path url:fullUrl data:data contentType:contentType headers:headers acceptContentType:acceptType charset:charset preparation:preparation];
 }
 
-- (NSMutableURLRequest *)createRequestWithService:(id)service method:(NSString *)method path:(NSString *)path url:(NSURL *)url data:(NSData *)data contentType:(NSString *)contentType headers:(NSDictionary<NSString *, NSString *> *)headers acceptContentType:(SEDataRequestAcceptContentType)acceptType charset:(NSString *)charset
+- (NSMutableURLRequest *)createRequestWithService:(id)service context:(SEDataRequestContext *)context method:(NSString *)method path:(NSString *)path url:(NSURL *)url data:(NSData *)data contentType:(NSString *)contentType headers:(NSDictionary<NSString *, NSString *> *)headers acceptContentType:(SEDataRequestAcceptContentType)acceptType charset:(NSString *)charset preparation:(SEDataRequestPreparation *)preparation
 {
     NSMutableURLRequest *request = [[NSMutableURLRequest alloc] init];
     [request setHTTPMethod:method];
@@ -356,7 +608,7 @@ static inline BOOL SEDataRequestMethodURLEncodesBody(NSString *method)
 
     if (_isSecure)
     {
-        [self applyGlobalAndDelegateSettingsForAuthorizedRequest:request withService:service method:method path:path];
+        [self applyGlobalAndDelegateSettingsForAuthorizedRequest:request withService:service context:context method:method path:path preparation:preparation];
     }
 
     if (data)
@@ -368,7 +620,7 @@ static inline BOOL SEDataRequestMethodURLEncodesBody(NSString *method)
     return request;
 }
 
-- (NSURL *)buildURLWithService:(id)service path:(NSString *)path baseURL:(NSURL *)baseURL forMethod:(NSString *)method body:(id)body needsBodyData:(BOOL *)needsBody error: (NSError * __autoreleasing *) error
+- (NSURL *)buildURLWithService:(id)service path:(NSString *)path baseURL:(NSURL *)baseURL forMethod:(NSString *)method body:(id)body preparation:(SEDataRequestPreparation *)preparation needsBodyData:(BOOL *)needsBody error: (NSError * __autoreleasing *) error
 {
     *needsBody = SEDataRequestMethodURLEncodesBody(method);
     if (*needsBody)
@@ -386,7 +638,7 @@ static inline BOOL SEDataRequestMethodURLEncodesBody(NSString *method)
         NSDictionary *parameters = body;
         if (_isSecure && _requestDelegate)
         {
-            parameters = SEDataRequestDictionaryWithAdditionalParameters(parameters, service, _requestDelegate, method, path);
+            parameters = SEDataRequestDictionaryWithAdditionalParameters(parameters, [self additionalParametersWithService:service method:method path:path preparation:preparation]);
         }
         
         if (parameters == nil || parameters.count == 0) return SEDataRequestValidateAndCreateURL(baseURL, path);
@@ -394,7 +646,7 @@ static inline BOOL SEDataRequestMethodURLEncodesBody(NSString *method)
     }
 }
 
-- (NSData *)buildRequestDataWithService:(id)service method:(NSString *)method path:(NSString *)path body:(id)body mimeType:(NSString *)mimeType charset:(NSString *)charset contentTypeOut:(NSString * __autoreleasing *)contentTypeOut error: (NSError * __autoreleasing *) error
+- (NSData *)buildRequestDataWithService:(id)service method:(NSString *)method path:(NSString *)path body:(id)body mimeType:(NSString *)mimeType charset:(NSString *)charset preparation:(SEDataRequestPreparation *)preparation contentTypeOut:(NSString * __autoreleasing *)contentTypeOut error: (NSError * __autoreleasing *) error
 {
     if (contentTypeOut == nil) THROW_INVALID_PARAM(contentTypeOut, nil);
 
@@ -428,7 +680,7 @@ static inline BOOL SEDataRequestMethodURLEncodesBody(NSString *method)
         {
             if (_isSecure && _requestDelegate && isDictionary && serializer.supportsAdditionalParameters)
             {
-                body = SEDataRequestDictionaryWithAdditionalParameters(body, service, _requestDelegate, method, path);
+                body = SEDataRequestDictionaryWithAdditionalParameters(body, [self additionalParametersWithService:service method:method path:path preparation:preparation]);
             }
             
             data = [serializer serializeObject:body mimeType:mimeType error:&serializationError];
@@ -449,7 +701,7 @@ static inline BOOL SEDataRequestMethodURLEncodesBody(NSString *method)
     {
         if (_isSecure && _requestDelegate && isDictionary)
         {
-            body = SEDataRequestDictionaryWithAdditionalParameters(body, service, _requestDelegate, method, path);
+            body = SEDataRequestDictionaryWithAdditionalParameters(body, [self additionalParametersWithService:service method:method path:path preparation:preparation]);
         }
         NSError *jsonError = nil;
         data = [SEJSONDataSerializer serializeObject:body error:error];
@@ -471,18 +723,102 @@ static inline BOOL SEDataRequestMethodURLEncodesBody(NSString *method)
     return data;
 }
 
-- (void)applyGlobalAndDelegateSettingsForAuthorizedRequest:(NSMutableURLRequest *)request withService:(id)service method:(NSString *)method path:(NSString *)path
+- (void)invalidatePreparations
+{
+    pthread_mutex_lock(&_preparationLock);
+    [_preparations removeAllObjects];
+    pthread_mutex_unlock(&_preparationLock);
+}
+
+- (void)applyDelegateHeadersToRestoredRequest:(NSMutableURLRequest *)request context:(SEDataRequestContext *)context
+{
+    if (!_isSecure || _requestDelegate == nil) return;
+    
+    id service = _service;
+    if (service == nil) return;
+    
+    // only requests of the environment were prepared by the delegate, the path is the one of the URL relative to the base
+    NSString *baseURLString = context.baseURL.absoluteString;
+    NSString *urlString = request.URL.absoluteString;
+    if (baseURLString == nil || ![urlString hasPrefix:baseURLString]) return;
+    
+    NSString *path = [urlString substringFromIndex:baseURLString.length];
+    NSRange queryRange = [path rangeOfString:@"?"];
+    if (queryRange.location != NSNotFound) path = [path substringToIndex:queryRange.location];
+    
+    NSString *method = request.HTTPMethod;
+    SEDataRequestPreparation *preparation = [self preparationWithService:service method:method path:path];
+    SEAssignHeadersToURLRequest(request, [self additionalHeadersWithService:service method:method path:path preparation:preparation]);
+}
+
+// Preparation of a caching delegate for a request, `nil` for other delegates
+- (SEDataRequestPreparation *)preparationWithService:(id)service method:(NSString *)method path:(NSString *)path
+{
+    if (!_delegateProvidesPreparations) return nil;
+    
+    SEDataRequestPreparation *preparation = nil;
+    NSTimeInterval now = [NSProcessInfo processInfo].systemUptime;
+    pthread_mutex_lock(&_preparationLock);
+    for (NSUInteger i = 0; i < _preparations.count;)
+    {
+        SEDataRequestCachedPreparation *cachedPreparation = _preparations[i];
+        if (cachedPreparation.expiration <= now)
+        {
+            [_preparations removeObjectAtIndex:i];
+            continue;
+        }
+        if ([cachedPreparation.preparation appliesToRequestMethod:method path:path])
+        {
+            preparation = cachedPreparation.preparation;
+            break;
+        }
+        ++i;
+    }
+    pthread_mutex_unlock(&_preparationLock);
+    if (preparation != nil) return preparation;
+    
+    // delegate is an external code, so it is never called in the lock
+    preparation = [(id<SEDataRequestCachingPreparationDelegate>)_requestDelegate dataRequestService:service preparationForRequestMethod:method path:path];
+    // a preparation out of the scope of its own request would never be found for it and only push the useful ones out
+    if (preparation.validityInterval > 0 && [preparation appliesToRequestMethod:method path:path])
+    {
+        SEDataRequestCachedPreparation *cachedPreparation = [[SEDataRequestCachedPreparation alloc] initWithPreparation:preparation expiration:now + preparation.validityInterval];
+        pthread_mutex_lock(&_preparationLock);
+        [_preparations insertObject:cachedPreparation atIndex:0];
+        if (_preparations.count > SEDataRequestFactoryPreparationCapacity) [_preparations removeLastObject];
+        pthread_mutex_unlock(&_preparationLock);
+    }
+    return preparation;
+}
+
+- (NSDictionary<NSString *, NSString *> *)additionalHeadersWithService:(id)service method:(NSString *)method path:(NSString *)path preparation:(SEDataRequestPreparation *)preparation
+{
+    if (_delegateProvidesPreparations) return preparation.headers;
+    if (_delegateProvidesHeaders) return [_requestDelegate dataRequestService:service additionalHeadersForRequestMethod:method path:path];
+    return nil;
+}
+
+- (NSDictionary<NSString *, id> *)additionalParametersWithService:(id)service method:(NSString *)method path:(NSString *)path preparation:(SEDataRequestPreparation *)preparation
+{
+    if (_delegateProvidesPreparations) return preparation.parameters;
+    if (_delegateProvidesParameters) return [_requestDelegate dataRequestService:service additionalParametersForRequestMethod:method path:path];
+    return nil;
+}
+
+- (void)applyGlobalAndDelegateSettingsForAuthorizedRequest:(NSMutableURLRequest *)request withService:(id)service context:(SEDataRequestContext *)context method:(NSString *)method path:(NSString *)path preparation:(SEDataRequestPreparation *)preparation
 {
     NSAssert(_isSecure, @"Global settings only apply to secure requests");
     
     if (_requestDelegate != nil)
     {
-        NSDictionary<NSString *, NSString *> *headers = [_requestDelegate dataRequestService:service additionalHeadersForRequestMethod:method path:path];
+        NSDictionary<NSString *, NSString *> *headers = [self additionalHeadersWithService:service method:method path:path preparation:preparation];
         SEAssignHeadersToURLRequest(request, headers);
     }
 
-    NSString *authorizationHeader = self.authorizationHeader;
+    NSString *authorizationHeader = context.authorizationHeader;
     if (authorizationHeader != nil) [request setValue:authorizationHeader forHTTPHeaderField:@"Authorization"];
+    
+    [NSURLProtocol setProperty:@YES forKey:SEDataRequestEnvironmentRequestProperty inRequest:request];
 }
 
 @end
@@ -0,0 +1,49 @@
+//
+//  SEDataRequestLinkPolicy.h
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+@import Foundation;
+
+#import <ServiceEssentials/SEDataRequestService.h>
+
+/** Link dependent settings used by the data request service. Immutable. */
+@interface SEDataRequestLinkParameters : NSObject
+
+- (nonnull instancetype) initWithMaxConcurrentRequests: (NSUInteger) maxConcurrentRequests
+                                         prefetchDepth: (NSUInteger) prefetchDepth
+                                  compressionThreshold: (NSUInteger) compressionThreshold;
+
+/** Maximum number of requests in flight, the rest wait in the order of their quality of service. 0 is treated as 1. */
+@property (nonatomic, readonly, assign) NSUInteger maxConcurrentRequests;
+/** Number of requests that may be issued ahead of need, 0 disables prefetching */
+@property (nonatomic, readonly, assign) NSUInteger prefetchDepth;
+/** Request bodies larger than this number of bytes are worth compressing. `NSUIntegerMax` means never. */
+@property (nonatomic, readonly, assign) NSUInteger compressionThreshold;
+
+@end
+
+/** Derives link parameters from the link class and measured throughput. Implementations must be thread-safe and fast. */
+@protocol SEDataRequestLinkPolicy <NSObject>
+/**
+ Called when reachability status changes and when a new throughput sample is taken.
+ @param status current reachability status
+ @param throughput measured throughput in bytes per second, 0 if not measured yet
+ */
+- (nonnull SEDataRequestLinkParameters *) linkParametersForStatus: (SENetworkReachabilityStatus) status throughput: (double) throughput;
+@end
+
+/**
+ Default policy: generous on WiFi and local networks, conservative on WWAN.
+ When measured throughput drops below `slowLinkThroughput`, concurrency is reduced further and prefetching is disabled regardless of the link class.
+ Unknown status is treated as a fast link, so that the service behaves as before reachability is determined.
+ */
+@interface SEDefaultDataRequestLinkPolicy : NSObject<SEDataRequestLinkPolicy>
+/** Throughput in bytes per second below which the link is considered slow. Defaults to 64 KB/s. */
+@property (atomic, assign) double slowLinkThroughput;
+@end
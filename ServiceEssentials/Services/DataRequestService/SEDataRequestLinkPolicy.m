@@ -0,0 +1,82 @@
+//
+//  SEDataRequestLinkPolicy.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <ServiceEssentials/SEDataRequestLinkPolicy.h>
+
+static const NSUInteger SEDataRequestLinkFastConcurrentRequests = 8;
+static const NSUInteger SEDataRequestLinkFastPrefetchDepth = 4;
+static const NSUInteger SEDataRequestLinkFastCompressionThreshold = 32 * 1024;
+static const NSUInteger SEDataRequestLinkCellularConcurrentRequests = 4;
+static const NSUInteger SEDataRequestLinkCellularPrefetchDepth = 1;
+static const NSUInteger SEDataRequestLinkCellularCompressionThreshold = 2 * 1024;
+static const NSUInteger SEDataRequestLinkSlowConcurrentRequests = 2;
+static const NSUInteger SEDataRequestLinkSlowCompressionThreshold = 1024;
+static const double SEDataRequestLinkDefaultSlowThroughput = 64 * 1024;
+
+@implementation SEDataRequestLinkParameters
+
+- (instancetype)initWithMaxConcurrentRequests:(NSUInteger)maxConcurrentRequests prefetchDepth:(NSUInteger)prefetchDepth compressionThreshold:(NSUInteger)compressionThreshold
+{
+    self = [super init];
+    if (self)
+    {
+        _maxConcurrentRequests = MAX(maxConcurrentRequests, (NSUInteger)1);
+        _prefetchDepth = prefetchDepth;
+        _compressionThreshold = compressionThreshold;
+    }
+    return self;
+}
+
+- (instancetype)init
+{
+    return [self initWithMaxConcurrentRequests:SEDataRequestLinkFastConcurrentRequests prefetchDepth:SEDataRequestLinkFastPrefetchDepth compressionThreshold:SEDataRequestLinkFastCompressionThreshold];
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: concurrent %lu, prefetch %lu, compression %lu>", NSStringFromClass([self class]), (unsigned long)_maxConcurrentRequests, (unsigned long)_prefetchDepth, (unsigned long)_compressionThreshold];
+}
+
+@end
+
+@implementation SEDefaultDataRequestLinkPolicy
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self)
+    {
+        _slowLinkThroughput = SEDataRequestLinkDefaultSlowThroughput;
+    }
+    return self;
+}
+
+- (SEDataRequestLinkParameters *)linkParametersForStatus:(SENetworkReachabilityStatus)status throughput:(double)throughput
+{
+    if (throughput > 0 && throughput < self.slowLinkThroughput)
+    {
+        return [[SEDataRequestLinkParameters alloc] initWithMaxConcurrentRequests:SEDataRequestLinkSlowConcurrentRequests prefetchDepth:0 compressionThreshold:SEDataRequestLinkSlowCompressionThreshold];
+    }
+    
+    switch (status)
+    {
+        case SENetworkReachabilityStatusReachableViaWWAN:
+            return [[SEDataRequestLinkParameters alloc] initWithMaxConcurrentRequests:SEDataRequestLinkCellularConcurrentRequests prefetchDepth:SEDataRequestLinkCellularPrefetchDepth compressionThreshold:SEDataRequestLinkCellularCompressionThreshold];
+            
+        case SENetworkReachabilityStatusNotReachable:
+            // nothing will go through anyway, do not pile up requests once the link comes back
+            return [[SEDataRequestLinkParameters alloc] initWithMaxConcurrentRequests:SEDataRequestLinkSlowConcurrentRequests prefetchDepth:0 compressionThreshold:SEDataRequestLinkSlowCompressionThreshold];
+            
+        default:
+            return [SEDataRequestLinkParameters new];
+    }
+}
+
+@end
@@ -0,0 +1,51 @@
+//
+//  SEDataRequestNetworkEstimator.h
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+@import Foundation;
+
+/**
+ Online estimate of round trip time and throughput, built from completed requests.
+ Round trip time is measured as time to the first byte of the response, and is smoothed the same way TCP does it,
+ keeping both the average and the mean deviation. Throughput is an exponentially weighted average of response transfer rates.
+ The estimator is thread-safe.
+ */
+@interface SEDataRequestNetworkEstimator : NSObject
+
+/** Smoothed time to the first byte, in seconds. 0 until measured. */
+@property (atomic, readonly, assign) NSTimeInterval roundTripTime;
+/** Smoothed mean deviation of the round trip time, in seconds */
+@property (atomic, readonly, assign) NSTimeInterval roundTripTimeVariation;
+/** Smoothed throughput in bytes per second. 0 until measured. */
+@property (atomic, readonly, assign) double throughput;
+/** Number of round trip time samples since the last reset */
+@property (atomic, readonly, assign) NSUInteger sampleCount;
+
+/** Number of round trip time samples required before timeouts are derived from the estimate. Defaults to 5. */
+@property (atomic, assign) NSUInteger minimumSampleCount;
+/** Lower bound of derived timeouts. Defaults to 10 seconds. */
+@property (atomic, assign) NSTimeInterval minimumTimeout;
+/** Upper bound of derived timeouts. Defaults to 120 seconds. */
+@property (atomic, assign) NSTimeInterval maximumTimeout;
+
+- (void) addRoundTripTimeSample: (NSTimeInterval) roundTripTime;
+/** Adds a throughput sample. Transfers shorter than a few kilobytes measure latency rather than throughput and should not be reported. */
+- (void) addThroughputSampleWithBytes: (int64_t) bytes duration: (NSTimeInterval) duration;
+
+/** Forgets all samples, for example when the link changes */
+- (void) reset;
+
+/**
+ Timeout for a request transferring the given number of bytes.
+ Returns `defaultTimeout` until there are enough samples, otherwise the expected round trip and transfer time with a safety margin,
+ bounded by `minimumTimeout` and `maximumTimeout`.
+ */
+- (NSTimeInterval) timeoutForExpectedBytes: (int64_t) expectedBytes defaultTimeout: (NSTimeInterval) defaultTimeout;
+
+@end
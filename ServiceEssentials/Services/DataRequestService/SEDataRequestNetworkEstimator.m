@@ -0,0 +1,139 @@
+//
+//  SEDataRequestNetworkEstimator.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <ServiceEssentials/SEDataRequestNetworkEstimator.h>
+
+#include <pthread.h>
+
+// Same gains as TCP retransmission timer (RFC 6298)
+static const double SEDataRequestNetworkEstimatorRTTGain = 0.125;
+static const double SEDataRequestNetworkEstimatorRTTVariationGain = 0.25;
+static const double SEDataRequestNetworkEstimatorRTTVariationFactor = 4.0;
+static const double SEDataRequestNetworkEstimatorThroughputGain = 0.3;
+// Timeout covers this many expected request durations
+static const double SEDataRequestNetworkEstimatorTimeoutMargin = 2.0;
+
+@implementation SEDataRequestNetworkEstimator
+{
+    pthread_mutex_t _lock;
+    NSTimeInterval _roundTripTime;
+    NSTimeInterval _roundTripTimeVariation;
+    double _throughput;
+    NSUInteger _sampleCount;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self)
+    {
+        _minimumSampleCount = 5;
+        _minimumTimeout = 10.0;
+        _maximumTimeout = 120.0;
+        pthread_mutex_init(&_lock, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&_lock);
+}
+
+- (NSTimeInterval)roundTripTime
+{
+    pthread_mutex_lock(&_lock);
+    NSTimeInterval roundTripTime = _roundTripTime;
+    pthread_mutex_unlock(&_lock);
+    return roundTripTime;
+}
+
+- (NSTimeInterval)roundTripTimeVariation
+{
+    pthread_mutex_lock(&_lock);
+    NSTimeInterval roundTripTimeVariation = _roundTripTimeVariation;
+    pthread_mutex_unlock(&_lock);
+    return roundTripTimeVariation;
+}
+
+- (double)throughput
+{
+    pthread_mutex_lock(&_lock);
+    double throughput = _throughput;
+    pthread_mutex_unlock(&_lock);
+    return throughput;
+}
+
+- (NSUInteger)sampleCount
+{
+    pthread_mutex_lock(&_lock);
+    NSUInteger sampleCount = _sampleCount;
+    pthread_mutex_unlock(&_lock);
+    return sampleCount;
+}
+
+- (void)addRoundTripTimeSample:(NSTimeInterval)roundTripTime
+{
+    if (roundTripTime <= 0) return;
+    
+    pthread_mutex_lock(&_lock);
+    if (_sampleCount == 0)
+    {
+        _roundTripTime = roundTripTime;
+        _roundTripTimeVariation = roundTripTime / 2;
+    }
+    else
+    {
+        _roundTripTimeVariation += (fabs(_roundTripTime - roundTripTime) - _roundTripTimeVariation) * SEDataRequestNetworkEstimatorRTTVariationGain;
+        _roundTripTime += (roundTripTime - _roundTripTime) * SEDataRequestNetworkEstimatorRTTGain;
+    }
+    _sampleCount++;
+    pthread_mutex_unlock(&_lock);
+}
+
+- (void)addThroughputSampleWithBytes:(int64_t)bytes duration:(NSTimeInterval)duration
+{
+    if (bytes <= 0 || duration <= 0) return;
+    
+    double sample = bytes / duration;
+    pthread_mutex_lock(&_lock);
+    _throughput = (_throughput == 0) ? sample : _throughput + (sample - _throughput) * SEDataRequestNetworkEstimatorThroughputGain;
+    pthread_mutex_unlock(&_lock);
+}
+
+- (void)reset
+{
+    pthread_mutex_lock(&_lock);
+    _roundTripTime = 0;
+    _roundTripTimeVariation = 0;
+    _throughput = 0;
+    _sampleCount = 0;
+    pthread_mutex_unlock(&_lock);
+}
+
+- (NSTimeInterval)timeoutForExpectedBytes:(int64_t)expectedBytes defaultTimeout:(NSTimeInterval)defaultTimeout
+{
+    NSUInteger minimumSampleCount = self.minimumSampleCount;
+    NSTimeInterval minimumTimeout = self.minimumTimeout;
+    NSTimeInterval maximumTimeout = self.maximumTimeout;
+    
+    pthread_mutex_lock(&_lock);
+    NSUInteger sampleCount = _sampleCount;
+    NSTimeInterval expectedDuration = _roundTripTime + _roundTripTimeVariation * SEDataRequestNetworkEstimatorRTTVariationFactor;
+    if (_throughput > 0 && expectedBytes > 0) expectedDuration += expectedBytes / _throughput;
+    pthread_mutex_unlock(&_lock);
+    
+    if (sampleCount == 0 || sampleCount < minimumSampleCount) return defaultTimeout;
+    
+    NSTimeInterval timeout = expectedDuration * SEDataRequestNetworkEstimatorTimeoutMargin;
+    return MIN(MAX(timeout, minimumTimeout), MAX(maximumTimeout, minimumTimeout));
+}
+
+@end
@@ -0,0 +1,64 @@
+//
+//  SEDataRequestOutbox.h
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+@import Foundation;
+
+/**
+ A request stored in the outbox. Authorization header is never stored, it is applied when the request is sent.
+ Other headers carrying credentials, such as Cookie or X-API-Key, are kept in memory, but are never written to the journal.
+ */
+@interface SEDataRequestOutboxRecord : NSObject
+@property (nonatomic, readonly, assign) uint64_t identifier;
+@property (nonatomic, readonly, strong, nonnull) NSURLRequest *request;
+/** Whether the request was sent with authorization */
+@property (nonatomic, readonly, assign) BOOL authorized;
+/** Whether the record was loaded from the journal, that is, it was created by a previous instance and has no callbacks */
+@property (nonatomic, readonly, assign) BOOL isRestored;
+@end
+
+/**
+ Durable, ordered queue of mutating requests that could not be sent because of missing connectivity.
+ 
+ Records are kept in an append-only journal: adding a record or acknowledging a batch of records is a single write at the end of the file.
+ The journal is compacted when the outbox is loaded and truncated whenever the outbox becomes empty.
+ A partially written record at the end of the journal (for example, after a crash) is discarded on load.
+ Writes are not synchronized to the storage, so records survive process termination, but not necessarily a power loss.
+ On iOS the journal is protected until the first unlock of the device after a restart.
+ 
+ The outbox is thread-safe.
+ */
+@interface SEDataRequestOutbox : NSObject
+
+/** Creates an outbox with a journal at the URL. Records from an existing journal are loaded. */
+- (nonnull instancetype) initWithJournalURL: (nonnull NSURL *) journalURL;
+
+@property (nonatomic, readonly, strong, nonnull) NSURL *journalURL;
+
+/** Maximum number of outbox requests sent concurrently during a flush. Defaults to 2. */
+@property (atomic, assign) NSUInteger maxConcurrentRequests;
+/** Maximum number of records flushed in a batch, acknowledgements are written once per batch. Defaults to 8. */
+@property (atomic, assign) NSUInteger batchSize;
+
+/** Number of records that are not acknowledged yet, including those being sent */
+@property (nonatomic, readonly, assign) NSUInteger count;
+
+/** Appends a request to the journal. Returns `nil` if the record could not be written. */
+- (nullable SEDataRequestOutboxRecord *) appendRequest: (nonnull NSURLRequest *) request authorized: (BOOL) authorized error: (NSError * __autoreleasing _Nullable * _Nullable) error;
+
+/** Returns up to `batchSize` oldest records that are not being sent already, and marks them as being sent */
+- (nonnull NSArray<SEDataRequestOutboxRecord *> *) dequeueBatch;
+
+/** Removes records from the outbox, the journal is updated with a single write */
+- (void) acknowledgeRecords: (nonnull NSArray<SEDataRequestOutboxRecord *> *) records;
+
+/** Returns records that could not be sent, they keep their position in the queue */
+- (void) requeueRecords: (nonnull NSArray<SEDataRequestOutboxRecord *> *) records;
+
+@end
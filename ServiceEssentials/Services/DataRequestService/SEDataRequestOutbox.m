@@ -0,0 +1,361 @@
+//
+//  SEDataRequestOutbox.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <ServiceEssentials/SEDataRequestOutbox.h>
+
+#include <pthread.h>
+
+#import <ServiceEssentials/SETools.h>
+
+// Journal entry is a type byte, a 32-bit big endian payload length and a payload.
+// Record payload is a binary property list, acknowledgement payload is a list of 64-bit big endian identifiers.
+static const uint8_t SEDataRequestOutboxEntryRecord = 'R';
+static const uint8_t SEDataRequestOutboxEntryAcknowledgement = 'A';
+static const NSUInteger SEDataRequestOutboxEntryHeaderLength = 5;
+
+static NSString * const SEDataRequestOutboxKeyIdentifier = @"i";
+static NSString * const SEDataRequestOutboxKeyMethod = @"m";
+static NSString * const SEDataRequestOutboxKeyURL = @"u";
+static NSString * const SEDataRequestOutboxKeyHeaders = @"h";
+static NSString * const SEDataRequestOutboxKeyBody = @"b";
+static NSString * const SEDataRequestOutboxKeyAuthorized = @"a";
+
+// Headers with these fragments in their names carry credentials, such as Authorization, Cookie or X-API-Key, and are never written to the journal
+static NSArray<NSString *> *SEDataRequestOutboxCredentialHeaderFragments(void)
+{
+    static NSArray<NSString *> *fragments;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        fragments = @[ @"auth", @"cookie", @"token", @"secret", @"session", @"signature", @"password", @"api-key", @"apikey", @"access-key" ];
+    });
+    return fragments;
+}
+
+static NSDictionary<NSString *, NSString *> *SEDataRequestOutboxStoredHeaders(NSDictionary<NSString *, NSString *> *headers)
+{
+    NSMutableDictionary<NSString *, NSString *> *storedHeaders = [[NSMutableDictionary alloc] initWithCapacity:headers.count];
+    [headers enumerateKeysAndObjectsUsingBlock:^(NSString *field, NSString *value, BOOL *stop) {
+        NSString *lowercaseField = field.lowercaseString;
+        for (NSString *fragment in SEDataRequestOutboxCredentialHeaderFragments())
+        {
+            if ([lowercaseField rangeOfString:fragment].location != NSNotFound) return;
+        }
+        [storedHeaders setObject:value forKey:field];
+    }];
+    return storedHeaders;
+}
+
+static inline void SEDataRequestOutboxAppendEntry(NSMutableData *data, uint8_t type, NSData *payload)
+{
+    uint32_t length = CFSwapInt32HostToBig((uint32_t)payload.length);
+    [data appendBytes:&type length:sizeof(type)];
+    [data appendBytes:&length length:sizeof(length)];
+    [data appendData:payload];
+}
+
+@implementation SEDataRequestOutboxRecord
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithIdentifier:(uint64_t)identifier request:(NSURLRequest *)request authorized:(BOOL)authorized restored:(BOOL)restored
+{
+    self = [super init];
+    if (self)
+    {
+        _identifier = identifier;
+        _request = request;
+        _authorized = authorized;
+        _isRestored = restored;
+    }
+    return self;
+}
+
+- (NSData *)serializedPayload
+{
+    NSMutableDictionary *plist = [[NSMutableDictionary alloc] initWithCapacity:6];
+    [plist setObject:@(_identifier) forKey:SEDataRequestOutboxKeyIdentifier];
+    [plist setObject:_request.HTTPMethod forKey:SEDataRequestOutboxKeyMethod];
+    [plist setObject:_request.URL.absoluteString forKey:SEDataRequestOutboxKeyURL];
+    NSDictionary<NSString *, NSString *> *headers = SEDataRequestOutboxStoredHeaders(_request.allHTTPHeaderFields);
+    if (headers.count > 0) [plist setObject:headers forKey:SEDataRequestOutboxKeyHeaders];
+    if (_request.HTTPBody != nil) [plist setObject:_request.HTTPBody forKey:SEDataRequestOutboxKeyBody];
+    if (_authorized) [plist setObject:@YES forKey:SEDataRequestOutboxKeyAuthorized];
+    return [NSPropertyListSerialization dataWithPropertyList:plist format:NSPropertyListBinaryFormat_v1_0 options:0 error:nil];
+}
+
++ (instancetype)recordWithPayload:(NSData *)payload
+{
+    NSDictionary *plist = [NSPropertyListSerialization propertyListWithData:payload options:NSPropertyListImmutable format:NULL error:nil];
+    if (![plist isKindOfClass:[NSDictionary class]]) return nil;
+    
+    NSURL *url = [NSURL URLWithString:[plist objectForKey:SEDataRequestOutboxKeyURL]];
+    NSString *method = [plist objectForKey:SEDataRequestOutboxKeyMethod];
+    if (url == nil || method == nil) return nil;
+    
+    NSMutableURLRequest *request = [[NSMutableURLRequest alloc] initWithURL:url];
+    request.HTTPMethod = method;
+    request.allHTTPHeaderFields = [plist objectForKey:SEDataRequestOutboxKeyHeaders];
+    request.HTTPBody = [plist objectForKey:SEDataRequestOutboxKeyBody];
+    
+    return [[self alloc] initWithIdentifier:[[plist objectForKey:SEDataRequestOutboxKeyIdentifier] unsignedLongLongValue]
+                                    request:[request copy]
+                                 authorized:[[plist objectForKey:SEDataRequestOutboxKeyAuthorized] boolValue]
+                                   restored:YES];
+}
+
+@end
+
+@implementation SEDataRequestOutbox
+{
+    pthread_mutex_t _lock;
+    NSFileHandle *_journal;
+    uint64_t _nextIdentifier;
+    // records in the order of submission
+    NSMutableArray<SEDataRequestOutboxRecord *> *_records;
+    NSMutableSet<NSNumber *> *_identifiersInFlight;
+}
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithJournalURL:(NSURL *)journalURL
+{
+    if (journalURL == nil || ![journalURL isFileURL]) THROW_INVALID_PARAM(journalURL, nil);
+    
+    self = [super init];
+    if (self)
+    {
+        _journalURL = [journalURL copy];
+        _maxConcurrentRequests = 2;
+        _batchSize = 8;
+        _nextIdentifier = 1;
+        _records = [NSMutableArray new];
+        _identifiersInFlight = [NSMutableSet new];
+        pthread_mutex_init(&_lock, NULL);
+        
+        [self loadJournal];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [_journal closeFile];
+    pthread_mutex_destroy(&_lock);
+}
+
+- (NSUInteger)count
+{
+    NSUInteger count;
+    pthread_mutex_lock(&_lock);
+    count = _records.count;
+    pthread_mutex_unlock(&_lock);
+    return count;
+}
+
+- (SEDataRequestOutboxRecord *)appendRequest:(NSURLRequest *)request authorized:(BOOL)authorized error:(NSError * _Nullable __autoreleasing *)error
+{
+    if (request == nil) THROW_INVALID_PARAM(request, nil);
+    
+    // credentials are never written to disk
+    NSMutableURLRequest *storedRequest = [request mutableCopy];
+    [storedRequest setValue:nil forHTTPHeaderField:@"Authorization"];
+    
+    SEDataRequestOutboxRecord *record = nil;
+    pthread_mutex_lock(&_lock);
+    record = [[SEDataRequestOutboxRecord alloc] initWithIdentifier:_nextIdentifier request:[storedRequest copy] authorized:authorized restored:NO];
+    
+    NSMutableData *entry = [NSMutableData new];
+    SEDataRequestOutboxAppendEntry(entry, SEDataRequestOutboxEntryRecord, [record serializedPayload]);
+    if ([self writeEntry:entry error:error])
+    {
+        _nextIdentifier++;
+        [_records addObject:record];
+    }
+    else
+    {
+        record = nil;
+    }
+    pthread_mutex_unlock(&_lock);
+    
+    return record;
+}
+
+- (NSArray<SEDataRequestOutboxRecord *> *)dequeueBatch
+{
+    NSUInteger batchSize = self.batchSize;
+    NSMutableArray<SEDataRequestOutboxRecord *> *batch = [[NSMutableArray alloc] initWithCapacity:batchSize];
+    
+    pthread_mutex_lock(&_lock);
+    for (SEDataRequestOutboxRecord *record in _records)
+    {
+        if (batch.count >= batchSize) break;
+        
+        NSNumber *identifier = @(record.identifier);
+        if (![_identifiersInFlight containsObject:identifier])
+        {
+            [_identifiersInFlight addObject:identifier];
+            [batch addObject:record];
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+    
+    return [batch copy];
+}
+
+- (void)acknowledgeRecords:(NSArray<SEDataRequestOutboxRecord *> *)records
+{
+    if (records.count == 0) return;
+    
+    NSMutableData *payload = [[NSMutableData alloc] initWithCapacity:records.count * sizeof(uint64_t)];
+    NSMutableSet<NSNumber *> *identifiers = [[NSMutableSet alloc] initWithCapacity:records.count];
+    for (SEDataRequestOutboxRecord *record in records)
+    {
+        uint64_t identifier = CFSwapInt64HostToBig(record.identifier);
+        [payload appendBytes:&identifier length:sizeof(identifier)];
+        [identifiers addObject:@(record.identifier)];
+    }
+    
+    pthread_mutex_lock(&_lock);
+    NSUInteger countBefore = _records.count;
+    [_records filterUsingPredicate:[NSPredicate predicateWithBlock:^BOOL(SEDataRequestOutboxRecord *record, NSDictionary *bindings) {
+        return ![identifiers containsObject:@(record.identifier)];
+    }]];
+    [_identifiersInFlight minusSet:identifiers];
+    
+    if (_records.count == 0)
+    {
+        // nothing to keep, start the journal from scratch
+        [self truncateJournal];
+    }
+    else if (_records.count != countBefore)
+    {
+        NSMutableData *entry = [NSMutableData new];
+        SEDataRequestOutboxAppendEntry(entry, SEDataRequestOutboxEntryAcknowledgement, payload);
+        [self writeEntry:entry error:nil];
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+- (void)requeueRecords:(NSArray<SEDataRequestOutboxRecord *> *)records
+{
+    pthread_mutex_lock(&_lock);
+    for (SEDataRequestOutboxRecord *record in records) [_identifiersInFlight removeObject:@(record.identifier)];
+    pthread_mutex_unlock(&_lock);
+}
+
+#pragma mark - Journal
+
+// Must be called in the lock
+- (BOOL)writeEntry:(NSData *)entry error:(NSError * __autoreleasing *)error
+{
+    if (_journal == nil)
+    {
+        if (error != nil) *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{ NSURLErrorKey: _journalURL }];
+        return NO;
+    }
+    
+    @try
+    {
+        [_journal seekToEndOfFile];
+        [_journal writeData:entry];
+    }
+    @catch (NSException *exception)
+    {
+        SELog(@"Failed to write outbox journal %@: %@", _journalURL, exception);
+        if (error != nil) *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{ NSURLErrorKey: _journalURL, NSLocalizedDescriptionKey: exception.reason ?: @"" }];
+        return NO;
+    }
+    return YES;
+}
+
+// Must be called in the lock
+- (void)truncateJournal
+{
+    @try
+    {
+        [_journal truncateFileAtOffset:0];
+    }
+    @catch (NSException *exception)
+    {
+        SELog(@"Failed to truncate outbox journal %@: %@", _journalURL, exception);
+    }
+}
+
+- (void)loadJournal
+{
+    NSData *data = [NSData dataWithContentsOfURL:_journalURL options:NSDataReadingMappedIfSafe error:nil];
+    
+    NSMutableArray<SEDataRequestOutboxRecord *> *records = [NSMutableArray new];
+    NSMutableSet<NSNumber *> *acknowledged = [NSMutableSet new];
+    const uint8_t *bytes = data.bytes;
+    NSUInteger offset = 0;
+    while (offset + SEDataRequestOutboxEntryHeaderLength <= data.length)
+    {
+        uint8_t type = bytes[offset];
+        uint32_t length;
+        memcpy(&length, bytes + offset + 1, sizeof(length));
+        length = CFSwapInt32BigToHost(length);
+        
+        // partially written entry
+        if (offset + SEDataRequestOutboxEntryHeaderLength + length > data.length) break;
+        
+        NSData *payload = [data subdataWithRange:NSMakeRange(offset + SEDataRequestOutboxEntryHeaderLength, length)];
+        if (type == SEDataRequestOutboxEntryRecord)
+        {
+            SEDataRequestOutboxRecord *record = [SEDataRequestOutboxRecord recordWithPayload:payload];
+            if (record != nil) [records addObject:record];
+        }
+        else if (type == SEDataRequestOutboxEntryAcknowledgement)
+        {
+            const uint8_t *identifiers = payload.bytes;
+            for (NSUInteger i = 0; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t))
+            {
+                uint64_t identifier;
+                memcpy(&identifier, identifiers + i, sizeof(identifier));
+                [acknowledged addObject:@(CFSwapInt64BigToHost(identifier))];
+            }
+        }
+        offset += SEDataRequestOutboxEntryHeaderLength + length;
+    }
+    
+    // compact: keep only the records that were never acknowledged
+    NSMutableData *compacted = [NSMutableData new];
+    for (SEDataRequestOutboxRecord *record in records)
+    {
+        if ([acknowledged containsObject:@(record.identifier)]) continue;
+        
+        [_records addObject:record];
+        SEDataRequestOutboxAppendEntry(compacted, SEDataRequestOutboxEntryRecord, [record serializedPayload]);
+        if (record.identifier >= _nextIdentifier) _nextIdentifier = record.identifier + 1;
+    }
+    
+    // bodies are stored as is, so the journal is only readable once the device has been unlocked
+    NSDataWritingOptions options = NSDataWritingAtomic;
+#if defined(__IPHONE_OS_VERSION_MIN_REQUIRED)
+    options |= NSDataWritingFileProtectionCompleteUntilFirstUserAuthentication;
+#endif
+    NSError *error = nil;
+    if (![compacted writeToURL:_journalURL options:options error:&error])
+    {
+        SELog(@"Failed to create outbox journal %@: %@", _journalURL, error);
+        return;
+    }
+    
+    _journal = [NSFileHandle fileHandleForWritingToURL:_journalURL error:&error];
+    if (_journal == nil) SELog(@"Failed to open outbox journal %@: %@", _journalURL, error);
+}
+
+@end
@@ -0,0 +1,131 @@
+//
+//  SEDataRequestPageSequence.h
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+@import Foundation;
+
+#import <ServiceEssentials/SEDataRequestService.h>
+
+/**
+ Finds the parameters of the next page of a paginated `GET` request.
+ Paginations are called on arbitrary threads, concurrently for different pages, and must be thread-safe.
+ */
+@protocol SEDataRequestPagination <NSObject>
+
+/**
+ Returns the parameters of the page following a received page, or `nil` if it is the last one.
+ @param parameters parameters of the received page
+ @param result serialized response body, before deserialization to a class
+ @param response response of the page
+ */
+- (nullable NSDictionary<NSString *, id> *) parametersOfPageAfterParameters: (nonnull NSDictionary<NSString *, id> *) parameters result: (nullable id) result response: (nonnull NSURLResponse *) response;
+
+@optional
+/** Returns the parameters of the first page, completing those the sequence is created with */
+- (nonnull NSDictionary<NSString *, id> *) parametersOfFirstPageWithParameters: (nonnull NSDictionary<NSString *, id> *) parameters;
+
+/**
+ Returns the parameters of the page following a page before it is received, when they do not depend on the response.
+ Pages are then requested without waiting for the previous ones, and the end is still detected with
+ `parametersOfPageAfterParameters:result:response:`. Pages requested past the end are discarded.
+ */
+- (nonnull NSDictionary<NSString *, id> *) parametersOfPageAfterParameters: (nonnull NSDictionary<NSString *, id> *) parameters;
+
+@end
+
+/** Pagination with a cursor returned in the response body and passed as a parameter of the next page */
+@interface SEDataRequestCursorPagination : NSObject<SEDataRequestPagination>
+/**
+ @param keyPath key path of the cursor in the response body, such as `paging.next`. A missing, `null` or empty cursor ends the sequence.
+ @param parameterName name of the parameter that passes the cursor
+ */
+- (nonnull instancetype) initWithCursorKeyPath: (nonnull NSString *) keyPath parameterName: (nonnull NSString *) parameterName;
+@property (nonatomic, readonly, copy, nonnull) NSString *cursorKeyPath;
+@property (nonatomic, readonly, copy, nonnull) NSString *parameterName;
+@end
+
+/**
+ Pagination with the `next` link of the RFC 8288 `Link` header, as used by GitHub and others.
+ Query parameters of the link become the parameters of the next page, while the path of the sequence is kept.
+ */
+@interface SEDataRequestLinkHeaderPagination : NSObject<SEDataRequestPagination>
+@end
+
+/**
+ Pagination with an offset and a page size. Pages are known in advance, so they are requested without waiting for each other.
+ The first page starts at offset 0 unless the parameters of the sequence set the offset.
+ A page with fewer items than the page size ends the sequence.
+ */
+@interface SEDataRequestOffsetPagination : NSObject<SEDataRequestPagination>
+/**
+ @param offsetParameter name of the parameter with the index of the first item of a page
+ @param limitParameter name of the parameter with the page size, `nil` if the server uses a fixed size
+ @param pageSize number of items on a page
+ @param itemsKeyPath key path of the items in the response body, `nil` if the body is an array of items
+ */
+- (nonnull instancetype) initWithOffsetParameter: (nonnull NSString *) offsetParameter limitParameter: (nullable NSString *) limitParameter pageSize: (NSUInteger) pageSize itemsKeyPath: (nullable NSString *) itemsKeyPath;
+@property (nonatomic, readonly, copy, nonnull) NSString *offsetParameter;
+@property (nonatomic, readonly, copy, nullable) NSString *limitParameter;
+@property (nonatomic, readonly, assign) NSUInteger pageSize;
+@property (nonatomic, readonly, copy, nullable) NSString *itemsKeyPath;
+@end
+
+/** Page of a sequence. Immutable. */
+@interface SEDataRequestPage : NSObject
+/** Position of the page in the sequence, starting with 0 */
+@property (nonatomic, readonly, assign) NSUInteger index;
+@property (nonatomic, readonly, strong, nonnull) NSDictionary<NSString *, id> *parameters;
+/** Response data, deserialized to the class of the sequence if there is one */
+@property (nonatomic, readonly, strong, nullable) id data;
+@property (nonatomic, readonly, strong, nonnull) NSURLResponse *response;
+@end
+
+/**
+ Pages of a paginated `GET` request, delivered in order as the consumer pulls them.
+
+ The sequence keeps `pagesAhead` pages requested ahead of the consumer, so a page is usually downloaded and deserialized
+ by the time it is pulled. The next page is requested as soon as its parameters are known: right after the previous page
+ is received for cursors and links, or right away for offsets. Nothing is requested past the pulled pages and `pagesAhead`,
+ so a consumer that stops pulling stops the sequence from loading more.
+
+ An error fails the pull of the page and finishes the sequence. Pages are deserialized off the completion queue.
+ The sequence is thread-safe. Releasing it cancels the pages in flight.
+ */
+@interface SEDataRequestPageSequence : NSObject
+
+/**
+ @param dataRequestService service the pages are requested with
+ @param path path of the request
+ @param parameters parameters of the first page
+ @param pagination finds the parameters of the following pages
+ @param class class pages are deserialized to, `nil` to deliver serialized data
+ */
+- (nonnull instancetype) initWithDataRequestService: (nonnull id<SEDataRequestService>) dataRequestService
+                                               path: (nonnull NSString *) path
+                                         parameters: (nullable NSDictionary<NSString *, id> *) parameters
+                                         pagination: (nonnull id<SEDataRequestPagination>) pagination
+                                 deserializeToClass: (nullable Class) class;
+
+/** Number of pages requested ahead of the pulled ones. Defaults to 2, 0 requests a page only when it is pulled. */
+@property (atomic, assign) NSUInteger pagesAhead;
+
+/** Whether the last page has been delivered, or the sequence has failed or has been cancelled */
+@property (atomic, readonly, assign) BOOL isFinished;
+
+/**
+ Pulls the next page. Pulls made before earlier ones complete are served in order.
+ @param completion callback invoked with the page, or with `nil` and `nil` after the last page, or with an error
+ @param completionQueue queue used to invoke the callback. Should be serial for the callbacks of several pulls to come in order.
+ */
+- (void) nextPage: (nonnull void (^)(SEDataRequestPage * _Nullable page, NSError * _Nullable error)) completion completionQueue: (nullable dispatch_queue_t) completionQueue;
+
+/** Cancels the pages in flight. Pending pulls are not called back, following pulls complete with no page. */
+- (void) cancel;
+
+@end
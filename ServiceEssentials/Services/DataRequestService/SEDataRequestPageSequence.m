@@ -0,0 +1,405 @@
+//
+//  SEDataRequestPageSequence.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <ServiceEssentials/SEDataRequestPageSequence.h>
+
+#import <ServiceEssentials/SETools.h>
+#import "SEDataRequestServicePrivate.h"
+#import "SEInternalDataRequest.h"
+
+static NSUInteger const SEDataRequestPageSequenceDefaultPagesAhead = 2;
+
+// Header lookup that does not depend on the case used by the server
+static inline NSString *SEPaginationHeader(NSURLResponse *response, NSString *name)
+{
+    if (![response isKindOfClass:[NSHTTPURLResponse class]]) return nil;
+    NSDictionary *headers = ((NSHTTPURLResponse *)response).allHeaderFields;
+    for (NSString *header in headers)
+    {
+        if ([header caseInsensitiveCompare:name] == NSOrderedSame) return [headers objectForKey:header];
+    }
+    return nil;
+}
+
+// Target of the link with the `next` relation, such as in `<https://host/items?page=2>; rel="next", <...>; rel="last"`
+static inline NSString *SEPaginationNextLink(NSString *header)
+{
+    NSScanner *scanner = [NSScanner scannerWithString:header];
+    scanner.charactersToBeSkipped = nil;
+    while (!scanner.isAtEnd)
+    {
+        NSString *target = nil;
+        NSString *linkParameters = nil;
+        [scanner scanUpToString:@"<" intoString:NULL];
+        if (![scanner scanString:@"<" intoString:NULL] || ![scanner scanUpToString:@">" intoString:&target] || ![scanner scanString:@">" intoString:NULL]) return nil;
+        [scanner scanUpToString:@"<" intoString:&linkParameters];
+
+        for (NSString *linkParameter in [linkParameters componentsSeparatedByString:@";"])
+        {
+            NSArray<NSString *> *nameAndValue = [linkParameter componentsSeparatedByString:@"="];
+            if (nameAndValue.count != 2) continue;
+            NSCharacterSet *trimmed = [NSCharacterSet characterSetWithCharactersInString:@"\" ,\t"];
+            if ([[nameAndValue[0] stringByTrimmingCharactersInSet:trimmed] caseInsensitiveCompare:@"rel"] != NSOrderedSame) continue;
+
+            // a link may have several relations separated with spaces
+            NSString *relations = [[nameAndValue[1] stringByTrimmingCharactersInSet:trimmed] lowercaseString];
+            if ([[relations componentsSeparatedByString:@" "] containsObject:@"next"]) return target;
+        }
+    }
+    return nil;
+}
+
+static inline NSInteger SEPaginationIntegerParameter(id value)
+{
+    return ([value isKindOfClass:[NSNumber class]] || [value isKindOfClass:[NSString class]]) ? [value integerValue] : 0;
+}
+
+@implementation SEDataRequestCursorPagination
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithCursorKeyPath:(NSString *)keyPath parameterName:(NSString *)parameterName
+{
+    if (keyPath.length == 0) THROW_INVALID_PARAM(keyPath, nil);
+    if (parameterName.length == 0) THROW_INVALID_PARAM(parameterName, nil);
+
+    self = [super init];
+    if (self)
+    {
+        _cursorKeyPath = [keyPath copy];
+        _parameterName = [parameterName copy];
+    }
+    return self;
+}
+
+- (NSDictionary<NSString *,id> *)parametersOfPageAfterParameters:(NSDictionary<NSString *,id> *)parameters result:(id)result response:(NSURLResponse *)response
+{
+    id cursor = [result isKindOfClass:[NSDictionary class]] ? [result valueForKeyPath:_cursorKeyPath] : nil;
+    if ([cursor isKindOfClass:[NSNumber class]]) cursor = [cursor stringValue];
+    if (![cursor isKindOfClass:[NSString class]] || [cursor length] == 0) return nil;
+
+    NSMutableDictionary<NSString *, id> *nextParameters = [parameters mutableCopy];
+    [nextParameters setObject:cursor forKey:_parameterName];
+    return nextParameters;
+}
+
+@end
+
+@implementation SEDataRequestLinkHeaderPagination
+
+- (NSDictionary<NSString *,id> *)parametersOfPageAfterParameters:(NSDictionary<NSString *,id> *)parameters result:(id)result response:(NSURLResponse *)response
+{
+    NSString *header = SEPaginationHeader(response, @"Link");
+    NSString *link = (header != nil) ? SEPaginationNextLink(header) : nil;
+    NSURL *url = (link != nil) ? [NSURL URLWithString:link relativeToURL:response.URL] : nil;
+    if (url == nil) return nil;
+
+    NSURLComponents *components = [NSURLComponents componentsWithURL:url resolvingAgainstBaseURL:YES];
+    NSMutableDictionary<NSString *, id> *nextParameters = [[NSMutableDictionary alloc] initWithCapacity:components.queryItems.count];
+    for (NSURLQueryItem *item in components.queryItems)
+    {
+        [nextParameters setObject:item.value ?: @"" forKey:item.name];
+    }
+    return nextParameters;
+}
+
+@end
+
+@implementation SEDataRequestOffsetPagination
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithOffsetParameter:(NSString *)offsetParameter limitParameter:(NSString *)limitParameter pageSize:(NSUInteger)pageSize itemsKeyPath:(NSString *)itemsKeyPath
+{
+    if (offsetParameter.length == 0) THROW_INVALID_PARAM(offsetParameter, nil);
+    if (pageSize == 0) THROW_INVALID_PARAM(pageSize, nil);
+
+    self = [super init];
+    if (self)
+    {
+        _offsetParameter = [offsetParameter copy];
+        _limitParameter = [limitParameter copy];
+        _pageSize = pageSize;
+        _itemsKeyPath = [itemsKeyPath copy];
+    }
+    return self;
+}
+
+- (NSDictionary<NSString *,id> *)parametersWithOffset:(NSInteger)offset parameters:(NSDictionary<NSString *,id> *)parameters
+{
+    NSMutableDictionary<NSString *, id> *pageParameters = [parameters mutableCopy];
+    [pageParameters setObject:@(offset) forKey:_offsetParameter];
+    if (_limitParameter != nil) [pageParameters setObject:@(_pageSize) forKey:_limitParameter];
+    return pageParameters;
+}
+
+- (NSDictionary<NSString *,id> *)parametersOfFirstPageWithParameters:(NSDictionary<NSString *,id> *)parameters
+{
+    return [self parametersWithOffset:SEPaginationIntegerParameter([parameters objectForKey:_offsetParameter]) parameters:parameters];
+}
+
+- (NSDictionary<NSString *,id> *)parametersOfPageAfterParameters:(NSDictionary<NSString *,id> *)parameters
+{
+    return [self parametersWithOffset:SEPaginationIntegerParameter([parameters objectForKey:_offsetParameter]) + _pageSize parameters:parameters];
+}
+
+- (NSDictionary<NSString *,id> *)parametersOfPageAfterParameters:(NSDictionary<NSString *,id> *)parameters result:(id)result response:(NSURLResponse *)response
+{
+    id items = (_itemsKeyPath != nil && [result isKindOfClass:[NSDictionary class]]) ? [result valueForKeyPath:_itemsKeyPath] : result;
+    if (![items isKindOfClass:[NSArray class]] || [items count] < _pageSize) return nil;
+    return [self parametersOfPageAfterParameters:parameters];
+}
+
+@end
+
+@interface SEDataRequestPage ()
+- (instancetype) initWithIndex: (NSUInteger) index parameters: (NSDictionary<NSString *, id> *) parameters data: (id) data response: (NSURLResponse *) response;
+@end
+
+@implementation SEDataRequestPage
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithIndex:(NSUInteger)index parameters:(NSDictionary<NSString *,id> *)parameters data:(id)data response:(NSURLResponse *)response
+{
+    self = [super init];
+    if (self)
+    {
+        _index = index;
+        _parameters = parameters;
+        _data = data;
+        _response = response;
+    }
+    return self;
+}
+
+@end
+
+// A page that has been requested and has not been delivered yet. Only accessed on the queue of the sequence.
+@interface SEDataRequestPageSlot : NSObject
+@property (nonatomic, assign) NSUInteger index;
+@property (nonatomic, strong) id<SECancellableToken> token;
+@property (nonatomic, assign) BOOL isComplete;
+@property (nonatomic, strong) SEDataRequestPage *page;
+@property (nonatomic, strong) NSError *error;
+@end
+
+@implementation SEDataRequestPageSlot
+@end
+
+@interface SEDataRequestPageSequence ()
+@property (atomic, readwrite, assign) BOOL isFinished;
+@end
+
+@implementation SEDataRequestPageSequence
+{
+    id<SEDataRequestService> _dataRequestService;
+    NSString *_path;
+    id<SEDataRequestPagination> _pagination;
+    Class _dataClass;
+    BOOL _knowsPagesInAdvance;
+
+    // State below is only accessed on the serial queue
+    dispatch_queue_t _queue;
+    NSMutableArray<SEDataRequestPageSlot *> *_slots;
+    NSMutableArray<void (^)(SEDataRequestPage *, NSError *)> *_pulls;
+    NSDictionary<NSString *, id> *_nextParameters; // `nil` until the parameters of the next page to request are known
+    NSUInteger _requestedCount;
+    NSUInteger _deliveredCount;
+    NSUInteger _pageCount; // known once the last page is received
+    BOOL _isPageCountKnown;
+    BOOL _isStopped;
+}
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithDataRequestService:(id<SEDataRequestService>)dataRequestService path:(NSString *)path parameters:(NSDictionary<NSString *,id> *)parameters pagination:(id<SEDataRequestPagination>)pagination deserializeToClass:(Class)class
+{
+    if (dataRequestService == nil) THROW_INVALID_PARAM(dataRequestService, nil);
+    if (path == nil) THROW_INVALID_PARAM(path, nil);
+    if (pagination == nil) THROW_INVALID_PARAM(pagination, nil);
+    if (class != nil && !SECanDeserializeToClass(class)) THROW_INVALID_PARAM(class, nil);
+
+    self = [super init];
+    if (self)
+    {
+        _dataRequestService = dataRequestService;
+        _path = [path copy];
+        _pagination = pagination;
+        _dataClass = class;
+        _knowsPagesInAdvance = [pagination respondsToSelector:@selector(parametersOfPageAfterParameters:)];
+        _pagesAhead = SEDataRequestPageSequenceDefaultPagesAhead;
+
+        _queue = dispatch_queue_create("com.service-essentials.DataRequestPageSequence", DISPATCH_QUEUE_SERIAL);
+        _slots = [[NSMutableArray alloc] init];
+        _pulls = [[NSMutableArray alloc] init];
+        _nextParameters = [parameters copy] ?: @{};
+        if ([pagination respondsToSelector:@selector(parametersOfFirstPageWithParameters:)]) _nextParameters = [pagination parametersOfFirstPageWithParameters:_nextParameters];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    // callbacks only hold the sequence weakly, so nothing else touches the slots anymore
+    for (SEDataRequestPageSlot *slot in _slots)
+    {
+        [slot.token cancel];
+    }
+}
+
+- (void)nextPage:(void (^)(SEDataRequestPage * _Nullable, NSError * _Nullable))completion completionQueue:(dispatch_queue_t)completionQueue
+{
+    if (completion == nil) THROW_INVALID_PARAM(completion, nil);
+
+    dispatch_async(_queue, ^{
+        [self->_pulls addObject:^(SEDataRequestPage *page, NSError *error) {
+            SEDataRequestDispatchCompletion(completionQueue, ^{ completion(page, error); });
+        }];
+        [self pump];
+    });
+}
+
+- (void)cancel
+{
+    dispatch_async(_queue, ^{
+        [self->_pulls removeAllObjects];
+        [self stop];
+    });
+}
+
+#pragma mark - Private
+
+// Must be called on the queue. Requests pages the consumer is going to need and delivers those it is waiting for.
+- (void)pump
+{
+    NSUInteger requestLimit = _deliveredCount + _pulls.count + self.pagesAhead;
+    while (!_isStopped && !_isPageCountKnown && _nextParameters != nil && _requestedCount < requestLimit)
+    {
+        [self requestPage];
+    }
+
+    while (_pulls.count > 0)
+    {
+        void (^pull)(SEDataRequestPage *, NSError *) = _pulls.firstObject;
+        if (_isStopped || (_isPageCountKnown && _deliveredCount >= _pageCount))
+        {
+            [_pulls removeObjectAtIndex:0];
+            self.isFinished = YES;
+            pull(nil, nil);
+            continue;
+        }
+
+        SEDataRequestPageSlot *slot = _slots.firstObject;
+        if (slot == nil || !slot.isComplete) break;
+
+        [_pulls removeObjectAtIndex:0];
+        [_slots removeObjectAtIndex:0];
+        ++_deliveredCount;
+        if (slot.error != nil) [self stop];
+        else if (_isPageCountKnown && _deliveredCount >= _pageCount) self.isFinished = YES;
+        pull(slot.page, slot.error);
+    }
+}
+
+// Must be called on the queue
+- (void)requestPage
+{
+    SEDataRequestPageSlot *slot = [SEDataRequestPageSlot new];
+    slot.index = _requestedCount++;
+    [_slots addObject:slot];
+
+    NSDictionary<NSString *, id> *parameters = _nextParameters;
+    _nextParameters = _knowsPagesInAdvance ? [_pagination parametersOfPageAfterParameters:parameters] : nil;
+
+    __weak typeof(self) weakSelf = self;
+    dispatch_queue_t queue = _queue;
+    id<SEDataRequestPagination> pagination = _pagination;
+    Class dataClass = _dataClass;
+    slot.token = [_dataRequestService GET:_path parameters:parameters success:^(id data, NSURLResponse *response) {
+        // the response is parsed on the delegate queue of the session, the next page and the data class are worked out
+        // on a concurrent queue, in parallel with other pages and without holding up the delegate queue
+        NSDictionary<NSString *, id> *nextParameters = [pagination parametersOfPageAfterParameters:parameters result:data response:response];
+        NSError *error = nil;
+        id pageData = (dataClass != nil && data != nil) ? [SEInternalDataRequest deserializeResult:data toClass:dataClass error:&error] : data;
+        SEDataRequestPage *page = (error == nil) ? [[SEDataRequestPage alloc] initWithIndex:slot.index parameters:parameters data:pageData response:response] : nil;
+        dispatch_async(queue, ^{
+            [weakSelf completeSlot:slot page:page nextParameters:nextParameters error:error];
+        });
+    } failure:^(NSError *error) {
+        dispatch_async(queue, ^{
+            [weakSelf completeSlot:slot page:nil nextParameters:nil error:error];
+        });
+    } completionQueue:dispatch_get_global_queue(QOS_CLASS_UTILITY, 0)];
+}
+
+// Must be called on the queue
+- (void)completeSlot:(SEDataRequestPageSlot *)slot page:(SEDataRequestPage *)page nextParameters:(NSDictionary<NSString *, id> *)nextParameters error:(NSError *)error
+{
+    // stopped or discarded as past the end
+    if (_isStopped || [_slots indexOfObjectIdenticalTo:slot] == NSNotFound) return;
+
+    slot.isComplete = YES;
+    slot.token = nil;
+    slot.page = page;
+    slot.error = error;
+
+    if (error == nil && nextParameters == nil && (!_isPageCountKnown || slot.index + 1 < _pageCount))
+    {
+        // pages requested in advance past the last one are not needed
+        _isPageCountKnown = YES;
+        _pageCount = slot.index + 1;
+        [self discardSlotsPassingTest:^BOOL(SEDataRequestPageSlot *otherSlot) {
+            return otherSlot.index >= slot.index + 1;
+        }];
+    }
+    else if (error == nil && _nextParameters == nil && !_knowsPagesInAdvance)
+    {
+        _nextParameters = nextParameters;
+    }
+
+    [self pump];
+}
+
+// Must be called on the queue
+- (void)stop
+{
+    _isStopped = YES;
+    self.isFinished = YES;
+    [self discardSlotsPassingTest:^BOOL(SEDataRequestPageSlot *slot) {
+        return YES;
+    }];
+}
+
+// Must be called on the queue
+- (void)discardSlotsPassingTest:(BOOL (^)(SEDataRequestPageSlot *slot))predicate
+{
+    NSIndexSet *discarded = [_slots indexesOfObjectsPassingTest:^BOOL(SEDataRequestPageSlot *slot, NSUInteger idx, BOOL *stop) {
+        return predicate(slot);
+    }];
+    [_slots enumerateObjectsAtIndexes:discarded options:0 usingBlock:^(SEDataRequestPageSlot *slot, NSUInteger idx, BOOL *stop) {
+        [slot.token cancel];
+    }];
+    [_slots removeObjectsAtIndexes:discarded];
+}
+
+@end
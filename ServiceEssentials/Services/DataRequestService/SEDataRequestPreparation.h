@@ -0,0 +1,46 @@
+//
+//  SEDataRequestPreparation.h
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+@import Foundation;
+
+/**
+ Headers and parameters a caching preparation delegate provides for requests, see `SEDataRequestCachingPreparationDelegate`.
+ A preparation is reused for every request in its scope until it expires, or until preparations are invalidated.
+ Immutable.
+ */
+@interface SEDataRequestPreparation : NSObject
+
+/** Preparation for the single request it has been asked for, it is not reused */
++ (nonnull instancetype) preparationWithHeaders: (nullable NSDictionary<NSString *, NSString *> *) headers parameters: (nullable NSDictionary<NSString *, id> *) parameters;
+
+/**
+ Initializes a preparation reused for requests in a scope
+ @param headers headers added to requests
+ @param parameters parameters added to requests, see `dataRequestService:additionalParametersForRequestMethod:path:`
+ @param method method of requests in the scope, `nil` for any method
+ @param pathPattern shell-style wildcard pattern, such as `users*`, matched against request paths. `*` also matches `/`. `nil` matches any path.
+ @param validityInterval time the preparation is reused for, 0 to not reuse it
+ */
+- (nonnull instancetype) initWithHeaders: (nullable NSDictionary<NSString *, NSString *> *) headers
+                              parameters: (nullable NSDictionary<NSString *, id> *) parameters
+                                  method: (nullable NSString *) method
+                             pathPattern: (nullable NSString *) pathPattern
+                        validityInterval: (NSTimeInterval) validityInterval;
+
+@property (nonatomic, readonly, strong, nullable) NSDictionary<NSString *, NSString *> *headers;
+@property (nonatomic, readonly, strong, nullable) NSDictionary<NSString *, id> *parameters;
+@property (nonatomic, readonly, strong, nullable) NSString *method;
+@property (nonatomic, readonly, strong, nullable) NSString *pathPattern;
+@property (nonatomic, readonly, assign) NSTimeInterval validityInterval;
+
+/** Whether a request with the method and path is in the scope of the preparation */
+- (BOOL) appliesToRequestMethod: (nonnull NSString *) method path: (nonnull NSString *) path;
+
+@end
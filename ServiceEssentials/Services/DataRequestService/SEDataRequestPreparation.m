@@ -0,0 +1,52 @@
+//
+//  SEDataRequestPreparation.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <ServiceEssentials/SEDataRequestPreparation.h>
+
+#include <fnmatch.h>
+
+#import <ServiceEssentials/SETools.h>
+
+@implementation SEDataRequestPreparation
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
++ (instancetype)preparationWithHeaders:(NSDictionary<NSString *,NSString *> *)headers parameters:(NSDictionary<NSString *,id> *)parameters
+{
+    return [[self alloc] initWithHeaders:headers parameters:parameters method:nil pathPattern:nil validityInterval:0];
+}
+
+- (instancetype)initWithHeaders:(NSDictionary<NSString *,NSString *> *)headers parameters:(NSDictionary<NSString *,id> *)parameters method:(NSString *)method pathPattern:(NSString *)pathPattern validityInterval:(NSTimeInterval)validityInterval
+{
+    if (validityInterval < 0) THROW_INVALID_PARAM(validityInterval, nil);
+
+    self = [super init];
+    if (self)
+    {
+        // empty dictionaries are not added to requests at all
+        _headers = (headers.count > 0) ? [headers copy] : nil;
+        _parameters = (parameters.count > 0) ? [parameters copy] : nil;
+        _method = [method uppercaseString];
+        _pathPattern = [pathPattern copy];
+        _validityInterval = validityInterval;
+    }
+    return self;
+}
+
+- (BOOL)appliesToRequestMethod:(NSString *)method path:(NSString *)path
+{
+    if (_method != nil && ![_method isEqualToString:method]) return NO;
+    return _pathPattern == nil || fnmatch(_pathPattern.UTF8String, path.UTF8String, 0) == 0;
+}
+
+@end
@@ -0,0 +1,54 @@
+//
+//  SEDataRequestRateLimiter.h
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+@import Foundation;
+
+/**
+ Client-side rate limiter with a token bucket per route group. A route group is the host of a request, unless `routeGroupProvider` says otherwise.
+ Instead of rejecting requests, the limiter tells how long a request should be delayed to stay within the rate.
+ A route group can also be paused, for example when the server responds with HTTP 429 and `Retry-After`.
+ The limiter is thread-safe.
+ */
+@interface SEDataRequestRateLimiter : NSObject
+
+/** Default sustained rate of each route group. 0, the default, means no limit, but pauses are still honored. */
+@property (atomic, assign) double requestsPerSecond;
+/** Default number of requests a route group may send at once before the rate applies. Defaults to 5. */
+@property (atomic, assign) NSUInteger burstSize;
+/** Pause applied on HTTP 429 without `Retry-After`. Defaults to 1 second. */
+@property (atomic, assign) NSTimeInterval defaultPauseInterval;
+/** Upper bound of pauses requested by servers. Defaults to 5 minutes. */
+@property (atomic, assign) NSTimeInterval maximumPauseInterval;
+/** Maps a URL to a route group. When not set, or when it returns `nil`, the lowercased host is used. */
+@property (atomic, copy, nullable) NSString * _Nullable (^routeGroupProvider)(NSURL * _Nonnull url);
+
+/** Overrides the rate of a route group. Rate 0 removes the limit for the group. */
+- (void) setRequestsPerSecond: (double) requestsPerSecond burstSize: (NSUInteger) burstSize forRouteGroup: (nonnull NSString *) routeGroup;
+
+- (nonnull NSString *) routeGroupForURL: (nonnull NSURL *) url;
+
+/** Reserves a slot for a request and returns how long the request should wait before it is sent, 0 if it can be sent right away */
+- (NSTimeInterval) reserveRequestForRouteGroup: (nonnull NSString *) routeGroup;
+
+/** Pauses a route group, requests reserved after this call are delayed until the pause ends and then spread at the group rate */
+- (void) pauseRouteGroup: (nonnull NSString *) routeGroup forInterval: (NSTimeInterval) interval;
+/** Time left until the pause of the route group ends, 0 if not paused */
+- (NSTimeInterval) remainingPauseForRouteGroup: (nonnull NSString *) routeGroup;
+
+/**
+ Pauses the route group if the response is HTTP 429, or HTTP 503 with `Retry-After`.
+ @return pause interval applied, 0 if the response did not ask to slow down
+ */
+- (NSTimeInterval) handleResponse: (nonnull NSHTTPURLResponse *) response forRouteGroup: (nonnull NSString *) routeGroup;
+
+/** Interval requested by `Retry-After` header, either in seconds or as an HTTP date. Negative if the header is missing or invalid. */
++ (NSTimeInterval) retryAfterIntervalFromResponse: (nonnull NSHTTPURLResponse *) response;
+
+@end
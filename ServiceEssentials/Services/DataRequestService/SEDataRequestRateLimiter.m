@@ -0,0 +1,204 @@
+//
+//  SEDataRequestRateLimiter.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <ServiceEssentials/SEDataRequestRateLimiter.h>
+
+#include <pthread.h>
+
+#import <ServiceEssentials/SETools.h>
+
+// Bucket is kept as a theoretical arrival time (generic cell rate algorithm), which is equivalent to a token bucket
+// but does not need a timer to refill tokens. Only accessed in the lock of the limiter.
+@interface SEDataRequestRateBucket : NSObject
+{
+@public
+    NSTimeInterval _theoreticalArrivalTime;
+    NSTimeInterval _pausedUntil;
+    BOOL _hasCustomRate;
+    double _requestsPerSecond;
+    NSUInteger _burstSize;
+}
+@end
+
+@implementation SEDataRequestRateBucket
+@end
+
+@implementation SEDataRequestRateLimiter
+{
+    pthread_mutex_t _lock;
+    NSMutableDictionary<NSString *, SEDataRequestRateBucket *> *_buckets;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self)
+    {
+        _burstSize = 5;
+        _defaultPauseInterval = 1.0;
+        _maximumPauseInterval = 300.0;
+        _buckets = [NSMutableDictionary new];
+        pthread_mutex_init(&_lock, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&_lock);
+}
+
+// Must be called in the lock
+- (SEDataRequestRateBucket *)bucketForRouteGroup:(NSString *)routeGroup
+{
+    SEDataRequestRateBucket *bucket = [_buckets objectForKey:routeGroup];
+    if (bucket == nil)
+    {
+        bucket = [SEDataRequestRateBucket new];
+        [_buckets setObject:bucket forKey:routeGroup];
+    }
+    return bucket;
+}
+
+- (void)setRequestsPerSecond:(double)requestsPerSecond burstSize:(NSUInteger)burstSize forRouteGroup:(NSString *)routeGroup
+{
+    if (routeGroup == nil) THROW_INVALID_PARAM(routeGroup, nil);
+    
+    pthread_mutex_lock(&_lock);
+    SEDataRequestRateBucket *bucket = [self bucketForRouteGroup:routeGroup];
+    bucket->_hasCustomRate = YES;
+    bucket->_requestsPerSecond = requestsPerSecond;
+    bucket->_burstSize = burstSize;
+    pthread_mutex_unlock(&_lock);
+}
+
+- (NSString *)routeGroupForURL:(NSURL *)url
+{
+    NSString * (^routeGroupProvider)(NSURL *) = self.routeGroupProvider;
+    NSString *routeGroup = (routeGroupProvider != nil) ? routeGroupProvider(url) : nil;
+    return routeGroup ?: (url.host.lowercaseString ?: @"");
+}
+
+- (NSTimeInterval)reserveRequestForRouteGroup:(NSString *)routeGroup
+{
+    double defaultRequestsPerSecond = self.requestsPerSecond;
+    NSUInteger defaultBurstSize = self.burstSize;
+    NSTimeInterval now = [NSProcessInfo processInfo].systemUptime;
+    
+    pthread_mutex_lock(&_lock);
+    SEDataRequestRateBucket *bucket = [_buckets objectForKey:routeGroup];
+    // groups without a custom rate are not tracked until they need to be
+    if (bucket == nil && defaultRequestsPerSecond > 0) bucket = [self bucketForRouteGroup:routeGroup];
+    
+    NSTimeInterval sendTime = now;
+    if (bucket != nil)
+    {
+        double requestsPerSecond = bucket->_hasCustomRate ? bucket->_requestsPerSecond : defaultRequestsPerSecond;
+        NSUInteger burstSize = MAX(bucket->_hasCustomRate ? bucket->_burstSize : defaultBurstSize, (NSUInteger)1);
+        sendTime = MAX(now, bucket->_pausedUntil);
+        if (requestsPerSecond > 0)
+        {
+            NSTimeInterval emissionInterval = 1.0 / requestsPerSecond;
+            NSTimeInterval burstTolerance = (burstSize - 1) * emissionInterval;
+            sendTime = MAX(sendTime, bucket->_theoreticalArrivalTime - burstTolerance);
+            bucket->_theoreticalArrivalTime = MAX(bucket->_theoreticalArrivalTime, sendTime) + emissionInterval;
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+    
+    return sendTime - now;
+}
+
+- (void)pauseRouteGroup:(NSString *)routeGroup forInterval:(NSTimeInterval)interval
+{
+    if (routeGroup == nil) THROW_INVALID_PARAM(routeGroup, nil);
+    if (interval <= 0) return;
+    
+    double defaultRequestsPerSecond = self.requestsPerSecond;
+    NSUInteger defaultBurstSize = self.burstSize;
+    NSTimeInterval now = [NSProcessInfo processInfo].systemUptime;
+    
+    pthread_mutex_lock(&_lock);
+    SEDataRequestRateBucket *bucket = [self bucketForRouteGroup:routeGroup];
+    bucket->_pausedUntil = MAX(bucket->_pausedUntil, now + interval);
+    
+    // no burst right after the pause, requests are spread at the group rate
+    double requestsPerSecond = bucket->_hasCustomRate ? bucket->_requestsPerSecond : defaultRequestsPerSecond;
+    NSUInteger burstSize = MAX(bucket->_hasCustomRate ? bucket->_burstSize : defaultBurstSize, (NSUInteger)1);
+    NSTimeInterval burstTolerance = (requestsPerSecond > 0) ? (burstSize - 1) / requestsPerSecond : 0;
+    bucket->_theoreticalArrivalTime = MAX(bucket->_theoreticalArrivalTime, bucket->_pausedUntil + burstTolerance);
+    pthread_mutex_unlock(&_lock);
+}
+
+- (NSTimeInterval)remainingPauseForRouteGroup:(NSString *)routeGroup
+{
+    NSTimeInterval now = [NSProcessInfo processInfo].systemUptime;
+    pthread_mutex_lock(&_lock);
+    SEDataRequestRateBucket *bucket = [_buckets objectForKey:routeGroup];
+    NSTimeInterval pausedUntil = (bucket != nil) ? bucket->_pausedUntil : 0;
+    pthread_mutex_unlock(&_lock);
+    return MAX(pausedUntil - now, 0);
+}
+
+- (NSTimeInterval)handleResponse:(NSHTTPURLResponse *)response forRouteGroup:(NSString *)routeGroup
+{
+    NSInteger statusCode = response.statusCode;
+    if (statusCode != 429 && statusCode != 503) return 0;
+    
+    NSTimeInterval interval = [SEDataRequestRateLimiter retryAfterIntervalFromResponse:response];
+    if (interval < 0)
+    {
+        // unavailable service without a hint is the business of circuit breakers, not the rate limiter
+        if (statusCode != 429) return 0;
+        interval = self.defaultPauseInterval;
+    }
+    
+    interval = MIN(interval, self.maximumPauseInterval);
+    [self pauseRouteGroup:routeGroup forInterval:interval];
+    return interval;
+}
+
++ (NSTimeInterval)retryAfterIntervalFromResponse:(NSHTTPURLResponse *)response
+{
+    NSString *retryAfter = [[response.allHeaderFields objectForKey:@"Retry-After"] description];
+    if (retryAfter == nil)
+    {
+        // header names are case-insensitive, but `allHeaderFields` is a plain dictionary on older systems
+        for (NSString *header in response.allHeaderFields)
+        {
+            if ([header caseInsensitiveCompare:@"Retry-After"] == NSOrderedSame) retryAfter = [[response.allHeaderFields objectForKey:header] description];
+        }
+    }
+    retryAfter = [retryAfter stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+    if (retryAfter.length == 0) return -1;
+    
+    NSScanner *scanner = [NSScanner scannerWithString:retryAfter];
+    NSInteger seconds = 0;
+    if ([scanner scanInteger:&seconds] && scanner.isAtEnd) return (seconds >= 0) ? seconds : -1;
+    
+    static NSDateFormatter *dateFormatter;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        dateFormatter = [NSDateFormatter new];
+        dateFormatter.locale = [NSLocale localeWithLocaleIdentifier:@"en_US_POSIX"];
+        dateFormatter.timeZone = [NSTimeZone timeZoneWithAbbreviation:@"GMT"];
+        dateFormatter.dateFormat = @"EEE',' dd MMM yyyy HH':'mm':'ss z";
+    });
+    
+    NSDate *date = nil;
+    @synchronized (dateFormatter)
+    {
+        date = [dateFormatter dateFromString:retryAfter];
+    }
+    if (date == nil) return -1;
+    return MAX([date timeIntervalSinceNow], 0);
+}
+
+@end
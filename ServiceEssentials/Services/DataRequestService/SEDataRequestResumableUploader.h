@@ -0,0 +1,79 @@
+//
+//  SEDataRequestResumableUploader.h
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+@import Foundation;
+
+#import <ServiceEssentials/SEDataRequestService.h>
+
+/** Server response does not follow the upload protocol, for example a creation response without `Location` */
+extern NSInteger const SEDataRequestResumableUploadInvalidResponse;
+/**
+ Response to the final concatenation request has been lost, so it is not known whether the final upload has been created.
+ The error of the request is the underlying error. The progress is discarded if the server has released the parts.
+ */
+extern NSInteger const SEDataRequestResumableUploadConcatenationUnconfirmed;
+
+/**
+ Client of the tus resumable upload protocol (https://tus.io), with the creation, checksum and concatenation extensions.
+
+ A file is split into chunks, and each chunk is a partial upload: it is created with `POST`, sent with `PATCH`
+ and verified with a SHA-256 checksum. Up to `maxConcurrentChunks` chunks of an upload are sent at once.
+ When all chunks are sent, the final upload concatenates them. A file that fits in a single chunk is uploaded as is.
+ Creating the final upload is not idempotent, so it is only retried when the request has certainly not reached the server.
+ When its response is lost, the first part is queried with `HEAD` instead, and the upload fails with
+ `SEDataRequestResumableUploadConcatenationUnconfirmed` rather than risk a duplicate upload.
+
+ Progress is stored in the state directory after every chunk, so an upload that has been interrupted, cancelled
+ or has not finished before the application was terminated is resumed by starting it again with the same identifier.
+ Chunks that were being sent are resumed from the offset reported by the server with `HEAD`.
+ If the file has changed since, the upload starts over.
+
+ Requests are sent with the data request service, so the upload endpoint and the upload URLs must be on the host of the service.
+ The uploader is thread-safe.
+ */
+@interface SEDataRequestResumableUploader : NSObject
+
+- (nonnull instancetype) initWithDataRequestService: (nonnull id<SEDataRequestService>) dataRequestService stateDirectoryURL: (nonnull NSURL *) stateDirectoryURL;
+
+@property (nonatomic, readonly, strong, nonnull) NSURL *stateDirectoryURL;
+
+/** Size of a chunk in bytes, only affects uploads that are started from scratch. Defaults to 4 MB. */
+@property (atomic, assign) NSUInteger chunkSize;
+/** Maximum number of chunks of an upload sent concurrently. Defaults to 3. */
+@property (atomic, assign) NSUInteger maxConcurrentChunks;
+/** Number of attempts to send a chunk, or the final request when it has not reached the server, before the upload fails, the progress is kept. Defaults to 3. */
+@property (atomic, assign) NSUInteger maxChunkAttempts;
+
+/** Identifiers of uploads that have not finished, including those left by a previous run */
+- (nonnull NSArray<NSString *> *) pendingUploadIdentifiers;
+
+/**
+ Starts or resumes an upload of a file.
+ @param fileURL URL of the file
+ @param path path of the upload creation endpoint
+ @param identifier identifies the upload across runs, there can only be one upload in progress with an identifier
+ @param success callback invoked with the URL of the uploaded file
+ @param failure callback invoked on failure, progress is kept so that the upload can be resumed
+ @param progress optional callback invoked with the number of bytes confirmed by the server and the size of the file
+ @param completionQueue queue used to invoke callbacks
+ @return token that stops the upload without invoking callbacks, progress is kept
+ */
+- (nonnull id<SECancellableToken>) uploadFileAtURL: (nonnull NSURL *) fileURL
+                                            toPath: (nonnull NSString *) path
+                                        identifier: (nonnull NSString *) identifier
+                                           success: (nonnull void (^)(NSURL * _Nonnull uploadURL)) success
+                                           failure: (nullable void (^)(NSError * _Nonnull error)) failure
+                                          progress: (nullable void (^)(int64_t bytesUploaded, int64_t totalBytes)) progress
+                                   completionQueue: (nullable dispatch_queue_t) completionQueue;
+
+/** Forgets the progress of an upload that is not in progress */
+- (void) discardUploadWithIdentifier: (nonnull NSString *) identifier;
+
+@end
@@ -0,0 +1,683 @@
+//
+//  SEDataRequestResumableUploader.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <ServiceEssentials/SEDataRequestResumableUploader.h>
+
+#include <pthread.h>
+#include <CommonCrypto/CommonDigest.h>
+
+#import <ServiceEssentials/SETools.h>
+#import "SEDataRequestServicePrivate.h"
+
+static NSInteger const SEDataRequestResumableUploadErrorStart = 1200;
+NSInteger const SEDataRequestResumableUploadInvalidResponse = SEDataRequestResumableUploadErrorStart;
+NSInteger const SEDataRequestResumableUploadConcatenationUnconfirmed = SEDataRequestResumableUploadErrorStart + 1;
+
+static NSString * const SEResumableUploadProtocolVersion = @"1.0.0";
+static NSString * const SEResumableUploadContentType = @"application/offset+octet-stream";
+
+// Keys of the upload state property list
+static NSString * const SEResumableUploadKeyIdentifier = @"i";
+static NSString * const SEResumableUploadKeyFile = @"f";
+static NSString * const SEResumableUploadKeyFileSize = @"s";
+static NSString * const SEResumableUploadKeyFileModified = @"d";
+static NSString * const SEResumableUploadKeyPath = @"e";
+static NSString * const SEResumableUploadKeyChunkSize = @"c";
+static NSString * const SEResumableUploadKeyParts = @"p";
+static NSString * const SEResumableUploadKeyCompleted = @"x";
+
+static inline NSError *SEResumableUploadInvalidResponseError(NSString *description)
+{
+    return [NSError errorWithDomain:SEErrorDomain code:SEDataRequestResumableUploadInvalidResponse userInfo:@{ NSLocalizedDescriptionKey: description }];
+}
+
+// Failures of requests the server has answered carry the HTTP status code
+static inline BOOL SEResumableUploadIsHTTPError(NSError *error)
+{
+    return [error.domain isEqualToString:NSURLErrorDomain] && error.code >= 400;
+}
+
+// Header lookup that does not depend on the case used by the server
+static inline NSString *SEResumableUploadHeader(NSURLResponse *response, NSString *name)
+{
+    if (![response isKindOfClass:[NSHTTPURLResponse class]]) return nil;
+    NSDictionary *headers = ((NSHTTPURLResponse *)response).allHeaderFields;
+    for (NSString *header in headers)
+    {
+        if ([header caseInsensitiveCompare:name] == NSOrderedSame) return [headers objectForKey:header];
+    }
+    return nil;
+}
+
+static inline NSURL *SEResumableUploadURLFromResponse(NSURLResponse *response)
+{
+    NSString *location = SEResumableUploadHeader(response, @"Location");
+    if (location.length == 0) return nil;
+
+    NSURL *url = [NSURL URLWithString:location relativeToURL:response.URL].absoluteURL;
+    // requests are sent with the data request service, which only talks to its own host
+    if (![url.scheme isEqualToString:response.URL.scheme] || ![url.host isEqualToString:response.URL.host]) return nil;
+    return url;
+}
+
+static inline NSString *SEResumableUploadChecksum(NSData *data)
+{
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256(data.bytes, (CC_LONG)data.length, digest);
+    NSData *digestData = [NSData dataWithBytes:digest length:CC_SHA256_DIGEST_LENGTH];
+    return [NSString stringWithFormat:@"sha256 %@", [digestData base64EncodedStringWithOptions:0]];
+}
+
+// Identifiers are arbitrary strings, so file names are made of their digest
+static inline NSString *SEResumableUploadStateFileName(NSString *identifier)
+{
+    NSData *data = [identifier dataUsingEncoding:NSUTF8StringEncoding];
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256(data.bytes, (CC_LONG)data.length, digest);
+
+    NSMutableString *name = [[NSMutableString alloc] initWithCapacity:CC_SHA256_DIGEST_LENGTH * 2 + 6];
+    for (int i = 0; i < CC_SHA256_DIGEST_LENGTH; ++i) [name appendFormat:@"%02x", digest[i]];
+    [name appendString:@".plist"];
+    return name;
+}
+
+@interface SEDataRequestResumableUploader ()
+- (void) uploadDidStop: (id<SECancellableToken>) upload identifier: (NSString *) identifier;
+@end
+
+// An upload in progress. State is only accessed on the serial queue of the upload.
+@interface SEResumableUpload : NSObject<SECancellableToken>
+@end
+
+@implementation SEResumableUpload
+{
+    __weak SEDataRequestResumableUploader *_uploader;
+    id<SEDataRequestService> _dataRequestService;
+    dispatch_queue_t _queue;
+
+    NSString *_identifier;
+    NSURL *_fileURL;
+    NSString *_path;
+    NSURL *_stateURL;
+    NSUInteger _maxConcurrentChunks;
+    NSUInteger _maxChunkAttempts;
+
+    void (^_success)(NSURL *);
+    void (^_failure)(NSError *);
+    void (^_progress)(int64_t, int64_t);
+    dispatch_queue_t _completionQueue;
+
+    // persistent state
+    int64_t _fileSize;
+    NSDate *_fileModified;
+    int64_t _chunkSize;
+    NSMutableArray<NSString *> *_partURLs; // empty string until the part is created
+    NSMutableArray<NSNumber *> *_completedChunks;
+
+    NSUInteger _chunkCount;
+    NSFileHandle *_fileHandle;
+    NSMutableIndexSet *_pendingChunks;
+    // chunk -> token of the request in flight, `NSNull` if the request could not be submitted and its failure is on the way
+    NSMutableDictionary<NSNumber *, id> *_tokensByChunk;
+    NSMutableDictionary<NSNumber *, NSNumber *> *_attemptsByChunk;
+    id<SECancellableToken> _concatenationToken;
+    NSUInteger _concatenationAttempts;
+    BOOL _isConcatenating;
+    BOOL _isStopped;
+}
+
+- (instancetype)initWithService:(id<SECancellableItemService>)service
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithUploader:(SEDataRequestResumableUploader *)uploader dataRequestService:(id<SEDataRequestService>)dataRequestService fileURL:(NSURL *)fileURL path:(NSString *)path identifier:(NSString *)identifier success:(void (^)(NSURL *))success failure:(void (^)(NSError *))failure progress:(void (^)(int64_t, int64_t))progress completionQueue:(dispatch_queue_t)completionQueue
+{
+    self = [super init];
+    if (self)
+    {
+        _uploader = uploader;
+        _dataRequestService = dataRequestService;
+        _queue = dispatch_queue_create("com.service-essentials.ResumableUpload", DISPATCH_QUEUE_SERIAL);
+        _identifier = [identifier copy];
+        _fileURL = fileURL;
+        _path = [path copy];
+        _stateURL = [uploader.stateDirectoryURL URLByAppendingPathComponent:SEResumableUploadStateFileName(identifier)];
+        _chunkSize = MAX(uploader.chunkSize, 1);
+        _maxConcurrentChunks = MAX(uploader.maxConcurrentChunks, 1);
+        _maxChunkAttempts = MAX(uploader.maxChunkAttempts, 1);
+        _success = success;
+        _failure = failure;
+        _progress = progress;
+        _completionQueue = completionQueue;
+        _tokensByChunk = [NSMutableDictionary new];
+        _attemptsByChunk = [NSMutableDictionary new];
+    }
+    return self;
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+    return self;
+}
+
+- (void)cancel
+{
+    dispatch_async(_queue, ^{
+        [self stop];
+    });
+}
+
+- (void)start
+{
+    dispatch_async(_queue, ^{
+        NSError *error = nil;
+        if (![self prepareOrError:&error])
+        {
+            [self finishWithURL:nil error:error];
+            return;
+        }
+
+        [self reportProgress];
+        [self sendChunks];
+    });
+}
+
+#pragma mark - State
+
+- (BOOL)prepareOrError:(NSError * __autoreleasing *)error
+{
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:_fileURL.path error:error];
+    if (attributes == nil) return NO;
+    _fileHandle = [NSFileHandle fileHandleForReadingFromURL:_fileURL error:error];
+    if (_fileHandle == nil) return NO;
+
+    _fileSize = (int64_t)[attributes fileSize];
+    _fileModified = [attributes fileModificationDate];
+
+    if (![self loadState])
+    {
+        // new upload, or the file has changed and the parts that have been sent are useless
+        _chunkCount = (_fileSize > 0) ? (NSUInteger)((_fileSize + _chunkSize - 1) / _chunkSize) : 1;
+        _partURLs = [[NSMutableArray alloc] initWithCapacity:_chunkCount];
+        _completedChunks = [[NSMutableArray alloc] initWithCapacity:_chunkCount];
+        for (NSUInteger i = 0; i < _chunkCount; ++i)
+        {
+            [_partURLs addObject:@""];
+            [_completedChunks addObject:@NO];
+        }
+        [self saveState];
+    }
+
+    _pendingChunks = [NSMutableIndexSet new];
+    for (NSUInteger i = 0; i < _chunkCount; ++i)
+    {
+        if (![_completedChunks[i] boolValue]) [_pendingChunks addIndex:i];
+    }
+    return YES;
+}
+
+// Returns `NO` when there is no usable state for the file
+- (BOOL)loadState
+{
+    NSData *data = [NSData dataWithContentsOfURL:_stateURL];
+    if (data == nil) return NO;
+    NSDictionary *state = [NSPropertyListSerialization propertyListWithData:data options:NSPropertyListImmutable format:NULL error:nil];
+    if (![state isKindOfClass:[NSDictionary class]]) return NO;
+
+    if (![[state objectForKey:SEResumableUploadKeyFile] isEqualToString:_fileURL.path]) return NO;
+    if (![[state objectForKey:SEResumableUploadKeyPath] isEqualToString:_path]) return NO;
+    if ([[state objectForKey:SEResumableUploadKeyFileSize] longLongValue] != _fileSize) return NO;
+    if ([[state objectForKey:SEResumableUploadKeyFileModified] doubleValue] != _fileModified.timeIntervalSinceReferenceDate) return NO;
+
+    int64_t chunkSize = [[state objectForKey:SEResumableUploadKeyChunkSize] longLongValue];
+    NSArray<NSString *> *parts = [state objectForKey:SEResumableUploadKeyParts];
+    NSArray<NSNumber *> *completed = [state objectForKey:SEResumableUploadKeyCompleted];
+    if (chunkSize <= 0 || parts.count == 0 || parts.count != completed.count) return NO;
+
+    _chunkSize = chunkSize;
+    _chunkCount = parts.count;
+    _partURLs = [parts mutableCopy];
+    _completedChunks = [completed mutableCopy];
+    return YES;
+}
+
+- (void)saveState
+{
+    NSDictionary *state = @{ SEResumableUploadKeyIdentifier: _identifier,
+                             SEResumableUploadKeyFile: _fileURL.path,
+                             SEResumableUploadKeyFileSize: @(_fileSize),
+                             SEResumableUploadKeyFileModified: @(_fileModified.timeIntervalSinceReferenceDate),
+                             SEResumableUploadKeyPath: _path,
+                             SEResumableUploadKeyChunkSize: @(_chunkSize),
+                             SEResumableUploadKeyParts: _partURLs,
+                             SEResumableUploadKeyCompleted: _completedChunks };
+
+    NSError *error = nil;
+    NSData *data = [NSPropertyListSerialization dataWithPropertyList:state format:NSPropertyListBinaryFormat_v1_0 options:0 error:&error];
+    // the upload goes on, it just would not be resumed from this point
+    if (data == nil || ![data writeToURL:_stateURL options:NSDataWritingAtomic error:&error]) SELog(@"Failed to save upload state: %@", error);
+}
+
+#pragma mark - Chunks
+
+- (int64_t)lengthOfChunk:(NSUInteger)chunk
+{
+    return MIN(_chunkSize, _fileSize - (int64_t)chunk * _chunkSize);
+}
+
+- (void)applyProtocolToCustomizer:(id<SEDataRequestCustomizer>)customizer
+{
+    [customizer setHTTPHeader:SEResumableUploadProtocolVersion forKey:@"Tus-Resumable"];
+    [customizer setAcceptRawData];
+}
+
+- (void)submit:(id<SEDataRequestCustomizer>)customizer forChunk:(NSUInteger)chunk
+{
+    id<SECancellableToken> token = [customizer submit];
+    [_tokensByChunk setObject:(token ?: [NSNull null]) forKey:@(chunk)];
+}
+
+- (void)sendChunks
+{
+    if (_isStopped) return;
+
+    while (_tokensByChunk.count < _maxConcurrentChunks && _pendingChunks.count > 0)
+    {
+        NSUInteger chunk = _pendingChunks.firstIndex;
+        [_pendingChunks removeIndex:chunk];
+        if (_partURLs[chunk].length == 0) [self createChunk:chunk];
+        else [self resumeChunk:chunk];
+    }
+
+    if (_tokensByChunk.count == 0 && _pendingChunks.count == 0 && !_isConcatenating)
+    {
+        if (_chunkCount == 1) [self finishWithURL:[NSURL URLWithString:_partURLs[0]] error:nil];
+        else [self concatenateChunks];
+    }
+}
+
+- (void)createChunk:(NSUInteger)chunk
+{
+    id<SEDataRequestCustomizer> customizer = [[_dataRequestService createRequestBuilder] POST:_path success:^(id data, NSURLResponse *response) {
+        [self chunk:chunk didCreateWithResponse:response];
+    } failure:^(NSError *error) {
+        [self chunk:chunk didFailWithError:error];
+    } completionQueue:_queue];
+    [self applyProtocolToCustomizer:customizer];
+    [customizer setHTTPHeader:[NSString stringWithFormat:@"%lld", [self lengthOfChunk:chunk]] forKey:@"Upload-Length"];
+    // a file that fits in a chunk is uploaded as is
+    if (_chunkCount > 1) [customizer setHTTPHeader:@"partial" forKey:@"Upload-Concat"];
+    [self submit:customizer forChunk:chunk];
+}
+
+- (void)chunk:(NSUInteger)chunk didCreateWithResponse:(NSURLResponse *)response
+{
+    if (_isStopped) return;
+
+    NSURL *url = SEResumableUploadURLFromResponse(response);
+    if (url == nil)
+    {
+        [self finishWithURL:nil error:SEResumableUploadInvalidResponseError(@"Upload creation response has no valid location")];
+        return;
+    }
+
+    [_partURLs replaceObjectAtIndex:chunk withObject:url.absoluteString];
+    [self saveState];
+    [self sendChunk:chunk fromOffset:0];
+}
+
+// The server tells how much of the chunk it has, so that data is never sent twice
+- (void)resumeChunk:(NSUInteger)chunk
+{
+    id<SEDataRequestCustomizer> customizer = [[_dataRequestService createRequestBuilder] HEAD:_partURLs[chunk] success:^(id data, NSURLResponse *response) {
+        [self chunk:chunk didReceiveOffsetWithResponse:response];
+    } failure:^(NSError *error) {
+        [self chunk:chunk didFailToReceiveOffsetWithError:error];
+    } completionQueue:_queue];
+    [self applyProtocolToCustomizer:customizer];
+    [self submit:customizer forChunk:chunk];
+}
+
+- (void)chunk:(NSUInteger)chunk didReceiveOffsetWithResponse:(NSURLResponse *)response
+{
+    if (_isStopped) return;
+
+    NSString *offset = SEResumableUploadHeader(response, @"Upload-Offset");
+    if (offset == nil)
+    {
+        [self finishWithURL:nil error:SEResumableUploadInvalidResponseError(@"Upload offset response has no offset")];
+        return;
+    }
+    [self sendChunk:chunk fromOffset:offset.longLongValue];
+}
+
+- (void)chunk:(NSUInteger)chunk didFailToReceiveOffsetWithError:(NSError *)error
+{
+    if (_isStopped) return;
+
+    // the server has expired the part, it is created again
+    if ([error.domain isEqualToString:NSURLErrorDomain] && (error.code == 404 || error.code == 410))
+    {
+        [_partURLs replaceObjectAtIndex:chunk withObject:@""];
+        [self saveState];
+        [self createChunk:chunk];
+        return;
+    }
+    [self chunk:chunk didFailWithError:error];
+}
+
+- (void)sendChunk:(NSUInteger)chunk fromOffset:(int64_t)offset
+{
+    int64_t length = [self lengthOfChunk:chunk];
+    if (offset < 0 || offset > length)
+    {
+        [self finishWithURL:nil error:SEResumableUploadInvalidResponseError(@"Upload offset is out of bounds")];
+        return;
+    }
+    if (offset == length)
+    {
+        [self completeChunk:chunk];
+        return;
+    }
+
+    NSData *data = nil;
+    @try
+    {
+        [_fileHandle seekToFileOffset:(unsigned long long)((int64_t)chunk * _chunkSize + offset)];
+        data = [_fileHandle readDataOfLength:(NSUInteger)(length - offset)];
+    }
+    @catch (NSException *exception)
+    {
+        data = nil;
+    }
+    if (data.length != length - offset)
+    {
+        [self finishWithURL:nil error:[NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:@{ NSURLErrorKey: _fileURL }]];
+        return;
+    }
+
+    id<SEDataRequestCustomizer> customizer = [[_dataRequestService createRequestBuilder] PATCH:_partURLs[chunk] success:^(id responseData, NSURLResponse *response) {
+        [self chunk:chunk didSendWithResponse:response];
+    } failure:^(NSError *error) {
+        [self chunk:chunk didFailWithError:error];
+    } completionQueue:_queue];
+    [self applyProtocolToCustomizer:customizer];
+    [customizer setBodyData:data];
+    [customizer setContentEncoding:SEResumableUploadContentType];
+    [customizer setHTTPHeader:[NSString stringWithFormat:@"%lld", offset] forKey:@"Upload-Offset"];
+    // the server rejects a chunk that has been corrupted on the way
+    [customizer setHTTPHeader:SEResumableUploadChecksum(data) forKey:@"Upload-Checksum"];
+    [self submit:customizer forChunk:chunk];
+}
+
+- (void)chunk:(NSUInteger)chunk didSendWithResponse:(NSURLResponse *)response
+{
+    if (_isStopped) return;
+
+    if ([SEResumableUploadHeader(response, @"Upload-Offset") longLongValue] != [self lengthOfChunk:chunk])
+    {
+        // not all of the chunk has been taken, the offset is checked again
+        [self chunk:chunk didFailWithError:SEResumableUploadInvalidResponseError(@"Upload offset does not match the chunk")];
+        return;
+    }
+    [self completeChunk:chunk];
+}
+
+- (void)completeChunk:(NSUInteger)chunk
+{
+    [_tokensByChunk removeObjectForKey:@(chunk)];
+    [_completedChunks replaceObjectAtIndex:chunk withObject:@YES];
+    [self saveState];
+    [self reportProgress];
+    [self sendChunks];
+}
+
+- (void)chunk:(NSUInteger)chunk didFailWithError:(NSError *)error
+{
+    if (_isStopped) return;
+
+    [_tokensByChunk removeObjectForKey:@(chunk)];
+    NSUInteger attempts = [[_attemptsByChunk objectForKey:@(chunk)] unsignedIntegerValue] + 1;
+    if (attempts >= _maxChunkAttempts)
+    {
+        [self finishWithURL:nil error:error];
+        return;
+    }
+
+    [_attemptsByChunk setObject:@(attempts) forKey:@(chunk)];
+    [_pendingChunks addIndex:chunk];
+    [self sendChunks];
+}
+
+- (void)concatenateChunks
+{
+    _isConcatenating = YES;
+
+    id<SEDataRequestCustomizer> customizer = [[_dataRequestService createRequestBuilder] POST:_path success:^(id data, NSURLResponse *response) {
+        [self didConcatenateWithResponse:response];
+    } failure:^(NSError *error) {
+        [self didFailToConcatenateWithError:error];
+    } completionQueue:_queue];
+    [self applyProtocolToCustomizer:customizer];
+    [customizer setHTTPHeader:[@"final;" stringByAppendingString:[_partURLs componentsJoinedByString:@" "]] forKey:@"Upload-Concat"];
+    _concatenationToken = [customizer submit];
+}
+
+- (void)didConcatenateWithResponse:(NSURLResponse *)response
+{
+    if (_isStopped) return;
+
+    _concatenationToken = nil;
+    NSURL *url = SEResumableUploadURLFromResponse(response);
+    if (url == nil)
+    {
+        [self finishWithURL:nil error:SEResumableUploadInvalidResponseError(@"Upload concatenation response has no valid location")];
+        return;
+    }
+    [self finishWithURL:url error:nil];
+}
+
+- (void)didFailToConcatenateWithError:(NSError *)error
+{
+    if (_isStopped) return;
+
+    _concatenationToken = nil;
+    BOOL notSent = SEDataRequestIsConnectivityError(error);
+    if (notSent && ++_concatenationAttempts < _maxChunkAttempts)
+    {
+        [self concatenateChunks];
+        return;
+    }
+    // the server has refused the request, or has never got it
+    if (notSent || SEResumableUploadIsHTTPError(error))
+    {
+        [self finishWithURL:nil error:error];
+        return;
+    }
+    // the final upload may have been created, sending the request again could create another one
+    [self verifyConcatenationAfterError:error];
+}
+
+- (void)verifyConcatenationAfterError:(NSError *)error
+{
+    id<SEDataRequestCustomizer> customizer = [[_dataRequestService createRequestBuilder] HEAD:_partURLs[0] success:^(id data, NSURLResponse *response) {
+        // servers may keep the parts after concatenation, so the outcome is still unknown; starting the upload again sends the final request
+        [self finishWithUnconfirmedConcatenationError:error partsReleased:NO];
+    } failure:^(NSError *queryError) {
+        // the server has released the parts, which it only does once they are concatenated
+        BOOL partsReleased = [queryError.domain isEqualToString:NSURLErrorDomain] && (queryError.code == 404 || queryError.code == 410);
+        if (partsReleased) [self finishWithUnconfirmedConcatenationError:error partsReleased:YES];
+        else [self finishWithURL:nil error:error];
+    } completionQueue:_queue];
+    [self applyProtocolToCustomizer:customizer];
+    _concatenationToken = [customizer submit];
+}
+
+- (void)finishWithUnconfirmedConcatenationError:(NSError *)error partsReleased:(BOOL)partsReleased
+{
+    if (_isStopped) return;
+
+    _concatenationToken = nil;
+    // the parts cannot be concatenated again
+    if (partsReleased) [[NSFileManager defaultManager] removeItemAtURL:_stateURL error:nil];
+    [self finishWithURL:nil error:[NSError errorWithDomain:SEErrorDomain code:SEDataRequestResumableUploadConcatenationUnconfirmed userInfo:@{ NSLocalizedDescriptionKey: @"Upload concatenation has not been confirmed", NSUnderlyingErrorKey: error }]];
+}
+
+#pragma mark - Completion
+
+- (void)reportProgress
+{
+    void (^progress)(int64_t, int64_t) = _progress;
+    if (progress == nil) return;
+
+    int64_t uploaded = 0;
+    for (NSUInteger i = 0; i < _chunkCount; ++i)
+    {
+        if ([_completedChunks[i] boolValue]) uploaded += [self lengthOfChunk:i];
+    }
+    int64_t total = _fileSize;
+    SEDataRequestDispatchCompletion(_completionQueue, ^{ progress(uploaded, total); });
+}
+
+- (void)stop
+{
+    if (_isStopped) return;
+    _isStopped = YES;
+
+    for (id token in _tokensByChunk.allValues)
+    {
+        if (token != [NSNull null]) [(id<SECancellableToken>)token cancel];
+    }
+    [_tokensByChunk removeAllObjects];
+    [_concatenationToken cancel];
+    _concatenationToken = nil;
+    [_fileHandle closeFile];
+    _fileHandle = nil;
+
+    [_uploader uploadDidStop:self identifier:_identifier];
+}
+
+- (void)finishWithURL:(NSURL *)url error:(NSError *)error
+{
+    if (_isStopped) return;
+
+    // the state is removed before the upload is released, so that it can be started again right away
+    if (url != nil) [[NSFileManager defaultManager] removeItemAtURL:_stateURL error:nil];
+    [self stop];
+
+    if (url != nil)
+    {
+        void (^success)(NSURL *) = _success;
+        SEDataRequestDispatchCompletion(_completionQueue, ^{ success(url); });
+    }
+    else if (_failure != nil)
+    {
+        void (^failure)(NSError *) = _failure;
+        SEDataRequestDispatchCompletion(_completionQueue, ^{ failure(error); });
+    }
+}
+
+@end
+
+@implementation SEDataRequestResumableUploader
+{
+    id<SEDataRequestService> _dataRequestService;
+    pthread_mutex_t _lock;
+    NSMutableDictionary<NSString *, SEResumableUpload *> *_uploadsByIdentifier;
+}
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithDataRequestService:(id<SEDataRequestService>)dataRequestService stateDirectoryURL:(NSURL *)stateDirectoryURL
+{
+    if (dataRequestService == nil) THROW_INVALID_PARAM(dataRequestService, nil);
+    if (stateDirectoryURL == nil || !stateDirectoryURL.isFileURL) THROW_INVALID_PARAM(stateDirectoryURL, nil);
+
+    self = [super init];
+    if (self)
+    {
+        _dataRequestService = dataRequestService;
+        _stateDirectoryURL = stateDirectoryURL;
+        _chunkSize = 4 * 1024 * 1024;
+        _maxConcurrentChunks = 3;
+        _maxChunkAttempts = 3;
+        _uploadsByIdentifier = [NSMutableDictionary new];
+        pthread_mutex_init(&_lock, NULL);
+
+        [[NSFileManager defaultManager] createDirectoryAtURL:stateDirectoryURL withIntermediateDirectories:YES attributes:nil error:nil];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&_lock);
+}
+
+- (NSArray<NSString *> *)pendingUploadIdentifiers
+{
+    NSArray<NSURL *> *files = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:_stateDirectoryURL includingPropertiesForKeys:nil options:NSDirectoryEnumerationSkipsHiddenFiles error:nil];
+    NSMutableArray<NSString *> *identifiers = [[NSMutableArray alloc] initWithCapacity:files.count];
+    for (NSURL *file in files)
+    {
+        if (![file.pathExtension isEqualToString:@"plist"]) continue;
+        NSData *data = [NSData dataWithContentsOfURL:file];
+        NSDictionary *state = (data != nil) ? [NSPropertyListSerialization propertyListWithData:data options:NSPropertyListImmutable format:NULL error:nil] : nil;
+        NSString *identifier = [state isKindOfClass:[NSDictionary class]] ? [state objectForKey:SEResumableUploadKeyIdentifier] : nil;
+        if (identifier != nil) [identifiers addObject:identifier];
+    }
+    return identifiers;
+}
+
+- (id<SECancellableToken>)uploadFileAtURL:(NSURL *)fileURL toPath:(NSString *)path identifier:(NSString *)identifier success:(void (^)(NSURL * _Nonnull))success failure:(void (^)(NSError * _Nonnull))failure progress:(void (^)(int64_t, int64_t))progress completionQueue:(dispatch_queue_t)completionQueue
+{
+    if (fileURL == nil || !fileURL.isFileURL) THROW_INVALID_PARAM(fileURL, nil);
+    if (path == nil) THROW_INVALID_PARAM(path, nil);
+    if (identifier == nil) THROW_INVALID_PARAM(identifier, nil);
+    if (success == nil) THROW_INVALID_PARAM(success, nil);
+
+    SEResumableUpload *upload = [[SEResumableUpload alloc] initWithUploader:self dataRequestService:_dataRequestService fileURL:fileURL path:path identifier:identifier success:success failure:failure progress:progress completionQueue:completionQueue];
+
+    BOOL inProgress = NO;
+    pthread_mutex_lock(&_lock);
+    inProgress = ([_uploadsByIdentifier objectForKey:identifier] != nil);
+    if (!inProgress) [_uploadsByIdentifier setObject:upload forKey:identifier];
+    pthread_mutex_unlock(&_lock);
+
+    if (inProgress) THROW_INVALID_PARAM(identifier, @{ NSLocalizedDescriptionKey: @"An upload with the identifier is in progress." });
+
+    [upload start];
+    return upload;
+}
+
+- (void)discardUploadWithIdentifier:(NSString *)identifier
+{
+    if (identifier == nil) THROW_INVALID_PARAM(identifier, nil);
+
+    pthread_mutex_lock(&_lock);
+    if ([_uploadsByIdentifier objectForKey:identifier] == nil)
+    {
+        [[NSFileManager defaultManager] removeItemAtURL:[_stateDirectoryURL URLByAppendingPathComponent:SEResumableUploadStateFileName(identifier)] error:nil];
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+- (void)uploadDidStop:(id<SECancellableToken>)upload identifier:(NSString *)identifier
+{
+    pthread_mutex_lock(&_lock);
+    if ([_uploadsByIdentifier objectForKey:identifier] == upload) [_uploadsByIdentifier removeObjectForKey:identifier];
+    pthread_mutex_unlock(&_lock);
+}
+
+@end
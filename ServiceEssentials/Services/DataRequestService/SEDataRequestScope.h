@@ -0,0 +1,33 @@
+//
+//  SEDataRequestScope.h
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+@import Foundation;
+
+#import <ServiceEssentials/SEDataRequestService.h>
+
+/**
+ Set of requests that are cancelled together, for example the requests of a screen.
+ Requests join the scope by its tag, either with `setTag:` of the customizer or with `track:`.
+ The requests are cancelled with `cancelAll`, or when the scope is deallocated, in a single pass over the requests of the service.
+ */
+@interface SEDataRequestScope : NSObject
+
+- (nonnull instancetype) initWithDataRequestService: (nonnull id<SEDataRequestService>) dataRequestService;
+
+/** Unique tag of the scope */
+@property (nonatomic, readonly, strong, nonnull) NSString *tag;
+
+/** Adds a request in progress to the scope and returns its token */
+- (nullable id<SECancellableToken>) track: (nullable id<SECancellableToken>) token;
+
+/** Cancels all requests of the scope. The scope can be used for new requests afterwards. */
+- (void) cancelAll;
+
+@end
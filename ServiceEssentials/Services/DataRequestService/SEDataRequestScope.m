@@ -0,0 +1,54 @@
+//
+//  SEDataRequestScope.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <ServiceEssentials/SEDataRequestScope.h>
+
+#import <ServiceEssentials/SETools.h>
+
+@implementation SEDataRequestScope
+{
+    __weak id<SEDataRequestService> _dataRequestService;
+}
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithDataRequestService:(id<SEDataRequestService>)dataRequestService
+{
+    if (dataRequestService == nil) THROW_INVALID_PARAM(dataRequestService, nil);
+    
+    self = [super init];
+    if (self)
+    {
+        _dataRequestService = dataRequestService;
+        _tag = [NSString stringWithFormat:@"scope-%@", [NSUUID UUID].UUIDString];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [_dataRequestService cancelAllWithTag:_tag];
+}
+
+- (id<SECancellableToken>)track:(id<SECancellableToken>)token
+{
+    if (token != nil) [_dataRequestService setTag:_tag forRequest:token];
+    return token;
+}
+
+- (void)cancelAll
+{
+    [_dataRequestService cancelAllWithTag:_tag];
+}
+
+@end
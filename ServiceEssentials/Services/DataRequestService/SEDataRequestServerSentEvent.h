@@ -0,0 +1,25 @@
+//
+//  SEDataRequestServerSentEvent.h
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+@import Foundation;
+
+/** Event of a `text/event-stream` response, see `setStreamFormat:recordHandler:` of `SEDataRequestCustomizer`. Immutable. */
+@interface SEDataRequestServerSentEvent : NSObject
+/** Type of the event, `message` unless the event sets it */
+@property (nonatomic, readonly, copy, nonnull) NSString *eventType;
+/** Last event ID of the stream at the time of the event, `nil` if none has been set */
+@property (nonatomic, readonly, copy, nullable) NSString *identifier;
+/** Data lines of the event joined with line feeds */
+@property (nonatomic, readonly, copy, nonnull) NSString *data;
+/** Reconnection time last requested by the server on the stream, 0 if none has been requested */
+@property (nonatomic, readonly, assign) NSTimeInterval retryInterval;
+/** Data parsed as JSON and deserialized to the class of the request, `nil` if the request has no class to deserialize to */
+@property (nonatomic, readonly, strong, nullable) id object;
+@end
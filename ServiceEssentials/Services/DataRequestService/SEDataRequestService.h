@@ -15,19 +15,33 @@
 
 #import <ServiceEssentials/SEConstants.h>
 #import <ServiceEssentials/SECancellableToken.h>
+#import <ServiceEssentials/SEFuture.h>
 #import <ServiceEssentials/SEDataRequestJSONDeserializable.h>
 
+@class SEDataRequestPreparation;
+
 extern NSString * _Nonnull const SEDataRequestServiceChangedReachabilityNotification;
 extern NSString * _Nonnull const SEDataRequestServiceChangedReachabilityStatusKey;
+/** Posted when a circuit breaker of an endpoint changes state. May be posted on any thread. */
+extern NSString * _Nonnull const SEDataRequestServiceChangedCircuitStateNotification;
+extern NSString * _Nonnull const SEDataRequestServiceChangedCircuitEndpointKey;
+extern NSString * _Nonnull const SEDataRequestServiceChangedCircuitStateKey;
 
 extern NSInteger const SEDataRequestServiceSerializationFailure;
 extern NSInteger const SEDataRequestServiceTrustFailure;
 extern NSInteger const SEDataRequestServiceRequestCancelled;
 extern NSInteger const SEDataRequestServiceRequestSubmissuionFailure;
 extern NSInteger const SEDataRequestServiceRequestBuilderFailure;
+/** Request failed without being sent because the circuit breaker of the endpoint is open */
+extern NSInteger const SEDataRequestServiceCircuitOpen;
+/** Request has not completed by its deadline, see `setDeadline:` */
+extern NSInteger const SEDataRequestServiceDeadlineExceeded;
 
 extern NSString * _Nonnull const SEDataRequestServiceErrorDeserializedContentKey;
 
+/** Header telling the server of the environment how many milliseconds are left until the deadline of the request, never sent to other hosts */
+extern NSString * _Nonnull const SEDataRequestServiceDeadlineHeader;
+
 extern NSString * _Nonnull const SEDataRequestServiceContentTypeJSON;
 extern NSString * _Nonnull const SEDataRequestServiceContentTypeURLEncode;
 extern NSString * _Nonnull const SEDataRequestServiceContentTypePlainText;
@@ -70,6 +84,14 @@ typedef enum
     SEDataRequestQOSPriorityInteractive = QOS_CLASS_USER_INTERACTIVE
 } SEDataRequestQualityOfService;
 
+typedef enum
+{
+    // newline-delimited JSON, a JSON value per line
+    SEDataRequestStreamFormatNDJSON = 0,
+    // Server-Sent Events, records are `SEDataRequestServerSentEvent`
+    SEDataRequestStreamFormatServerSentEvents = 1
+} SEDataRequestStreamFormat;
+
 @protocol SEDataRequestCustomizer <NSObject>
 /** 
  Finalizes the requests and submits it. This method must be invoked in the end of the building to make the request. 
@@ -105,9 +127,54 @@ typedef enum
 /** Set the request body as raw data. Cannot be combined with parameters or multipart. */
 - (void) setBodyData:(nonnull NSData *) data;
 
+/**
+ Set the request body to a JSON dictionary or array which is encoded as the request is sent, rather than in memory upfront.
+ The body is the same as with `setBodyParameters:`, but it is never held in memory in full, which suits large payloads.
+ It is sent as a streamed upload with chunked transfer encoding. Cannot be combined with other bodies, content encodings or multipart.
+ */
+- (void) setStreamedBodyJSONObject: (nonnull id) object;
+
+/**
+ Set the request body to a JSON array of records which are enumerated and encoded as the request is sent, see `setStreamedBodyJSONObject:`.
+ @param records returns an enumerator of the records, which are JSON values. It is invoked each time the body is sent,
+ including a resend after a redirect or an authorization refresh, and the enumerator is used on a private queue.
+ */
+- (void) setStreamedBodyRecords: (nonnull NSEnumerator * _Nonnull (^)(void)) records;
+
 /** Request can be sent while application is in the background */
 - (void) setCanSendInBackground:(BOOL)canSendInBackground;
 
+/** Tags the request, so that it can be cancelled together with other requests with `cancelAllWithTag:` */
+- (void) setTag: (nonnull NSString *) tag;
+
+/**
+ Sets the time by which the request must complete, including waiting to be sent, retries and parsing the response.
+ The timeout of the request is capped by the time left, which is also sent to the server in `SEDataRequestServiceDeadlineHeader`.
+ Requests that are not complete by the deadline fail with `SEDataRequestServiceDeadlineExceeded`.
+ */
+- (void) setDeadline: (nonnull NSDate *) deadline;
+
+/**
+ Streams the response record by record instead of buffering the whole body, for long NDJSON exports and event streams.
+ Records are split as the body arrives, deserialized to the class set with `setDeserializeClass:` if there is one,
+ and delivered in batches to the record handler on the completion queue, which should be serial for batches to come in order.
+ Once the body is over, `success` is invoked with no data. A malformed record fails the request,
+ and cancelling the request stops the delivery, including the batches dispatched already.
+ Responses with unexpected HTTP codes are not streamed and fail as usual. Sets the `Accept` header unless it is set explicitly.
+ Streamed requests are sent as data tasks and cannot be multipart.
+ @param format format of the records, which determines how they are split
+ @param recordHandler handler of a batch of records, either JSON objects or instances of the class for NDJSON,
+ or `SEDataRequestServerSentEvent` for Server-Sent Events
+ */
+- (void) setStreamFormat: (SEDataRequestStreamFormat) format recordHandler: (nonnull void (^)(NSArray * _Nonnull records)) recordHandler;
+
+/**
+ Sets the number of records delivered to the record handler and not yet processed that pauses the response. Defaults to 256.
+ The task is suspended until the handler catches up to half of the number, so the rest of the body waits on the server.
+ Time spent suspended counts towards request timeouts and deadlines.
+ */
+- (void) setMaxPendingRecords: (NSUInteger) maxPendingRecords;
+
 /** Append a data part for multipart request */
 - (BOOL) appendPartWithData: (nonnull NSData *) data name: (nonnull NSString *) name fileName:(nullable NSString *) fileName mimeType: (nullable NSString *) mimeType error: (NSError * __autoreleasing _Nullable * _Nullable) error;
 /** Append a data part for multipart request */
@@ -119,8 +186,35 @@ typedef enum
 @end
 
 @protocol SEDataRequestBuilder <NSObject>
+/** Parameters set with `setBodyParameters:` are sent in the query */
+- (nonnull id<SEDataRequestCustomizer>) GET: (nonnull NSString *)path success: (nonnull void(^)(id _Nullable data, NSURLResponse * _Nonnull response)) success failure: (nullable void (^)(NSError * _Nonnull error)) failure completionQueue: (nullable dispatch_queue_t) completionQueue;
 - (nonnull id<SEDataRequestCustomizer>) POST: (nonnull NSString *)path success: (nonnull void(^)(id _Nullable data, NSURLResponse * _Nonnull response)) success failure: (nullable void (^)(NSError * _Nonnull error)) failure completionQueue: (nullable dispatch_queue_t) completionQueue;
 - (nonnull id<SEDataRequestCustomizer>) PUT: (nonnull NSString *)path success: (nonnull void(^)(id _Nullable data, NSURLResponse * _Nonnull response)) success failure: (nullable void (^)(NSError * _Nonnull error)) failure completionQueue: (nullable dispatch_queue_t) completionQueue;
+- (nonnull id<SEDataRequestCustomizer>) PATCH: (nonnull NSString *)path success: (nonnull void(^)(id _Nullable data, NSURLResponse * _Nonnull response)) success failure: (nullable void (^)(NSError * _Nonnull error)) failure completionQueue: (nullable dispatch_queue_t) completionQueue;
+/** Requests headers only, `success` receives the response and no data */
+- (nonnull id<SEDataRequestCustomizer>) HEAD: (nonnull NSString *)path success: (nonnull void(^)(id _Nullable data, NSURLResponse * _Nonnull response)) success failure: (nullable void (^)(NSError * _Nonnull error)) failure completionQueue: (nullable dispatch_queue_t) completionQueue;
+@end
+
+/**
+ Request template is a pre-compiled description of a request that is sent often, for example polling or telemetry.
+ Method, path pattern, headers, serialization and deserialization are validated and prepared once,
+ so that each submission only substitutes path placeholders and parameters.
+ Templates are immutable and can be used from any thread.
+ */
+@protocol SEDataRequestTemplate <NSObject>
+/**
+ Creates and submits a request from the template
+ @param pathParameters values for path pattern placeholders. Values are percent-encoded, so they cannot change the path structure.
+ @param parameters request parameters, become a part of the query or body depending on the method
+ @param success callback invoked on success
+ @param failure callback invoked on failure
+ @param completionQueue queue used to invoke a completion callback
+ @return request token
+ */
+- (nonnull id<SECancellableToken>) submitWithPathParameters: (nullable NSDictionary<NSString *, id> *)pathParameters parameters: (nullable NSDictionary<NSString *, id> *)parameters success: (nonnull void(^)(id _Nullable data, NSURLResponse * _Nonnull response)) success failure: (nullable void (^)(NSError * _Nonnull error)) failure completionQueue: (nullable dispatch_queue_t) completionQueue;
+
+/** Same as `submitWithPathParameters:parameters:success:failure:completionQueue:`, but returns a future resolved with the response data */
+- (nonnull SEFuture *) futureWithPathParameters: (nullable NSDictionary<NSString *, id> *)pathParameters parameters: (nullable NSDictionary<NSString *, id> *)parameters;
 @end
 
 
@@ -134,6 +228,10 @@ typedef enum
  Some requests don't return any response for a valid reason.
  For exmaple, HTTP 204 No Data is one of those reasons (may be in response to PUT request)
  So a successful response may contain no data and there is nothing to deserialize
+ 
+ When completion queue is `nil`, callbacks are invoked on the thread that completes the request.
+ Failures found while a request is submitted, such as an invalid URL or an open circuit, are never reported inside the submitting call:
+ they are dispatched to the completion queue, or to a global queue when it is `nil`.
 
  */
 @protocol SEDataRequestService <NSObject>
@@ -160,6 +258,13 @@ typedef enum
  */
 - (void) clearAuthorization;
 
+/**
+ Opens connections to the current base URL ahead of time, so that DNS resolution, TCP and TLS handshakes
+ (including certificate pinning validation) are not paid by the first real request.
+ @discussion Pre-warming sends lightweight HEAD requests without authorization. Responses are ignored.
+ */
+- (void) prewarmConnections;
+
 /**
  Creates, starts and returns a new GET request
  @param path specifies a relative path to the API
@@ -230,6 +335,26 @@ typedef enum
  */
 - (nonnull id<SECancellableToken>) PUT: (nonnull NSString *)path parameters: (nullable NSDictionary <NSString *, id> *)parameters success: (nonnull void(^)(id _Nullable data, NSURLResponse * _Nonnull response)) success failure: (nullable void (^)(NSError * _Nonnull error)) failure completionQueue: (nullable dispatch_queue_t) completionQueue;
 
+/**
+ Creates and starts a GET request, and returns a future resolved with the response data.
+ Continuations of the future run on the thread that completes the request unless they are given a queue.
+ @param path specifies a relative path to the API
+ @param parameters specifies request query parameters if any
+ @param class specifies the class to deserialize JSON object to, `nil` to get the JSON object
+ @return future of the data, cancelling it cancels the request
+ */
+- (nonnull SEFuture *) futureForGET: (nonnull NSString *)path parameters: (nullable NSDictionary <NSString *, id> *)parameters deserializeToClass: (nullable Class) class;
+
+/**
+ Creates and starts a POST request, and returns a future resolved with the response data.
+ Continuations of the future run on the thread that completes the request unless they are given a queue.
+ @param path specifies a relative path to the API
+ @param parameters specifies request body parameters if any
+ @param class specifies the class to deserialize JSON object to, `nil` to get the JSON object
+ @return future of the data, cancelling it cancels the request
+ */
+- (nonnull SEFuture *) futureForPOST: (nonnull NSString *)path parameters: (nullable NSDictionary <NSString *, id> *)parameters deserializeToClass: (nullable Class) class;
+
 /**
  Creates, starts and returns a new DOWNLOAD request
  @param path specifies a URL to a relative path to the downloadable content
@@ -249,11 +374,37 @@ typedef enum
  */
 - (nonnull id<SEDataRequestBuilder>) createRequestBuilder;
 
+/**
+ Creates a request template for a frequently used endpoint.
+ @param method request method, such as `GET` or `POST`
+ @param pathPattern a path relative to the API with placeholders in curly braces, for example `users/{userId}/feed`
+ @param headers static headers added to every request
+ @param encoding content encoding of the request body. Defaults to JSON. If a serializer cannot be found, exception will be thrown.
+ @param class specifies the class to deserialize JSON object to
+ @param qualityOfService quality of service of requests created from the template
+ @return request template
+ */
+- (nonnull id<SEDataRequestTemplate>) createRequestTemplateWithMethod: (nonnull NSString *)method pathPattern: (nonnull NSString *)pathPattern headers: (nullable NSDictionary<NSString *, NSString *> *)headers contentEncoding: (nullable NSString *)encoding deserializeToClass: (nullable Class)class qualityOfService: (SEDataRequestQualityOfService)qualityOfService;
+
 /**
  A function to use when a client needs to validate a challenge according to common policies.
  It may be helpful for the stream, for example, to coordinate the common security policy and certificate/key pinning
  */
 - (BOOL) validateSecurityChallenge: (nonnull NSURLAuthenticationChallenge *) challenge;
+
+/**
+ Tags a request that is in progress, including results being delivered from the content cache or a prefetch, and prefetches.
+ Has no effect when the request is complete.
+ @param tag tag of the request, replaces the previous one
+ @param token token of the request
+ */
+- (void) setTag: (nonnull NSString *) tag forRequest: (nonnull id<SECancellableToken>) token;
+
+/**
+ Cancels all requests with the tag at once. Cancelled requests do not invoke their callbacks, same as cancelled with a token.
+ @param tag tag of the requests
+ */
+- (void) cancelAllWithTag: (nonnull NSString *) tag;
 @end
 
 /**
@@ -312,8 +463,10 @@ typedef enum
  
  The delegate mothods can be used to add tracking, dynamic authorization and lots of other things 
  in a uniform way rather than having to add them for each request.
+ Delegates which results change rarely should adopt `SEDataRequestCachingPreparationDelegate` instead.
  */
 @protocol SEDataRequestPreparationDelegate <NSObject>
+@optional
 
 /**
  Queries a delegate for additional headers that should be added to a request with URL and method.
@@ -342,4 +495,43 @@ typedef enum
 
 @end
 
+/**
+ Preparation delegate which results are reused. Instead of being asked for headers and parameters of every request,
+ the delegate returns a preparation with both, which the service keeps for requests in its scope until it expires
+ or until `invalidateRequestPreparations` is called, for example when a signing key changes.
+ Methods of `SEDataRequestPreparationDelegate` are not called for such delegates.
+ */
+@protocol SEDataRequestCachingPreparationDelegate <SEDataRequestPreparationDelegate>
+@required
+
+/**
+ Queries a delegate for headers and parameters of a request, and of other requests in the scope of the result.
+ @param dataRequestService data request service sending a request.
+ @param method request method, such as `POST` or `GET`.
+ @param path path of the request.
+ @return headers and parameters, or `nil` if there are none. A `nil` result is not reused.
+ @discussion The method may be called concurrently from different threads, and may be called again for requests in the scope
+ of a preparation that has just been created by a concurrent call.
+ */
+- (nullable SEDataRequestPreparation *)dataRequestService:(nonnull id<SEDataRequestService>)dataRequestService preparationForRequestMethod:(nonnull NSString *)method path:(nonnull NSString *)path;
+
+@end
+
+/**
+ Authorization refresher obtains a new authorization header when the current one is rejected by the server.
+ */
+@protocol SEDataRequestAuthorizationRefresher <NSObject>
+
+/**
+ Requests a new authorization header.
+ @param dataRequestService data request service which requests failed with HTTP 401.
+ @param completion callback that must be invoked exactly once, on any thread. Pass a new authorization header on success, or `nil` and an error on failure.
+ @discussion Only one refresh is performed at a time. While it is in progress, authorized requests are suspended,
+ and once it completes, they are sent again with the new header. Do not send requests that depend on
+ the data request service authorization from this method, they would be suspended until the refresh completes.
+ */
+- (void)dataRequestService:(nonnull id<SEDataRequestService>)dataRequestService refreshAuthorizationWithCompletion:(nonnull void (^)(NSString * _Nullable authorizationHeader, NSError * _Nullable error))completion;
+
+@end
+
 #endif
@@ -11,6 +11,14 @@
 #import <ServiceEssentials/SEDataRequestService.h>
 
 @protocol SEEnvironmentService;
+@protocol SENetworkReachabilitySource;
+@protocol SEDataRequestLinkPolicy;
+@class SEDataRequestLinkParameters;
+@class SEDataRequestNetworkEstimator;
+@class SEDataRequestCircuitBreakers;
+@class SEDataRequestRateLimiter;
+@class SEDataRequestOutbox;
+@class SEDataRequestContentCache;
 @class SEDataSerializer;
 
 @interface SEDataRequestServiceImpl : NSObject<SEDataRequestService, SEUnsafeURLRequestService>
@@ -62,4 +70,138 @@
                                        serializers:(nullable NSDictionary<NSString *, __kindof SEDataSerializer *> *)serializers
                         requestPreparationDelegate:(nullable id<SEDataRequestPreparationDelegate>)requestDelegate;
 
+/**
+ Number of connections opened by `prewarmConnections`. Defaults to 1.
+ The value is capped by `HTTPMaximumConnectionsPerHost` of the session configuration.
+ Setting it to 0 disables pre-warming, including the automatic one performed when the environment changes.
+ */
+@property (atomic, assign) NSUInteger prewarmConnectionCount;
+
+/** Path relative to the base URL used by pre-warming requests. If not set, the base URL itself is requested. */
+@property (atomic, copy, nullable) NSString *prewarmPath;
+
+/** Quality of service of pre-warming requests. Defaults to `SEDataRequestQOSPriorityLow`. */
+@property (atomic, assign) SEDataRequestQualityOfService prewarmQualityOfService;
+
+/**
+ Refresher invoked when an authorized request fails with HTTP 401.
+ When set, concurrent authorization failures result in a single refresh, and failed requests are replayed once with the new header,
+ so callers only see the final result. Downloads and uploads from a file are not replayed. If not set, 401 responses are reported as is.
+ */
+@property (atomic, strong, nullable) id<SEDataRequestAuthorizationRefresher> authorizationRefresher;
+
+/**
+ Durable outbox for mutating requests, disabled by default. Should be set right after initialization.
+ When set, mutating requests (other than `GET` and `HEAD`) submitted while the network is not reachable, or failed because
+ the host could not be reached, are stored in the outbox instead of failing. They are sent in order when the network becomes reachable,
+ and the original callbacks are invoked with the final result. Requests left in the outbox by a previous run are sent without callbacks.
+ Stored requests are sent like new ones: an open circuit keeps them in the outbox, and they wait for rate limits and link concurrency.
+ Multipart, file upload and download requests are not stored.
+ */
+@property (atomic, strong, nullable) SEDataRequestOutbox *outbox;
+
+/**
+ Cache of responses to unsafe URL requests, not set by default.
+ When set, `URLGET:` and `URLDownload:` with a fresh cached response are served from the cache without sending a request,
+ and successful responses that may be stored are stored. Cached responses are delivered asynchronously, like the network ones.
+ */
+@property (atomic, strong, nullable) SEDataRequestContentCache *contentCache;
+
+/**
+ Prefetches a resource that is likely to be requested soon. The request is sent below every quality of service,
+ so it is admitted after other waiting requests. A `GET:` with the same path and parameters attaches to the prefetch instead
+ of sending another request, and promotes it to the quality of service of the `GET:`. Requests only attach when their headers,
+ including those of the preparation delegate, and the cookies of the session are the same. A result nobody has asked for is kept
+ for `prefetchTimeToLive` and is delivered once.
+
+ At most `prefetchDepth` of the current link parameters are in flight, further prefetches are ignored. Prefetches no request
+ has attached to are cancelled when the link parameters lower the depth, when response memory is over budget,
+ and when the application receives a memory warning.
+ @return token that cancels the prefetch unless a request has attached to it, or `nil` if the prefetch is ignored.
+ An existing prefetch of the same resource returns its own token.
+ */
+- (nullable id<SECancellableToken>) prefetch: (nonnull NSString *) path parameters: (nullable NSDictionary<NSString *, id> *) parameters;
+
+/** Time a prefetched result is kept for a request to claim it. Defaults to 30 seconds. */
+@property (atomic, assign) NSTimeInterval prefetchTimeToLive;
+
+/**
+ Source of reachability status. By default, a `SENetworkReachabilityTracker` for the host of the base URL is used when available,
+ and it is recreated when the environment changes. A source set explicitly is kept across environment changes.
+ */
+@property (atomic, strong, nullable) id<SENetworkReachabilitySource> reachabilitySource;
+
+/** Policy that adapts link parameters to reachability status and measured throughput. Defaults to `SEDefaultDataRequestLinkPolicy`. */
+@property (atomic, strong, nonnull) id<SEDataRequestLinkPolicy> linkPolicy;
+
+/**
+ Link parameters currently in effect. The service limits the number of requests in flight accordingly,
+ the rest of the requests wait and are started in the order of their quality of service.
+ */
+@property (atomic, readonly, strong, nonnull) SEDataRequestLinkParameters *linkParameters;
+
+/**
+ Round trip time and throughput estimate built from completed requests. The estimate is reset when reachability status changes.
+ Callers may use it for decisions such as choosing the resolution of an image.
+ */
+@property (nonatomic, readonly, strong, nonnull) SEDataRequestNetworkEstimator *networkEstimator;
+
+/**
+ Whether data requests and in-memory uploads get timeouts derived from `networkEstimator`, enabled by default.
+ Only requests with the default `NSURLRequest` timeout are affected, explicitly configured timeouts are kept.
+ */
+@property (atomic, assign) BOOL adaptsTimeouts;
+
+/** Response size assumed when deriving a timeout, in bytes. Defaults to 16 KB. */
+@property (atomic, assign) int64_t expectedResponseLength;
+
+/**
+ Circuit breakers keyed by endpoint. Requests to an endpoint which circuit is open fail immediately with `SEDataRequestServiceCircuitOpen`.
+ Failures are transport errors and HTTP 5xx responses, as well as responses slower than `slowRequestThreshold`.
+ State changes are posted as `SEDataRequestServiceChangedCircuitStateNotification`.
+ */
+@property (nonatomic, readonly, strong, nonnull) SEDataRequestCircuitBreakers *circuitBreakers;
+
+/**
+ Client-side rate limiter. Requests over the rate of their route group are started later instead of being sent to be rejected.
+ HTTP 429, and HTTP 503 with `Retry-After`, pause the route group for the requested interval.
+ No rate is set by default, so only the pauses apply until `requestsPerSecond` is configured.
+ */
+@property (nonatomic, readonly, strong, nonnull) SEDataRequestRateLimiter *rateLimiter;
+
+/**
+ Sets the time budget of requests with the quality of service that have no explicit deadline.
+ Such requests get a deadline that far from submission, see `setDeadline:` of `SEDataRequestCustomizer`.
+ @param timeBudget time budget in seconds, 0 removes the default deadline
+ */
+- (void) setDefaultTimeBudget: (NSTimeInterval) timeBudget forQualityOfService: (SEDataRequestQualityOfService) qualityOfService;
+
+/** Time budget of requests with the quality of service that have no explicit deadline, 0 if there is none. None are set by default. */
+- (NSTimeInterval) defaultTimeBudgetForQualityOfService: (SEDataRequestQualityOfService) qualityOfService;
+
+/**
+ Budget for response bodies buffered in memory by requests in flight, in bytes. 0, the default, means no limit.
+ When buffered data exceeds the budget, running tasks are suspended, except the most urgent one, which keeps running
+ so that memory is eventually freed. Among requests of equal quality of service, the one with the most data received is kept.
+ Suspended tasks are resumed once buffered data falls below three quarters of the budget.
+ While suspended, tasks do not count towards the concurrency limit of the link, so waiting requests are admitted in their place.
+ Downloads are written to disk and are not counted. Time spent suspended counts towards request timeouts and deadlines.
+ */
+@property (atomic, assign) int64_t responseMemoryBudget;
+
+/** Bytes of response bodies currently buffered in memory by requests in flight */
+@property (atomic, readonly, assign) int64_t bufferedResponseLength;
+
+/** Highest `bufferedResponseLength` since the service has been created or the mark has been reset */
+@property (atomic, readonly, assign) int64_t bufferedResponseLengthHighWaterMark;
+
+/** Resets the high-water mark to the current `bufferedResponseLength` */
+- (void) resetBufferedResponseLengthHighWaterMark;
+
+/**
+ Discards preparations of a `SEDataRequestCachingPreparationDelegate` kept by the service,
+ so the delegate is asked again for following requests. Preparations are also discarded when the environment changes.
+ */
+- (void) invalidateRequestPreparations;
+
 @end
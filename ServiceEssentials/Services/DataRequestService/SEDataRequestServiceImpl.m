@@ -18,17 +18,28 @@
 
 #import "NSString+SEExtensions.h"
 #import "SETools.h"
+#import "SEDataRequestContext.h"
 #import "SEDataRequestFactory.h"
-#import "SEDataRequestServiceSecurityHelper.h"
+#import <ServiceEssentials/SEDataRequestOutbox.h>
+#import <ServiceEssentials/SEDataRequestContentCache.h>
+#import <ServiceEssentials/SEDataRequestLinkPolicy.h>
+#import <ServiceEssentials/SEDataRequestNetworkEstimator.h>
+#import <ServiceEssentials/SEDataRequestCircuitBreakers.h>
+#import <ServiceEssentials/SEDataRequestRateLimiter.h>
 #import "SEDataRequestServiceUserAgent.h"
 #import "SEDataSerializer.h"
 #import "SEEnvironmentService.h"
+#import "SECancellableTokenImpl.h"
 #import "SEInternalDataRequest.h"
 #import "SEInternalDataRequestBuilder.h"
+#import "SEInternalDataRequestTemplate.h"
+#import "SEInternalRecordStream.h"
+#import "SEJSONStreamWriter.h"
 #import "SEJSONDataSerializer.h"
 #import "SEMultipartRequestContentStream.h"
 #import "SENetworkReachabilityTracker.h"
 #import "SEPlainTextSerializer.h"
+#import "SEServerTrustCache.h"
 #import "SEWebFormSerializer.h"
 
 // Pair of macros to enter and leave the critical section
@@ -62,6 +73,9 @@ NSString * const SEDataRequestServiceContentTypeOctetStream = @"application/octe
 
 NSString * const SEDataRequestServiceChangedReachabilityNotification = @"SEDataRequestServiceChangedReachabilityNotification";
 NSString * const SEDataRequestServiceChangedReachabilityStatusKey = @"reachabilityStatus";
+NSString * const SEDataRequestServiceChangedCircuitStateNotification = @"SEDataRequestServiceChangedCircuitStateNotification";
+NSString * const SEDataRequestServiceChangedCircuitEndpointKey = @"endpoint";
+NSString * const SEDataRequestServiceChangedCircuitStateKey = @"circuitState";
 
 static NSInteger const SEDataRequestServiceErrorStart = 1000;
 NSInteger const SEDataRequestServiceSerializationFailure = SEDataRequestServiceErrorStart;
@@ -69,30 +83,138 @@ NSInteger const SEDataRequestServiceTrustFailure = SEDataRequestServiceErrorStar
 NSInteger const SEDataRequestServiceRequestCancelled = SEDataRequestServiceErrorStart + 2;
 NSInteger const SEDataRequestServiceRequestSubmissuionFailure = SEDataRequestServiceErrorStart + 3;
 NSInteger const SEDataRequestServiceRequestBuilderFailure = SEDataRequestServiceErrorStart + 4;
+NSInteger const SEDataRequestServiceCircuitOpen = SEDataRequestServiceErrorStart + 5;
+NSInteger const SEDataRequestServiceDeadlineExceeded = SEDataRequestServiceErrorStart + 6;
 
 NSString * _Nonnull const SEDataRequestServiceErrorDeserializedContentKey = @"ErrorDeserializedContentKey";
+NSString * _Nonnull const SEDataRequestServiceDeadlineHeader = @"X-Request-Timeout-Ms";
+
+// Deadline travels with the URL request as system uptime, so that copies made for retries keep it
+static NSString * _Nonnull const SEDataRequestServiceDeadlineProperty = @"com.service-essentials.DataRequestService.deadline";
+// Marks unsafe requests which successful responses are offered to the content cache
+static NSString * _Nonnull const SEDataRequestServiceContentCacheProperty = @"com.service-essentials.DataRequestService.contentCache";
+// Marks prefetch requests, which are scheduled below every quality of service
+static NSString * _Nonnull const SEDataRequestServicePrefetchProperty = @"com.service-essentials.DataRequestService.prefetch";
+// Tag of a built request, so that it is registered tagged and no bulk cancellation can miss it
+static NSString * _Nonnull const SEDataRequestServiceTagProperty = @"com.service-essentials.DataRequestService.tag";
 
 static NSString * _Nonnull const SEDataRequestServiceBackgroundTaskId = @"com.service-essentials.DataRequestService.background";
+static NSString * _Nonnull const SEDataRequestServicePrewarmTaskDescription = @"com.service-essentials.DataRequestService.prewarm";
+
+static NSUInteger const SEDataRequestServiceTrustCacheCapacity = 16;
+static NSTimeInterval const SEDataRequestServiceTrustCacheTimeToLive = 600.0;
+static int64_t const SEDataRequestServiceDefaultExpectedResponseLength = 16 * 1024;
+static NSTimeInterval const SEDataRequestServiceDefaultPrefetchTimeToLive = 30.0;
+static NSUInteger const SEDataRequestServicePrefetchCapacity = 32;
+static float const SEDataRequestServicePrefetchTaskPriority = 0.1f;
 
 NSString * _Nonnull const SEDataRequestMethodGET = @"GET";
 NSString * _Nonnull const SEDataRequestMethodPOST = @"POST";
 NSString * _Nonnull const SEDataRequestMethodPUT = @"PUT";
 NSString * _Nonnull const SEDataRequestMethodDELETE = @"DELETE";
 NSString * _Nonnull const SEDataRequestMethodHEAD = @"HEAD";
+NSString * _Nonnull const SEDataRequestMethodPATCH = @"PATCH";
+
+/** Prefetch of a GET request, guarded by the request lock of the service */
+@interface SEDataRequestPrefetch : NSObject
+/** Absolute URL of the request, qualified by its headers and session cookies */
+@property (nonatomic, readonly, copy) NSString *key;
+/** Token returned to the caller of `prefetch:` */
+@property (nonatomic, readonly, strong) id<SECancellableToken> token;
+/** Token of the request in flight, `nil` until it is submitted and after it completes */
+@property (nonatomic, strong) id<SECancellableToken> requestToken;
+/** Whether a request has attached to the prefetch, after which it is never cancelled as a prefetch */
+@property (nonatomic, assign) BOOL isPromoted;
+@property (nonatomic, assign) float promotedPriority;
+@property (nonatomic, assign) BOOL isCancelled;
+@property (nonatomic, assign) BOOL isComplete;
+/** Tag for bulk cancellation of the prefetch */
+@property (nonatomic, copy) NSString *tag;
+/** System uptime of the completion, unclaimed results expire relative to it */
+@property (nonatomic, assign) NSTimeInterval completionTime;
+@property (nonatomic, strong) id result;
+@property (nonatomic, strong) NSURLResponse *response;
+/** Callbacks of attached requests */
+@property (nonatomic, readonly, strong) NSMutableArray<void (^)(id result, NSURLResponse *response, NSError *error)> *waiters;
+@end
+
+@implementation SEDataRequestPrefetch
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithKey:(NSString *)key token:(id<SECancellableToken>)token
+{
+    self = [super init];
+    if (self)
+    {
+        _key = [key copy];
+        _token = token;
+        _waiters = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+@end
 
 @interface SEDataRequestServiceImpl () <NSURLSessionDelegate, NSURLSessionDataDelegate, NSURLSessionDownloadDelegate, SEDataRequestServicePrivate, SENetworkReachabilityTrackerDelegate>
+/** Current settings snapshot. Readers take it with a single atomic load, writers replace it under `_contextUpdateLock`. */
+@property (atomic, strong) SEDataRequestContext *requestContext;
+/** Quality of service -> default time budget. Replaced as a whole under `_contextUpdateLock`. */
+@property (atomic, copy) NSDictionary<NSNumber *, NSNumber *> *defaultTimeBudgets;
 @end
 
 @implementation SEDataRequestServiceImpl
 {
     NSURLSession *_session;
     NSOperationQueue *_queue;
-    SENetworkReachabilityTracker *_reachabilityTracker;
+    id<SENetworkReachabilitySource> _reachabilitySource;
+    BOOL _hasCustomReachabilitySource;
     
     NSMutableDictionary<id<SECancellableToken>, SEInternalDataRequest *> *_internalRequestsByKey;
     NSMutableDictionary<NSNumber *, SEInternalDataRequest *> *_internalRequestsByTask;
     pthread_mutex_t _requestLock;
     
+    // Authorization refresh state, guarded by `_requestLock`
+    BOOL _isRefreshingAuthorization;
+    NSMutableArray<SEInternalDataRequest *> *_requestsAwaitingAuthorization;
+    
+    // Outbox state, guarded by `_requestLock`
+    SEDataRequestOutbox *_outbox;
+    NSMutableDictionary<id<SECancellableToken>, SEDataRequestOutboxRecord *> *_outboxRecordsByToken;
+    NSMutableDictionary<NSNumber *, SEInternalDataRequest *> *_outboxRequestsByRecord;
+    BOOL _isFlushingOutbox;
+    NSMutableArray<SEDataRequestOutboxRecord *> *_outboxBatchPending;
+    NSMutableSet<NSNumber *> *_outboxRecordsInFlight;
+    NSMutableArray<SEDataRequestOutboxRecord *> *_outboxBatchAcknowledged;
+    NSMutableArray<SEDataRequestOutboxRecord *> *_outboxBatchRequeued;
+    
+    // Link adaptation state, guarded by `_requestLock`
+    id<SEDataRequestLinkPolicy> _linkPolicy;
+    SEDataRequestLinkParameters *_linkParameters;
+    NSMutableSet<id<SECancellableToken>> *_admittedRequests;
+    NSMutableArray<SEInternalDataRequest *> *_requestsAwaitingAdmission;
+    
+    // Response memory state, guarded by `_requestLock`
+    int64_t _responseMemoryBudget;
+    int64_t _bufferedResponseLength;
+    int64_t _bufferedResponseLengthHighWaterMark;
+    NSMutableArray<SEInternalDataRequest *> *_requestsSuspendedForMemory;
+    
+    // Content cache state, guarded by `_requestLock`
+    SEDataRequestContentCache *_contentCache;
+    
+    // Prefetch state, guarded by `_requestLock`
+    NSMutableArray<SEDataRequestPrefetch *> *_prefetches;
+    NSTimeInterval _prefetchTimeToLive;
+    // Cookies the session adds to requests are a part of their identity, `nil` if it does not add any
+    NSHTTPCookieStorage *_prefetchCookieStorage;
+    
+    // Tokens of results delivered without a task of their own, such as cached and prefetched ones, to their tags or `NSNull`, guarded by `_requestLock`
+    NSMutableDictionary<id<SECancellableToken>, id> *_pendingDeliveries;
+    
     // Will create the factory for safe requests immediately, but create unsafe counterpart lazy
     // since it may or may or may not be needed.
     SEDataRequestFactory *_secureRequestFactory;
@@ -100,14 +222,14 @@ NSString * _Nonnull const SEDataRequestMethodHEAD = @"HEAD";
     SEDataRequestFactory *_unsafeRequestFactory;
     
     id<SEEnvironmentService> _environmentService;
-    pthread_mutex_t _baseURLLock;
-    NSURL *_baseURL;
-    SEDataRequestCertificatePinningType _pinningType;
+    pthread_mutex_t _contextUpdateLock;
+    SEServerTrustCache *_serverTrustCache;
 
     NSDictionary<NSString *, __kindof SEDataSerializer *> *_dataSerializers;
     SEDataSerializer *_defaultSerializer;
         
     BOOL _applicationBackgroundDefault;
+    SEDataRequestQualityOfService _prewarmQualityOfService;
     
 #if defined(__IPHONE_OS_VERSION_MIN_REQUIRED)
     UIBackgroundTaskIdentifier _backgroundTaskId;
@@ -146,12 +268,43 @@ NSString * _Nonnull const SEDataRequestMethodHEAD = @"HEAD";
         _queue.maxConcurrentOperationCount = 5;
         _queue.qualityOfService = SEDataRequestQualityOfServiceForQOS(qualityOfService);
         _session = [NSURLSession sessionWithConfiguration:configuration delegate:self delegateQueue:_queue];
-        _baseURL = [environmentService environmentBaseURL];
-        _pinningType = certificatePinningType;
+        _requestContext = [[SEDataRequestContext alloc] initWithBaseURL:[environmentService environmentBaseURL] authorizationHeader:nil pinningType:certificatePinningType];
+        pthread_mutex_init(&_contextUpdateLock, NULL);
+        _serverTrustCache = [[SEServerTrustCache alloc] initWithEvaluator:nil capacity:SEDataRequestServiceTrustCacheCapacity timeToLive:SEDataRequestServiceTrustCacheTimeToLive];
         _applicationBackgroundDefault = backgroundDefault;
+        _prewarmConnectionCount = 1;
+        _prewarmQualityOfService = SEDataRequestQOSPriorityLow;
         
         _internalRequestsByKey = [[NSMutableDictionary alloc] initWithCapacity:1];
         _internalRequestsByTask = [[NSMutableDictionary alloc] initWithCapacity:1];
+        _requestsAwaitingAuthorization = [[NSMutableArray alloc] init];
+        _outboxRecordsByToken = [[NSMutableDictionary alloc] init];
+        _outboxRequestsByRecord = [[NSMutableDictionary alloc] init];
+        _outboxBatchPending = [[NSMutableArray alloc] init];
+        _outboxRecordsInFlight = [[NSMutableSet alloc] init];
+        _outboxBatchAcknowledged = [[NSMutableArray alloc] init];
+        _outboxBatchRequeued = [[NSMutableArray alloc] init];
+        _linkPolicy = [SEDefaultDataRequestLinkPolicy new];
+        _networkEstimator = [SEDataRequestNetworkEstimator new];
+        _adaptsTimeouts = YES;
+        _expectedResponseLength = SEDataRequestServiceDefaultExpectedResponseLength;
+        _circuitBreakers = [SEDataRequestCircuitBreakers new];
+        __weak typeof(self) weakSelf = self;
+        _circuitBreakers.stateChangeHandler = ^(NSString *endpoint, SEDataRequestCircuitState state) {
+            SELog(@"Circuit of %@ changed state to %d", endpoint, (int)state);
+            typeof(self) strongSelf = weakSelf;
+            if (strongSelf == nil) return;
+            [[NSNotificationCenter defaultCenter] postNotificationName:SEDataRequestServiceChangedCircuitStateNotification object:strongSelf userInfo:@{ SEDataRequestServiceChangedCircuitEndpointKey: endpoint, SEDataRequestServiceChangedCircuitStateKey: @(state) }];
+        };
+        _rateLimiter = [SEDataRequestRateLimiter new];
+        _linkParameters = [SEDataRequestLinkParameters new];
+        _admittedRequests = [[NSMutableSet alloc] init];
+        _requestsAwaitingAdmission = [[NSMutableArray alloc] init];
+        _requestsSuspendedForMemory = [[NSMutableArray alloc] init];
+        _prefetches = [[NSMutableArray alloc] init];
+        _prefetchTimeToLive = SEDataRequestServiceDefaultPrefetchTimeToLive;
+        _prefetchCookieStorage = configuration.HTTPShouldSetCookies ? configuration.HTTPCookieStorage : nil;
+        _pendingDeliveries = [[NSMutableDictionary alloc] init];
         pthread_mutex_init(&_requestLock, NULL);
                 
         _defaultSerializer = [SEDataSerializer new];
@@ -184,10 +337,11 @@ NSString * _Nonnull const SEDataRequestMethodHEAD = @"HEAD";
         [defaultCenter addObserver:self selector:@selector(onDidEnterBackground:) name:UIApplicationDidEnterBackgroundNotification object:nil];
         [defaultCenter addObserver:self selector:@selector(onWillResumeActive:) name:UIApplicationWillEnterForegroundNotification object:nil];
         [defaultCenter addObserver:self selector:@selector(onWillTerminateApplication:) name:UIApplicationWillTerminateNotification object:nil];
+        [defaultCenter addObserver:self selector:@selector(onDidReceiveMemoryWarning:) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
 #endif
         
         // track connectivity/reachability
-        [self createReachabilityTrackerIfAvailableForURL:_baseURL];
+        [self createReachabilityTrackerIfAvailableForURL:_requestContext.baseURL];
     }
     return self;
 }
@@ -212,6 +366,7 @@ static inline void SEDataRequestServiceKillAllTasksAndCleanup(__unsafe_unretaine
     ENTER_CRITICAL_SECTION(service)
         for (SEInternalDataRequest *request in service->_internalRequestsByKey.allValues)
         {
+            // completion is reported inline and would take the request lock again
             [request cancelAndNotifyComplete:NO];
         }
         
@@ -221,6 +376,15 @@ static inline void SEDataRequestServiceKillAllTasksAndCleanup(__unsafe_unretaine
         {
             [service->_internalRequestsByKey removeAllObjects];
             [service->_internalRequestsByTask removeAllObjects];
+            [service->_requestsAwaitingAuthorization removeAllObjects];
+            [service->_outboxRecordsByToken removeAllObjects];
+            [service->_outboxRequestsByRecord removeAllObjects];
+            [service->_admittedRequests removeAllObjects];
+            [service->_requestsAwaitingAdmission removeAllObjects];
+            [service->_requestsSuspendedForMemory removeAllObjects];
+            [service->_prefetches removeAllObjects];
+            [service->_pendingDeliveries removeAllObjects];
+            service->_bufferedResponseLength = 0;
             service->_session = nil;
         }
     LEAVE_CRITICAL_SECTION(service)
@@ -235,6 +399,7 @@ static inline void SEDataRequestServiceKillAllTasksAndCleanup(__unsafe_unretaine
     // Can do short cleanup (without cleaning up the requests maps and such).
     __unsafe_unretained typeof (self) unsafeInstance = self;
     SEDataRequestServiceKillAllTasksAndCleanup(unsafeInstance, NO);
+    pthread_mutex_destroy(&_contextUpdateLock);
     [[NSNotificationCenter defaultCenter] removeObserver:self];
 }
 
@@ -257,48 +422,62 @@ static inline void SEDataRequestServiceKillAllTasksAndCleanup(__unsafe_unretaine
 #endif
 }
 
+- (void) onDidReceiveMemoryWarning: (NSNotification *) notification
+{
+    [self cancelPrefetchesKeepingCount:0 discardingResults:YES];
+}
+
 - (void) onUpdateEnvironment: (NSNotification *) notification
 {
     NSURL *newUrl = [_environmentService environmentBaseURL];
+    BOOL changed = NO;
     @try
     {
-        pthread_mutex_lock(&_baseURLLock);
-        if (![newUrl isEqual:_baseURL])
+        pthread_mutex_lock(&_contextUpdateLock);
+        SEDataRequestContext *context = self.requestContext;
+        if (![newUrl isEqual:context.baseURL])
         {
-            _baseURL = [_environmentService environmentBaseURL];
-            [self createReachabilityTrackerIfAvailableForURL:_baseURL];
+            // requests being built keep using the previous snapshot, new ones pick up the new generation
+            self.requestContext = [context contextWithBaseURL:newUrl];
+            [self createReachabilityTrackerIfAvailableForURL:newUrl];
+            [_serverTrustCache invalidate];
+            [_secureRequestFactory invalidatePreparations];
+            changed = YES;
             
             // TODO: implement the rest of environment switch if needed (cancel requests and so on)
         }
     }
     @finally
     {
-        pthread_mutex_unlock(&_baseURLLock);
+        pthread_mutex_unlock(&_contextUpdateLock);
     }
+    
+    // Connections to the old host are useless now, warm up the new one outside of the lock
+    if (changed) [self prewarmConnections];
 }
 
-- (NSURL *)safeBaseURL
+- (void)updateAuthorizationHeader:(NSString *)authorizationHeader
 {
-    NSURL *baseURL = nil;
-    @try
-    {
-        pthread_mutex_lock(&_baseURLLock);
-
-        baseURL = [_baseURL copy];
-    }
-    @finally
+    BOOL changed = NO;
+    pthread_mutex_lock(&_contextUpdateLock);
+    SEDataRequestContext *context = self.requestContext;
+    if (authorizationHeader != context.authorizationHeader && ![authorizationHeader isEqualToString:context.authorizationHeader])
     {
-        pthread_mutex_unlock(&_baseURLLock);
+        self.requestContext = [context contextWithAuthorizationHeader:authorizationHeader];
+        changed = YES;
     }
+    pthread_mutex_unlock(&_contextUpdateLock);
     
-    return baseURL;
+    // Prefetches were made on behalf of the previous user, none of them may be delivered to the new one
+    if (changed) [self cancelPrefetchesKeepingCount:0 discardingResults:YES];
 }
 
+// Must be called in `_contextUpdateLock` or during initialization
 - (void)createReachabilityTrackerIfAvailableForURL:(NSURL *)url
 {
-    if ([SENetworkReachabilityTracker isReachabilityAvailable])
+    if (!_hasCustomReachabilitySource && [SENetworkReachabilityTracker isReachabilityAvailable])
     {
-        _reachabilityTracker = [[SENetworkReachabilityTracker alloc] initWithURL:url delegate:self dispatchQueue:dispatch_get_main_queue()];
+        _reachabilitySource = [[SENetworkReachabilityTracker alloc] initWithURL:url delegate:self dispatchQueue:dispatch_get_main_queue()];
     }
 }
 
@@ -312,7 +491,8 @@ static inline void SEDataRequestServiceKillAllTasksAndCleanup(__unsafe_unretaine
 
 - (SENetworkReachabilityStatus)reachabilityStatus
 {
-    if (_reachabilityTracker != nil) return _reachabilityTracker.reachability;
+    id<SENetworkReachabilitySource> reachabilitySource = self.reachabilitySource;
+    if (reachabilitySource != nil) return reachabilitySource.reachability;
     return SENetworkReachabilityStatusUnavailable;
 }
 
@@ -322,12 +502,60 @@ static inline void SEDataRequestServiceKillAllTasksAndCleanup(__unsafe_unretaine
     if (authorizationHeader == nil) THROW_INVALID_PARAM(authorizationHeader, nil);
 #endif
 
-    _secureRequestFactory.authorizationHeader = authorizationHeader;
+    [self updateAuthorizationHeader:authorizationHeader];
 }
 
 - (void)clearAuthorization
 {
-    _secureRequestFactory.authorizationHeader = nil;
+    [self updateAuthorizationHeader:nil];
+}
+
+- (SEDataRequestQualityOfService)prewarmQualityOfService
+{
+    return _prewarmQualityOfService;
+}
+
+- (void)setPrewarmQualityOfService:(SEDataRequestQualityOfService)prewarmQualityOfService
+{
+    SEDataRequestVerifyQOS(prewarmQualityOfService);
+    _prewarmQualityOfService = prewarmQualityOfService;
+}
+
+- (void)prewarmConnections
+{
+    NSUInteger count = self.prewarmConnectionCount;
+    if (count == 0) return;
+    
+    NSURLSession *session = _session;
+    if (session == nil) return;
+    
+    NSInteger maxConnections = session.configuration.HTTPMaximumConnectionsPerHost;
+    if (maxConnections > 0 && count > (NSUInteger)maxConnections) count = (NSUInteger)maxConnections;
+
+    NSURL *baseURL = self.requestContext.baseURL;
+    NSString *path = self.prewarmPath;
+    NSURL *url = (path.length > 0) ? [NSURL URLWithString:path relativeToURL:baseURL] : baseURL;
+    if (url == nil || ![url.host isEqualToString:baseURL.host])
+    {
+        SELog(@"Pre-warming path %@ is not relative to the base URL %@", path, baseURL);
+        return;
+    }
+
+    // Bare HEAD request: no authorization or delegate-provided details since the response is discarded anyway.
+    NSMutableURLRequest *request = [[NSMutableURLRequest alloc] initWithURL:url cachePolicy:NSURLRequestReloadIgnoringLocalCacheData timeoutInterval:session.configuration.timeoutIntervalForRequest];
+    [request setHTTPMethod:SEDataRequestMethodHEAD];
+    NSString *userAgent = _secureRequestFactory.userAgent;
+    if (userAgent) [request setValue:userAgent forHTTPHeaderField:@"User-Agent"];
+
+    float priority = SEDataRequestServiceTaskPriorityForQOS(_prewarmQualityOfService);
+    for (NSUInteger i = 0; i < count; ++i)
+    {
+        // Tasks are not registered as internal requests, the delegate recognizes them by description.
+        NSURLSessionDataTask *task = [session dataTaskWithRequest:request];
+        task.taskDescription = SEDataRequestServicePrewarmTaskDescription;
+        task.priority = priority;
+        [task resume];
+    }
 }
 
 - (id<SECancellableToken>)GET:(NSString *)path parameters:(NSDictionary <NSString *, id> *)parameters success:(void (^)(id, NSURLResponse *))success failure:(void (^)(NSError *))failure completionQueue:(dispatch_queue_t)completionQueue
@@ -368,20 +596,42 @@ static inline void SEDataRequestServiceKillAllTasksAndCleanup(__unsafe_unretaine
     return [self buildAndSubmitSimpleRequestWithMethod:SEDataRequestMethodPUT path:path parameters:parameters mimeType:nil deserializationClass:nil success:success failure:failure completionQueue:completionQueue];
 }
 
+- (SEFuture *)futureForGET:(NSString *)path parameters:(NSDictionary<NSString *,id> *)parameters deserializeToClass:(Class)class
+{
+    return [SEFuture futureWithBlock:^id<SECancellableToken>(SEFutureResolver resolve) {
+        return [self GET:path parameters:parameters deserializeToClass:class success:^(id data, NSURLResponse *response) {
+            resolve(data, nil);
+        } failure:^(NSError *error) {
+            resolve(nil, error);
+        } completionQueue:nil];
+    }];
+}
+
+- (SEFuture *)futureForPOST:(NSString *)path parameters:(NSDictionary<NSString *,id> *)parameters deserializeToClass:(Class)class
+{
+    return [SEFuture futureWithBlock:^id<SECancellableToken>(SEFutureResolver resolve) {
+        return [self POST:path parameters:parameters contentEncoding:nil deserializeToClass:class success:^(id data, NSURLResponse *response) {
+            resolve(data, nil);
+        } failure:^(NSError *error) {
+            resolve(nil, error);
+        } completionQueue:nil];
+    }];
+}
+
 - (id<SECancellableToken>)download:(NSString *)path parameters:(NSDictionary<NSString *,id> *)parameters saveAs:(NSURL *)saveAsURL success:(void (^)(id _Nullable, NSURLResponse * _Nonnull))success failure:(void (^)(NSError * _Nonnull))failure progress:(void (^)(int64_t, int64_t, int64_t))progress completionQueue:(dispatch_queue_t)completionQueue
 {
     if (path == nil) THROW_INVALID_PARAM(url, @{ NSLocalizedDescriptionKey: @"Invalid URL"} );
     if (saveAsURL == nil || ![saveAsURL isFileURL]) THROW_INVALID_PARAM(saveAsURL, @{ NSLocalizedDescriptionKey: @"Invalid URL to save a file" });
 
     NSError *error = nil;
-    NSURLRequest *request = [_secureRequestFactory createDownloadRequestWithBaseURL:[self safeBaseURL] path:path body:parameters error:&error];
+    NSURLRequest *request = [_secureRequestFactory createDownloadRequestWithContext:self.requestContext path:path body:parameters error:&error];
     
     if (request == nil)
     {
         if (failure != nil)
         {
             if (error == nil) error = [NSError errorWithDomain:SEErrorDomain code:SEDataRequestServiceRequestSubmissuionFailure userInfo:@{ NSLocalizedDescriptionKey: @"Invalid URL" }];
-            dispatch_async(completionQueue, ^{ failure(error); });
+            SEDataRequestDispatchSubmissionFailure(completionQueue, ^{ failure(error); });
         }
         return nil;
     }
@@ -396,6 +646,29 @@ static inline void SEDataRequestServiceKillAllTasksAndCleanup(__unsafe_unretaine
     return [[SEInternalDataRequestBuilder alloc] initWithDataRequestService:self];
 }
 
+- (id<SEDataRequestTemplate>)createRequestTemplateWithMethod:(NSString *)method pathPattern:(NSString *)pathPattern headers:(NSDictionary<NSString *,NSString *> *)headers contentEncoding:(NSString *)encoding deserializeToClass:(Class)class qualityOfService:(SEDataRequestQualityOfService)qualityOfService
+{
+    return [_secureRequestFactory createTemplateWithMethod:method pathPattern:pathPattern headers:headers contentEncoding:encoding deserializeClass:class qualityOfService:qualityOfService];
+}
+
+- (void)setDefaultTimeBudget:(NSTimeInterval)timeBudget forQualityOfService:(SEDataRequestQualityOfService)qualityOfService
+{
+    if (timeBudget < 0) THROW_INVALID_PARAM(timeBudget, nil);
+    SEDataRequestVerifyQOS(qualityOfService);
+    
+    pthread_mutex_lock(&_contextUpdateLock);
+    NSMutableDictionary<NSNumber *, NSNumber *> *timeBudgets = [self.defaultTimeBudgets mutableCopy] ?: [NSMutableDictionary new];
+    if (timeBudget > 0) [timeBudgets setObject:@(timeBudget) forKey:@(qualityOfService)];
+    else [timeBudgets removeObjectForKey:@(qualityOfService)];
+    self.defaultTimeBudgets = timeBudgets;
+    pthread_mutex_unlock(&_contextUpdateLock);
+}
+
+- (NSTimeInterval)defaultTimeBudgetForQualityOfService:(SEDataRequestQualityOfService)qualityOfService
+{
+    return [[self.defaultTimeBudgets objectForKey:@(qualityOfService)] doubleValue];
+}
+
 - (BOOL)validateSecurityChallenge:(NSURLAuthenticationChallenge *)challenge
 {
     BOOL accept = NO;
@@ -404,31 +677,13 @@ static inline void SEDataRequestServiceKillAllTasksAndCleanup(__unsafe_unretaine
         SecTrustRef serverTrust = challenge.protectionSpace.serverTrust;
         NSError *error = nil;
         
-        NSURL *baseURL = [self safeBaseURL];
-        SEDataRequestCertificatePinningType pinningType = _pinningType;
-        if (![challenge.protectionSpace.host isEqualToString:baseURL.host]) pinningType = SEDataRequestCertificatePinningTypeNone;
+        SEDataRequestContext *context = self.requestContext;
+        NSString *host = challenge.protectionSpace.host;
+        SEDataRequestCertificatePinningType pinningType = context.pinningType;
+        if (![host isEqualToString:context.baseURL.host]) pinningType = SEDataRequestCertificatePinningTypeNone;
         
-        switch (pinningType)
-        {
-            case SEDataRequestCertificatePinningTypeNone:
-                accept = [SEDataRequestServiceSecurityHelper validateTrustDefault:serverTrust error:&error];
-                break;
-            case SEDataRequestCertificatePinningTypeCertificate:
-                accept = [SEDataRequestServiceSecurityHelper validateTrustUsingCertificates:serverTrust error:&error];
-                break;
-            case SEDataRequestCertificatePinningTypePublicKey:
-                accept = [SEDataRequestServiceSecurityHelper validateTrustUsingPublicKeys:serverTrust error:&error];
-                break;
-#ifdef ALLOWS_TEST_ENVIRONMENTS
-            case SEDataRequestCertificatePinningTypeNoneAcceptRecoverableFailure:
-                accept = [SEDataRequestServiceSecurityHelper validateTrustDefaultAcceptRecoverable:serverTrust error:&error];
-                break;
-#endif
-                
-            default:
-                accept = NO;
-                break;
-        }
+        // Repeated handshakes with the same host and certificate skip the expensive evaluation.
+        accept = [_serverTrustCache validateServerTrust:serverTrust host:host pinningType:pinningType error:&error];
         
         if (error != nil) SELog(@"Security challenge error: %@", error);
     }
@@ -437,6 +692,72 @@ static inline void SEDataRequestServiceKillAllTasksAndCleanup(__unsafe_unretaine
 
 #pragma mark - Unsafe URL Request service interface
 
+static inline NSURLRequest *SEDataRequestServiceOfferToContentCache(NSURLRequest *urlRequest)
+{
+    NSMutableURLRequest *request = [urlRequest mutableCopy];
+    [NSURLProtocol setProperty:@YES forKey:SEDataRequestServiceContentCacheProperty inRequest:request];
+    return request;
+}
+
+- (SEDataRequestContentCache *)contentCache
+{
+    SEDataRequestContentCache *contentCache = nil;
+    ENTER_CRITICAL_SECTION(self)
+        contentCache = _contentCache;
+    LEAVE_CRITICAL_SECTION(self)
+    return contentCache;
+}
+
+- (void)setContentCache:(SEDataRequestContentCache *)contentCache
+{
+    ENTER_CRITICAL_SECTION(self)
+        _contentCache = contentCache;
+    LEAVE_CRITICAL_SECTION(self)
+}
+
+- (id<SECancellableToken>)deliverCachedContent:(SEDataRequestCachedContent *)content saveAs:(NSURL *)saveAsURL success:(void (^)(id _Nullable, NSURLResponse * _Nonnull))success failure:(void (^)(NSError * _Nonnull))failure completionQueue:(dispatch_queue_t)completionQueue
+{
+    id<SECancellableToken> token = [[SECancellableTokenImpl alloc] initWithService:self];
+    ENTER_CRITICAL_SECTION(self)
+        [_pendingDeliveries setObject:[NSNull null] forKey:token];
+    LEAVE_CRITICAL_SECTION(self)
+    
+    // parsing and copying cost the same as for a response, so they are kept off the calling thread as well
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        id result = nil;
+        NSError *error = nil;
+        if (saveAsURL != nil)
+        {
+            [content.data writeToURL:saveAsURL options:NSDataWritingAtomic error:&error];
+        }
+        else if (content.data.length > 0)
+        {
+            SEDataSerializer *serializer = [self serializerForMIMEType:content.response.MIMEType];
+            if (serializer == nil) error = [NSError errorWithDomain:SEErrorDomain code:SEDataRequestServiceSerializationFailure userInfo:nil];
+            else result = [serializer deserializeData:content.data mimeType:content.response.MIMEType error:&error];
+        }
+        
+        [self dispatchDeliveryForToken:token completionQueue:completionQueue block:^{
+            if (error == nil) success(result, content.response);
+            else if (failure != nil) failure(error);
+        }];
+    });
+    return token;
+}
+
+// Invokes the block on the queue unless the token has been cancelled meanwhile
+- (void)dispatchDeliveryForToken:(id<SECancellableToken>)token completionQueue:(dispatch_queue_t)completionQueue block:(dispatch_block_t)block
+{
+    SEDataRequestDispatchCompletion(completionQueue, ^{
+        BOOL cancelled = NO;
+        ENTER_CRITICAL_SECTION(self)
+            cancelled = ([_pendingDeliveries objectForKey:token] == nil);
+            [_pendingDeliveries removeObjectForKey:token];
+        LEAVE_CRITICAL_SECTION(self)
+        if (!cancelled) block();
+    });
+}
+
 - (SEDataRequestFactory *)lazyUnsafeFactory
 {
     dispatch_once(&_unsafeRequestFactoryOnceToken, ^{
@@ -454,11 +775,19 @@ static inline void SEDataRequestServiceKillAllTasksAndCleanup(__unsafe_unretaine
     {
         if (failure != nil)
         {
-            dispatch_async(completionQueue, ^{ failure(error); });
+            SEDataRequestDispatchSubmissionFailure(completionQueue, ^{ failure(error); });
         }
         return nil;
     }
 
+    SEDataRequestContentCache *contentCache = self.contentCache;
+    if (contentCache != nil)
+    {
+        SEDataRequestCachedContent *content = [contentCache cachedContentForURL:request.URL];
+        if (content != nil) return [self deliverCachedContent:content saveAs:nil success:success failure:failure completionQueue:completionQueue];
+        request = SEDataRequestServiceOfferToContentCache(request);
+    }
+
     return [self createDataRequestWithURLRequest:request qos:SEDataRequestQOSDefault dataClass:nil expectedHTTPCodes:nil success:success failure:failure completionQueue:completionQueue];
 }
 
@@ -472,16 +801,167 @@ static inline void SEDataRequestServiceKillAllTasksAndCleanup(__unsafe_unretaine
     {
         if (failure != nil)
         {
-            dispatch_async(completionQueue, ^{ failure(error); });
+            SEDataRequestDispatchSubmissionFailure(completionQueue, ^{ failure(error); });
         }
         return nil;
     }
     
+    SEDataRequestContentCache *contentCache = self.contentCache;
+    if (contentCache != nil)
+    {
+        SEDataRequestCachedContent *content = [contentCache cachedContentForURL:request.URL];
+        if (content != nil) return [self deliverCachedContent:content saveAs:saveAsURL success:success failure:failure completionQueue:completionQueue];
+        request = SEDataRequestServiceOfferToContentCache(request);
+    }
+    
     return [self createDownloadRequestWithURLRequest:request qos:SEDataRequestQOSPriorityLow saveFileAs:saveAsURL expectedHTTPCodes:nil success:success failure:failure progress:progress completionQueue:completionQueue];
 }
 
 #pragma mark - Private interface
 
+// Responses smaller than this mostly measure latency rather than throughput
+static const int64_t SEDataRequestServiceThroughputSampleMinimumBytes = 16 * 1024;
+
+// Returns YES if the request produced a throughput sample
+static inline BOOL SEDataRequestServiceSampleThroughput(SEDataRequestNetworkEstimator *estimator, SEInternalDataRequest *request, NSURLSessionTask *task)
+{
+    int64_t bytesReceived = task.countOfBytesReceived;
+    if (request.startTime <= 0 || task.error != nil || bytesReceived < SEDataRequestServiceThroughputSampleMinimumBytes) return NO;
+    
+    // transfer time only, the time to the first byte is accounted for by the round trip time
+    NSTimeInterval transferStart = (request.responseTime > 0) ? request.responseTime : request.startTime;
+    NSTimeInterval duration = [NSProcessInfo processInfo].systemUptime - transferStart;
+    if (duration <= 0) return NO;
+    
+    [estimator addThroughputSampleWithBytes:bytesReceived duration:duration];
+    return YES;
+}
+
+static inline void SEDataRequestServiceSampleRoundTripTime(SEDataRequestNetworkEstimator *estimator, SEInternalDataRequest *request)
+{
+    NSTimeInterval startTime = request.startTime;
+    if (startTime <= 0 || request.responseTime > 0) return;
+    
+    NSTimeInterval now = [NSProcessInfo processInfo].systemUptime;
+    request.responseTime = now;
+    [estimator addRoundTripTimeSample:now - startTime];
+}
+
+static inline void SEDataRequestServiceRecordCircuitOutcome(SEDataRequestCircuitBreakers *circuitBreakers, NSString *endpoint, SEInternalDataRequest *request, NSURLSessionTask *task)
+{
+    NSError *error = task.error;
+    NSURLResponse *response = task.response;
+    BOOL cancelled = [error.domain isEqualToString:NSURLErrorDomain] && error.code == NSURLErrorCancelled;
+    if (request.startTime <= 0 || cancelled || (error == nil && response == nil))
+    {
+        // never sent or cancelled, says nothing about the endpoint
+        [circuitBreakers recordNoOutcomeForEndpoint:endpoint];
+    }
+    else if (error != nil || ([response isKindOfClass:[NSHTTPURLResponse class]] && ((NSHTTPURLResponse *)response).statusCode >= 500))
+    {
+        [circuitBreakers recordFailureForEndpoint:endpoint];
+    }
+    else
+    {
+        [circuitBreakers recordSuccessForEndpoint:endpoint duration:[NSProcessInfo processInfo].systemUptime - request.startTime];
+    }
+}
+
+// Requests of different users never share a prefetch, even if one is in flight while the authorization changes.
+// Besides `Authorization`, identity may be carried by headers of the preparation delegate or by session cookies, so all of them are in the key.
+static NSString *SEDataRequestServicePrefetchKey(NSURLRequest *urlRequest, NSHTTPCookieStorage *cookieStorage)
+{
+    NSMutableString *key = [urlRequest.URL.absoluteString mutableCopy];
+    NSDictionary<NSString *, NSString *> *headers = urlRequest.allHTTPHeaderFields;
+    for (NSString *field in [headers.allKeys sortedArrayUsingSelector:@selector(caseInsensitiveCompare:)])
+    {
+        [key appendFormat:@"\n%@: %@", field.lowercaseString, headers[field]];
+    }
+    
+    if (cookieStorage != nil && urlRequest.HTTPShouldHandleCookies)
+    {
+        NSArray<NSHTTPCookie *> *cookies = [cookieStorage cookiesForURL:urlRequest.URL];
+        if (cookies.count > 0) [key appendFormat:@"\ncookie: %@", [NSHTTPCookie requestHeaderFieldsWithCookies:cookies][@"Cookie"]];
+    }
+    return key;
+}
+
+// Only requests that kept the default timeout get the derived one
+static inline NSURLRequest *SEDataRequestServiceApplyAdaptiveTimeout(__unsafe_unretained SEDataRequestServiceImpl *service, NSURLRequest *urlRequest, int64_t bodyLength)
+{
+    static NSTimeInterval defaultTimeout;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        defaultTimeout = [NSURLRequest requestWithURL:[NSURL URLWithString:@"https://localhost"]].timeoutInterval;
+    });
+    
+    if (!service.adaptsTimeouts || urlRequest.timeoutInterval != defaultTimeout) return urlRequest;
+    
+    NSTimeInterval timeout = [service->_networkEstimator timeoutForExpectedBytes:bodyLength + service.expectedResponseLength defaultTimeout:defaultTimeout];
+    if (timeout == defaultTimeout) return urlRequest;
+    
+    NSMutableURLRequest *request = [urlRequest mutableCopy];
+    request.timeoutInterval = timeout;
+    return request;
+}
+
+static inline NSError *SEDataRequestServiceDeadlineError(NSURL *url)
+{
+    NSMutableDictionary *userInfo = [NSMutableDictionary dictionaryWithObject:@"Request deadline has passed" forKey:NSLocalizedDescriptionKey];
+    if (url != nil) [userInfo setObject:url forKey:NSURLErrorFailingURLErrorKey];
+    return [NSError errorWithDomain:SEErrorDomain code:SEDataRequestServiceDeadlineExceeded userInfo:userInfo];
+}
+
+// System uptime of the deadline, 0 if the request has none
+static inline NSTimeInterval SEDataRequestServiceDeadlineOfRequest(NSURLRequest *urlRequest)
+{
+    return [[NSURLProtocol propertyForKey:SEDataRequestServiceDeadlineProperty inRequest:urlRequest] doubleValue];
+}
+
+static inline NSURLRequest *SEDataRequestServiceSetDeadline(NSURLRequest *urlRequest, NSDate *deadline)
+{
+    if (deadline == nil) return urlRequest;
+    
+    NSMutableURLRequest *request = [urlRequest mutableCopy];
+    NSTimeInterval uptimeDeadline = [NSProcessInfo processInfo].systemUptime + deadline.timeIntervalSinceNow;
+    [NSURLProtocol setProperty:@(uptimeDeadline) forKey:SEDataRequestServiceDeadlineProperty inRequest:request];
+    return request;
+}
+
+static inline NSURLRequest *SEDataRequestServiceSetTag(NSURLRequest *urlRequest, NSString *tag)
+{
+    if (tag == nil) return urlRequest;
+    
+    NSMutableURLRequest *request = [urlRequest mutableCopy];
+    [NSURLProtocol setProperty:tag forKey:SEDataRequestServiceTagProperty inRequest:request];
+    return request;
+}
+
+// Requests without a deadline get the default budget of their quality of service.
+// Timeout is capped by the time left, which the server of the environment is told about as well, so that it can give up on a late request too.
+// Other hosts are not told, the deadline is only enforced locally for them.
+static inline NSURLRequest *SEDataRequestServiceApplyDeadline(__unsafe_unretained SEDataRequestServiceImpl *service, NSURLRequest *urlRequest, SEDataRequestQualityOfService qos)
+{
+    NSTimeInterval now = [NSProcessInfo processInfo].systemUptime;
+    NSTimeInterval deadline = SEDataRequestServiceDeadlineOfRequest(urlRequest);
+    if (deadline <= 0)
+    {
+        NSTimeInterval timeBudget = [service defaultTimeBudgetForQualityOfService:qos];
+        if (timeBudget <= 0) return urlRequest;
+        deadline = now + timeBudget;
+    }
+    
+    NSMutableURLRequest *request = [urlRequest mutableCopy];
+    [NSURLProtocol setProperty:@(deadline) forKey:SEDataRequestServiceDeadlineProperty inRequest:request];
+    NSTimeInterval remaining = deadline - now;
+    if (remaining > 0)
+    {
+        if (request.timeoutInterval > remaining) request.timeoutInterval = remaining;
+        if ([NSURLProtocol propertyForKey:SEDataRequestEnvironmentRequestProperty inRequest:request] != nil) [request setValue:[NSString stringWithFormat:@"%lld", (long long)(remaining * 1000)] forHTTPHeaderField:SEDataRequestServiceDeadlineHeader];
+    }
+    return request;
+}
+
 - (NSStringEncoding)stringEncoding
 {
     return SEDataRequestServiceStringEncoding;
@@ -492,6 +972,8 @@ static inline void SEDataRequestServiceKillAllTasksAndCleanup(__unsafe_unretaine
     SEInternalDataRequest *request = nil;
     ENTER_CRITICAL_SECTION(self)
         request = [_internalRequestsByKey objectForKey:token];
+        [_pendingDeliveries removeObjectForKey:token];
+        if (request == nil && _prefetches.count > 0) request = [self removePrefetchForToken:token];
     LEAVE_CRITICAL_SECTION(self);
     
     if (request) [request cancelAndNotifyComplete:YES];
@@ -499,13 +981,165 @@ static inline void SEDataRequestServiceKillAllTasksAndCleanup(__unsafe_unretaine
 
 - (void)completeInternalRequest:(SEInternalDataRequest *)request
 {
+    SEDataRequestOutboxRecord *outboxRecord = nil;
+    NSURLSessionTask *task = nil;
     ENTER_CRITICAL_SECTION(self)
-        [_internalRequestsByKey removeObjectForKey:request.token];
-        NSURLSessionTask *task = request.task;
-        if (task != nil) [_internalRequestsByTask removeObjectForKey:@(task.taskIdentifier)];
-        
+        task = request.task;
+        outboxRecord = [self unregisterInternalRequest:request];
         if (_internalRequestsByKey.count == 0) [self completeBackgroundTaskIfNeeded];
     LEAVE_CRITICAL_SECTION(self);
+    
+    [self finishInternalRequest:request task:task outboxRecord:outboxRecord];
+    
+    if (SEDataRequestServiceSampleThroughput(_networkEstimator, request, task)) [self updateLinkParameters];
+    else [self admitWaitingRequests];
+}
+
+- (NSUInteger)registeredRequestCount
+{
+    NSUInteger count;
+    ENTER_CRITICAL_SECTION(self)
+        count = _internalRequestsByKey.count;
+    LEAVE_CRITICAL_SECTION(self);
+    return count;
+}
+
+// Must be called in the request lock. Returns the outbox record of the request, if any.
+- (SEDataRequestOutboxRecord *)unregisterInternalRequest:(SEInternalDataRequest *)request
+{
+    [_internalRequestsByKey removeObjectForKey:request.token];
+    NSURLSessionTask *task = request.task;
+    if (task != nil) [_internalRequestsByTask removeObjectForKey:@(task.taskIdentifier)];
+    
+    SEDataRequestOutboxRecord *outboxRecord = [_outboxRecordsByToken objectForKey:request.token];
+    if (outboxRecord != nil)
+    {
+        [_outboxRecordsByToken removeObjectForKey:request.token];
+        [_outboxRequestsByRecord removeObjectForKey:@(outboxRecord.identifier)];
+    }
+    
+    BOOL wasAdmitted = [_admittedRequests containsObject:request.token];
+    if (wasAdmitted) [_admittedRequests removeObject:request.token];
+    else [_requestsAwaitingAdmission removeObjectIdenticalTo:request];
+    
+    [self releaseResponseMemoryOfInternalRequest:request];
+    
+    return outboxRecord;
+}
+
+// Bookkeeping of an unregistered request that is done outside of the request lock
+- (void)finishInternalRequest:(SEInternalDataRequest *)request task:(NSURLSessionTask *)task outboxRecord:(SEDataRequestOutboxRecord *)outboxRecord
+{
+    // completed or cancelled, the request should never be sent from the outbox again
+    if (outboxRecord != nil) [self finishOutboxRecord:outboxRecord requeue:NO];
+    
+    NSString *circuitEndpoint = request.circuitEndpoint;
+    if (circuitEndpoint != nil) SEDataRequestServiceRecordCircuitOutcome(_circuitBreakers, circuitEndpoint, request, task);
+    
+    // following requests to the route group wait for the interval the server has asked for
+    NSString *routeGroup = request.routeGroup;
+    NSURLResponse *response = task.response;
+    if (routeGroup != nil && [response isKindOfClass:[NSHTTPURLResponse class]]) [_rateLimiter handleResponse:(NSHTTPURLResponse *)response forRouteGroup:routeGroup];
+}
+
+- (void)cancelInternalRequestsPassingTest:(BOOL (^)(SEInternalDataRequest *request))predicate
+{
+    [self cancelInternalRequestsPassingTest:predicate deliveriesWithTag:nil];
+}
+
+/**
+ Cancels requests in a single pass of the request lock. Cancelled requests do not invoke callbacks.
+ Deliveries and prefetches without a task of their own are cancelled in the same pass if they have the tag.
+ */
+- (void)cancelInternalRequestsPassingTest:(BOOL (^)(SEInternalDataRequest *request))predicate deliveriesWithTag:(NSString *)tag
+{
+    NSMutableArray<SEInternalDataRequest *> *cancelled = nil;
+    NSMutableArray<NSURLSessionTask *> *tasks = nil;
+    NSMutableArray *outboxRecords = nil;
+    NSMutableArray<SEInternalDataRequest *> *prefetchRequests = nil;
+    ENTER_CRITICAL_SECTION(self)
+        if (tag != nil)
+        {
+            // cancelled deliveries are dropped before they call back
+            if (_pendingDeliveries.count > 0) [_pendingDeliveries removeObjectsForKeys:[_pendingDeliveries allKeysForObject:tag]];
+            
+            for (SEDataRequestPrefetch *prefetch in [_prefetches copy])
+            {
+                if (![prefetch.tag isEqualToString:tag]) continue;
+                SEInternalDataRequest *prefetchRequest = [self removePrefetchForToken:prefetch.token];
+                if (prefetchRequest == nil) continue;
+                if (prefetchRequests == nil) prefetchRequests = [NSMutableArray new];
+                [prefetchRequests addObject:prefetchRequest];
+            }
+        }
+        
+        for (SEInternalDataRequest *request in _internalRequestsByKey.allValues)
+        {
+            // requests completing on other threads report their own completion
+            if (!predicate(request) || ![request cancelAndNotifyComplete:NO]) continue;
+            
+            if (cancelled == nil)
+            {
+                cancelled = [NSMutableArray new];
+                tasks = [NSMutableArray new];
+                outboxRecords = [NSMutableArray new];
+            }
+            [cancelled addObject:request];
+            [tasks addObject:request.task ?: (id)[NSNull null]];
+            [outboxRecords addObject:[self unregisterInternalRequest:request] ?: [NSNull null]];
+        }
+        if (cancelled != nil && _internalRequestsByKey.count == 0) [self completeBackgroundTaskIfNeeded];
+    LEAVE_CRITICAL_SECTION(self)
+    
+    // requests of prefetches were not tagged themselves, they report their own completion
+    for (SEInternalDataRequest *prefetchRequest in prefetchRequests)
+    {
+        [prefetchRequest cancelAndNotifyComplete:YES];
+    }
+    
+    if (cancelled == nil) return;
+    
+    for (NSUInteger i = 0; i < cancelled.count; ++i)
+    {
+        NSURLSessionTask *task = (tasks[i] != (id)[NSNull null]) ? tasks[i] : nil;
+        SEDataRequestOutboxRecord *outboxRecord = (outboxRecords[i] != [NSNull null]) ? outboxRecords[i] : nil;
+        [self finishInternalRequest:cancelled[i] task:task outboxRecord:outboxRecord];
+    }
+    [self admitWaitingRequests];
+}
+
+- (void)setTag:(NSString *)tag forRequest:(id<SECancellableToken>)token
+{
+    if (tag == nil) THROW_INVALID_PARAM(tag, nil);
+    if (token == nil) THROW_INVALID_PARAM(token, nil);
+    
+    ENTER_CRITICAL_SECTION(self)
+        SEInternalDataRequest *request = [_internalRequestsByKey objectForKey:token];
+        if (request != nil)
+        {
+            request.tag = tag;
+        }
+        else if ([_pendingDeliveries objectForKey:token] != nil)
+        {
+            [_pendingDeliveries setObject:tag forKey:token];
+        }
+        else
+        {
+            for (SEDataRequestPrefetch *prefetch in _prefetches)
+            {
+                if (prefetch.token == token) prefetch.tag = tag;
+            }
+        }
+    LEAVE_CRITICAL_SECTION(self)
+}
+
+- (void)cancelAllWithTag:(NSString *)tag
+{
+    if (tag == nil) THROW_INVALID_PARAM(tag, nil);
+    
+    [self cancelInternalRequestsPassingTest:^BOOL(SEInternalDataRequest *request) {
+        return [request.tag isEqualToString:tag];
+    } deliveriesWithTag:tag];
 }
 
 - (SEDataSerializer *)explicitSerializerForMIMEType:(NSString *)mimeType
@@ -525,52 +1159,1085 @@ static inline void SEDataRequestServiceKillAllTasksAndCleanup(__unsafe_unretaine
     return _defaultSerializer;
 }
 
+static inline SEInternalRecordStream *SEDataRequestServiceRecordStreamForBuilder(SEInternalDataRequestBuilder *requestBuilder)
+{
+    if (requestBuilder.recordHandler == nil) return nil;
+    return [[SEInternalRecordStream alloc] initWithFormat:requestBuilder.streamFormat dataClass:requestBuilder.deserializeClass maxPendingRecords:requestBuilder.maxPendingRecords recordHandler:requestBuilder.recordHandler completionQueue:requestBuilder.completionQueue];
+}
+
 - (id<SECancellableToken>)submitRequestWithBuilder:(SEInternalDataRequestBuilder *)requestBuilder asUpload:(BOOL)asUpload
 {
     NSError *error = nil;
     NSURLRequest *request;
-    if (requestBuilder.contentParts == nil)
+    NSDate *deadline = requestBuilder.deadline;
+    if (deadline != nil && deadline.timeIntervalSinceNow <= 0)
+    {
+        // not worth building a request that is late already
+        error = SEDataRequestServiceDeadlineError(nil);
+    }
+    else if (requestBuilder.streamedBody != nil || requestBuilder.streamedBodyRecords != nil)
+    {
+        // JSON body encoded while it is sent
+        id body = nil;
+        request = [_secureRequestFactory createStreamedRequestWithBuilder:requestBuilder context:self.requestContext body:&body error:&error];
+        
+        if (request != nil)
+        {
+            request = SEDataRequestServiceSetTag(SEDataRequestServiceSetDeadline(request, deadline), requestBuilder.tag);
+            NSEnumerator *(^records)(void) = requestBuilder.streamedBodyRecords;
+            NSInputStream *(^bodyStreamFactory)(void (^)(NSError *)) = ^NSInputStream *(void (^failure)(NSError *)) {
+                if (records != nil) return [SEJSONStreamWriter inputStreamWithRecords:records() failure:failure];
+                return [SEJSONStreamWriter inputStreamWithJSONObject:body failure:failure];
+            };
+            return [self createStreamedUploadRequestWithURLRequest:request qos:requestBuilder.qualityOfService dataClass:requestBuilder.deserializeClass expectedHTTPCodes:requestBuilder.expectedHTTPCodes recordStream:SEDataRequestServiceRecordStreamForBuilder(requestBuilder) bodyStreamFactory:bodyStreamFactory success:requestBuilder.success failure:requestBuilder.failure completionQueue:requestBuilder.completionQueue];
+        }
+    }
+    else if (requestBuilder.contentParts == nil)
     {
         // regular, non-multipart request
-        request = [_secureRequestFactory createRequestWithBuilder:requestBuilder baseURL:[self safeBaseURL] error:&error];
+        request = [_secureRequestFactory createRequestWithBuilder:requestBuilder context:self.requestContext error:&error];
         
         if (request != nil)
-        {            
-            if (asUpload)
+        {
+            request = SEDataRequestServiceSetTag(SEDataRequestServiceSetDeadline(request, deadline), requestBuilder.tag);
+            if (requestBuilder.recordHandler != nil)
             {
-                return [self createDataRequestWithURLRequest:request qos:requestBuilder.qualityOfService dataClass:requestBuilder.deserializeClass expectedHTTPCodes:requestBuilder.expectedHTTPCodes success:requestBuilder.success failure:requestBuilder.failure completionQueue:requestBuilder.completionQueue];
+                // streamed responses are read from data tasks
+                return [self createDataRequestWithURLRequest:request qos:requestBuilder.qualityOfService dataClass:requestBuilder.deserializeClass expectedHTTPCodes:requestBuilder.expectedHTTPCodes recordStream:SEDataRequestServiceRecordStreamForBuilder(requestBuilder) success:requestBuilder.success failure:requestBuilder.failure completionQueue:requestBuilder.completionQueue];
             }
-            else
+            // requests without a body, such as HEAD, have nothing to upload
+            else if (asUpload && request.HTTPBody != nil)
             {
                 return [self createUploadRequestWithURLRequest:request qos:requestBuilder.qualityOfService data:request.HTTPBody dataClass:requestBuilder.deserializeClass expectedHTTPCodes:requestBuilder.expectedHTTPCodes success:requestBuilder.success failure:requestBuilder.failure completionQueue:requestBuilder.completionQueue];
             }
+            else
+            {
+                return [self createDataRequestWithURLRequest:request qos:requestBuilder.qualityOfService dataClass:requestBuilder.deserializeClass expectedHTTPCodes:requestBuilder.expectedHTTPCodes success:requestBuilder.success failure:requestBuilder.failure completionQueue:requestBuilder.completionQueue];
+            }
         }
     }
     else
     {
         // multipart request
         NSString *boundary = [NSString randomStringOfLength:10];
-        request = [_secureRequestFactory createMultipartRequestWithBuilder:requestBuilder baseURL:[self safeBaseURL] boundary:boundary error:&error];
+        request = [_secureRequestFactory createMultipartRequestWithBuilder:requestBuilder context:self.requestContext boundary:boundary error:&error];
         
         if (request != nil)
         {
+            request = SEDataRequestServiceSetTag(SEDataRequestServiceSetDeadline(request, deadline), requestBuilder.tag);
             return [self createStreamedUploadRequestWithURLRequest:request qos:requestBuilder.qualityOfService dataClass:requestBuilder.deserializeClass expectedHTTPCodes:requestBuilder.expectedHTTPCodes multipartContents:requestBuilder.contentParts boundary:boundary success:requestBuilder.success failure:requestBuilder.failure completionQueue:requestBuilder.completionQueue];
         }
     }
     
     if (error != nil && requestBuilder.failure != nil)
     {
-        dispatch_async(requestBuilder.completionQueue, ^{ requestBuilder.failure(error); });
+        SEDataRequestDispatchSubmissionFailure(requestBuilder.completionQueue, ^{ requestBuilder.failure(error); });
     }
     return nil;
 }
 
-#pragma mark - NSURLSessionDelegate
-
-- (void)URLSession:(NSURLSession *)session didReceiveChallenge:(NSURLAuthenticationChallenge *)challenge completionHandler:(void (^)(NSURLSessionAuthChallengeDisposition, NSURLCredential *))completionHandler
+- (id<SECancellableToken>)submitRequestWithTemplate:(SEInternalDataRequestTemplate *)requestTemplate pathParameters:(NSDictionary<NSString *,id> *)pathParameters parameters:(NSDictionary<NSString *,id> *)parameters success:(void (^)(id _Nullable, NSURLResponse * _Nonnull))success failure:(void (^)(NSError * _Nonnull))failure completionQueue:(dispatch_queue_t)completionQueue
 {
-    // validation will take host into account and check if it's the 'safe' host or not, and will apply policy correspondingly.
-    BOOL accept = [self validateSecurityChallenge:challenge];
+    NSError *error = nil;
+    NSURLRequest *request = [_secureRequestFactory createRequestWithTemplate:requestTemplate context:self.requestContext pathParameters:pathParameters parameters:parameters error:&error];
+
+    if (request == nil)
+    {
+        if (failure != nil)
+        {
+            if (error == nil) error = [NSError errorWithDomain:SEErrorDomain code:SEDataRequestServiceRequestSubmissuionFailure userInfo:@{ NSLocalizedDescriptionKey: @"Invalid URL" }];
+            SEDataRequestDispatchSubmissionFailure(completionQueue, ^{ failure(error); });
+        }
+        return nil;
+    }
+
+    return [self createDataRequestWithURLRequest:request qos:requestTemplate.qualityOfService dataClass:requestTemplate.deserializeClass expectedHTTPCodes:nil success:success failure:failure completionQueue:completionQueue];
+}
+
+#pragma mark - Authorization refresh
+
+// Only requests which can be re-created from the original URL request are replayed.
+// Downloads are saved regardless of response code and uploads from file don't keep the body,
+// streamed bodies are created anew.
+static inline BOOL SEDataRequestServiceCanReplayRequest(SEInternalDataRequest *request)
+{
+    NSURLSessionTask *task = request.task;
+    if (request.isReplayed || [task isKindOfClass:[NSURLSessionDownloadTask class]]) return NO;
+    if ([task isKindOfClass:[NSURLSessionUploadTask class]]) return request.multipartContents != nil || request.bodyStreamFactory != nil || task.originalRequest.HTTPBody != nil;
+    return YES;
+}
+
+static inline NSURLSessionTask *SEDataRequestServiceCreateReplayTask(NSURLSession *session, SEInternalDataRequest *request, NSURLRequest *urlRequest)
+{
+    if (![request.task isKindOfClass:[NSURLSessionUploadTask class]]) return [session dataTaskWithRequest:urlRequest];
+    if (request.multipartContents != nil || request.bodyStreamFactory != nil) return [session uploadTaskWithStreamedRequest:urlRequest];
+    return [session uploadTaskWithRequest:urlRequest fromData:urlRequest.HTTPBody];
+}
+
+- (BOOL)internalRequestFailedAuthorization:(SEInternalDataRequest *)request
+{
+    id<SEDataRequestAuthorizationRefresher> refresher = self.authorizationRefresher;
+    if (refresher == nil || !SEDataRequestServiceCanReplayRequest(request)) return NO;
+    
+    // requests sent without authorization (including unsafe ones) are not recovered
+    NSString *sentAuthorizationHeader = [request.task.originalRequest valueForHTTPHeaderField:@"Authorization"];
+    if (sentAuthorizationHeader == nil) return NO;
+    
+    SEDataRequestContext *context = self.requestContext;
+    BOOL startRefresh = NO;
+    BOOL parked = NO;
+    ENTER_CRITICAL_SECTION(self)
+        if (_isRefreshingAuthorization || [sentAuthorizationHeader isEqualToString:context.authorizationHeader])
+        {
+            [_requestsAwaitingAuthorization addObject:request];
+            startRefresh = !_isRefreshingAuthorization;
+            _isRefreshingAuthorization = YES;
+            parked = YES;
+        }
+    LEAVE_CRITICAL_SECTION(self)
+    
+    if (parked)
+    {
+        if (startRefresh) [self refreshAuthorizationWithRefresher:refresher];
+        return YES;
+    }
+    
+    // Authorization has changed since the request was sent, so it can be replayed right away.
+    // If authorization was cleared, the failure is final.
+    if (context.authorizationHeader == nil) return NO;
+    [self replayInternalRequest:request withContext:context];
+    return YES;
+}
+
+- (void)refreshAuthorizationWithRefresher:(id<SEDataRequestAuthorizationRefresher>)refresher
+{
+    __weak typeof(self) weakSelf = self;
+    [refresher dataRequestService:self refreshAuthorizationWithCompletion:^(NSString *authorizationHeader, NSError *error) {
+        [weakSelf completeAuthorizationRefreshWithHeader:authorizationHeader error:error];
+    }];
+}
+
+- (void)completeAuthorizationRefreshWithHeader:(NSString *)authorizationHeader error:(NSError *)error
+{
+    // publish the new header first, so that no new request is sent with the rejected one
+    if (authorizationHeader != nil) [self updateAuthorizationHeader:authorizationHeader];
+    SEDataRequestContext *context = self.requestContext;
+    
+    NSArray<SEInternalDataRequest *> *requests = nil;
+    ENTER_CRITICAL_SECTION(self)
+        requests = [_requestsAwaitingAuthorization copy];
+        [_requestsAwaitingAuthorization removeAllObjects];
+        _isRefreshingAuthorization = NO;
+    LEAVE_CRITICAL_SECTION(self)
+    
+    if (authorizationHeader != nil)
+    {
+        for (SEInternalDataRequest *request in requests) [self replayInternalRequest:request withContext:context];
+    }
+    else
+    {
+        SELog(@"Authorization refresh failed: %@", error);
+        
+        // callers see the same failure they would see without the refresh
+        NSMutableDictionary *userInfo = [[NSMutableDictionary alloc] initWithCapacity:2];
+        [userInfo setObject:@"Request failed: Unauthorized" forKey:NSLocalizedDescriptionKey];
+        if (error != nil) [userInfo setObject:error forKey:NSUnderlyingErrorKey];
+        NSError *authorizationError = [NSError errorWithDomain:NSURLErrorDomain code:401 userInfo:userInfo];
+        
+        for (SEInternalDataRequest *request in requests)
+        {
+            [request.task cancel];
+            [request completeWithError:authorizationError];
+        }
+    }
+}
+
+- (void)replayInternalRequest:(SEInternalDataRequest *)request withContext:(SEDataRequestContext *)context
+{
+    NSMutableURLRequest *urlRequest = [request.task.originalRequest mutableCopy];
+    [urlRequest setValue:context.authorizationHeader forHTTPHeaderField:@"Authorization"];
+    
+    request.isReplayed = YES;
+    [self resendInternalRequest:request withURLRequest:urlRequest];
+}
+
+- (void)resendInternalRequest:(SEInternalDataRequest *)request withURLRequest:(NSURLRequest *)urlRequest
+{
+    [self resendInternalRequest:request withURLRequest:urlRequest throughAdmission:NO];
+}
+
+// Without admission the new task is sent right away, which is how requests that have already been admitted are replayed
+- (void)resendInternalRequest:(SEInternalDataRequest *)request withURLRequest:(NSURLRequest *)urlRequest throughAdmission:(BOOL)throughAdmission
+{
+    if (request.deadline > 0)
+    {
+        // the retry only gets the time that is left
+        if (request.deadline <= [NSProcessInfo processInfo].systemUptime)
+        {
+            [request expireWithError:SEDataRequestServiceDeadlineError(urlRequest.URL)];
+            return;
+        }
+        urlRequest = SEDataRequestServiceApplyDeadline(self, urlRequest, request.qualityOfService);
+    }
+    
+    NSURLSessionTask *oldTask = request.task;
+    NSURLSessionTask *task = SEDataRequestServiceCreateReplayTask(_session, request, urlRequest);
+    task.priority = oldTask.priority;
+    
+    BOOL replaced = NO;
+    ENTER_CRITICAL_SECTION(self)
+        [_internalRequestsByTask removeObjectForKey:@(oldTask.taskIdentifier)];
+        // the response of the old task is discarded
+        [self releaseResponseMemoryOfInternalRequest:request];
+        if (task != nil && [request replaceTask:task])
+        {
+            [_internalRequestsByTask setObject:request forKey:@(task.taskIdentifier)];
+            [_requestsAwaitingAdmission removeObjectIdenticalTo:request];
+            if (!throughAdmission) [_admittedRequests addObject:request.token];
+            replaced = YES;
+        }
+    LEAVE_CRITICAL_SECTION(self)
+    
+    // suspended submissions have never been started, the rest are complete already
+    [oldTask cancel];
+    
+    if (replaced && throughAdmission)
+    {
+        [self admitInternalRequest:request];
+    }
+    else if (replaced)
+    {
+        request.startTime = [NSProcessInfo processInfo].systemUptime;
+        [task resume];
+    }
+    else if (task == nil)
+    {
+        // session has been invalidated
+        [request cancelAndNotifyComplete:YES];
+    }
+}
+
+#pragma mark - Outbox
+
+// Only mutating requests which body can be stored are journaled
+static inline BOOL SEDataRequestServiceCanJournalRequest(SEInternalDataRequest *request)
+{
+    NSURLSessionTask *task = request.task;
+    NSString *method = task.originalRequest.HTTPMethod;
+    if ([method isEqualToString:SEDataRequestMethodGET] || [method isEqualToString:SEDataRequestMethodHEAD]) return NO;
+    if (request.multipartContents != nil || request.bodyStreamFactory != nil || [task isKindOfClass:[NSURLSessionDownloadTask class]]) return NO;
+    return ![task isKindOfClass:[NSURLSessionUploadTask class]] || task.originalRequest.HTTPBody != nil;
+}
+
+- (SEDataRequestOutbox *)outbox
+{
+    SEDataRequestOutbox *outbox = nil;
+    ENTER_CRITICAL_SECTION(self)
+        outbox = _outbox;
+    LEAVE_CRITICAL_SECTION(self)
+    return outbox;
+}
+
+- (void)setOutbox:(SEDataRequestOutbox *)outbox
+{
+    ENTER_CRITICAL_SECTION(self)
+        _outbox = outbox;
+    LEAVE_CRITICAL_SECTION(self)
+    
+    // requests left by the previous run are sent as soon as possible
+    [self flushOutbox];
+}
+
+- (BOOL)journalInternalRequest:(SEInternalDataRequest *)request
+{
+    SEDataRequestOutbox *outbox = self.outbox;
+    if (outbox == nil || !SEDataRequestServiceCanJournalRequest(request)) return NO;
+    
+    NSURLRequest *urlRequest = request.task.originalRequest;
+    BOOL authorized = [urlRequest valueForHTTPHeaderField:@"Authorization"] != nil;
+    NSError *error = nil;
+    SEDataRequestOutboxRecord *record = [outbox appendRequest:urlRequest authorized:authorized error:&error];
+    if (record == nil)
+    {
+        SELog(@"Failed to store a request in the outbox: %@", error);
+        return NO;
+    }
+    
+    ENTER_CRITICAL_SECTION(self)
+        [_outboxRecordsByToken setObject:record forKey:request.token];
+        [_outboxRequestsByRecord setObject:request forKey:@(record.identifier)];
+    LEAVE_CRITICAL_SECTION(self)
+    return YES;
+}
+
+- (BOOL)deferInternalRequestToOutbox:(SEInternalDataRequest *)request
+{
+    SEDataRequestOutboxRecord *record = nil;
+    ENTER_CRITICAL_SECTION(self)
+        record = [_outboxRecordsByToken objectForKey:request.token];
+        if (record != nil && record.isRestored)
+        {
+            // nobody waits for the restored request, it is simply sent again with the next flush
+            [_outboxRecordsByToken removeObjectForKey:request.token];
+        }
+    LEAVE_CRITICAL_SECTION(self)
+    
+    if (record == nil) return [self journalInternalRequest:request];
+    
+    if (record.isRestored) [request cancelAndNotifyComplete:YES];
+    [self finishOutboxRecord:record requeue:YES];
+    return YES;
+}
+
+- (void)flushOutbox
+{
+    if (self.reachabilityStatus == SENetworkReachabilityStatusNotReachable) return;
+    
+    SEDataRequestOutbox *outbox = nil;
+    ENTER_CRITICAL_SECTION(self)
+        if (!_isFlushingOutbox && _outbox != nil)
+        {
+            outbox = _outbox;
+            _isFlushingOutbox = YES;
+        }
+    LEAVE_CRITICAL_SECTION(self)
+    if (outbox == nil) return;
+    
+    NSArray<SEDataRequestOutboxRecord *> *batch = [outbox dequeueBatch];
+    ENTER_CRITICAL_SECTION(self)
+        [_outboxBatchPending addObjectsFromArray:batch];
+    LEAVE_CRITICAL_SECTION(self)
+    
+    [self pumpOutbox];
+}
+
+// Sends pending records of the current batch while there are free slots, and finishes the batch once all records are done
+- (void)pumpOutbox
+{
+    NSMutableArray<SEDataRequestOutboxRecord *> *recordsToSend = [NSMutableArray new];
+    NSArray<SEDataRequestOutboxRecord *> *acknowledged = nil;
+    NSArray<SEDataRequestOutboxRecord *> *requeued = nil;
+    SEDataRequestOutbox *outbox = nil;
+    ENTER_CRITICAL_SECTION(self)
+        if (_isFlushingOutbox)
+        {
+            outbox = _outbox;
+            NSUInteger maxConcurrentRequests = MAX(outbox.maxConcurrentRequests, (NSUInteger)1);
+            while (_outboxBatchPending.count > 0 && _outboxRecordsInFlight.count < maxConcurrentRequests)
+            {
+                SEDataRequestOutboxRecord *record = [_outboxBatchPending firstObject];
+                [_outboxBatchPending removeObjectAtIndex:0];
+                [_outboxRecordsInFlight addObject:@(record.identifier)];
+                [recordsToSend addObject:record];
+            }
+            
+            if (_outboxBatchPending.count == 0 && _outboxRecordsInFlight.count == 0)
+            {
+                acknowledged = [_outboxBatchAcknowledged copy];
+                requeued = [_outboxBatchRequeued copy];
+                [_outboxBatchAcknowledged removeAllObjects];
+                [_outboxBatchRequeued removeAllObjects];
+                _isFlushingOutbox = NO;
+            }
+        }
+    LEAVE_CRITICAL_SECTION(self)
+    
+    for (SEDataRequestOutboxRecord *record in recordsToSend) [self sendOutboxRecord:record];
+    
+    if (acknowledged != nil)
+    {
+        // journal is updated once per batch
+        [outbox acknowledgeRecords:acknowledged];
+        [outbox requeueRecords:requeued];
+        
+        // keep going while the batches make progress
+        if (requeued.count == 0 && acknowledged.count > 0) [self flushOutbox];
+    }
+}
+
+- (void)finishOutboxRecord:(SEDataRequestOutboxRecord *)record requeue:(BOOL)requeue
+{
+    BOOL belongsToBatch = NO;
+    ENTER_CRITICAL_SECTION(self)
+        NSNumber *identifier = @(record.identifier);
+        if ([_outboxRecordsInFlight containsObject:identifier] || [_outboxBatchPending containsObject:record])
+        {
+            belongsToBatch = YES;
+            [_outboxRecordsInFlight removeObject:identifier];
+            [_outboxBatchPending removeObject:record];
+            if (requeue)
+            {
+                // the host cannot be reached, the rest of the batch waits for the next flush
+                [_outboxBatchRequeued addObject:record];
+                [_outboxBatchRequeued addObjectsFromArray:_outboxBatchPending];
+                [_outboxBatchPending removeAllObjects];
+            }
+            else
+            {
+                [_outboxBatchAcknowledged addObject:record];
+            }
+        }
+    LEAVE_CRITICAL_SECTION(self)
+    
+    if (belongsToBatch) [self pumpOutbox];
+    else if (!requeue) [self.outbox acknowledgeRecords:@[ record ]];
+}
+
+- (void)sendOutboxRecord:(SEDataRequestOutboxRecord *)record
+{
+    SEDataRequestContext *context = self.requestContext;
+    NSMutableURLRequest *urlRequest = [record.request mutableCopy];
+    
+    // credentials are not kept in the journal, cookies are added by the session
+    if (record.isRestored) [_secureRequestFactory applyDelegateHeadersToRestoredRequest:urlRequest context:context];
+    
+    // authorization is only applied to the host it was meant for
+    if (record.authorized && context.authorizationHeader != nil && [urlRequest.URL.host isEqualToString:context.baseURL.host])
+    {
+        [urlRequest setValue:context.authorizationHeader forHTTPHeaderField:@"Authorization"];
+    }
+    
+    SEInternalDataRequest *request = nil;
+    ENTER_CRITICAL_SECTION(self)
+        request = [_outboxRequestsByRecord objectForKey:@(record.identifier)];
+    LEAVE_CRITICAL_SECTION(self)
+    
+    // a failing endpoint is not flooded with the backlog, the records wait for the next flush
+    NSString *circuitEndpoint = (request != nil) ? request.circuitEndpoint : [SEDataRequestCircuitBreakers endpointForURL:urlRequest.URL];
+    if ((request != nil || record.isRestored) && circuitEndpoint != nil && ![_circuitBreakers shouldAllowRequestToEndpoint:circuitEndpoint])
+    {
+        return [self finishOutboxRecord:record requeue:YES];
+    }
+    
+    if (request != nil)
+    {
+        // admitted like a new request, so that a flush observes the rate limits and the link concurrency
+        [self resendInternalRequest:request withURLRequest:urlRequest throughAdmission:YES];
+    }
+    else if (record.isRestored)
+    {
+        // request from the previous run, nobody is waiting for the result
+        NSURLSessionDataTask *task = [_session dataTaskWithRequest:urlRequest];
+        if (task == nil) return [self finishOutboxRecord:record requeue:YES];
+        
+        task.priority = SEDataRequestServiceTaskPriorityForQOS(SEDataRequestQOSPriorityLow);
+        SEInternalDataRequest *internalRequest = [[SEInternalDataRequest alloc] initWithSessionTask:task requestService:self qualityOfService:SEDataRequestQOSPriorityLow responseDataClass:nil expectedHTTPCodes:nil multipartContents:nil downloadParameters:nil success:nil failure:nil completionQueue:nil];
+        internalRequest.circuitEndpoint = circuitEndpoint;
+        internalRequest.routeGroup = [_rateLimiter routeGroupForURL:urlRequest.URL];
+        ENTER_CRITICAL_SECTION(self)
+            [_internalRequestsByKey setObject:internalRequest forKey:internalRequest.token];
+            [_internalRequestsByTask setObject:internalRequest forKey:@(task.taskIdentifier)];
+            [_outboxRecordsByToken setObject:record forKey:internalRequest.token];
+        LEAVE_CRITICAL_SECTION(self)
+        [self admitInternalRequest:internalRequest];
+    }
+    else
+    {
+        // cancelled while waiting for connectivity
+        [self finishOutboxRecord:record requeue:NO];
+    }
+}
+
+#pragma mark - Link adaptation
+
+- (id<SENetworkReachabilitySource>)reachabilitySource
+{
+    id<SENetworkReachabilitySource> reachabilitySource = nil;
+    pthread_mutex_lock(&_contextUpdateLock);
+    reachabilitySource = _reachabilitySource;
+    pthread_mutex_unlock(&_contextUpdateLock);
+    return reachabilitySource;
+}
+
+- (void)setReachabilitySource:(id<SENetworkReachabilitySource>)reachabilitySource
+{
+    pthread_mutex_lock(&_contextUpdateLock);
+    _hasCustomReachabilitySource = (reachabilitySource != nil);
+    _reachabilitySource.delegate = nil;
+    _reachabilitySource = reachabilitySource;
+    _reachabilitySource.delegate = self;
+    if (!_hasCustomReachabilitySource) [self createReachabilityTrackerIfAvailableForURL:self.requestContext.baseURL];
+    pthread_mutex_unlock(&_contextUpdateLock);
+    
+    [self updateLinkParameters];
+}
+
+- (id<SEDataRequestLinkPolicy>)linkPolicy
+{
+    id<SEDataRequestLinkPolicy> linkPolicy = nil;
+    ENTER_CRITICAL_SECTION(self)
+        linkPolicy = _linkPolicy;
+    LEAVE_CRITICAL_SECTION(self)
+    return linkPolicy;
+}
+
+- (void)setLinkPolicy:(id<SEDataRequestLinkPolicy>)linkPolicy
+{
+    if (linkPolicy == nil) THROW_INVALID_PARAM(linkPolicy, nil);
+    
+    ENTER_CRITICAL_SECTION(self)
+        _linkPolicy = linkPolicy;
+    LEAVE_CRITICAL_SECTION(self)
+    [self updateLinkParameters];
+}
+
+- (SEDataRequestLinkParameters *)linkParameters
+{
+    SEDataRequestLinkParameters *linkParameters = nil;
+    ENTER_CRITICAL_SECTION(self)
+        linkParameters = _linkParameters;
+    LEAVE_CRITICAL_SECTION(self)
+    return linkParameters;
+}
+
+- (void)updateLinkParameters
+{
+    SENetworkReachabilityStatus status = self.reachabilityStatus;
+    double throughput = _networkEstimator.throughput;
+    id<SEDataRequestLinkPolicy> linkPolicy = nil;
+    ENTER_CRITICAL_SECTION(self)
+        linkPolicy = _linkPolicy;
+    LEAVE_CRITICAL_SECTION(self)
+    
+    // policy is an external code, so it is never called in the lock
+    SEDataRequestLinkParameters *linkParameters = [linkPolicy linkParametersForStatus:status throughput:throughput];
+    if (linkParameters == nil) THROW_INCONSISTENCY(@{ NSLocalizedDescriptionKey: @"Link policy returned no parameters." });
+    
+    ENTER_CRITICAL_SECTION(self)
+        _linkParameters = linkParameters;
+    LEAVE_CRITICAL_SECTION(self)
+    
+    // the link may no longer afford as many prefetches
+    [self cancelPrefetchesKeepingCount:linkParameters.prefetchDepth discardingResults:NO];
+    // the limit may have been raised
+    [self admitWaitingRequests];
+}
+
+- (void)admitWaitingRequests
+{
+    NSMutableArray<SEInternalDataRequest *> *admitted = nil;
+    ENTER_CRITICAL_SECTION(self)
+        while (_requestsAwaitingAdmission.count > 0 && _admittedRequests.count < _linkParameters.maxConcurrentRequests)
+        {
+            // the most urgent request first, in the order of submission among equals
+            NSUInteger index = 0;
+            float priority = -1;
+            for (NSUInteger i = 0; i < _requestsAwaitingAdmission.count; ++i)
+            {
+                float requestPriority = _requestsAwaitingAdmission[i].task.priority;
+                if (requestPriority > priority)
+                {
+                    priority = requestPriority;
+                    index = i;
+                }
+            }
+            
+            SEInternalDataRequest *request = _requestsAwaitingAdmission[index];
+            [_requestsAwaitingAdmission removeObjectAtIndex:index];
+            [_admittedRequests addObject:request.token];
+            if (admitted == nil) admitted = [NSMutableArray new];
+            [admitted addObject:request];
+        }
+    LEAVE_CRITICAL_SECTION(self)
+    
+    NSTimeInterval now = [NSProcessInfo processInfo].systemUptime;
+    for (SEInternalDataRequest *request in admitted)
+    {
+        request.startTime = now;
+        [request.task resume];
+    }
+}
+
+// Starts a registered request once the rate of its route group and the link concurrency allow it
+- (void)admitInternalRequest:(SEInternalDataRequest *)request
+{
+    NSString *routeGroup = request.routeGroup;
+    NSTimeInterval rateDelay = 0;
+    BOOL admitted = NO;
+    ENTER_CRITICAL_SECTION(self)
+        if (routeGroup != nil) rateDelay = [_rateLimiter reserveRequestForRouteGroup:routeGroup];
+        if (rateDelay <= 0)
+        {
+            admitted = (_admittedRequests.count < _linkParameters.maxConcurrentRequests);
+            if (admitted) [_admittedRequests addObject:request.token];
+            else [_requestsAwaitingAdmission addObject:request];
+        }
+    LEAVE_CRITICAL_SECTION(self)
+    
+    if (rateDelay > 0)
+    {
+        [self admitInternalRequest:request afterDelay:rateDelay];
+    }
+    else if (admitted)
+    {
+        request.startTime = [NSProcessInfo processInfo].systemUptime;
+        [request.task resume];
+    }
+}
+
+- (void)admitInternalRequest:(SEInternalDataRequest *)request afterDelay:(NSTimeInterval)delay
+{
+    __weak typeof(self) weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        [weakSelf enqueueDelayedInternalRequest:request];
+    });
+}
+
+- (void)expireInternalRequest:(SEInternalDataRequest *)request atDeadline:(NSTimeInterval)deadline
+{
+    // completed requests are released by the service and are not kept alive until the deadline
+    __weak SEInternalDataRequest *weakRequest = request;
+    NSTimeInterval delay = MAX(deadline - [NSProcessInfo processInfo].systemUptime, 0);
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        SEInternalDataRequest *request = weakRequest;
+        [request expireWithError:SEDataRequestServiceDeadlineError(request.task.originalRequest.URL)];
+    });
+}
+
+- (void)enqueueDelayedInternalRequest:(SEInternalDataRequest *)request
+{
+    ENTER_CRITICAL_SECTION(self)
+        // the request may have been cancelled while it was delayed
+        if ([_internalRequestsByKey objectForKey:request.token] == request) [_requestsAwaitingAdmission addObject:request];
+    LEAVE_CRITICAL_SECTION(self)
+    
+    [self admitWaitingRequests];
+}
+
+#pragma mark - Response memory
+
+// Buffered data falls this far below the budget before suspended tasks are resumed, so they are not suspended again right away
+static double const SEDataRequestServiceResponseMemoryResumeRatio = 0.75;
+
+- (int64_t)responseMemoryBudget
+{
+    int64_t budget = 0;
+    ENTER_CRITICAL_SECTION(self)
+        budget = _responseMemoryBudget;
+    LEAVE_CRITICAL_SECTION(self)
+    return budget;
+}
+
+- (void)setResponseMemoryBudget:(int64_t)responseMemoryBudget
+{
+    if (responseMemoryBudget < 0) THROW_INVALID_PARAM(responseMemoryBudget, nil);
+    
+    ENTER_CRITICAL_SECTION(self)
+        _responseMemoryBudget = responseMemoryBudget;
+        // the budget may have been raised or removed
+        [self resumeRequestsSuspendedForMemoryIfPossible];
+    LEAVE_CRITICAL_SECTION(self)
+}
+
+- (int64_t)bufferedResponseLength
+{
+    int64_t length = 0;
+    ENTER_CRITICAL_SECTION(self)
+        length = _bufferedResponseLength;
+    LEAVE_CRITICAL_SECTION(self)
+    return length;
+}
+
+- (int64_t)bufferedResponseLengthHighWaterMark
+{
+    int64_t length = 0;
+    ENTER_CRITICAL_SECTION(self)
+        length = _bufferedResponseLengthHighWaterMark;
+    LEAVE_CRITICAL_SECTION(self)
+    return length;
+}
+
+- (void)resetBufferedResponseLengthHighWaterMark
+{
+    ENTER_CRITICAL_SECTION(self)
+        _bufferedResponseLengthHighWaterMark = _bufferedResponseLength;
+    LEAVE_CRITICAL_SECTION(self)
+}
+
+- (void)invalidateRequestPreparations
+{
+    [_secureRequestFactory invalidatePreparations];
+}
+
+- (void)accountResponseLength:(int64_t)length ofInternalRequest:(SEInternalDataRequest *)request
+{
+    BOOL overBudget = NO;
+    BOOL releasedAdmission = NO;
+    ENTER_CRITICAL_SECTION(self)
+        // requests that have left the registry have released their memory already
+        if ([_internalRequestsByKey objectForKey:request.token] == request)
+        {
+            request.bufferedLength += length;
+            _bufferedResponseLength += length;
+            _bufferedResponseLengthHighWaterMark = MAX(_bufferedResponseLengthHighWaterMark, _bufferedResponseLength);
+            if (_responseMemoryBudget > 0 && _bufferedResponseLength > _responseMemoryBudget)
+            {
+                releasedAdmission = [self suspendRequestsForMemory];
+                overBudget = (_prefetches.count > 0);
+            }
+        }
+    LEAVE_CRITICAL_SECTION(self)
+    
+    // memory goes to requests somebody is waiting for
+    if (overBudget) [self cancelPrefetchesKeepingCount:0 discardingResults:YES];
+    if (releasedAdmission) [self admitWaitingRequests];
+}
+
+// Must be called in the request lock
+- (void)releaseResponseMemoryOfInternalRequest:(SEInternalDataRequest *)request
+{
+    [_requestsSuspendedForMemory removeObjectIdenticalTo:request];
+    if (request.bufferedLength == 0) return;
+    
+    _bufferedResponseLength -= request.bufferedLength;
+    request.bufferedLength = 0;
+    [self resumeRequestsSuspendedForMemoryIfPossible];
+}
+
+// Must be called in the request lock. Tasks are suspended and resumed in the lock, so that the two never race.
+// Suspended requests give up their admission, so that the link is not left idle behind them. Returns YES if any did.
+- (BOOL)suspendRequestsForMemory
+{
+    // the most urgent running request keeps going, the one closest to completion among equals
+    SEInternalDataRequest *keptRequest = nil;
+    NSMutableArray<SEInternalDataRequest *> *runningRequests = [[NSMutableArray alloc] initWithCapacity:_internalRequestsByTask.count];
+    for (SEInternalDataRequest *request in _internalRequestsByTask.objectEnumerator)
+    {
+        NSURLSessionTask *task = request.task;
+        if (![task isKindOfClass:[NSURLSessionDataTask class]] || task.state != NSURLSessionTaskStateRunning || request.isCompleted || request.isStreamingResponse) continue;
+        if ([_requestsSuspendedForMemory indexOfObjectIdenticalTo:request] != NSNotFound) continue;
+        
+        [runningRequests addObject:request];
+        if (keptRequest == nil || task.priority > keptRequest.task.priority || (task.priority == keptRequest.task.priority && request.bufferedLength > keptRequest.bufferedLength))
+        {
+            keptRequest = request;
+        }
+    }
+    
+    BOOL releasedAdmission = NO;
+    for (SEInternalDataRequest *request in runningRequests)
+    {
+        if (request == keptRequest) continue;
+        [_requestsSuspendedForMemory addObject:request];
+        [request.task suspend];
+        if ([_admittedRequests containsObject:request.token])
+        {
+            [_admittedRequests removeObject:request.token];
+            releasedAdmission = YES;
+        }
+    }
+    return releasedAdmission;
+}
+
+// Must be called in the request lock. Resumed requests are admitted again even over the concurrency limit,
+// they have data buffered already and only their completion releases it.
+- (void)resumeRequestsSuspendedForMemoryIfPossible
+{
+    if (_requestsSuspendedForMemory.count == 0) return;
+    
+    if (_responseMemoryBudget == 0 || _bufferedResponseLength <= _responseMemoryBudget * SEDataRequestServiceResponseMemoryResumeRatio)
+    {
+        for (SEInternalDataRequest *request in _requestsSuspendedForMemory)
+        {
+            [_admittedRequests addObject:request.token];
+            [request.task resume];
+        }
+        [_requestsSuspendedForMemory removeAllObjects];
+        return;
+    }
+    
+    // suspended requests may hold enough data to stay over the budget, one of them is resumed when nothing else runs to free memory
+    for (SEInternalDataRequest *request in _internalRequestsByTask.objectEnumerator)
+    {
+        NSURLSessionTask *task = request.task;
+        if (task.state == NSURLSessionTaskStateRunning && [task isKindOfClass:[NSURLSessionDataTask class]]) return;
+    }
+    
+    SEInternalDataRequest *resumedRequest = nil;
+    for (SEInternalDataRequest *request in _requestsSuspendedForMemory)
+    {
+        if (resumedRequest == nil || request.task.priority > resumedRequest.task.priority || (request.task.priority == resumedRequest.task.priority && request.bufferedLength > resumedRequest.bufferedLength))
+        {
+            resumedRequest = request;
+        }
+    }
+    [_requestsSuspendedForMemory removeObjectIdenticalTo:resumedRequest];
+    [_admittedRequests addObject:resumedRequest.token];
+    [resumedRequest.task resume];
+}
+
+#pragma mark - Prefetching
+
+- (NSTimeInterval)prefetchTimeToLive
+{
+    NSTimeInterval timeToLive = 0;
+    ENTER_CRITICAL_SECTION(self)
+        timeToLive = _prefetchTimeToLive;
+    LEAVE_CRITICAL_SECTION(self)
+    return timeToLive;
+}
+
+- (void)setPrefetchTimeToLive:(NSTimeInterval)prefetchTimeToLive
+{
+    if (prefetchTimeToLive < 0) THROW_INVALID_PARAM(prefetchTimeToLive, nil);
+    
+    ENTER_CRITICAL_SECTION(self)
+        _prefetchTimeToLive = prefetchTimeToLive;
+    LEAVE_CRITICAL_SECTION(self)
+}
+
+- (id<SECancellableToken>)prefetch:(NSString *)path parameters:(NSDictionary<NSString *,id> *)parameters
+{
+    if (path == nil) THROW_INVALID_PARAM(path, nil);
+    
+    NSError *error = nil;
+    NSURLRequest *urlRequest = [_secureRequestFactory createRequestWithMethod:SEDataRequestMethodGET context:self.requestContext path:path body:parameters mimeType:nil error:&error];
+    if (urlRequest == nil)
+    {
+        SELog(@"Prefetch of %@ could not be built: %@", path, error);
+        return nil;
+    }
+    
+    NSString *key = SEDataRequestServicePrefetchKey(urlRequest, _prefetchCookieStorage);
+    SEDataRequestPrefetch *prefetch = nil;
+    id<SECancellableToken> existingToken = nil;
+    ENTER_CRITICAL_SECTION(self)
+        [self purgeExpiredPrefetches];
+        existingToken = [self prefetchForKey:key].token;
+        if (existingToken == nil && [self countOfPrefetchesInFlight] < _linkParameters.prefetchDepth && [self makeRoomForPrefetch])
+        {
+            prefetch = [[SEDataRequestPrefetch alloc] initWithKey:key token:[[SECancellableTokenImpl alloc] initWithService:self]];
+            [_prefetches addObject:prefetch];
+        }
+    LEAVE_CRITICAL_SECTION(self)
+    
+    if (existingToken != nil) return existingToken;
+    if (prefetch == nil) return nil;
+    
+    NSMutableURLRequest *prefetchRequest = [urlRequest mutableCopy];
+    [NSURLProtocol setProperty:@YES forKey:SEDataRequestServicePrefetchProperty inRequest:prefetchRequest];
+    
+    // the serialized result is kept, so that requests attaching later may deserialize it to their own classes
+    __weak typeof(self) weakSelf = self;
+    id<SECancellableToken> requestToken = [self createDataRequestWithURLRequest:prefetchRequest qos:SEDataRequestQOSPriorityBackground dataClass:nil expectedHTTPCodes:nil success:^(id result, NSURLResponse *response) {
+        [weakSelf completePrefetch:prefetch result:result response:response error:nil];
+    } failure:^(NSError *error) {
+        [weakSelf completePrefetch:prefetch result:nil response:nil error:error];
+    } completionQueue:nil];
+    
+    BOOL cancelled = NO;
+    ENTER_CRITICAL_SECTION(self)
+        // the prefetch may have been cancelled, completed or attached to while it was being submitted
+        cancelled = prefetch.isCancelled;
+        if (!cancelled && !prefetch.isComplete)
+        {
+            prefetch.requestToken = requestToken;
+            if (prefetch.isPromoted) [self promotePrefetch:prefetch];
+        }
+    LEAVE_CRITICAL_SECTION(self)
+    
+    if (cancelled && requestToken != nil) [self cancelItemForToken:requestToken];
+    return prefetch.token;
+}
+
+// Returns a token of a delivery from a prefetch of the same request, or `nil` if there is none
+- (id<SECancellableToken>)attachToPrefetchWithURLRequest:(NSURLRequest *)urlRequest qos:(SEDataRequestQualityOfService)qos dataClass:(Class)dataClass success:(void (^)(id, NSURLResponse *))success failure:(void (^)(NSError *))failure completionQueue:(dispatch_queue_t)completionQueue
+{
+    NSString *key = SEDataRequestServicePrefetchKey(urlRequest, _prefetchCookieStorage);
+    id<SECancellableToken> token = nil;
+    SEDataRequestPrefetch *completedPrefetch = nil;
+    void (^waiter)(id, NSURLResponse *, NSError *) = nil;
+    ENTER_CRITICAL_SECTION(self)
+        if (_prefetches.count > 0)
+        {
+            [self purgeExpiredPrefetches];
+            SEDataRequestPrefetch *prefetch = [self prefetchForKey:key];
+            if (prefetch != nil)
+            {
+                id<SECancellableToken> deliveryToken = [[SECancellableTokenImpl alloc] initWithService:self];
+                __weak typeof(self) weakSelf = self;
+                waiter = ^(id result, NSURLResponse *response, NSError *error) {
+                    NSError *deserializationError = nil;
+                    if (error == nil && dataClass != nil) result = [SEInternalDataRequest deserializeResult:result toClass:dataClass error:&deserializationError];
+                    NSError *finalError = error ?: deserializationError;
+                    [weakSelf dispatchDeliveryForToken:deliveryToken completionQueue:completionQueue block:^{
+                        if (finalError == nil) success(result, response);
+                        else if (failure != nil) failure(finalError);
+                    }];
+                };
+                token = deliveryToken;
+                [_pendingDeliveries setObject:[NSNull null] forKey:token];
+                
+                if (prefetch.isComplete)
+                {
+                    // a result is delivered once, following requests go to the network
+                    completedPrefetch = prefetch;
+                    [_prefetches removeObjectIdenticalTo:prefetch];
+                }
+                else
+                {
+                    [prefetch.waiters addObject:waiter];
+                    prefetch.isPromoted = YES;
+                    prefetch.promotedPriority = MAX(prefetch.promotedPriority, SEDataRequestServiceTaskPriorityForQOS(qos));
+                    [self promotePrefetch:prefetch];
+                }
+            }
+        }
+    LEAVE_CRITICAL_SECTION(self)
+    
+    if (completedPrefetch != nil)
+    {
+        // delivered like cached content, off the calling thread and never inside the submitting call
+        dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+            waiter(completedPrefetch.result, completedPrefetch.response, nil);
+        });
+    }
+    return token;
+}
+
+- (void)completePrefetch:(SEDataRequestPrefetch *)prefetch result:(id)result response:(NSURLResponse *)response error:(NSError *)error
+{
+    NSArray<void (^)(id, NSURLResponse *, NSError *)> *waiters = nil;
+    ENTER_CRITICAL_SECTION(self)
+        prefetch.isComplete = YES;
+        prefetch.requestToken = nil;
+        waiters = [prefetch.waiters copy];
+        [prefetch.waiters removeAllObjects];
+        
+        NSUInteger index = [_prefetches indexOfObjectIdenticalTo:prefetch];
+        if (index != NSNotFound && waiters.count == 0 && error == nil)
+        {
+            // kept for a request that may still come
+            prefetch.result = result;
+            prefetch.response = response;
+            prefetch.completionTime = [NSProcessInfo processInfo].systemUptime;
+        }
+        else if (index != NSNotFound)
+        {
+            [_prefetches removeObjectAtIndex:index];
+        }
+    LEAVE_CRITICAL_SECTION(self)
+    
+    for (void (^waiter)(id, NSURLResponse *, NSError *) in waiters)
+    {
+        waiter(result, response, error);
+    }
+}
+
+/**
+ Cancels prefetches no request has attached to, keeping at most the given number of them in flight, the earliest ones.
+ Results of completed prefetches are discarded when requested.
+ */
+- (void)cancelPrefetchesKeepingCount:(NSUInteger)count discardingResults:(BOOL)discardResults
+{
+    NSMutableArray<id<SECancellableToken>> *requestTokens = nil;
+    ENTER_CRITICAL_SECTION(self)
+        NSUInteger inFlight = 0;
+        for (SEDataRequestPrefetch *prefetch in [_prefetches copy])
+        {
+            if (prefetch.isPromoted) continue;
+            if (prefetch.isComplete)
+            {
+                if (discardResults) [_prefetches removeObjectIdenticalTo:prefetch];
+                continue;
+            }
+            if (inFlight < count)
+            {
+                ++inFlight;
+                continue;
+            }
+            
+            [_prefetches removeObjectIdenticalTo:prefetch];
+            prefetch.isCancelled = YES;
+            if (prefetch.requestToken == nil) continue;
+            if (requestTokens == nil) requestTokens = [NSMutableArray new];
+            [requestTokens addObject:prefetch.requestToken];
+        }
+    LEAVE_CRITICAL_SECTION(self)
+    
+    for (id<SECancellableToken> requestToken in requestTokens)
+    {
+        [self cancelItemForToken:requestToken];
+    }
+}
+
+// Must be called in the request lock. Returns the request of a cancelled prefetch in flight, if any.
+- (SEInternalDataRequest *)removePrefetchForToken:(id<SECancellableToken>)token
+{
+    for (NSUInteger i = 0; i < _prefetches.count; ++i)
+    {
+        SEDataRequestPrefetch *prefetch = _prefetches[i];
+        if (prefetch.token != token) continue;
+        
+        // requests that have attached keep it going
+        if (prefetch.isPromoted) return nil;
+        
+        [_prefetches removeObjectAtIndex:i];
+        prefetch.isCancelled = YES;
+        return (prefetch.requestToken != nil) ? [_internalRequestsByKey objectForKey:prefetch.requestToken] : nil;
+    }
+    return nil;
+}
+
+// Must be called in the request lock
+- (void)promotePrefetch:(SEDataRequestPrefetch *)prefetch
+{
+    // the new priority orders admission and memory suspension like any request of the quality of service
+    NSURLSessionTask *task = (prefetch.requestToken != nil) ? [_internalRequestsByKey objectForKey:prefetch.requestToken].task : nil;
+    if (task != nil && task.priority < prefetch.promotedPriority) task.priority = prefetch.promotedPriority;
+}
+
+// Must be called in the request lock
+- (SEDataRequestPrefetch *)prefetchForKey:(NSString *)key
+{
+    for (SEDataRequestPrefetch *prefetch in _prefetches)
+    {
+        if ([prefetch.key isEqualToString:key]) return prefetch;
+    }
+    return nil;
+}
+
+// Must be called in the request lock
+- (NSUInteger)countOfPrefetchesInFlight
+{
+    NSUInteger count = 0;
+    for (SEDataRequestPrefetch *prefetch in _prefetches)
+    {
+        if (!prefetch.isComplete && !prefetch.isPromoted) ++count;
+    }
+    return count;
+}
+
+// Must be called in the request lock
+- (void)purgeExpiredPrefetches
+{
+    NSTimeInterval expirationTime = [NSProcessInfo processInfo].systemUptime - _prefetchTimeToLive;
+    NSIndexSet *expired = [_prefetches indexesOfObjectsPassingTest:^BOOL(SEDataRequestPrefetch *prefetch, NSUInteger idx, BOOL *stop) {
+        return prefetch.isComplete && prefetch.completionTime <= expirationTime;
+    }];
+    if (expired.count > 0) [_prefetches removeObjectsAtIndexes:expired];
+}
+
+// Must be called in the request lock. Drops the oldest unclaimed result when at capacity, returns NO if there is none.
+- (BOOL)makeRoomForPrefetch
+{
+    if (_prefetches.count < SEDataRequestServicePrefetchCapacity) return YES;
+    
+    for (NSUInteger i = 0; i < _prefetches.count; ++i)
+    {
+        if (!_prefetches[i].isComplete) continue;
+        [_prefetches removeObjectAtIndex:i];
+        return YES;
+    }
+    return NO;
+}
+
+#pragma mark - NSURLSessionDelegate
+
+- (void)URLSession:(NSURLSession *)session didReceiveChallenge:(NSURLAuthenticationChallenge *)challenge completionHandler:(void (^)(NSURLSessionAuthChallengeDisposition, NSURLCredential *))completionHandler
+{
+    // validation will take host into account and check if it's the 'safe' host or not, and will apply policy correspondingly.
+    BOOL accept = [self validateSecurityChallenge:challenge];
     if (accept)
     {
         SecTrustRef serverTrust = challenge.protectionSpace.serverTrust;
@@ -596,19 +2263,30 @@ static inline SEInternalDataRequest *SEDataRequestServiceInterlockedGetRequest(S
 
 - (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didCompleteWithError:(NSError *)error {
     SEInternalDataRequest *dataRequest = SEDataRequestServiceInterlockedGetRequest(self, task);
-    if (dataRequest) [dataRequest completeWithError:error];
+    if (dataRequest == nil) return;
+    
+    // requests that did not reach the host may wait in the outbox for connectivity instead of failing
+    if (SEDataRequestIsConnectivityError(error) && !dataRequest.isCompleted && [self deferInternalRequestToOutbox:dataRequest]) return;
+    
+    [dataRequest completeWithError:error];
 }
 
 - (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveResponse:(NSURLResponse *)response completionHandler:(void (^)(NSURLSessionResponseDisposition))completionHandler
 {
     SEInternalDataRequest *dataRequest = SEDataRequestServiceInterlockedGetRequest(self, dataTask);
     
-    if ((dataRequest == nil) || (dataRequest.isCompleted))
+    if ((dataRequest == nil) && [dataTask.taskDescription isEqualToString:SEDataRequestServicePrewarmTaskDescription])
+    {
+        // Let pre-warming requests finish normally, cancelling may close the connection that was just established.
+        completionHandler(NSURLSessionResponseAllow);
+    }
+    else if ((dataRequest == nil) || (dataRequest.isCompleted))
     {
         completionHandler(NSURLSessionResponseCancel);
     }
     else
     {
+        SEDataRequestServiceSampleRoundTripTime(_networkEstimator, dataRequest);
         if([dataRequest receivedURLResponse:response])
             completionHandler(NSURLSessionResponseAllow);
         else
@@ -620,7 +2298,12 @@ static inline SEInternalDataRequest *SEDataRequestServiceInterlockedGetRequest(S
 {
     SEInternalDataRequest *dataRequest = SEDataRequestServiceInterlockedGetRequest(self, dataTask);
     
-    if ((dataRequest != nil) && !dataRequest.isCompleted) [dataRequest receivedData:data];
+    if ((dataRequest != nil) && !dataRequest.isCompleted)
+    {
+        [dataRequest receivedData:data];
+        // streamed responses are not buffered, they are paused by their record handler instead
+        if (!dataRequest.isStreamingResponse) [self accountResponseLength:data.length ofInternalRequest:dataRequest];
+    }
 }
 
 - (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task needNewBodyStream:(void (^)(NSInputStream * _Nullable))completionHandler
@@ -667,15 +2350,20 @@ static inline SEInternalDataRequest *SEDataRequestServiceInterlockedGetRequest(S
     }
     
     NSError *error = nil;
-    NSURLRequest *urlRequest = [_secureRequestFactory createRequestWithMethod:method baseURL:[self safeBaseURL] path:path body:parameters mimeType:mimeType error:&error];
+    NSURLRequest *urlRequest = [_secureRequestFactory createRequestWithMethod:method context:self.requestContext path:path body:parameters mimeType:mimeType error:&error];
     
     if (urlRequest != nil)
     {
-        return [self createDataRequestWithURLRequest:urlRequest qos:SEDataRequestQOSDefault dataClass:class expectedHTTPCodes:nil success:success failure:failure completionQueue:completionQueue];
+        id<SECancellableToken> token = nil;
+        if ([method isEqualToString:SEDataRequestMethodGET])
+        {
+            token = [self attachToPrefetchWithURLRequest:urlRequest qos:SEDataRequestQOSDefault dataClass:class success:success failure:failure completionQueue:completionQueue];
+        }
+        return token ?: [self createDataRequestWithURLRequest:urlRequest qos:SEDataRequestQOSDefault dataClass:class expectedHTTPCodes:nil success:success failure:failure completionQueue:completionQueue];
     }
     else
     {
-        if (failure) dispatch_async(completionQueue, ^{ failure(error); });
+        if (failure) SEDataRequestDispatchSubmissionFailure(completionQueue, ^{ failure(error); });
         return nil;
     }
 }
@@ -683,50 +2371,158 @@ static inline SEInternalDataRequest *SEDataRequestServiceInterlockedGetRequest(S
 /** Creates and submits standard data task */
 - (id<SECancellableToken>) createDataRequestWithURLRequest: (NSURLRequest *) urlRequest qos: (SEDataRequestQualityOfService) qos dataClass:(Class) dataClass expectedHTTPCodes:(NSIndexSet *)expectedCodes success:(void (^)(id, NSURLResponse *))success failure:(void (^)(NSError *))failure completionQueue:(dispatch_queue_t)completionQueue
 {
+    return [self createDataRequestWithURLRequest:urlRequest qos:qos dataClass:dataClass expectedHTTPCodes:expectedCodes recordStream:nil success:success failure:failure completionQueue:completionQueue];
+}
+
+/** Creates and submits standard data task, which response is delivered to the record stream if there is one */
+- (id<SECancellableToken>) createDataRequestWithURLRequest: (NSURLRequest *) urlRequest qos: (SEDataRequestQualityOfService) qos dataClass:(Class) dataClass expectedHTTPCodes:(NSIndexSet *)expectedCodes recordStream:(SEInternalRecordStream *)recordStream success:(void (^)(id, NSURLResponse *))success failure:(void (^)(NSError *))failure completionQueue:(dispatch_queue_t)completionQueue
+{
+    urlRequest = SEDataRequestServiceApplyAdaptiveTimeout(self, urlRequest, urlRequest.HTTPBody.length);
+    urlRequest = SEDataRequestServiceApplyDeadline(self, urlRequest, qos);
     NSURLSessionDataTask *dataTask = [_session dataTaskWithRequest:urlRequest];
-    return [self createInternalRequestWithTask:dataTask qos:qos dataClass:dataClass expectedHTTPCodes:expectedCodes multipartContents:nil downloadParameters:nil success:success failure:failure completionQueue:completionQueue];
+    return [self createInternalRequestWithTask:dataTask qos:qos dataClass:dataClass expectedHTTPCodes:expectedCodes multipartContents:nil downloadParameters:nil recordStream:recordStream bodyStreamFactory:nil success:success failure:failure completionQueue:completionQueue];
 }
 
 /** Creates and submits upload data task with provided data */
 - (id<SECancellableToken>) createUploadRequestWithURLRequest: (NSURLRequest *) urlRequest qos: (SEDataRequestQualityOfService) qos data:(NSData *) data dataClass: (Class) dataClass expectedHTTPCodes:(NSIndexSet *) expectedCodes success:(void (^)(id, NSURLResponse *))success failure:(void (^)(NSError *))failure completionQueue:(dispatch_queue_t)completionQueue
 {
+    urlRequest = SEDataRequestServiceApplyAdaptiveTimeout(self, urlRequest, data.length);
+    urlRequest = SEDataRequestServiceApplyDeadline(self, urlRequest, qos);
     NSURLSessionDataTask *dataTask = [_session uploadTaskWithRequest:urlRequest fromData:data];
-    return [self createInternalRequestWithTask:dataTask qos:qos dataClass:dataClass expectedHTTPCodes:expectedCodes multipartContents:nil downloadParameters:nil success:success failure:failure completionQueue:completionQueue];
+    return [self createInternalRequestWithTask:dataTask qos:qos dataClass:dataClass expectedHTTPCodes:expectedCodes multipartContents:nil downloadParameters:nil recordStream:nil bodyStreamFactory:nil success:success failure:failure completionQueue:completionQueue];
 }
 
 /** Creates and submits upload data task with a file */
 - (id<SECancellableToken>) createUploadRequestWithURLRequest: (NSURLRequest *) urlRequest qos: (SEDataRequestQualityOfService) qos file:(NSURL *) dataFile dataClass:(Class) dataClass expectedHTTPCodes: (NSIndexSet *) expectedCodes success:(void (^)(id, NSURLResponse *))success failure:(void (^)(NSError *))failure completionQueue:(dispatch_queue_t)completionQueue
 {
+    urlRequest = SEDataRequestServiceApplyDeadline(self, urlRequest, qos);
     NSURLSessionDataTask *dataTask = [_session uploadTaskWithRequest:urlRequest fromFile:dataFile];
-    return [self createInternalRequestWithTask:dataTask qos:qos dataClass:dataClass expectedHTTPCodes:expectedCodes multipartContents:nil downloadParameters:nil success:success failure:failure completionQueue:completionQueue];
+    return [self createInternalRequestWithTask:dataTask qos:qos dataClass:dataClass expectedHTTPCodes:expectedCodes multipartContents:nil downloadParameters:nil recordStream:nil bodyStreamFactory:nil success:success failure:failure completionQueue:completionQueue];
 }
 
 /** Creates and submits streamed uploda data task - will have to provide the stream as well. Will use for some of the multipart submissions. */
 - (id<SECancellableToken>) createStreamedUploadRequestWithURLRequest: (NSURLRequest *) urlRequest qos:(SEDataRequestQualityOfService)qos dataClass:(Class) dataClass expectedHTTPCodes:(NSIndexSet *)expectedCodes multipartContents:(NSArray *)multipartContents boundary:(NSString *)boundary success:(void (^)(id, NSURLResponse *))success failure:(void (^)(NSError *))failure completionQueue:(dispatch_queue_t)completionQueue
 {
+    urlRequest = SEDataRequestServiceApplyDeadline(self, urlRequest, qos);
     NSURLSessionUploadTask *dataTask = [_session uploadTaskWithStreamedRequest:urlRequest];
     SEInternalMultipartContents *multipartParameters = (multipartContents == nil || boundary == nil) ? nil : [[SEInternalMultipartContents alloc] initWithMultipartContents:multipartContents boundary:boundary];
-    return [self createInternalRequestWithTask:dataTask qos:qos dataClass:dataClass expectedHTTPCodes:expectedCodes multipartContents:multipartParameters downloadParameters:nil success:success failure:failure completionQueue:completionQueue];
+    return [self createInternalRequestWithTask:dataTask qos:qos dataClass:dataClass expectedHTTPCodes:expectedCodes multipartContents:multipartParameters downloadParameters:nil recordStream:nil bodyStreamFactory:nil success:success failure:failure completionQueue:completionQueue];
+}
+
+/** Creates and submits streamed upload data task, which body is created by the factory each time it is sent */
+- (id<SECancellableToken>) createStreamedUploadRequestWithURLRequest: (NSURLRequest *) urlRequest qos:(SEDataRequestQualityOfService)qos dataClass:(Class) dataClass expectedHTTPCodes:(NSIndexSet *)expectedCodes recordStream:(SEInternalRecordStream *)recordStream bodyStreamFactory:(NSInputStream *(^)(void (^)(NSError *)))bodyStreamFactory success:(void (^)(id, NSURLResponse *))success failure:(void (^)(NSError *))failure completionQueue:(dispatch_queue_t)completionQueue
+{
+    urlRequest = SEDataRequestServiceApplyDeadline(self, urlRequest, qos);
+    NSURLSessionUploadTask *dataTask = [_session uploadTaskWithStreamedRequest:urlRequest];
+    return [self createInternalRequestWithTask:dataTask qos:qos dataClass:dataClass expectedHTTPCodes:expectedCodes multipartContents:nil downloadParameters:nil recordStream:recordStream bodyStreamFactory:bodyStreamFactory success:success failure:failure completionQueue:completionQueue];
 }
 
 - (id<SECancellableToken>) createDownloadRequestWithURLRequest: (NSURLRequest *) urlRequest qos:(SEDataRequestQualityOfService)qos saveFileAs: (NSURL *) saveAs expectedHTTPCodes:(NSIndexSet *)expectedCodes success:(void (^)(id, NSURLResponse *))success failure:(void (^)(NSError *))failure progress:(void (^)(int64_t, int64_t, int64_t))progress completionQueue:(dispatch_queue_t)completionQueue
 {
+    urlRequest = SEDataRequestServiceApplyDeadline(self, urlRequest, qos);
     NSURLSessionDownloadTask *downloadTask = [_session downloadTaskWithRequest:urlRequest];
     SEInternalDownloadRequestParameters *downloadRequestParameters = [[SEInternalDownloadRequestParameters alloc] initWithSaveAsURL:saveAs downloadProgressCallback:progress];
-    return [self createInternalRequestWithTask:downloadTask qos:qos dataClass:nil expectedHTTPCodes:nil multipartContents:nil downloadParameters:downloadRequestParameters success:success failure:failure completionQueue:completionQueue];
+    return [self createInternalRequestWithTask:downloadTask qos:qos dataClass:nil expectedHTTPCodes:nil multipartContents:nil downloadParameters:downloadRequestParameters recordStream:nil bodyStreamFactory:nil success:success failure:failure completionQueue:completionQueue];
 }
 
-- (id<SECancellableToken>) createInternalRequestWithTask: (NSURLSessionTask *) dataTask qos:(SEDataRequestQualityOfService)qos dataClass:(Class) dataClass expectedHTTPCodes:(NSIndexSet *)expectedCodes multipartContents:(SEInternalMultipartContents *)multipartContents downloadParameters:(SEInternalDownloadRequestParameters *)downloadParameters success:(void (^)(id, NSURLResponse *))success failure:(void (^)(NSError *))failure completionQueue:(dispatch_queue_t)completionQueue
+- (id<SECancellableToken>) createInternalRequestWithTask: (NSURLSessionTask *) dataTask qos:(SEDataRequestQualityOfService)qos dataClass:(Class) dataClass expectedHTTPCodes:(NSIndexSet *)expectedCodes multipartContents:(SEInternalMultipartContents *)multipartContents downloadParameters:(SEInternalDownloadRequestParameters *)downloadParameters recordStream:(SEInternalRecordStream *)recordStream bodyStreamFactory:(NSInputStream *(^)(void (^)(NSError *)))bodyStreamFactory success:(void (^)(id, NSURLResponse *))success failure:(void (^)(NSError *))failure completionQueue:(dispatch_queue_t)completionQueue
 {
-    dataTask.priority = SEDataRequestServiceTaskPriorityForQOS(qos);
+    // failing endpoints are not bothered until they recover
+    NSURL *url = dataTask.originalRequest.URL;
+    NSString *circuitEndpoint = (url != nil) ? [SEDataRequestCircuitBreakers endpointForURL:url] : nil;
+    if (circuitEndpoint != nil && ![_circuitBreakers shouldAllowRequestToEndpoint:circuitEndpoint])
+    {
+        [dataTask cancel];
+        NSError *error = [NSError errorWithDomain:SEErrorDomain code:SEDataRequestServiceCircuitOpen userInfo:@{ NSLocalizedDescriptionKey: @"Endpoint is temporarily unavailable", NSURLErrorFailingURLErrorKey: url }];
+        if (failure) SEDataRequestDispatchSubmissionFailure(completionQueue, ^{ failure(error); });
+        return nil;
+    }
+    
+    NSTimeInterval deadline = SEDataRequestServiceDeadlineOfRequest(dataTask.originalRequest);
+    if (deadline > 0 && deadline <= [NSProcessInfo processInfo].systemUptime)
+    {
+        [dataTask cancel];
+        NSError *error = SEDataRequestServiceDeadlineError(url);
+        if (failure) SEDataRequestDispatchSubmissionFailure(completionQueue, ^{ failure(error); });
+        return nil;
+    }
+    
+    // prefetches are admitted after everything else, until a request attaches to them
+    BOOL isPrefetch = [NSURLProtocol propertyForKey:SEDataRequestServicePrefetchProperty inRequest:dataTask.originalRequest] != nil;
+    dataTask.priority = isPrefetch ? SEDataRequestServicePrefetchTaskPriority : SEDataRequestServiceTaskPriorityForQOS(qos);
     SEInternalDataRequest *internalRequest = [[SEInternalDataRequest alloc] initWithSessionTask:dataTask requestService:self qualityOfService:qos responseDataClass:dataClass expectedHTTPCodes:expectedCodes multipartContents:multipartContents downloadParameters:downloadParameters success:success failure:failure completionQueue:completionQueue];
+    internalRequest.circuitEndpoint = circuitEndpoint;
+    NSString *routeGroup = (url != nil) ? [_rateLimiter routeGroupForURL:url] : nil;
+    internalRequest.routeGroup = routeGroup;
+    internalRequest.deadline = deadline;
+    internalRequest.tag = [NSURLProtocol propertyForKey:SEDataRequestServiceTagProperty inRequest:dataTask.originalRequest];
+    internalRequest.recordStream = recordStream;
+    internalRequest.bodyStreamFactory = bodyStreamFactory;
+    
+    SEDataRequestContentCache *contentCache = self.contentCache;
+    if (contentCache != nil && [NSURLProtocol propertyForKey:SEDataRequestServiceContentCacheProperty inRequest:dataTask.originalRequest] != nil)
+    {
+        // the cache decides whether the response may be stored
+        internalRequest.contentHandler = ^(NSURLResponse *response, NSData *data, NSURL *fileURL) {
+            if (![response isKindOfClass:[NSHTTPURLResponse class]]) return;
+            if (fileURL != nil) [contentCache storeContentOfFileAtURL:fileURL response:(NSHTTPURLResponse *)response forURL:url];
+            else [contentCache storeData:data ?: [NSData data] response:(NSHTTPURLResponse *)response forURL:url];
+        };
+    }
     
+    // mutating requests submitted while offline wait in the outbox instead of failing
+    BOOL suspended = (self.reachabilityStatus == SENetworkReachabilityStatusNotReachable) && [self journalInternalRequest:internalRequest];
+    NSTimeInterval rateDelay = 0;
     ENTER_CRITICAL_SECTION(self)
         [_internalRequestsByKey setObject:internalRequest forKey:internalRequest.token];
         [_internalRequestsByTask setObject:internalRequest forKey:@(dataTask.taskIdentifier)];
+        
+        // while authorization is being refreshed, authorized requests wait for it instead of failing with the rejected header
+        if (!suspended && _isRefreshingAuthorization && SEDataRequestServiceCanReplayRequest(internalRequest) && [dataTask.originalRequest valueForHTTPHeaderField:@"Authorization"] != nil)
+        {
+            [_requestsAwaitingAuthorization addObject:internalRequest];
+            suspended = YES;
+        }
+        
+        // requests over the rate of their route group are started later rather than sent to be rejected
+        if (!suspended && routeGroup != nil)
+        {
+            rateDelay = [_rateLimiter reserveRequestForRouteGroup:routeGroup];
+            suspended = (rateDelay > 0);
+        }
+        
+        // requests over the link concurrency limit wait for a free slot
+        if (!suspended && _admittedRequests.count >= _linkParameters.maxConcurrentRequests)
+        {
+            [_requestsAwaitingAdmission addObject:internalRequest];
+            suspended = YES;
+        }
+        else if (!suspended)
+        {
+            [_admittedRequests addObject:internalRequest.token];
+        }
     LEAVE_CRITICAL_SECTION(self)
     
-    [dataTask resume];
+    if (deadline > 0)
+    {
+        // expires wherever the request is at the time: waiting, in flight or being parsed
+        [self expireInternalRequest:internalRequest atDeadline:deadline];
+    }
+    
+    if (rateDelay > 0 && deadline > 0 && [NSProcessInfo processInfo].systemUptime + rateDelay >= deadline)
+    {
+        // would only be started to be expired
+        [internalRequest expireWithError:SEDataRequestServiceDeadlineError(url)];
+    }
+    else if (rateDelay > 0)
+    {
+        [self admitInternalRequest:internalRequest afterDelay:rateDelay];
+    }
+    else if (!suspended)
+    {
+        internalRequest.startTime = [NSProcessInfo processInfo].systemUptime;
+        [dataTask resume];
+    }
     
     return internalRequest.token;
 }
@@ -734,10 +2530,18 @@ static inline SEInternalDataRequest *SEDataRequestServiceInterlockedGetRequest(S
 
 #pragma mark - Reachability Tracking Delegation
 
-- (void)networkReachabilityTracker:(SENetworkReachabilityTracker *)tracker didUpdateStatus:(SENetworkReachabilityStatus)status
+- (void)networkReachabilityTracker:(id<SENetworkReachabilitySource>)tracker didUpdateStatus:(SENetworkReachabilityStatus)status
 {
     SELog(@"Reachability changed: %@", tracker);
+    // estimate of the previous link says nothing about the new one
+    [_networkEstimator reset];
+    [self updateLinkParameters];
     [[NSNotificationCenter defaultCenter] postNotificationName:SEDataRequestServiceChangedReachabilityNotification object:self userInfo:@{ SEDataRequestServiceChangedReachabilityStatusKey: @(status) }];
+    
+    if (status == SENetworkReachabilityStatusReachableLocal || status == SENetworkReachabilityStatusReachableViaWiFi || status == SENetworkReachabilityStatusReachableViaWWAN)
+    {
+        [self flushOutbox];
+    }
 }
 
 
@@ -769,18 +2573,9 @@ static inline SEInternalDataRequest *SEDataRequestServiceInterlockedGetRequest(S
 
 - (void) expireBackgroundWaitForCompletion
 {
-    NSArray *incompleteTasks = nil;
-    ENTER_CRITICAL_SECTION(self)
-        if (_internalRequestsByKey.count > 0)
-        {
-            incompleteTasks = [_internalRequestsByKey allValues];
-        }
-    LEAVE_CRITICAL_SECTION(self)
-    
-    if (incompleteTasks != nil)
-    {
-        for (SEInternalDataRequest *task in incompleteTasks) [task cancelAndNotifyComplete:YES];
-    }
+    [self cancelInternalRequestsPassingTest:^BOOL(SEInternalDataRequest *request) {
+        return YES;
+    }];
 }
 
 #endif
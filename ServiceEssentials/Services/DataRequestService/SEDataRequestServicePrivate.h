@@ -29,14 +29,18 @@ extern NSString * _Nonnull const SEDataRequestMethodPOST;
 extern NSString * _Nonnull const SEDataRequestMethodPUT;
 extern NSString * _Nonnull const SEDataRequestMethodDELETE;
 extern NSString * _Nonnull const SEDataRequestMethodHEAD;
+extern NSString * _Nonnull const SEDataRequestMethodPATCH;
 
 @protocol SECancellableToken;
 @class SEInternalDataRequest;
 @class SEInternalDataRequestBuilder;
+@class SEInternalDataRequestTemplate;
 
 @protocol SEDataRequestServicePrivate <NSObject, SECancellableItemService>
-/** Called when a data request is complete. Removes the request from internal data structures */
+/** Called when a data request is complete, on the thread that has completed it. Removes the request from internal data structures */
 - (void) completeInternalRequest: (nonnull SEInternalDataRequest *) request;
+/** Number of requests the service keeps track of, including requests waiting for admission. For diagnostics. */
+- (NSUInteger) registeredRequestCount;
 /** Returns a serializer for a specified MIME type. Returns default serializer when explicit serializer was not found */
 - (nullable SEDataSerializer *) serializerForMIMEType: (nonnull NSString *) mimeType;
 /** Returns a serializer for a specified MIME type. Returns `nil` when explicit serializer was not found */
@@ -45,11 +49,40 @@ extern NSString * _Nonnull const SEDataRequestMethodHEAD;
 /** Submits a request with parameters specified by the builder. */
 - (nullable id<SECancellableToken>)submitRequestWithBuilder: (nonnull SEInternalDataRequestBuilder *) requestBuilder asUpload: (BOOL) asUpload;
 
+/** Tags a request that is in progress */
+- (void) setTag: (nonnull NSString *) tag forRequest: (nonnull id<SECancellableToken>) token;
+
+/**
+ Called when a request fails with HTTP 401.
+ Returns `YES` if the service takes over the request to replay it after authorization refresh, and will complete it eventually.
+ */
+- (BOOL)internalRequestFailedAuthorization: (nonnull SEInternalDataRequest *) request;
+
+/** Submits a request described by a template. */
+- (nullable id<SECancellableToken>)submitRequestWithTemplate: (nonnull SEInternalDataRequestTemplate *) requestTemplate
+                                              pathParameters: (nullable NSDictionary<NSString *, id> *) pathParameters
+                                                  parameters: (nullable NSDictionary<NSString *, id> *) parameters
+                                                     success: (nonnull void(^)(id _Nullable data, NSURLResponse * _Nonnull response)) success
+                                                     failure: (nullable void (^)(NSError * _Nonnull error)) failure
+                                             completionQueue: (nullable dispatch_queue_t) completionQueue;
+
 - (NSStringEncoding) stringEncoding;
 @end
 
 /* Utilities */
 
+// Marks requests built against the environment base URL, only these carry headers meant for the server of the environment
+static NSString * _Nonnull const SEDataRequestEnvironmentRequestProperty = @"com.service-essentials.DataRequestService.environment";
+
+// Category of the spans the service records to the shared timeline
+static char const * _Nonnull const SEDataRequestTimelineCategory = "network";
+
+// Determines if request parameters go to the body for a method (as opposed to URL query)
+static inline BOOL SEDataRequestMethodURLEncodesBody(NSString * _Nonnull method)
+{
+    return !([method isEqualToString:SEDataRequestMethodGET] || [method isEqualToString:SEDataRequestMethodHEAD] || [method isEqualToString:SEDataRequestMethodDELETE]);
+}
+
 // Verify Quality of Service value
 static inline void SEDataRequestVerifyQOS(SEDataRequestQualityOfService qualityOfService)
 {
@@ -130,6 +163,38 @@ static inline BOOL SECanDeserializeToClass(Class _Nonnull klass)
 
 typedef void (^ SEFailureBlock)(NSError * _Nonnull error);
 
+// Invokes a callback on the completion queue, or right away on the calling thread when there is no queue
+static inline void SEDataRequestDispatchCompletion(dispatch_queue_t _Nullable completionQueue, dispatch_block_t _Nonnull block)
+{
+    if (completionQueue != nil) dispatch_async(completionQueue, block);
+    else block();
+}
+
+// Invokes a failure found while a request is being submitted. It is never invoked inside the submitting call,
+// which the caller may not expect to re-enter it, so without a completion queue it runs on a global queue.
+static inline void SEDataRequestDispatchSubmissionFailure(dispatch_queue_t _Nullable completionQueue, dispatch_block_t _Nonnull block)
+{
+    dispatch_async(completionQueue ?: dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), block);
+}
+
+// Only errors which guarantee that the request has not reached the server, so that sending it again is safe
+static inline BOOL SEDataRequestIsConnectivityError(NSError * _Nonnull error)
+{
+    if (![error.domain isEqualToString:NSURLErrorDomain]) return NO;
+    switch (error.code)
+    {
+        case NSURLErrorNotConnectedToInternet:
+        case NSURLErrorCannotFindHost:
+        case NSURLErrorCannotConnectToHost:
+        case NSURLErrorDNSLookupFailed:
+        case NSURLErrorDataNotAllowed:
+        case NSURLErrorInternationalRoamingOff:
+            return YES;
+        default:
+            return NO;
+    }
+}
+
 static inline BOOL SEVerifyClassForDeserialization(Class _Nonnull klass, SEFailureBlock _Nonnull failure, dispatch_queue_t _Nullable completionQueue)
 {
     if (!SECanDeserializeToClass(klass))
@@ -139,7 +204,7 @@ static inline BOOL SEVerifyClassForDeserialization(Class _Nonnull klass, SEFailu
         THROW_INVALID_PARAM(klass, (@{ NSLocalizedDescriptionKey: reason }));
 #else
         if (failure != nil) {
-            dispatch_async(completionQueue, ^{
+            SEDataRequestDispatchSubmissionFailure(completionQueue, ^{
                 failure([NSError errorWithDomain:SEErrorDomain code:SEDataRequestServiceSerializationFailure userInfo:@{ NSLocalizedDescriptionKey: reason }]);
             });
         }
@@ -14,6 +14,7 @@
 @protocol SEDataRequestServicePrivate;
 @protocol SECancellableToken;
 @class SEMultipartRequestContentPart;
+@class SEInternalRecordStream;
 
 @interface SEInternalMultipartContents : NSObject
 - (instancetype) initWithMultipartContents: (NSArray<SEMultipartRequestContentPart *> *) multipartContents boundary:(NSString *)boundary;
@@ -41,12 +42,45 @@
                      completionQueue:(dispatch_queue_t)completionQueue;
 
 @property (nonatomic, readonly, retain) id<SECancellableToken> token;
-@property (nonatomic, readonly, retain) NSURLSessionTask *task;
+@property (atomic, readonly, retain) NSURLSessionTask *task;
 @property (nonatomic, readonly, assign) SEDataRequestQualityOfService qualityOfService;
+@property (nonatomic, readonly, strong) SEInternalMultipartContents *multipartContents;
+/** Set once a request has been replayed after authorization refresh, a request is never replayed twice */
+@property (atomic, assign) BOOL isReplayed;
+/** System uptime when the current task has been resumed */
+@property (atomic, assign) NSTimeInterval startTime;
+/** System uptime when the response of the current task has been received, 0 before that */
+@property (atomic, assign) NSTimeInterval responseTime;
+/** Endpoint which circuit breaker has admitted the request, outcome is reported back to it */
+@property (atomic, copy) NSString *circuitEndpoint;
+/** Route group of the rate limiter, responses asking to slow down pause it */
+@property (atomic, copy) NSString *routeGroup;
+/** Tag for bulk cancellation, guarded by the request lock of the service */
+@property (nonatomic, copy) NSString *tag;
+/** System uptime by which the request must complete, 0 if there is no deadline */
+@property (atomic, assign) NSTimeInterval deadline;
+/** Response bytes counted against the memory budget of the service, guarded by the request lock of the service */
+@property (nonatomic, assign) int64_t bufferedLength;
+/**
+ Invoked with the raw response when the request succeeds, right before the success callback is dispatched.
+ Downloads pass the file the content has been saved to instead of data.
+ */
+@property (atomic, copy) void (^contentHandler)(NSURLResponse *response, NSData *data, NSURL *fileURL);
+/** Splits the response body into records as it arrives, set before the task is resumed */
+@property (nonatomic, strong) SEInternalRecordStream *recordStream;
+/** Whether the response body goes to the record stream instead of being buffered, known once the response is received */
+@property (atomic, readonly, assign) BOOL isStreamingResponse;
+/** Creates a stream of the request body encoded as it is sent, the stream reports errors of encoding to the failure block */
+@property (nonatomic, copy) NSInputStream *(^bodyStreamFactory)(void (^failure)(NSError *error));
 
 @property (nonatomic, readonly, assign) BOOL isCompleted;
 
-- (void) cancelAndNotifyComplete:(BOOL)notifyComplete;
+/** Returns `YES` if the request has been cancelled by this call, `NO` if it was already complete */
+- (BOOL) cancelAndNotifyComplete:(BOOL)notifyComplete;
+/** Replaces the task of the request that is going to be sent again. Returns `NO` if request has been completed or cancelled meanwhile. */
+- (BOOL) replaceTask: (NSURLSessionTask *) task;
+/** Fails the request with the error unless it is complete already, the task is cancelled */
+- (void) expireWithError: (NSError *) error;
 - (void) completeWithError: (NSError *) error;
 - (void) receivedData: (NSData *) data;
 - (BOOL) receivedURLResponse: (NSURLResponse *) response;
@@ -55,4 +89,7 @@
 
 - (NSInputStream *) createStream;
 
+/** Converts a deserialized JSON dictionary or array to instances of the class, as requests with a response data class do */
++ (id) deserializeResult: (id) result toClass: (Class) dataClass error: (NSError * __autoreleasing *) error;
+
 @end
@@ -19,26 +19,41 @@
 #import <ServiceEssentials/SEDataSerializer.h>
 #import <ServiceEssentials/SECancellableTokenImpl.h>
 #import <ServiceEssentials/SEMultipartRequestContentStream.h>
+#import <ServiceEssentials/SETimeline.h>
+#import "SEInternalRecordStream.h"
 
 #define COMPLETED_REQUEST_BIT       0 // signals that request has been completed
 #define CANCELLED_REQUEST_BIT       1 // signals that request has been cancelled, this bit will also be set by completed callback
 
+// Spans of a request share a track of the timeline
+static inline uint64_t SEInternalDataRequestTimelineIdentifier(SEInternalDataRequest *request)
+{
+    return (uint64_t)(uintptr_t)request;
+}
+
+// Service cleanup runs inline on the calling thread, so the request leaves the registry before its callback is dispatched.
+// For completed tasks that is the delegate queue of the session, which then also admits waiting requests and finishes the outbox record,
+// the same queue that pumps the outbox and resends requests, so the cleanup has to stay cheap: the `cleanup` span of the timeline shows its cost.
+// Callers must not hold the request lock of the service and must keep a strong reference to the request,
+// which delegate callbacks, tokens and service loops all do.
 static inline void SEDataRequestSendCompletionToService(id<SEDataRequestServicePrivate> service, SEInternalDataRequest *request)
 {
-    if (service)
-    {
-        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
-            [service completeInternalRequest:request];
-        });
-    }
+    NSTimeInterval cleanupTime = SETimelineBegin();
+    [service completeInternalRequest:request];
+    SETimelineEnd(cleanupTime, "cleanup", SEDataRequestTimelineCategory, SEInternalDataRequestTimelineIdentifier(request));
 }
 
+@interface SEInternalDataRequest ()
+// task is replaced on replay while it may be read by other threads
+@property (atomic, readwrite, retain) NSURLSessionTask *task;
+@property (atomic, readwrite, assign) BOOL isStreamingResponse;
+@end
+
 @implementation SEInternalDataRequest
 {
     __weak id<SEDataRequestServicePrivate> _requestService;
     __unsafe_unretained Class _dataClass;
     NSIndexSet *_expectedHTTPCodes;
-    SEInternalMultipartContents *_multipartContents;
     SEInternalDownloadRequestParameters *_downloadRequestParameters;
     void (^_success)(id data, NSURLResponse *response);
     void (^_failure)(NSError *error);
@@ -47,6 +62,10 @@ static inline void SEDataRequestSendCompletionToService(id<SEDataRequestServiceP
     
     NSMutableData *_data;
     NSURLResponse *_response;
+    
+    // timeline phases, only used on the delegate queue of the session; 0 unless the timeline is enabled
+    NSTimeInterval _timelineResponseTime;
+    NSTimeInterval _timelineFirstByteTime;
 }
 
 - (instancetype)initWithSessionTask:(NSURLSessionTask *)task requestService:(id<SEDataRequestServicePrivate>)requestService qualityOfService:(SEDataRequestQualityOfService)qualityOfService responseDataClass:(__unsafe_unretained Class)dataClass expectedHTTPCodes:(NSIndexSet *)expectedCodes multipartContents:(SEInternalMultipartContents *)multipartContents downloadParameters:(SEInternalDownloadRequestParameters *)downloadParameters success:(void (^)(id, NSURLResponse *))success failure:(void (^)(NSError *))failure completionQueue:(dispatch_queue_t)completionQueue
@@ -78,6 +97,7 @@ static inline void SEDataRequestSendCompletionToService(id<SEDataRequestServiceP
     if (!wasCompleted)
     {
         [_task cancel];
+        [_recordStream cancel];
         
         // cannot do anything that causes a retain of self, need to be very careful
         // cannot make a block that uses self
@@ -89,7 +109,7 @@ static inline void SEDataRequestSendCompletionToService(id<SEDataRequestServiceP
         NSError *error = [NSError errorWithDomain:SEErrorDomain code:SEDataRequestServiceRequestCancelled userInfo:nil];
         if (failureBlock)
         {
-            dispatch_async(_completionQueue, ^{
+            SEDataRequestDispatchCompletion(_completionQueue, ^{
                 failureBlock(error);
             });
         }
@@ -112,25 +132,58 @@ static inline void SEDataRequestSendCompletionToService(id<SEDataRequestServiceP
     return _completed != 0;
 }
 
-- (void)cancelAndNotifyComplete:(BOOL)notifyComplete
+- (BOOL)cancelAndNotifyComplete:(BOOL)notifyComplete
 {
     // always set 'completed' first, then 'cancelled'
     bool wasCompleted = OSAtomicTestAndSet(COMPLETED_REQUEST_BIT, &_completed);
     if (!wasCompleted)
     {
         OSAtomicTestAndSet(CANCELLED_REQUEST_BIT, &_completed);
-        [_task cancel];
+        [self.task cancel];
+        [_recordStream cancel];
         if (notifyComplete)
         {
             SEDataRequestSendCompletionToService(_requestService, self);
         }
     }
+    return !wasCompleted;
+}
+
+- (void)expireWithError:(NSError *)error
+{
+    bool wasCompleted = OSAtomicTestAndSet(COMPLETED_REQUEST_BIT, &_completed);
+    if (!wasCompleted)
+    {
+        [self.task cancel];
+        [self sendFailureAndComplete:error checkBeforeCallback:YES];
+    }
+}
+
+- (BOOL)replaceTask:(NSURLSessionTask *)task
+{
+    _data = nil;
+    _response = nil;
+    _timelineResponseTime = 0;
+    _timelineFirstByteTime = 0;
+    self.isStreamingResponse = NO;
+    self.responseTime = 0;
+    self.task = task;
+    
+    // if the request is cancelled concurrently, the cancellation may have missed the new task
+    if (_completed)
+    {
+        [task cancel];
+        return NO;
+    }
+    return YES;
 }
 
 - (void)completeWithError:(NSError *)error
 {
     if (_completed) return;
     
+    SETimelineEnd(_timelineFirstByteTime > 0 ? _timelineFirstByteTime : _timelineResponseTime, "body complete", SEDataRequestTimelineCategory, SEInternalDataRequestTimelineIdentifier(self));
+    
     if (error)
     {
         [self failedWithError:error];
@@ -141,10 +194,21 @@ static inline void SEDataRequestSendCompletionToService(id<SEDataRequestServiceP
     // If there was an error, it will contain deserialized data if deserialization was possible and there was data.
     if (error != nil)
     {
+        // Service may recover from authorization failure by refreshing authorization and replaying the request
+        if (!_isReplayed && ((NSHTTPURLResponse *)_response).statusCode == 401 && [_requestService internalRequestFailedAuthorization:self]) return;
+
         [self failedWithError:error];
         return;
     }
     
+    if (self.isStreamingResponse)
+    {
+        // records have been delivered as they arrived, only the last one may be left
+        if ([_recordStream finishWithError:&error]) [self finalizeCompleteRequestSuccessfulWithResult:nil];
+        else [self failedWithError:error];
+        return;
+    }
+    
     id result = nil;
     
     // Some requests don't return any response for a valid reason.
@@ -152,6 +216,7 @@ static inline void SEDataRequestSendCompletionToService(id<SEDataRequestServiceP
     // So a successful response may contain no data and there is nothing to deserialize
     if (_data != nil && _data.length > 0)
     {
+        NSTimeInterval deserializeTime = SETimelineBegin();
         SEDataSerializer *serializer = [_requestService serializerForMIMEType:_response.MIMEType];
         if (serializer == nil)
         {
@@ -171,20 +236,9 @@ static inline void SEDataRequestSendCompletionToService(id<SEDataRequestServiceP
 #endif
         if (error == nil && _dataClass != nil)
         {
-            if ([result isKindOfClass:[NSDictionary class]])
-            {
-                result = [_dataClass deserializeFromJSON: result];
-                if (result == nil) error = [NSError errorWithDomain:SEErrorDomain code:SEDataRequestServiceSerializationFailure userInfo:nil];
-            }
-            else if ([result isKindOfClass:[NSArray class]])
-            {
-                result = [SEInternalDataRequest deserializeArray:result toClass:_dataClass error:&error];
-            }
-            else
-            {
-                error = [NSError errorWithDomain:SEErrorDomain code:SEDataRequestServiceSerializationFailure userInfo:@{ NSLocalizedDescriptionKey: @"Incompatible data type for deserialization." }];
-            }
+            result = [SEInternalDataRequest deserializeResult:result toClass:_dataClass error:&error];
         }
+        SETimelineEnd(deserializeTime, "deserialize", SEDataRequestTimelineCategory, SEInternalDataRequestTimelineIdentifier(self));
     }
 
     if (error != nil)
@@ -193,11 +247,31 @@ static inline void SEDataRequestSendCompletionToService(id<SEDataRequestServiceP
         return;
     }
     
+    void (^contentHandler)(NSURLResponse *, NSData *, NSURL *) = self.contentHandler;
+    if (contentHandler != nil && !_completed) contentHandler(_response, _data, nil);
+    
     [self finalizeCompleteRequestSuccessfulWithResult:result];
 }
 
 - (void)receivedData:(NSData *)data
 {
+    if (_timelineResponseTime > 0 && _timelineFirstByteTime == 0)
+    {
+        _timelineFirstByteTime = SETimelineBegin();
+        SETimelineEnd(_timelineResponseTime, "first byte", SEDataRequestTimelineCategory, SEInternalDataRequestTimelineIdentifier(self));
+    }
+    
+    if (self.isStreamingResponse)
+    {
+        NSError *error = nil;
+        if (![_recordStream appendData:data error:&error])
+        {
+            [self failedWithError:error];
+            [self.task cancel];
+        }
+        return;
+    }
+    
     // No need for locking since the sequence of events is such that data is accumulated in chunks and only then task is completed
     if (_data == nil) _data  = [[NSMutableData alloc] initWithData:data];
     else [_data appendData:data];
@@ -212,12 +286,34 @@ static inline void SEDataRequestSendCompletionToService(id<SEDataRequestServiceP
 
     // Still receive data since even a faulty response may contain valuable body
     _response = response;
+    
+    // the request has been sending since its task was resumed
+    _timelineResponseTime = SETimelineBegin();
+    NSTimeInterval startTime = self.startTime;
+    if (_timelineResponseTime > 0 && startTime > 0)
+    {
+        [[SETimeline sharedTimeline] recordSpanWithName:"send" category:SEDataRequestTimelineCategory beginTime:startTime endTime:_timelineResponseTime identifier:SEInternalDataRequestTimelineIdentifier(self)];
+    }
+    
+    // faulty responses are buffered as usual, so that the error contains their body
+    if (_recordStream != nil && [response isKindOfClass:[NSHTTPURLResponse class]] && [_expectedHTTPCodes containsIndex:((NSHTTPURLResponse *)response).statusCode])
+    {
+        _recordStream.task = self.task;
+        self.isStreamingResponse = YES;
+    }
     return YES;
 }
 
 - (NSInputStream *)createStream
 {
     if (_completed) return nil;
+    if (_bodyStreamFactory != nil)
+    {
+        __weak typeof(self) weakSelf = self;
+        return _bodyStreamFactory(^(NSError *error) {
+            [weakSelf expireWithError:error];
+        });
+    }
     if (_multipartContents == nil) return nil;
     return [[SEMultipartRequestContentStream alloc] initWithParts:_multipartContents.multipartContents boundary:_multipartContents.boundary stringEncoding:[_requestService stringEncoding]];
 }
@@ -244,6 +340,8 @@ static inline void SEDataRequestSendCompletionToService(id<SEDataRequestServiceP
         // 2. Invoke a completion callback
         if ([fileManager moveItemAtURL:location toURL:_downloadRequestParameters.saveAsURL error:&error])
         {
+            void (^contentHandler)(NSURLResponse *, NSData *, NSURL *) = self.contentHandler;
+            if (contentHandler != nil) contentHandler(self.task.response, nil, _downloadRequestParameters.saveAsURL);
             [self finalizeCompleteRequestSuccessfulWithResult:nil];
         }
         else
@@ -260,7 +358,7 @@ static inline void SEDataRequestSendCompletionToService(id<SEDataRequestServiceP
     void (^progress)(int64_t, int64_t, int64_t) = _downloadRequestParameters.progress;
     if (progress != nil)
     {
-        dispatch_async(_completionQueue, ^{
+        SEDataRequestDispatchCompletion(_completionQueue, ^{
             if (!_completed) progress(bytesWritten, totalBytesWritten, totalBytesExpectedToWrite);
         });
     }
@@ -315,10 +413,14 @@ static inline void SEDataRequestSendCompletionToService(id<SEDataRequestServiceP
     void (^completion)(id, NSURLResponse *) = _success;
     if (completion)
     {
-        dispatch_async(_completionQueue, ^{
+        // the span includes the wait for the completion queue
+        NSTimeInterval callbackTime = SETimelineBegin();
+        uint64_t timelineIdentifier = SEInternalDataRequestTimelineIdentifier(self);
+        SEDataRequestDispatchCompletion(_completionQueue, ^{
             // need to check for cancellation right before here
             if (!OSAtomicTestAndSet(CANCELLED_REQUEST_BIT, &_completed))
                 completion(result, response);
+            SETimelineEnd(callbackTime, "callback", SEDataRequestTimelineCategory, timelineIdentifier);
         });
     }
 }
@@ -334,16 +436,21 @@ static inline void SEDataRequestSendCompletionToService(id<SEDataRequestServiceP
 
 - (void) sendFailureAndComplete: (NSError *) error checkBeforeCallback: (BOOL) checkBeforeCallback
 {
+    [_recordStream cancel];
+    
     // send completion first so that data service can perform the cleanup, then send the callback
     SEDataRequestSendCompletionToService(_requestService, self);
     
     void (^failureBlock)(NSError *) = _failure;
     if (failureBlock)
     {
-        dispatch_async(_completionQueue, ^{
+        NSTimeInterval callbackTime = SETimelineBegin();
+        uint64_t timelineIdentifier = SEInternalDataRequestTimelineIdentifier(self);
+        SEDataRequestDispatchCompletion(_completionQueue, ^{
             // need to check for cancellation right before here
             if (!checkBeforeCallback || !OSAtomicTestAndSet(CANCELLED_REQUEST_BIT, &_completed))
                 failureBlock(error);
+            SETimelineEnd(callbackTime, "callback", SEDataRequestTimelineCategory, timelineIdentifier);
         });
     }
 }
@@ -386,6 +493,25 @@ static inline void SEDataRequestSendCompletionToService(id<SEDataRequestServiceP
 
 #pragma mark - Helpful functions
 
++ (id)deserializeResult:(id)result toClass:(Class)dataClass error:(NSError * __autoreleasing *)error
+{
+    if ([result isKindOfClass:[NSDictionary class]])
+    {
+        id object = [dataClass deserializeFromJSON: result];
+        if (object == nil && error != nil) *error = [NSError errorWithDomain:SEErrorDomain code:SEDataRequestServiceSerializationFailure userInfo:nil];
+        return object;
+    }
+    else if ([result isKindOfClass:[NSArray class]])
+    {
+        return [SEInternalDataRequest deserializeArray:result toClass:dataClass error:error];
+    }
+    else
+    {
+        if (error != nil) *error = [NSError errorWithDomain:SEErrorDomain code:SEDataRequestServiceSerializationFailure userInfo:@{ NSLocalizedDescriptionKey: @"Incompatible data type for deserialization." }];
+        return nil;
+    }
+}
+
 + (NSArray *) deserializeArray: (NSArray *) array toClass: (Class) dataClass error: (NSError * __autoreleasing *) error
 {
     NSError *innerError = nil;
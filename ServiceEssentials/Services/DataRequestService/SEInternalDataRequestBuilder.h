@@ -31,7 +31,14 @@
 @property (nonatomic, readonly, strong, nullable) NSIndexSet *expectedHTTPCodes;
 @property (nonatomic, readonly, strong, nullable) NSDictionary<NSString *, id> *bodyParameters;
 @property (nonatomic, readonly, strong, nullable) NSData *body;
+@property (nonatomic, readonly, strong, nullable) id streamedBody;
+@property (nonatomic, readonly, strong, nullable) NSEnumerator * _Nonnull (^streamedBodyRecords)(void);
 @property (nonatomic, readonly, strong, nullable) NSArray<SEMultipartRequestContentPart *> *contentParts;
 @property (nonatomic, readonly, strong, nullable) NSNumber *canSendInBackground;
+@property (nonatomic, readonly, strong, nullable) NSString *tag;
+@property (nonatomic, readonly, strong, nullable) NSDate *deadline;
+@property (nonatomic, readonly, assign) SEDataRequestStreamFormat streamFormat;
+@property (nonatomic, readonly, strong, nullable) void (^recordHandler)(NSArray * _Nonnull);
+@property (nonatomic, readonly, assign) NSUInteger maxPendingRecords;
 
 @end
@@ -16,6 +16,8 @@
 
 #define INVALID_BUILDER_PARAM(param) THROW_INVALID_PARAM(param, nil);
 
+static NSUInteger const SEDataRequestDefaultMaxPendingRecords = 256;
+
 @implementation SEInternalDataRequestBuilder
 {
     __weak id<SEDataRequestServicePrivate> _dataRequestService;
@@ -37,6 +39,7 @@
         _dataRequestService = dataRequestService;
         _acceptContentType = SEDataRequestAcceptContentTypeJSON;
         _qualityOfService = SEDataRequestQOSDefault;
+        _maxPendingRecords = SEDataRequestDefaultMaxPendingRecords;
     }
     return self;
 }
@@ -55,6 +58,11 @@
 
 #pragma mark - Builder Interface
 
+- (id<SEDataRequestCustomizer>)GET:(NSString *)path success:(void (^)(id _Nonnull, NSURLResponse * _Nonnull))success failure:(void (^)(NSError * _Nonnull))failure completionQueue:(dispatch_queue_t)completionQueue
+{
+    return [self requestWithMethod:SEDataRequestMethodGET path:path success:success failure:failure completionQueue:completionQueue];
+}
+
 - (id<SEDataRequestCustomizer>)POST:(NSString *)path success:(void (^)(id _Nonnull, NSURLResponse * _Nonnull))success failure:(void (^)(NSError * _Nonnull))failure completionQueue:(dispatch_queue_t)completionQueue
 {
     return [self requestWithMethod:@"POST" path:path success:success failure:failure completionQueue:completionQueue];
@@ -65,6 +73,16 @@
     return [self requestWithMethod:@"PUT" path:path success:success failure:failure completionQueue:completionQueue];
 }
 
+- (id<SEDataRequestCustomizer>)PATCH:(NSString *)path success:(void (^)(id _Nonnull, NSURLResponse * _Nonnull))success failure:(void (^)(NSError * _Nonnull))failure completionQueue:(dispatch_queue_t)completionQueue
+{
+    return [self requestWithMethod:SEDataRequestMethodPATCH path:path success:success failure:failure completionQueue:completionQueue];
+}
+
+- (id<SEDataRequestCustomizer>)HEAD:(NSString *)path success:(void (^)(id _Nonnull, NSURLResponse * _Nonnull))success failure:(void (^)(NSError * _Nonnull))failure completionQueue:(dispatch_queue_t)completionQueue
+{
+    return [self requestWithMethod:SEDataRequestMethodHEAD path:path success:success failure:failure completionQueue:completionQueue];
+}
+
 #pragma mark - Customizer Interface
 
 - (id<SECancellableToken>)submitAsUpload:(BOOL)asUpload
@@ -108,7 +126,7 @@
 
 - (void)setContentEncoding:(NSString *)encoding
 {
-    if (_contentParts != nil || (_bodyParameters != nil && [_dataRequestService explicitSerializerForMIMEType:encoding] == nil))
+    if (_contentParts != nil || (_bodyParameters != nil && [_dataRequestService explicitSerializerForMIMEType:encoding] == nil) || [self hasStreamedBody])
     {
         INVALID_BUILDER_PARAM(encoding);
     }
@@ -137,7 +155,7 @@
 
 - (void)setBodyParameters:(NSDictionary<NSString *,id> *)parameters
 {
-    if (_bodyParameters != nil || _body != nil || _contentParts != nil || (_contentEncoding != nil && [_dataRequestService explicitSerializerForMIMEType:_contentEncoding] == nil))
+    if (_bodyParameters != nil || _body != nil || _contentParts != nil || [self hasStreamedBody] || (_contentEncoding != nil && [_dataRequestService explicitSerializerForMIMEType:_contentEncoding] == nil))
     {
         THROW_INCONSISTENCY(@{ NSLocalizedDescriptionKey: @"Cannot set body paramters at this stage." });
     }
@@ -147,7 +165,7 @@
 
 - (void)setBodyData:(NSData *)data
 {
-    if (_bodyParameters != nil || _body != nil || _contentParts != nil)
+    if (_bodyParameters != nil || _body != nil || _contentParts != nil || [self hasStreamedBody])
     {
         THROW_INCONSISTENCY(@{ NSLocalizedDescriptionKey: @"Cannot set body at this stage." });
     }
@@ -155,16 +173,80 @@
     _body = [data copy];
 }
 
+- (void)setStreamedBodyJSONObject:(id)object
+{
+    if (![object isKindOfClass:[NSDictionary class]] && ![object isKindOfClass:[NSArray class]]) INVALID_BUILDER_PARAM(object);
+    [self checkStreamedBodyPossible];
+    
+    _streamedBody = object;
+}
+
+- (void)setStreamedBodyRecords:(NSEnumerator * _Nonnull (^)(void))records
+{
+    if (records == nil) INVALID_BUILDER_PARAM(records);
+    [self checkStreamedBodyPossible];
+    
+    _streamedBodyRecords = records;
+}
+
+- (BOOL)hasStreamedBody
+{
+    return _streamedBody != nil || _streamedBodyRecords != nil;
+}
+
+- (void)checkStreamedBodyPossible
+{
+    if (_bodyParameters != nil || _body != nil || _contentParts != nil || _contentEncoding != nil || [self hasStreamedBody] || (_method != nil && !SEDataRequestMethodURLEncodesBody(_method)))
+    {
+        THROW_INCONSISTENCY(@{ NSLocalizedDescriptionKey: @"Cannot set streamed body at this stage." });
+    }
+}
+
 - (void)setCanSendInBackground:(BOOL)canSendInBackground
 {
     _canSendInBackground = @(canSendInBackground);
 }
 
+- (void)setTag:(NSString *)tag
+{
+    if (tag == nil) THROW_INVALID_PARAM(tag, nil);
+    _tag = [tag copy];
+}
+
+- (void)setDeadline:(NSDate *)deadline
+{
+    if (deadline == nil) THROW_INVALID_PARAM(deadline, nil);
+    _deadline = deadline;
+}
+
+- (void)setStreamFormat:(SEDataRequestStreamFormat)format recordHandler:(void (^)(NSArray * _Nonnull))recordHandler
+{
+    if (recordHandler == nil) THROW_INVALID_PARAM(recordHandler, nil);
+    if (_contentParts != nil)
+    {
+        THROW_INCONSISTENCY(@{ NSLocalizedDescriptionKey: @"Cannot stream the response of a multipart request." });
+    }
+    
+    _streamFormat = format;
+    _recordHandler = recordHandler;
+    
+    if ([_additionalHeaders objectForKey:@"Accept"] == nil)
+    {
+        [self setHTTPHeader:(format == SEDataRequestStreamFormatServerSentEvents ? @"text/event-stream" : @"application/x-ndjson") forKey:@"Accept"];
+    }
+}
+
+- (void)setMaxPendingRecords:(NSUInteger)maxPendingRecords
+{
+    if (maxPendingRecords == 0) INVALID_BUILDER_PARAM(maxPendingRecords);
+    _maxPendingRecords = maxPendingRecords;
+}
+
 - (BOOL)checkMultipartRequestPossibleOrError: (NSError * _Nullable __autoreleasing *)error
 {
-    if (_bodyParameters != nil || _body != nil || _contentEncoding != nil)
+    if (_bodyParameters != nil || _body != nil || _contentEncoding != nil || _recordHandler != nil || [self hasStreamedBody])
     {
-        NSDictionary *info = @{ NSLocalizedDescriptionKey: @"Cannot add multipart content to a request that has body or custom content type." };
+        NSDictionary *info = @{ NSLocalizedDescriptionKey: @"Cannot add multipart content to a request that has body, custom content type or streamed response." };
         if (error != nil) *error = [NSError errorWithDomain:SEErrorDomain code:SEDataRequestServiceRequestBuilderFailure userInfo:info];
         return NO;
     }
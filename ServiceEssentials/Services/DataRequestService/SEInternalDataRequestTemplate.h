@@ -0,0 +1,59 @@
+//
+//  SEInternalDataRequestTemplate.h
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <ServiceEssentials/SEDataRequestService.h>
+#import "SEDataRequestServicePrivate.h"
+
+@class SEDataSerializer;
+
+/** URL parts of a template resolved against a specific base URL. Immutable. */
+@interface SEDataRequestTemplateURL : NSObject
+- (nonnull instancetype) initWithBaseURL: (nonnull NSURL *) baseURL literals: (nonnull NSArray<NSString *> *) literals;
+@property (nonatomic, readonly, strong, nonnull) NSURL *baseURL;
+/** Absolute URL string pieces. There is always one more literal than placeholders. */
+@property (nonatomic, readonly, strong, nonnull) NSArray<NSString *> *literals;
+@end
+
+@interface SEInternalDataRequestTemplate : NSObject<SEDataRequestTemplate>
+
+- (nonnull instancetype) initWithDataRequestService: (nonnull id<SEDataRequestServicePrivate>) dataRequestService
+                                             method: (nonnull NSString *) method
+                                        pathPattern: (nonnull NSString *) pathPattern
+                                      staticHeaders: (nonnull NSDictionary<NSString *, NSString *> *) staticHeaders
+                                     bodySerializer: (nullable SEDataSerializer *) bodySerializer
+                                    contentEncoding: (nullable NSString *) contentEncoding
+                                        contentType: (nullable NSString *) contentType
+                                   deserializeClass: (nullable Class) deserializeClass
+                                   qualityOfService: (SEDataRequestQualityOfService) qualityOfService;
+
+@property (nonatomic, readonly, strong, nonnull) NSString *method;
+@property (nonatomic, readonly, strong, nonnull) NSString *pathPattern;
+/** Placeholder names in the order of appearance in the path pattern */
+@property (nonatomic, readonly, strong, nonnull) NSArray<NSString *> *placeholders;
+/** Relative path pieces between placeholders. There is always one more literal than placeholders. */
+@property (nonatomic, readonly, strong, nonnull) NSArray<NSString *> *pathLiterals;
+/** Path pattern with placeholders replaced by unique markers, used to resolve URL literals */
+@property (nonatomic, readonly, strong, nonnull) NSString *markedPath;
+@property (nonatomic, readonly, strong, nonnull) NSArray<NSString *> *markers;
+
+/** Headers that do not change between requests: user agent, accept and template headers */
+@property (nonatomic, readonly, strong, nonnull) NSDictionary<NSString *, NSString *> *staticHeaders;
+@property (nonatomic, readonly, assign) BOOL encodesParametersInURL;
+/** Serializer for request body. When `nil`, body is encoded as JSON */
+@property (nonatomic, readonly, strong, nullable) SEDataSerializer *bodySerializer;
+@property (nonatomic, readonly, strong, nullable) NSString *contentEncoding;
+@property (nonatomic, readonly, strong, nullable) NSString *contentType;
+@property (nonatomic, readonly, assign, nullable) Class deserializeClass;
+@property (nonatomic, readonly, assign) SEDataRequestQualityOfService qualityOfService;
+
+/** Last resolved URL parts. Swapped atomically when the base URL changes. */
+@property (atomic, strong, nullable) SEDataRequestTemplateURL *resolvedURL;
+
+@end
@@ -0,0 +1,133 @@
+//
+//  SEInternalDataRequestTemplate.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <ServiceEssentials/SEInternalDataRequestTemplate.h>
+
+#import "SETools.h"
+#import "SEDataSerializer.h"
+
+@implementation SEDataRequestTemplateURL
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithBaseURL:(NSURL *)baseURL literals:(NSArray<NSString *> *)literals
+{
+    self = [super init];
+    if (self)
+    {
+        _baseURL = baseURL;
+        _literals = [literals copy];
+    }
+    return self;
+}
+
+@end
+
+@implementation SEInternalDataRequestTemplate
+{
+    __weak id<SEDataRequestServicePrivate> _dataRequestService;
+}
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithDataRequestService:(id<SEDataRequestServicePrivate>)dataRequestService method:(NSString *)method pathPattern:(NSString *)pathPattern staticHeaders:(NSDictionary<NSString *,NSString *> *)staticHeaders bodySerializer:(SEDataSerializer *)bodySerializer contentEncoding:(NSString *)contentEncoding contentType:(NSString *)contentType deserializeClass:(Class)deserializeClass qualityOfService:(SEDataRequestQualityOfService)qualityOfService
+{
+    if (dataRequestService == nil) THROW_INVALID_PARAM(dataRequestService, nil);
+    if (method == nil) THROW_INVALID_PARAM(method, nil);
+    if (pathPattern == nil) THROW_INVALID_PARAM(pathPattern, nil);
+    if (staticHeaders == nil) THROW_INVALID_PARAM(staticHeaders, nil);
+    if (deserializeClass != nil && !SECanDeserializeToClass(deserializeClass)) THROW_INVALID_PARAM(deserializeClass, nil);
+    SEDataRequestVerifyQOS(qualityOfService);
+
+    self = [super init];
+    if (self)
+    {
+        _dataRequestService = dataRequestService;
+        _method = [method copy];
+        _pathPattern = [pathPattern copy];
+        _staticHeaders = [staticHeaders copy];
+        _encodesParametersInURL = !SEDataRequestMethodURLEncodesBody(method);
+        _bodySerializer = bodySerializer;
+        _contentEncoding = [contentEncoding copy];
+        _contentType = [contentType copy];
+        _deserializeClass = deserializeClass;
+        _qualityOfService = qualityOfService;
+
+        [self parsePathPattern];
+    }
+    return self;
+}
+
+#pragma mark - SEDataRequestTemplate
+
+- (id<SECancellableToken>)submitWithPathParameters:(NSDictionary<NSString *,id> *)pathParameters parameters:(NSDictionary<NSString *,id> *)parameters success:(void (^)(id _Nullable, NSURLResponse * _Nonnull))success failure:(void (^)(NSError * _Nonnull))failure completionQueue:(dispatch_queue_t)completionQueue
+{
+    if (success == nil) THROW_INVALID_PARAM(success, nil);
+    return [_dataRequestService submitRequestWithTemplate:self pathParameters:pathParameters parameters:parameters success:success failure:failure completionQueue:completionQueue];
+}
+
+- (SEFuture *)futureWithPathParameters:(NSDictionary<NSString *,id> *)pathParameters parameters:(NSDictionary<NSString *,id> *)parameters
+{
+    return [SEFuture futureWithBlock:^id<SECancellableToken>(SEFutureResolver resolve) {
+        return [_dataRequestService submitRequestWithTemplate:self pathParameters:pathParameters parameters:parameters success:^(id data, NSURLResponse *response) {
+            resolve(data, nil);
+        } failure:^(NSError *error) {
+            resolve(nil, error);
+        } completionQueue:nil];
+    }];
+}
+
+#pragma mark - Private
+
+- (void)parsePathPattern
+{
+    NSMutableArray<NSString *> *placeholders = [NSMutableArray new];
+    NSMutableArray<NSString *> *markers = [NSMutableArray new];
+    NSMutableArray<NSString *> *pathLiterals = [NSMutableArray new];
+    NSMutableString *markedPath = [[NSMutableString alloc] initWithCapacity:_pathPattern.length];
+
+    NSScanner *scanner = [NSScanner scannerWithString:_pathPattern];
+    scanner.charactersToBeSkipped = nil;
+    while (YES)
+    {
+        NSString *literal = nil;
+        if (![scanner scanUpToString:@"{" intoString:&literal]) literal = @"";
+        [markedPath appendString:literal];
+        [pathLiterals addObject:literal];
+        if (scanner.isAtEnd) break;
+
+        scanner.scanLocation += 1;
+        NSString *name = nil;
+        if (![scanner scanUpToString:@"}" intoString:&name] || scanner.isAtEnd || name.length == 0)
+        {
+            THROW_INVALID_PARAM(pathPattern, @{ NSLocalizedDescriptionKey: @"Path pattern contains an unterminated or empty placeholder." });
+        }
+        scanner.scanLocation += 1;
+
+        // Marker is made of URL-safe characters so that it survives URL resolution unchanged
+        NSString *marker = [NSString stringWithFormat:@"_se_placeholder_%lu_", (unsigned long)placeholders.count];
+        [placeholders addObject:name];
+        [markers addObject:marker];
+        [markedPath appendString:marker];
+    }
+
+    _pathLiterals = [pathLiterals copy];
+    _placeholders = [placeholders copy];
+    _markers = [markers copy];
+    _markedPath = [markedPath copy];
+}
+
+@end
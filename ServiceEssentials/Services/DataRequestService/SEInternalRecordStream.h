@@ -0,0 +1,41 @@
+//
+//  SEInternalRecordStream.h
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+@import Foundation;
+#import <ServiceEssentials/SEDataRequestService.h>
+
+/**
+ Splits a streamed response body into records as it arrives and delivers them in batches.
+ Data is appended on the delegate queue of the session, one chunk at a time, and records are deserialized there.
+ Each chunk delivers the records it completes as one batch on the completion queue.
+ */
+@interface SEInternalRecordStream : NSObject
+
+- (instancetype) initWithFormat: (SEDataRequestStreamFormat) format
+                      dataClass: (Class) dataClass
+              maxPendingRecords: (NSUInteger) maxPendingRecords
+                  recordHandler: (void (^)(NSArray *records)) recordHandler
+                completionQueue: (dispatch_queue_t) completionQueue;
+
+@property (nonatomic, readonly, assign) SEDataRequestStreamFormat format;
+
+/** Task suspended while more than `maxPendingRecords` records wait for the record handler */
+@property (atomic, weak) NSURLSessionTask *task;
+
+/** Delivers the records completed by the data. Returns `NO` if a record is malformed, nothing is delivered after that. */
+- (BOOL) appendData: (NSData *) data error: (NSError * __autoreleasing *) error;
+
+/** Delivers the record left at the end of the body, which has no separator after it */
+- (BOOL) finishWithError: (NSError * __autoreleasing *) error;
+
+/** Stops delivering records, including the batches dispatched already */
+- (void) cancel;
+
+@end
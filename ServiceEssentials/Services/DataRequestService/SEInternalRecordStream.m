@@ -0,0 +1,328 @@
+//
+//  SEInternalRecordStream.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import "SEInternalRecordStream.h"
+
+#include <pthread.h>
+
+#import "SETools.h"
+#import "SEDataRequestServicePrivate.h"
+#import "SEDataRequestServerSentEvent.h"
+#import "SEInternalDataRequest.h"
+
+// a record this long without a separator is taken for a response that is not a stream
+static NSUInteger const SEInternalRecordStreamMaxRecordLength = 16 * 1024 * 1024;
+
+static inline NSError *SEInternalRecordStreamError(NSString *description, NSError *underlyingError)
+{
+    NSMutableDictionary *userInfo = [[NSMutableDictionary alloc] initWithCapacity:2];
+    [userInfo setObject:description forKey:NSLocalizedDescriptionKey];
+    if (underlyingError != nil) [userInfo setObject:underlyingError forKey:NSUnderlyingErrorKey];
+    return [NSError errorWithDomain:SEErrorDomain code:SEDataRequestServiceSerializationFailure userInfo:userInfo];
+}
+
+static inline BOOL SEInternalRecordStreamIsBlank(const char *bytes, NSUInteger length)
+{
+    for (NSUInteger i = 0; i < length; ++i)
+    {
+        if (bytes[i] != ' ' && bytes[i] != '\t' && bytes[i] != '\r') return NO;
+    }
+    return YES;
+}
+
+@interface SEDataRequestServerSentEvent ()
+- (instancetype) initWithEventType: (NSString *) eventType identifier: (NSString *) identifier data: (NSString *) data retryInterval: (NSTimeInterval) retryInterval object: (id) object;
+@end
+
+@implementation SEInternalRecordStream
+{
+    __unsafe_unretained Class _dataClass;
+    NSUInteger _maxPendingRecords;
+    void (^_recordHandler)(NSArray *records);
+    dispatch_queue_t _completionQueue;
+
+    // parsing state, only used on the delegate queue of the session
+    NSMutableData *_buffer;
+    NSUInteger _scannedLength;
+    NSMutableArray<NSString *> *_eventDataLines;
+    NSString *_eventType;
+    NSString *_lastEventIdentifier;
+    NSTimeInterval _retryInterval;
+
+    // delivery state, shared with the completion queue
+    pthread_mutex_t _lock;
+    NSUInteger _pendingRecords;
+    BOOL _isSuspended;
+    BOOL _isCancelled;
+}
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithFormat:(SEDataRequestStreamFormat)format dataClass:(__unsafe_unretained Class)dataClass maxPendingRecords:(NSUInteger)maxPendingRecords recordHandler:(void (^)(NSArray *))recordHandler completionQueue:(dispatch_queue_t)completionQueue
+{
+#ifdef DEBUG
+    if (recordHandler == nil) THROW_INVALID_PARAM(recordHandler, nil);
+    if (maxPendingRecords == 0) THROW_INVALID_PARAM(maxPendingRecords, nil);
+#endif
+    self = [super init];
+    if (self)
+    {
+        _format = format;
+        _dataClass = dataClass;
+        _maxPendingRecords = maxPendingRecords;
+        _recordHandler = recordHandler;
+        _completionQueue = completionQueue;
+        pthread_mutex_init(&_lock, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&_lock);
+}
+
+- (BOOL)appendData:(NSData *)data error:(NSError * __autoreleasing *)error
+{
+    if (_buffer == nil) _buffer = [[NSMutableData alloc] initWithCapacity:data.length];
+    [_buffer appendData:data];
+
+    NSMutableArray *records = [NSMutableArray new];
+    if (![self extractRecords:records atEnd:NO error:error]) return NO;
+    [self deliverRecords:records];
+    return YES;
+}
+
+- (BOOL)finishWithError:(NSError * __autoreleasing *)error
+{
+    NSMutableArray *records = [NSMutableArray new];
+    if (![self extractRecords:records atEnd:YES error:error]) return NO;
+    [self deliverRecords:records];
+    return YES;
+}
+
+- (void)cancel
+{
+    pthread_mutex_lock(&_lock);
+    _isCancelled = YES;
+    pthread_mutex_unlock(&_lock);
+}
+
+#pragma mark - Framing
+
+// Lines end with LF or CRLF. Both formats are line-based: NDJSON has a record per line,
+// Server-Sent Events end an event with an empty line.
+- (BOOL) extractRecords: (NSMutableArray *) records atEnd: (BOOL) atEnd error: (NSError * __autoreleasing *) error
+{
+    const char *bytes = _buffer.bytes;
+    NSUInteger length = _buffer.length;
+    NSUInteger lineStart = 0;
+    NSUInteger position = _scannedLength;
+    while (position < length)
+    {
+        const char *lineFeed = memchr(bytes + position, '\n', length - position);
+        if (lineFeed == NULL) break;
+
+        NSUInteger lineEnd = lineFeed - bytes;
+        NSUInteger contentEnd = (lineEnd > lineStart && bytes[lineEnd - 1] == '\r') ? lineEnd - 1 : lineEnd;
+        if (![self processLine:bytes + lineStart length:contentEnd - lineStart records:records error:error]) return NO;
+        lineStart = position = lineEnd + 1;
+    }
+
+    // an event is only complete with the empty line after it, so the rest of the body is a record of NDJSON only
+    if (atEnd && lineStart < length && _format == SEDataRequestStreamFormatNDJSON)
+    {
+        if (![self processLine:bytes + lineStart length:length - lineStart records:records error:error]) return NO;
+        lineStart = length;
+    }
+
+    if (lineStart > 0) [_buffer replaceBytesInRange:NSMakeRange(0, lineStart) withBytes:NULL length:0];
+    _scannedLength = _buffer.length;
+    if (_scannedLength > SEInternalRecordStreamMaxRecordLength)
+    {
+        if (error != nil) *error = SEInternalRecordStreamError(@"Record exceeds the maximum length", nil);
+        return NO;
+    }
+    return YES;
+}
+
+- (BOOL) processLine: (const char *) bytes length: (NSUInteger) length records: (NSMutableArray *) records error: (NSError * __autoreleasing *) error
+{
+    if (_format == SEDataRequestStreamFormatNDJSON)
+    {
+        if (SEInternalRecordStreamIsBlank(bytes, length)) return YES;
+
+        NSData *line = [NSData dataWithBytesNoCopy:(void *)bytes length:length freeWhenDone:NO];
+        id record = [self deserializeJSONData:line error:error];
+        if (record == nil) return NO;
+        [records addObject:record];
+        return YES;
+    }
+
+    if (length == 0) return [self dispatchEventToRecords:records error:error];
+    if (bytes[0] == ':') return YES; // comment, often sent to keep the connection alive
+
+    NSString *line = [[NSString alloc] initWithBytes:bytes length:length encoding:NSUTF8StringEncoding];
+    if (line == nil)
+    {
+        if (error != nil) *error = SEInternalRecordStreamError(@"Event stream is not valid UTF-8", nil);
+        return NO;
+    }
+
+    NSString *field = line;
+    NSString *value = @"";
+    NSRange colon = [line rangeOfString:@":"];
+    if (colon.location != NSNotFound)
+    {
+        field = [line substringToIndex:colon.location];
+        value = [line substringFromIndex:NSMaxRange(colon)];
+        if ([value hasPrefix:@" "]) value = [value substringFromIndex:1];
+    }
+
+    if ([field isEqualToString:@"data"])
+    {
+        if (_eventDataLines == nil) _eventDataLines = [NSMutableArray new];
+        [_eventDataLines addObject:value];
+    }
+    else if ([field isEqualToString:@"event"])
+    {
+        _eventType = value;
+    }
+    else if ([field isEqualToString:@"id"])
+    {
+        if ([value rangeOfString:@"\0"].location == NSNotFound) _lastEventIdentifier = value;
+    }
+    else if ([field isEqualToString:@"retry"])
+    {
+        NSScanner *scanner = [NSScanner scannerWithString:value];
+        long long milliseconds = 0;
+        if (value.length > 0 && [value rangeOfCharacterFromSet:[[NSCharacterSet decimalDigitCharacterSet] invertedSet]].location == NSNotFound && [scanner scanLongLong:&milliseconds])
+        {
+            _retryInterval = milliseconds / 1000.0;
+        }
+    }
+    // other fields are ignored, as the specification requires
+    return YES;
+}
+
+- (BOOL) dispatchEventToRecords: (NSMutableArray *) records error: (NSError * __autoreleasing *) error
+{
+    NSArray<NSString *> *dataLines = _eventDataLines;
+    NSString *eventType = _eventType;
+    _eventDataLines = nil;
+    _eventType = nil;
+
+    // events without data are not dispatched
+    if (dataLines == nil) return YES;
+
+    NSString *data = [dataLines componentsJoinedByString:@"\n"];
+    id object = nil;
+    if (_dataClass != nil)
+    {
+        object = [self deserializeJSONData:[data dataUsingEncoding:NSUTF8StringEncoding] error:error];
+        if (object == nil) return NO;
+    }
+
+    [records addObject:[[SEDataRequestServerSentEvent alloc] initWithEventType:(eventType.length > 0 ? eventType : @"message") identifier:_lastEventIdentifier data:data retryInterval:_retryInterval object:object]];
+    return YES;
+}
+
+- (id) deserializeJSONData: (NSData *) data error: (NSError * __autoreleasing *) error
+{
+    NSError *innerError = nil;
+    id result = [NSJSONSerialization JSONObjectWithData:data options:NSJSONReadingAllowFragments error:&innerError];
+    if (result != nil && _dataClass != nil)
+    {
+        result = [SEInternalDataRequest deserializeResult:result toClass:_dataClass error:&innerError];
+    }
+
+    if (result == nil && error != nil) *error = SEInternalRecordStreamError(@"Malformed record", innerError);
+    return result;
+}
+
+#pragma mark - Delivery
+
+// The task is suspended and resumed in the lock, so that the two never race.
+- (void) deliverRecords: (NSArray *) records
+{
+    NSUInteger count = records.count;
+    if (count == 0) return;
+
+    pthread_mutex_lock(&_lock);
+    BOOL isCancelled = _isCancelled;
+    if (!isCancelled)
+    {
+        _pendingRecords += count;
+        if (!_isSuspended && _pendingRecords > _maxPendingRecords)
+        {
+            // the record handler is behind, the rest of the body waits on the server
+            _isSuspended = YES;
+            [self.task suspend];
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+    if (isCancelled) return;
+
+    void (^recordHandler)(NSArray *) = _recordHandler;
+    SEDataRequestDispatchCompletion(_completionQueue, ^{
+        pthread_mutex_lock(&self->_lock);
+        BOOL isCancelled = self->_isCancelled;
+        pthread_mutex_unlock(&self->_lock);
+
+        if (!isCancelled) recordHandler(records);
+        [self didProcessRecordCount:count];
+    });
+}
+
+- (void) didProcessRecordCount: (NSUInteger) count
+{
+    pthread_mutex_lock(&_lock);
+    _pendingRecords -= count;
+    // resuming at half of the limit keeps the task from flapping with every batch
+    if (_isSuspended && _pendingRecords <= _maxPendingRecords / 2)
+    {
+        _isSuspended = NO;
+        if (!_isCancelled) [self.task resume];
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+@end
+
+@implementation SEDataRequestServerSentEvent
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithEventType:(NSString *)eventType identifier:(NSString *)identifier data:(NSString *)data retryInterval:(NSTimeInterval)retryInterval object:(id)object
+{
+    self = [super init];
+    if (self)
+    {
+        _eventType = [eventType copy];
+        _identifier = [identifier copy];
+        _data = [data copy];
+        _retryInterval = retryInterval;
+        _object = object;
+    }
+    return self;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p; event = %@; id = %@; data = %@>", NSStringFromClass([self class]), self, _eventType, _identifier, _data];
+}
+
+@end
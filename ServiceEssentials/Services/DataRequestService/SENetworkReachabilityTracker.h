@@ -10,13 +10,20 @@
 
 #import <ServiceEssentials/SEDataRequestService.h>
 
-@class SENetworkReachabilityTracker;
+@protocol SENetworkReachabilitySource;
 
 @protocol SENetworkReachabilityTrackerDelegate <NSObject>
-- (void) networkReachabilityTracker: (SENetworkReachabilityTracker * _Nonnull)tracker didUpdateStatus: (SENetworkReachabilityStatus) status;
+- (void) networkReachabilityTracker: (id<SENetworkReachabilitySource> _Nonnull)tracker didUpdateStatus: (SENetworkReachabilityStatus) status;
 @end
 
-@interface SENetworkReachabilityTracker : NSObject
+/** Anything that reports reachability status. Allows to replace system reachability, for example in tests. */
+@protocol SENetworkReachabilitySource <NSObject>
+@property (nonatomic, readonly, assign) SENetworkReachabilityStatus reachability;
+/** Delegate is notified about status changes on the queue chosen by the source */
+@property (atomic, weak, nullable) id<SENetworkReachabilityTrackerDelegate> delegate;
+@end
+
+@interface SENetworkReachabilityTracker : NSObject<SENetworkReachabilitySource>
 
 + (BOOL) isReachabilityAvailable;
 
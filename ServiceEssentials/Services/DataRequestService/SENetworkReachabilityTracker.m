@@ -62,7 +62,6 @@ void NetworkReachabilityCallback(SCNetworkReachabilityRef target, SCNetworkReach
 
 @implementation SENetworkReachabilityTracker
 {
-    __weak id<SENetworkReachabilityTrackerDelegate> _delegate;
     dispatch_queue_t _dispatchQueue;
     volatile SENetworkReachabilityStatus _status;
 #ifdef _SYSTEMCONFIGURATION_H
@@ -70,6 +69,8 @@ void NetworkReachabilityCallback(SCNetworkReachabilityRef target, SCNetworkReach
 #endif
 }
 
+@synthesize delegate = _delegate;
+
 + (BOOL)isReachabilityAvailable
 {
 #ifdef _SYSTEMCONFIGURATION_H
@@ -209,7 +210,7 @@ void NetworkReachabilityCallback(SCNetworkReachabilityRef target, SCNetworkReach
         [self didChangeValueForKey:keyPath];
         
         dispatch_async(_dispatchQueue, ^{
-            [_delegate networkReachabilityTracker:self didUpdateStatus:_status];
+            [self.delegate networkReachabilityTracker:self didUpdateStatus:_status];
         });
     }
 }
@@ -0,0 +1,50 @@
+//
+//  SEServerTrustCache.h
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+@import Foundation;
+
+#import <ServiceEssentials/SEDataRequestService.h>
+
+/** Performs the actual (expensive) server trust evaluation according to a pinning policy. */
+@protocol SEServerTrustEvaluator <NSObject>
+- (BOOL) evaluateServerTrust: (nonnull SecTrustRef) serverTrust pinningType: (SEDataRequestCertificatePinningType) pinningType error: (NSError * __autoreleasing _Nullable * _Nullable) error;
+@end
+
+/** Default evaluator, uses `SEDataRequestServiceSecurityHelper` */
+@interface SEDefaultServerTrustEvaluator : NSObject<SEServerTrustEvaluator>
+@end
+
+/**
+ A bounded cache of successfully validated server trusts.
+ Entries are keyed by host, pinning type and SHA-256 digest of the leaf certificate, and expire after a time-to-live.
+ Failed evaluations are never cached.
+ The cache is thread-safe.
+ */
+@interface SEServerTrustCache : NSObject
+
+- (nonnull instancetype) initWithEvaluator: (nullable id<SEServerTrustEvaluator>) evaluator capacity: (NSUInteger) capacity timeToLive: (NSTimeInterval) timeToLive;
+
+@property (nonatomic, readonly, strong, nonnull) id<SEServerTrustEvaluator> evaluator;
+@property (nonatomic, readonly, assign) NSUInteger capacity;
+@property (nonatomic, readonly, assign) NSTimeInterval timeToLive;
+
+/** Number of entries currently in the cache, including expired ones that were not purged yet */
+@property (nonatomic, readonly, assign) NSUInteger count;
+
+/**
+ Validates the trust, consulting the cache first.
+ If there is a valid cache entry, evaluator is not invoked.
+ */
+- (BOOL) validateServerTrust: (nonnull SecTrustRef) serverTrust host: (nonnull NSString *) host pinningType: (SEDataRequestCertificatePinningType) pinningType error: (NSError * __autoreleasing _Nullable * _Nullable) error;
+
+/** Removes all entries, for example when environment changes */
+- (void) invalidate;
+
+@end
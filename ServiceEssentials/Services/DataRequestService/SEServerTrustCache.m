@@ -0,0 +1,171 @@
+//
+//  SEServerTrustCache.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <ServiceEssentials/SEServerTrustCache.h>
+
+#include <pthread.h>
+#include <CommonCrypto/CommonDigest.h>
+
+#import <ServiceEssentials/SETools.h>
+#import <ServiceEssentials/SEDataRequestServiceSecurityHelper.h>
+
+// Cache key combines host, pinning type and the leaf certificate digest.
+// Host is a part of the key because a certificate that is valid for one host must not be accepted for another.
+static inline NSString *SEServerTrustCacheKey(SecTrustRef serverTrust, NSString *host, SEDataRequestCertificatePinningType pinningType)
+{
+    if (SecTrustGetCertificateCount(serverTrust) == 0) return nil;
+    SecCertificateRef leafCertificate = SecTrustGetCertificateAtIndex(serverTrust, 0);
+    if (leafCertificate == NULL) return nil;
+
+    CFDataRef certificateData = SecCertificateCopyData(leafCertificate);
+    if (certificateData == NULL) return nil;
+
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256(CFDataGetBytePtr(certificateData), (CC_LONG)CFDataGetLength(certificateData), digest);
+    CFRelease(certificateData);
+
+    NSMutableString *key = [[NSMutableString alloc] initWithCapacity:host.length + 4 + CC_SHA256_DIGEST_LENGTH * 2];
+    [key appendFormat:@"%@|%d|", host, (int)pinningType];
+    for (int i = 0; i < CC_SHA256_DIGEST_LENGTH; ++i) [key appendFormat:@"%02x", digest[i]];
+    return key;
+}
+
+@implementation SEDefaultServerTrustEvaluator
+
+- (BOOL)evaluateServerTrust:(SecTrustRef)serverTrust pinningType:(SEDataRequestCertificatePinningType)pinningType error:(NSError *__autoreleasing  _Nullable *)error
+{
+    switch (pinningType)
+    {
+        case SEDataRequestCertificatePinningTypeNone:
+            return [SEDataRequestServiceSecurityHelper validateTrustDefault:serverTrust error:error];
+        case SEDataRequestCertificatePinningTypeCertificate:
+            return [SEDataRequestServiceSecurityHelper validateTrustUsingCertificates:serverTrust error:error];
+        case SEDataRequestCertificatePinningTypePublicKey:
+            return [SEDataRequestServiceSecurityHelper validateTrustUsingPublicKeys:serverTrust error:error];
+#ifdef ALLOWS_TEST_ENVIRONMENTS
+        case SEDataRequestCertificatePinningTypeNoneAcceptRecoverableFailure:
+            return [SEDataRequestServiceSecurityHelper validateTrustDefaultAcceptRecoverable:serverTrust error:error];
+#endif
+
+        default:
+            return NO;
+    }
+}
+
+@end
+
+@implementation SEServerTrustCache
+{
+    pthread_mutex_t _lock;
+    // key -> expiration time (system uptime)
+    NSMutableDictionary<NSString *, NSNumber *> *_expirationByKey;
+    // keys in insertion order, used to evict the oldest entries when capacity is reached
+    NSMutableArray<NSString *> *_keysInOrder;
+}
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithEvaluator:(id<SEServerTrustEvaluator>)evaluator capacity:(NSUInteger)capacity timeToLive:(NSTimeInterval)timeToLive
+{
+    if (capacity == 0) THROW_INVALID_PARAM(capacity, nil);
+    if (timeToLive <= 0) THROW_INVALID_PARAM(timeToLive, nil);
+
+    self = [super init];
+    if (self)
+    {
+        _evaluator = evaluator ?: [SEDefaultServerTrustEvaluator new];
+        _capacity = capacity;
+        _timeToLive = timeToLive;
+        _expirationByKey = [[NSMutableDictionary alloc] initWithCapacity:capacity];
+        _keysInOrder = [[NSMutableArray alloc] initWithCapacity:capacity];
+        pthread_mutex_init(&_lock, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&_lock);
+}
+
+- (NSUInteger)count
+{
+    NSUInteger count;
+    pthread_mutex_lock(&_lock);
+    count = _keysInOrder.count;
+    pthread_mutex_unlock(&_lock);
+    return count;
+}
+
+- (BOOL)validateServerTrust:(SecTrustRef)serverTrust host:(NSString *)host pinningType:(SEDataRequestCertificatePinningType)pinningType error:(NSError *__autoreleasing  _Nullable *)error
+{
+    if (serverTrust == NULL) THROW_INVALID_PARAM(serverTrust, nil);
+    if (host == nil) THROW_INVALID_PARAM(host, nil);
+
+    NSString *key = SEServerTrustCacheKey(serverTrust, host, pinningType);
+    NSTimeInterval now = [NSProcessInfo processInfo].systemUptime;
+
+    if (key != nil)
+    {
+        BOOL hit = NO;
+        pthread_mutex_lock(&_lock);
+        NSNumber *expiration = [_expirationByKey objectForKey:key];
+        if (expiration != nil)
+        {
+            if (expiration.doubleValue > now)
+            {
+                hit = YES;
+            }
+            else
+            {
+                [_expirationByKey removeObjectForKey:key];
+                [_keysInOrder removeObject:key];
+            }
+        }
+        pthread_mutex_unlock(&_lock);
+
+        if (hit) return YES;
+    }
+
+    // Evaluation is expensive, so it is performed outside of the lock.
+    // Concurrent handshakes may evaluate the same chain twice, which is harmless.
+    BOOL valid = [_evaluator evaluateServerTrust:serverTrust pinningType:pinningType error:error];
+    if (valid && key != nil)
+    {
+        pthread_mutex_lock(&_lock);
+        if ([_expirationByKey objectForKey:key] == nil)
+        {
+            if (_keysInOrder.count >= _capacity)
+            {
+                NSString *oldestKey = [_keysInOrder firstObject];
+                [_keysInOrder removeObjectAtIndex:0];
+                [_expirationByKey removeObjectForKey:oldestKey];
+            }
+            [_keysInOrder addObject:key];
+        }
+        [_expirationByKey setObject:@(now + _timeToLive) forKey:key];
+        pthread_mutex_unlock(&_lock);
+    }
+
+    return valid;
+}
+
+- (void)invalidate
+{
+    pthread_mutex_lock(&_lock);
+    [_expirationByKey removeAllObjects];
+    [_keysInOrder removeAllObjects];
+    pthread_mutex_unlock(&_lock);
+}
+
+@end
@@ -0,0 +1,36 @@
+//
+//  SEJSONStreamWriter.h
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+@import Foundation;
+
+/**
+ Encodes JSON into a stream as it is read, so that large request bodies are never held in memory in full.
+ Output is UTF-8 and byte-compatible with `NSJSONSerialization` without options, dictionary keys come in enumeration order.
+
+ Streams are bound pairs: a writer encodes a few kilobytes at a time on a private queue whenever the buffer of the pair
+ has room, and stops when it is full, so memory stays flat whatever the size of the body. Containers, including nested ones,
+ are enumerated lazily. A value that cannot be encoded, such as NaN or an object that is not JSON, ends the stream
+ and is reported to the failure handler.
+ */
+@interface SEJSONStreamWriter : NSObject
+
+/** Returns a stream of the JSON encoding of a dictionary or an array */
++ (nonnull NSInputStream *) inputStreamWithJSONObject: (nonnull id) object failure: (nullable void (^)(NSError * _Nonnull error)) failure;
+
+/**
+ Returns a stream of a JSON array of records, enumerated on the private queue of the writer as the stream is read.
+ Records are JSON objects or any other value `NSJSONSerialization` can encode.
+ */
++ (nonnull NSInputStream *) inputStreamWithRecords: (nonnull NSEnumerator *) records failure: (nullable void (^)(NSError * _Nonnull error)) failure;
+
+/** Encodes a dictionary or an array to data with the same encoder */
++ (nullable NSData *) dataWithJSONObject: (nonnull id) object error: (NSError * __autoreleasing _Nullable * _Nullable) error;
+
+@end
@@ -0,0 +1,412 @@
+//
+//  SEJSONStreamWriter.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import "SEJSONStreamWriter.h"
+#import <ServiceEssentials/SEDataRequestService.h>
+#import "SETools.h"
+
+// the writer encodes this much before handing it to the stream, the pair buffers up to twice as much
+static NSUInteger const SEJSONStreamWriterChunkLength = 16 * 1024;
+static CFIndex const SEJSONStreamWriterBufferSize = 32 * 1024;
+
+static inline NSError *SEJSONStreamWriterError(NSString *description)
+{
+    return [NSError errorWithDomain:SEErrorDomain code:SEDataRequestServiceSerializationFailure userInfo:@{ NSLocalizedDescriptionKey: description }];
+}
+
+static inline BOOL SEJSONStreamWriterNeedsEscape(uint8_t character)
+{
+    // forward slashes are escaped, as NSJSONSerialization does by default
+    return character < 0x20 || character == '"' || character == '\\' || character == '/';
+}
+
+// Escapes UTF-8 bytes into the data, copying runs that need no escaping at once
+static void SEJSONStreamWriterAppendEscapedBytes(const uint8_t *bytes, NSUInteger length, NSMutableData *data)
+{
+    NSUInteger runStart = 0;
+    for (NSUInteger i = 0; i < length; ++i)
+    {
+        uint8_t character = bytes[i];
+        if (!SEJSONStreamWriterNeedsEscape(character)) continue;
+
+        if (i > runStart) [data appendBytes:bytes + runStart length:i - runStart];
+        runStart = i + 1;
+
+        char escape[8] = { '\\', 0 };
+        NSUInteger escapeLength = 2;
+        switch (character)
+        {
+            case '"': escape[1] = '"'; break;
+            case '\\': escape[1] = '\\'; break;
+            case '/': escape[1] = '/'; break;
+            case '\b': escape[1] = 'b'; break;
+            case '\f': escape[1] = 'f'; break;
+            case '\n': escape[1] = 'n'; break;
+            case '\r': escape[1] = 'r'; break;
+            case '\t': escape[1] = 't'; break;
+            default: escapeLength = snprintf(escape, sizeof(escape), "\\u%04x", character); break;
+        }
+        [data appendBytes:escape length:escapeLength];
+    }
+    if (length > runStart) [data appendBytes:bytes + runStart length:length - runStart];
+}
+
+static void SEJSONStreamWriterCallBack(CFWriteStreamRef stream, CFStreamEventType type, void *info);
+
+/** Container being enumerated by the writer */
+@interface SEJSONStreamContainer : NSObject
+@property (nonatomic, strong) NSEnumerator *enumerator;
+/** Dictionary which keys are enumerated, `nil` for arrays */
+@property (nonatomic, strong) NSDictionary *dictionary;
+@property (nonatomic, assign) BOOL hasElements;
+@end
+
+@implementation SEJSONStreamContainer
+@end
+
+@interface SEJSONStreamWriter ()
+- (void) writeAvailableBytes;
+- (void) stop;
+@end
+
+@implementation SEJSONStreamWriter
+{
+    id _rootObject;
+    NSMutableArray<SEJSONStreamContainer *> *_containers;
+    BOOL _isFinished;
+
+    NSOutputStream *_outputStream;
+    dispatch_queue_t _queue;
+    NSMutableData *_pendingData;
+    NSUInteger _pendingOffset;
+    void (^_failure)(NSError *error);
+}
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithRootObject: (id) rootObject records: (NSEnumerator *) records failure: (void (^)(NSError *)) failure
+{
+    self = [super init];
+    if (self)
+    {
+        _containers = [NSMutableArray new];
+        _pendingData = [[NSMutableData alloc] initWithCapacity:SEJSONStreamWriterChunkLength];
+        _failure = failure;
+
+        if (records != nil)
+        {
+            SEJSONStreamContainer *container = [SEJSONStreamContainer new];
+            container.enumerator = records;
+            [_containers addObject:container];
+            [_pendingData appendBytes:"[" length:1];
+        }
+        else
+        {
+            _rootObject = rootObject;
+        }
+    }
+    return self;
+}
+
++ (NSInputStream *)inputStreamWithJSONObject:(id)object failure:(void (^)(NSError * _Nonnull))failure
+{
+    if (object == nil) THROW_INVALID_PARAM(object, nil);
+    SEJSONStreamWriter *writer = [[SEJSONStreamWriter alloc] initWithRootObject:object records:nil failure:failure];
+    return [writer createInputStream];
+}
+
++ (NSInputStream *)inputStreamWithRecords:(NSEnumerator *)records failure:(void (^)(NSError * _Nonnull))failure
+{
+    if (records == nil) THROW_INVALID_PARAM(records, nil);
+    SEJSONStreamWriter *writer = [[SEJSONStreamWriter alloc] initWithRootObject:nil records:records failure:failure];
+    return [writer createInputStream];
+}
+
++ (NSData *)dataWithJSONObject:(id)object error:(NSError * __autoreleasing *)error
+{
+    if (object == nil) THROW_INVALID_PARAM(object, nil);
+    SEJSONStreamWriter *writer = [[SEJSONStreamWriter alloc] initWithRootObject:object records:nil failure:nil];
+    NSMutableData *data = [NSMutableData new];
+    if (![writer encodeIntoData:data upToLength:NSUIntegerMax error:error]) return nil;
+    return data;
+}
+
+#pragma mark - Streaming
+
+- (NSInputStream *) createInputStream
+{
+    NSInputStream *inputStream = nil;
+    NSOutputStream *outputStream = nil;
+    [NSStream getBoundStreamsWithBufferSize:SEJSONStreamWriterBufferSize inputStream:&inputStream outputStream:&outputStream];
+    _outputStream = outputStream;
+    _queue = dispatch_queue_create("com.serviceessentials.jsonstreamwriter", DISPATCH_QUEUE_SERIAL);
+
+    // the stream retains the writer until it is stopped
+    CFStreamClientContext context = { .version = 0, .info = (__bridge void *)self, .retain = CFRetain, .release = CFRelease, .copyDescription = NULL };
+    CFWriteStreamRef writeStream = (__bridge CFWriteStreamRef)outputStream;
+    CFWriteStreamSetClient(writeStream, kCFStreamEventCanAcceptBytes | kCFStreamEventErrorOccurred | kCFStreamEventEndEncountered, SEJSONStreamWriterCallBack, &context);
+    CFWriteStreamSetDispatchQueue(writeStream, _queue);
+    CFWriteStreamOpen(writeStream);
+    return inputStream;
+}
+
+// Called on the queue of the writer
+- (void) writeAvailableBytes
+{
+    CFWriteStreamRef writeStream = (__bridge CFWriteStreamRef)_outputStream;
+    while (writeStream != NULL && CFWriteStreamCanAcceptBytes(writeStream))
+    {
+        if (_pendingOffset >= _pendingData.length)
+        {
+            if (_isFinished)
+            {
+                // closing the stream ends the body
+                [self stop];
+                return;
+            }
+
+            _pendingData.length = 0;
+            _pendingOffset = 0;
+            BOOL isEncoded = NO;
+            NSError *error = nil;
+            @autoreleasepool
+            {
+                NSError *encodingError = nil;
+                isEncoded = [self encodeIntoData:_pendingData upToLength:SEJSONStreamWriterChunkLength error:&encodingError];
+                error = encodingError;
+            }
+
+            if (!isEncoded)
+            {
+                // the request is failed before the stream is closed, so that a truncated body is not sent as complete
+                if (_failure != nil) _failure(error);
+                [self stop];
+                return;
+            }
+            continue;
+        }
+
+        CFIndex written = CFWriteStreamWrite(writeStream, (const UInt8 *)_pendingData.bytes + _pendingOffset, _pendingData.length - _pendingOffset);
+        if (written <= 0)
+        {
+            // the reader has gone away
+            [self stop];
+            return;
+        }
+        _pendingOffset += written;
+    }
+}
+
+- (void) stop
+{
+    NSOutputStream *outputStream = _outputStream;
+    if (outputStream == nil) return;
+    _outputStream = nil;
+
+    CFWriteStreamRef writeStream = (__bridge CFWriteStreamRef)outputStream;
+    CFWriteStreamSetDispatchQueue(writeStream, NULL);
+    CFWriteStreamClose(writeStream);
+    // releases the writer, the callback keeps it alive until it returns
+    CFWriteStreamSetClient(writeStream, kCFStreamEventNone, NULL, NULL);
+}
+
+#pragma mark - Encoding
+
+- (BOOL) encodeIntoData: (NSMutableData *) data upToLength: (NSUInteger) length error: (NSError * __autoreleasing *) error
+{
+    while (!_isFinished && data.length < length)
+    {
+        SEJSONStreamContainer *container = _containers.lastObject;
+        if (container == nil)
+        {
+            id rootObject = _rootObject;
+            _rootObject = nil;
+            if (rootObject == nil)
+            {
+                _isFinished = YES;
+                break;
+            }
+
+            if (![rootObject isKindOfClass:[NSDictionary class]] && ![rootObject isKindOfClass:[NSArray class]])
+            {
+                if (error != nil) *error = SEJSONStreamWriterError(@"Invalid top-level type in JSON write");
+                return NO;
+            }
+            if (![self appendValue:rootObject toData:data error:error]) return NO;
+            continue;
+        }
+
+        id element = [container.enumerator nextObject];
+        if (element == nil)
+        {
+            [data appendBytes:(container.dictionary != nil ? "}" : "]") length:1];
+            [_containers removeLastObject];
+            continue;
+        }
+
+        if (container.hasElements) [data appendBytes:"," length:1];
+        container.hasElements = YES;
+
+        if (container.dictionary != nil)
+        {
+            if (![element isKindOfClass:[NSString class]])
+            {
+                if (error != nil) *error = SEJSONStreamWriterError(@"Invalid (non-string) key in JSON dictionary");
+                return NO;
+            }
+            if (![self appendString:element toData:data error:error]) return NO;
+            [data appendBytes:":" length:1];
+            element = [container.dictionary objectForKey:element];
+        }
+        if (![self appendValue:element toData:data error:error]) return NO;
+    }
+    return YES;
+}
+
+- (BOOL) appendValue: (id) value toData: (NSMutableData *) data error: (NSError * __autoreleasing *) error
+{
+    if ([value isKindOfClass:[NSString class]])
+    {
+        return [self appendString:value toData:data error:error];
+    }
+    else if ([value isKindOfClass:[NSNumber class]])
+    {
+        return [self appendNumber:value toData:data error:error];
+    }
+    else if (value == [NSNull null])
+    {
+        [data appendBytes:"null" length:4];
+        return YES;
+    }
+    else if ([value isKindOfClass:[NSArray class]] || [value isKindOfClass:[NSDictionary class]])
+    {
+        // containers are opened here and enumerated by the encoding loop
+        SEJSONStreamContainer *container = [SEJSONStreamContainer new];
+        if ([value isKindOfClass:[NSDictionary class]])
+        {
+            container.dictionary = value;
+            container.enumerator = [value keyEnumerator];
+            [data appendBytes:"{" length:1];
+        }
+        else
+        {
+            container.enumerator = [value objectEnumerator];
+            [data appendBytes:"[" length:1];
+        }
+        [_containers addObject:container];
+        return YES;
+    }
+
+    if (error != nil) *error = SEJSONStreamWriterError([NSString stringWithFormat:@"Invalid type in JSON write (%@)", [value class]]);
+    return NO;
+}
+
+- (BOOL) appendString: (NSString *) string toData: (NSMutableData *) data error: (NSError * __autoreleasing *) error
+{
+    [data appendBytes:"\"" length:1];
+
+    // ASCII strings are escaped in place, others are converted to UTF-8 a piece at a time
+    CFStringRef cfString = (__bridge CFStringRef)string;
+    const char *asciiBytes = CFStringGetCStringPtr(cfString, kCFStringEncodingUTF8);
+    if (asciiBytes != NULL)
+    {
+        SEJSONStreamWriterAppendEscapedBytes((const uint8_t *)asciiBytes, CFStringGetLength(cfString), data);
+    }
+    else
+    {
+        uint8_t buffer[1024];
+        NSRange remainingRange = NSMakeRange(0, string.length);
+        while (remainingRange.length > 0)
+        {
+            NSUInteger usedLength = 0;
+            if (![string getBytes:buffer maxLength:sizeof(buffer) usedLength:&usedLength encoding:NSUTF8StringEncoding options:0 range:remainingRange remainingRange:&remainingRange] || usedLength == 0)
+            {
+                if (error != nil) *error = SEJSONStreamWriterError(@"Unable to convert string to UTF-8 in JSON write");
+                return NO;
+            }
+            SEJSONStreamWriterAppendEscapedBytes(buffer, usedLength, data);
+        }
+    }
+
+    [data appendBytes:"\"" length:1];
+    return YES;
+}
+
+- (BOOL) appendNumber: (NSNumber *) number toData: (NSMutableData *) data error: (NSError * __autoreleasing *) error
+{
+    CFBooleanRef boolean = (__bridge CFBooleanRef)number;
+    if (boolean == kCFBooleanTrue)
+    {
+        [data appendBytes:"true" length:4];
+        return YES;
+    }
+    if (boolean == kCFBooleanFalse)
+    {
+        [data appendBytes:"false" length:5];
+        return YES;
+    }
+
+    // integers are formatted here, the formatting of floating point numbers is left to NSJSONSerialization
+    char digits[24];
+    int length = 0;
+    switch (number.objCType[0])
+    {
+        case 'c': case 's': case 'i': case 'l': case 'q':
+            length = snprintf(digits, sizeof(digits), "%lld", number.longLongValue);
+            break;
+        case 'C': case 'S': case 'I': case 'L': case 'Q':
+            length = snprintf(digits, sizeof(digits), "%llu", number.unsignedLongLongValue);
+            break;
+    }
+    if (length > 0)
+    {
+        [data appendBytes:digits length:length];
+        return YES;
+    }
+
+    NSData *arrayData = nil;
+    @try
+    {
+        arrayData = [NSJSONSerialization dataWithJSONObject:@[ number ] options:0 error:error];
+    }
+    @catch (NSException *exception)
+    {
+        if (error != nil) *error = SEJSONStreamWriterError(exception.description);
+        return NO;
+    }
+    if (arrayData.length < 2)
+    {
+        if (error != nil && *error == nil) *error = SEJSONStreamWriterError(@"Invalid number in JSON write");
+        return NO;
+    }
+
+    // strip the brackets of the array
+    [data appendBytes:(const uint8_t *)arrayData.bytes + 1 length:arrayData.length - 2];
+    return YES;
+}
+
+@end
+
+static void SEJSONStreamWriterCallBack(CFWriteStreamRef stream, CFStreamEventType type, void *info)
+{
+    SEJSONStreamWriter *writer = (__bridge SEJSONStreamWriter *)info;
+    if (type == kCFStreamEventCanAcceptBytes)
+    {
+        [writer writeAvailableBytes];
+    }
+    else
+    {
+        // the reader has closed the stream or has failed, nobody is waiting for the rest of the body
+        [writer stop];
+    }
+}
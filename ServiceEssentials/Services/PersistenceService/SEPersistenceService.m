@@ -16,12 +16,16 @@
 #import <ServiceEssentials/SETools.h>
 #import <ServiceEssentials/SEConstants.h>
 #import <ServiceEssentials/NSArray+SEJSONExtensions.h>
+#import <ServiceEssentials/SETimeline.h>
 
 NSString * _Nonnull const SEPersistenceServiceInitializationCompleteNotification = @"SEPersistenceServiceInitializationCompleteNotification";
 NSString * _Nonnull const SEPersistenceServiceInitializationSucceededKey = @"SEPersistenceServiceInitializationSucceededKey";
 NSInteger const SEPersistenceServiceBlockOperationError = 2000;
 NSInteger const SEPersistenceServiceInitializationError = 2001;
 
+// Category of the spans the service records to the shared timeline
+static char const * const SEPersistenceServiceTimelineCategory = "persistence";
+
 #define PERSISTENCE_VERIFY_DATA_LOADED do { if ((_parent == nil && _dataLoadedFlag == 0) || (_parent != nil && ![_parent isInitialized])) THROW_INCONSISTENCY(nil); } while(0)
 
 static inline BOOL PERSISTENCE_SHOULD_SAVE(SEPersistenceServiceSaveOptions options)
@@ -210,7 +214,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     NSString *entityName = [SEPersistenceServiceImpl entityNameForClass:type];
     BOOL shouldSave = PERSISTENCE_SHOULD_SAVE(saveOptions);
     BOOL shouldSaveToParent = PERSISTENCE_SHOULD_SAVE_AND_PERSIST(_parent, saveOptions);
-    [_objectContext performBlock:^{
+    [self performContextBlock:^{
         NSError *error = nil;
         if ([self internalCreateAndSaveEntityWithClass:type name:entityName obtainPermanentId:obtainPermanentId initializer:initializer shouldSave:shouldSave error:&error])
         {
@@ -242,7 +246,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     __block BOOL result = NO;
     __block NSError *innerError = nil;
     BOOL shouldSave = PERSISTENCE_SHOULD_SAVE(saveOptions);
-    [_objectContext performBlockAndWait:^{
+    [self performContextBlockAndWait:^{
         result = [self internalCreateAndSaveEntityWithClass:type name:entityName obtainPermanentId:obtainPermanentId initializer:initializer shouldSave:shouldSave error:&innerError];
     }];
     
@@ -273,7 +277,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     
     initializer(model);
     
-    if (shouldSave) return [_objectContext save:error];
+    if (shouldSave) return [self saveContext:error];
     
     if (error != nil) *error = nil;
     return YES;
@@ -294,7 +298,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     NSString *entityName = [SEPersistenceServiceImpl entityNameForClass:type];
     BOOL shouldSave = PERSISTENCE_SHOULD_SAVE(saveOptions);
     BOOL shouldSaveToParent = PERSISTENCE_SHOULD_SAVE_AND_PERSIST(_parent, saveOptions);
-    [_objectContext performBlock:^{
+    [self performContextBlock:^{
         NSError *error = nil;
         if ([self internalCreateAndSaveEntitiesWithClass:type name:entityName objects:objects transform:transform shouldSave:shouldSave error:&error])
         {
@@ -327,7 +331,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     __block BOOL result = NO;
     __block NSError *innerError = nil;
     BOOL shouldSave = PERSISTENCE_SHOULD_SAVE(saveOptions);
-    [_objectContext performBlockAndWait:^{
+    [self performContextBlockAndWait:^{
         result = [self internalCreateAndSaveEntitiesWithClass:type name:entityName objects:objects transform:transform shouldSave:shouldSave error:&innerError];
     }];
     
@@ -350,6 +354,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     NSEntityDescription *entity = [NSEntityDescription entityForName:entityName inManagedObjectContext:_objectContext];
     
     BOOL success = YES;
+    NSTimeInterval transformTime = SETimelineBegin();
     @try
     {
         for (id object in objects)
@@ -369,6 +374,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
         }
 
     }
+    SETimelineEnd(transformTime, "transform", SEPersistenceServiceTimelineCategory, 0);
 
     if (!success)
     {
@@ -376,7 +382,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
         return NO;
     }
     
-    if (shouldSave) return [_objectContext save:error];
+    if (shouldSave) return [self saveContext:error];
     
     if (error != nil) *error = nil;
     return YES;
@@ -390,7 +396,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     PERSISTENCE_VERIFY_DATA_LOADED;
     
     BOOL shouldSaveToParent = PERSISTENCE_SHOULD_SAVE_AND_PERSIST(_parent, saveOptions);
-    [_objectContext performBlock:^{
+    [self performContextBlock:^{
         if (!_objectContext.hasChanges)
         {
             if (success != nil) dispatch_async(completionQueue, success);
@@ -398,7 +404,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
         else
         {
             NSError *error = nil;
-            BOOL result = [_objectContext save:&error];
+            BOOL result = [self saveContext:&error];
             if (result)
             {
                 if (shouldSaveToParent)
@@ -423,11 +429,11 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     PERSISTENCE_VERIFY_DATA_LOADED;
     __block BOOL result = NO;
     __block NSError *innerError = nil;
-    [_objectContext performBlockAndWait:^{
+    [self performContextBlockAndWait:^{
         if (!_objectContext.hasChanges) result = YES;
         else
         {
-            result = [_objectContext save:&innerError];
+            result = [self saveContext:&innerError];
         }
     }];
     
@@ -457,7 +463,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
 
     NSString *entityName = [SEPersistenceServiceImpl entityNameForClass:type];
     
-    [_objectContext performBlock:^{
+    [self performContextBlock:^{
         NSError *error = nil;
         BOOL result = [self internalFetchReadOnlyAndProcessWithName:entityName fetchParameters:fetchParameters fetchedObjectProcessor:fetchedProcessor error:&error];
         if (result)
@@ -482,7 +488,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     NSString *entityName = [SEPersistenceServiceImpl entityNameForClass:type];
     __block BOOL result = YES;
     __block NSError *innerError = nil;
-    [_objectContext performBlockAndWait:^{
+    [self performContextBlockAndWait:^{
         result = [self internalFetchReadOnlyAndProcessWithName:entityName fetchParameters:fetchParameters fetchedObjectProcessor:fetchedProcessor error:&innerError];
     }];
     
@@ -501,7 +507,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     if (fetchedProcessor == nil) THROW_INVALID_PARAM(fetchedProcessor, nil);
 #endif
 
-    [_objectContext performBlock:^{
+    [self performContextBlock:^{
         NSError *error = nil;
         BOOL result = [self internalFetchReadOnlyObjectsByIds:objectIds fetchedObjectProcessor:fetchedProcessor error:&error];
         if (result)
@@ -525,7 +531,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     
     __block BOOL result = YES;
     __block NSError *innerError = nil;
-    [_objectContext performBlockAndWait:^{
+    [self performContextBlockAndWait:^{
         result = [self internalFetchReadOnlyObjectsByIds:objectIds fetchedObjectProcessor:fetchedProcessor error:&innerError];
     }];
     
@@ -547,7 +553,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     
     NSString *entityName = [SEPersistenceServiceImpl entityNameForClass:type];
     
-    [_objectContext performBlock:^{
+    [self performContextBlock:^{
         NSError *error = nil;
         NSArray *results = [self internalFetchTransformObjectsWithName:entityName fetchParameters:fetchParameters transform:transform error:&error];
         if (results)
@@ -573,7 +579,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     NSString *entityName = [SEPersistenceServiceImpl entityNameForClass:type];
     __block NSArray *results = nil;
     __block NSError *innerError = nil;
-    [_objectContext performBlockAndWait:^{
+    [self performContextBlockAndWait:^{
         results = [self internalFetchTransformObjectsWithName:entityName fetchParameters:fetchParameters transform:transform error:&innerError];
     }];
     
@@ -604,7 +610,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
 - (BOOL)internalFetchReadOnlyAndProcessWithName:(NSString *)entityName fetchParameters:(SEFetchParameters *)fetchParameters  fetchedObjectProcessor:(void (^)(NSArray * _Nonnull))fetchedProcessor error:(NSError *__autoreleasing  _Nullable *)error
 {
     NSFetchRequest *fetchRequest = [self createFetchRequestForEntityName:entityName fetchParameters:fetchParameters includesValues:YES];
-    NSArray *fetchedObjects = [_objectContext executeFetchRequest:fetchRequest error:error];
+    NSArray *fetchedObjects = [self executeFetchRequest:fetchRequest error:error];
     if (fetchedObjects == nil) return NO;
     
     BOOL result = YES;
@@ -689,13 +695,14 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
 - (NSArray *)internalFetchTransformObjectsWithName:(NSString *)entityName fetchParameters:(SEFetchParameters *)fetchParameters transform:(id  _Nonnull (^)(__kindof NSManagedObject * _Nonnull))transform error:(NSError *__autoreleasing  _Nullable *)error
 {
     NSFetchRequest *fetchRequest = [self createFetchRequestForEntityName:entityName fetchParameters:fetchParameters includesValues:YES];
-    NSArray *fetchedObjects = [_objectContext executeFetchRequest:fetchRequest error:error];
+    NSArray *fetchedObjects = [self executeFetchRequest:fetchRequest error:error];
     if (fetchedObjects == nil) return nil;
     
     BOOL hadChanges = _objectContext.hasChanges;
     NSMutableArray *results = [[NSMutableArray alloc] initWithCapacity:fetchedObjects.count];
     NSError *innerError = nil;
     
+    NSTimeInterval transformTime = SETimelineBegin();
     @try
     {
         for (NSManagedObject *source in fetchedObjects)
@@ -715,6 +722,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
         NSString *reason = [NSString stringWithFormat:@"Failed executing fetch processor: %@", exception];
         innerError = [NSError errorWithDomain:SEErrorDomain code:SEPersistenceServiceBlockOperationError userInfo:@{ NSLocalizedDescriptionKey: reason }];
     }
+    SETimelineEnd(transformTime, "transform", SEPersistenceServiceTimelineCategory, 0);
     
     // Maybe cannot prevent all changes but at least an obvious case. Also exclude a scenario when there were changes before.
     if (!hadChanges && _objectContext.hasChanges)
@@ -747,7 +755,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
 
     NSString *entityName = [SEPersistenceServiceImpl entityNameForClass:type];
 
-    [_objectContext performBlock:^{
+    [self performContextBlock:^{
         NSError *error = nil;
         SEPersistenceServiceSaveOptions saveOptions = SEPersistenceServiceDontSave;
         BOOL result = [self internalFetchAndProcessWithName:entityName fetchParameters:fetchParameters fetchedObjectProcessor:fetchedProcessor error:&error saveOptionsOut:&saveOptions];
@@ -781,7 +789,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     __block BOOL result = YES;
     __block NSError *innerError = nil;
     __block SEPersistenceServiceSaveOptions saveOptions = SEPersistenceServiceDontSave;
-    [_objectContext performBlockAndWait:^{
+    [self performContextBlockAndWait:^{
         result = [self internalFetchAndProcessWithName:entityName fetchParameters:fetchParameters fetchedObjectProcessor:fetchedProcessor error:&innerError saveOptionsOut:&saveOptions];
     }];
 
@@ -807,7 +815,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     if (fetchedProcessor == nil) THROW_INVALID_PARAM(fetchedProcessor, nil);
 #endif
 
-    [_objectContext performBlock:^{
+    [self performContextBlock:^{
         NSError *error = nil;
         SEPersistenceServiceSaveOptions saveOptions = SEPersistenceServiceDontSave;
         BOOL result = [self internalFetchAndProcessObjectsByIds:objectIds fetchedObjectProcessor:fetchedProcessor error:&error saveOptionsOut:&saveOptions];
@@ -841,7 +849,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     __block BOOL result = YES;
     __block NSError *innerError = nil;
     __block SEPersistenceServiceSaveOptions saveOptions = SEPersistenceServiceDontSave;
-    [_objectContext performBlockAndWait:^{
+    [self performContextBlockAndWait:^{
         result = [self internalFetchAndProcessObjectsByIds:objectIds fetchedObjectProcessor:fetchedProcessor error:&innerError saveOptionsOut:&saveOptions];
     }];
     
@@ -866,7 +874,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
 #endif
     
     NSFetchRequest *fetchRequest = [self createFetchRequestForEntityName:entityName fetchParameters:fetchParameters includesValues:YES];
-    NSArray *fetchedObjects = [_objectContext executeFetchRequest:fetchRequest error:error];
+    NSArray *fetchedObjects = [self executeFetchRequest:fetchRequest error:error];
     if (fetchedObjects == nil) return NO;
 
     BOOL result = YES;
@@ -890,7 +898,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     
     if (save && _objectContext.hasChanges)
     {
-        result = [_objectContext save:error];
+        result = [self saveContext:error];
     }
     return result;
 }
@@ -934,7 +942,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     {
         if (save && _objectContext.hasChanges)
         {
-            result = [_objectContext save:&innerError];
+            result = [self saveContext:&innerError];
         }
     }
     else
@@ -957,7 +965,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     BOOL shouldSave = PERSISTENCE_SHOULD_SAVE(saveOptions);
     BOOL shouldSaveToParent = PERSISTENCE_SHOULD_SAVE_AND_PERSIST(_parent, saveOptions);
     NSString *entityName = [SEPersistenceServiceImpl entityNameForClass:type];
-    [_objectContext performBlock:^{
+    [self performContextBlock:^{
         NSError *error = nil;
         BOOL result = [self internalDeleteObjectsWithName:entityName fetchParameters:fetchParameters shouldSave:shouldSave error:&error];
         if (result)
@@ -991,7 +999,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     __block BOOL result = YES;
     __block NSError *innerError = nil;
 
-    [_objectContext performBlockAndWait:^{
+    [self performContextBlockAndWait:^{
         result = [self internalDeleteObjectsWithName:entityName fetchParameters:fetchParameters shouldSave:shouldSave error:&innerError];
     }];
     
@@ -1018,7 +1026,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     
     BOOL shouldSave = PERSISTENCE_SHOULD_SAVE(saveOptions);
     BOOL shouldSaveToParent = PERSISTENCE_SHOULD_SAVE_AND_PERSIST(_parent, saveOptions);
-    [_objectContext performBlock:^{
+    [self performContextBlock:^{
         NSError *error = nil;
         BOOL result = [self internalDeleteObjectsByIds:objectIds shouldSave:shouldSave error:&error];
         if (result)
@@ -1050,7 +1058,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     __block BOOL result = YES;
     __block NSError *innerError = nil;
     
-    [_objectContext performBlockAndWait:^{
+    [self performContextBlockAndWait:^{
         result = [self internalDeleteObjectsByIds:objectIds shouldSave:shouldSave error:&innerError];
     }];
     
@@ -1073,7 +1081,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     NSFetchRequest *fetchRequest = [self createFetchRequestForEntityName:entityName fetchParameters:fetchParameters includesValues:NO];
     fetchRequest.returnsObjectsAsFaults = YES;
     
-    NSArray *fetchedObjects = [_objectContext executeFetchRequest:fetchRequest error:error];
+    NSArray *fetchedObjects = [self executeFetchRequest:fetchRequest error:error];
     if (fetchedObjects == nil) return NO;
 
     for (NSManagedObject *object in fetchedObjects)
@@ -1083,7 +1091,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     
     if (!shouldSave) return YES;
     
-    return [_objectContext save:error];
+    return [self saveContext:error];
 }
 
 - (BOOL)internalDeleteObjectsByIds:(NSArray<NSManagedObjectID *> *)objectIds shouldSave:(BOOL)shouldSave error:(NSError *__autoreleasing  _Nullable *)error
@@ -1116,7 +1124,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
     
     if (!shouldSave) return YES;
     
-    return [_objectContext save:error];
+    return [self saveContext:error];
 }
 
 
@@ -1125,7 +1133,7 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
 - (void)rollbackWithCompletion:(void (^)())completion completionQueue:(dispatch_queue_t)completionQueue
 {
     PERSISTENCE_VERIFY_DATA_LOADED;
-    [_objectContext performBlock:^{
+    [self performContextBlock:^{
         [_objectContext rollback];
         if (completion != nil) dispatch_async(completionQueue, ^{ completion(); });
     }];
@@ -1134,11 +1142,51 @@ static inline BOOL PERSISTENCE_SHOULD_SAVE_AND_PERSIST(SEPersistenceServiceImpl
 - (void)rollbackAndWait
 {
     PERSISTENCE_VERIFY_DATA_LOADED;
-    [_objectContext performBlockAndWait:^{
+    [self performContextBlockAndWait:^{
         [_objectContext rollback];
     }];
 }
 
+#pragma mark - Context Operations
+
+// Operations on the context record their spans to the shared timeline
+
+- (void)performContextBlock:(void (^)(void))block
+{
+    NSTimeInterval enqueueTime = SETimelineBegin();
+    [_objectContext performBlock:^{
+        SETimelineEnd(enqueueTime, "queue wait", SEPersistenceServiceTimelineCategory, 0);
+        block();
+    }];
+}
+
+- (void)performContextBlockAndWait:(void (^)(void))block
+{
+    NSTimeInterval enqueueTime = SETimelineBegin();
+    [_objectContext performBlockAndWait:^{
+        SETimelineEnd(enqueueTime, "queue wait", SEPersistenceServiceTimelineCategory, 0);
+        block();
+    }];
+}
+
+// Must be called on the queue of the context
+- (NSArray *)executeFetchRequest:(NSFetchRequest *)fetchRequest error:(NSError * __autoreleasing *)error
+{
+    NSTimeInterval fetchTime = SETimelineBegin();
+    NSArray *fetchedObjects = [_objectContext executeFetchRequest:fetchRequest error:error];
+    SETimelineEnd(fetchTime, "fetch", SEPersistenceServiceTimelineCategory, 0);
+    return fetchedObjects;
+}
+
+// Must be called on the queue of the context
+- (BOOL)saveContext:(NSError * __autoreleasing *)error
+{
+    NSTimeInterval saveTime = SETimelineBegin();
+    BOOL result = [_objectContext save:error];
+    SETimelineEnd(saveTime, "save", SEPersistenceServiceTimelineCategory, 0);
+    return result;
+}
+
 #pragma mark - Naming
 
 + (NSString *)entityNameForClass:(Class)type
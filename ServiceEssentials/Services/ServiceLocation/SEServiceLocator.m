@@ -11,6 +11,8 @@
 #import <ServiceEssentials/SEServiceLocator.h>
 
 #import <pthread.h>
+#import <objc/runtime.h>
+#import <ServiceEssentials/SETimeline.h>
 #import <ServiceEssentials/SETools.h>
 #import <ServiceEssentials/SEServiceWeakProxy.h>
 
@@ -274,7 +276,10 @@
             SEServiceLocator *strongServiceLocator = _serviceLocator;
             if (strongServiceLocator == nil || _constructionBlock == nil) return nil;
             
+            // construction shows on the timeline under the name of the protocol
+            NSTimeInterval constructionTime = SETimelineBegin();
             _lazyObject = _constructionBlock(strongServiceLocator);
+            SETimelineEnd(constructionTime, protocol_getName(_protocol), "service locator", 0);
             if (![_lazyObject conformsToProtocol:_protocol])
             {
 #ifdef DEBUG
@@ -0,0 +1,61 @@
+//
+//  SETimeline.h
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+@import Foundation;
+
+/**
+ Records spans of work of the services and exports them as a Chrome trace, which opens as a single timeline in `chrome://tracing` or Perfetto.
+
+ The services record to the shared timeline once it is enabled:
+ - data request service: `build` of a request on the calling thread, then `send` until the response, `first byte` until the body starts,
+ `body complete` until the task completes, `cleanup` that removes the request from the service, `deserialize` and `callback`,
+ which includes the wait for the completion queue.
+ All but `build` belong to the request and show on a track of their own.
+ - persistence service: `queue wait` of the blocks performed on the context queue, `fetch`, `save` and `transform`.
+ - service locator: construction of lazy evaluated services, named after the protocol.
+
+ Spans are written into a fixed ring buffer without locks, the oldest spans are overwritten once it is full.
+ Timestamps are the system uptime, same as `[NSProcessInfo processInfo].systemUptime`.
+ */
+@interface SETimeline : NSObject
+
+/** Timeline the services record to, disabled by default */
++ (nonnull SETimeline *) sharedTimeline;
+
+/** Initializes a disabled timeline which keeps at least the number of latest spans */
+- (nonnull instancetype) initWithCapacity: (NSUInteger) capacity;
+
+/** Spans are only recorded while enabled, a disabled timeline costs a check per span */
+@property (atomic, assign, getter=isEnabled) BOOL enabled;
+@property (nonatomic, readonly, assign) NSUInteger capacity;
+
+/**
+ Records a finished span of work, unless the timeline is disabled
+ @param name name of the span, a string that lives as long as the process, such as a literal
+ @param category category of the span, a string that lives as long as the process
+ @param beginTime system uptime the work has begun at
+ @param endTime system uptime the work has ended at
+ @param identifier identifies a flow of work which spans show on a track of their own, 0 to show the span on the track of the current thread
+ */
+- (void) recordSpanWithName: (nonnull const char *) name category: (nonnull const char *) category beginTime: (NSTimeInterval) beginTime endTime: (NSTimeInterval) endTime identifier: (uint64_t) identifier;
+
+/** Returns the recorded spans in Chrome trace event format. Spans overwritten while being exported are skipped. */
+- (nonnull NSData *) chromeTraceData;
+
+/** Discards the recorded spans */
+- (void) removeAllSpans;
+
+@end
+
+/** Returns the current system uptime if the shared timeline is enabled, 0 otherwise */
+FOUNDATION_EXPORT NSTimeInterval SETimelineBegin(void);
+
+/** Records a span of the shared timeline from the begin time until now, does nothing if the begin time is 0, see `recordSpanWithName:category:beginTime:endTime:identifier:` */
+FOUNDATION_EXPORT void SETimelineEnd(NSTimeInterval beginTime, const char * _Nonnull name, const char * _Nonnull category, uint64_t identifier);
@@ -0,0 +1,215 @@
+//
+//  SETimeline.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import "SETimeline.h"
+
+#include <libkern/OSAtomic.h>
+#include <mach/mach_time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#import "SETools.h"
+
+static NSUInteger const SETimelineSharedCapacity = 8192;
+
+typedef struct
+{
+    // ticket of the span plus one once it is written, 0 while it is being written
+    volatile int64_t sequence;
+    const char *name;
+    const char *category;
+    NSTimeInterval beginTime;
+    NSTimeInterval endTime;
+    uint64_t identifier;
+    uint64_t threadIdentifier;
+} SETimelineSpan;
+
+static double SETimelineSecondsPerTick = 0;
+
+static int SETimelineCompareSpans(const void *left, const void *right)
+{
+    NSTimeInterval leftTime = ((const SETimelineSpan *)left)->beginTime;
+    NSTimeInterval rightTime = ((const SETimelineSpan *)right)->beginTime;
+    return (leftTime < rightTime) ? -1 : (leftTime > rightTime ? 1 : 0);
+}
+
+@implementation SETimeline
+{
+    pthread_mutex_t _lock;
+    // allocated when the timeline is enabled for the first time, never released while the timeline is alive
+    SETimelineSpan *_spans;
+    NSUInteger _mask;
+    volatile int64_t _nextTicket;
+    volatile uint32_t _enabled;
+}
+
+// Writers claim a slot with a ticket and mark it as being written, so that the export skips it until it is consistent.
+static void SETimelineRecordSpan(SETimeline *timeline, const char *name, const char *category, NSTimeInterval beginTime, NSTimeInterval endTime, uint64_t identifier)
+{
+    if (timeline->_enabled == 0) return;
+    OSMemoryBarrier();
+
+    uint64_t threadIdentifier = 0;
+    pthread_threadid_np(NULL, &threadIdentifier);
+
+    int64_t ticket = OSAtomicIncrement64(&timeline->_nextTicket) - 1;
+    SETimelineSpan *span = &timeline->_spans[ticket & timeline->_mask];
+    span->sequence = 0;
+    OSMemoryBarrier();
+    span->name = name;
+    span->category = category;
+    span->beginTime = beginTime;
+    span->endTime = endTime;
+    span->identifier = identifier;
+    span->threadIdentifier = threadIdentifier;
+    OSMemoryBarrier();
+    span->sequence = ticket + 1;
+}
+
++ (SETimeline *)sharedTimeline
+{
+    static SETimeline *sharedTimeline = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        mach_timebase_info_data_t timebase;
+        mach_timebase_info(&timebase);
+        SETimelineSecondsPerTick = (double)timebase.numer / timebase.denom / NSEC_PER_SEC;
+        sharedTimeline = [[SETimeline alloc] initWithCapacity:SETimelineSharedCapacity];
+    });
+    return sharedTimeline;
+}
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity
+{
+    if (capacity == 0) THROW_INVALID_PARAM(capacity, nil);
+
+    self = [super init];
+    if (self)
+    {
+        // a power of two makes the slot of a ticket a mask away
+        NSUInteger roundedCapacity = 1;
+        while (roundedCapacity < capacity) roundedCapacity <<= 1;
+        _capacity = roundedCapacity;
+        _mask = roundedCapacity - 1;
+        pthread_mutex_init(&_lock, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    free(_spans);
+    pthread_mutex_destroy(&_lock);
+}
+
+- (BOOL)isEnabled
+{
+    return _enabled != 0;
+}
+
+- (void)setEnabled:(BOOL)enabled
+{
+    pthread_mutex_lock(&_lock);
+    if (enabled && _spans == NULL) _spans = calloc(_capacity, sizeof(SETimelineSpan));
+    // spans are in place before anybody sees the timeline enabled
+    OSMemoryBarrier();
+    _enabled = enabled ? 1 : 0;
+    pthread_mutex_unlock(&_lock);
+}
+
+- (void)recordSpanWithName:(const char *)name category:(const char *)category beginTime:(NSTimeInterval)beginTime endTime:(NSTimeInterval)endTime identifier:(uint64_t)identifier
+{
+#ifdef DEBUG
+    if (name == NULL) THROW_INVALID_PARAM(name, nil);
+    if (category == NULL) THROW_INVALID_PARAM(category, nil);
+#endif
+    SETimelineRecordSpan(self, name, category, beginTime, endTime, identifier);
+}
+
+- (void)removeAllSpans
+{
+    pthread_mutex_lock(&_lock);
+    if (_spans != NULL)
+    {
+        for (NSUInteger i = 0; i < _capacity; ++i) _spans[i].sequence = 0;
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+- (NSData *)chromeTraceData
+{
+    NSMutableData *snapshot = [NSMutableData new];
+    pthread_mutex_lock(&_lock);
+    if (_spans != NULL)
+    {
+        // a span is taken if it has not been rewritten while it was copied
+        for (NSUInteger i = 0; i < _capacity; ++i)
+        {
+            int64_t sequence = _spans[i].sequence;
+            if (sequence == 0) continue;
+            OSMemoryBarrier();
+            SETimelineSpan span = _spans[i];
+            OSMemoryBarrier();
+            if (_spans[i].sequence != sequence) continue;
+            [snapshot appendBytes:&span length:sizeof(span)];
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+
+    NSUInteger count = snapshot.length / sizeof(SETimelineSpan);
+    SETimelineSpan *spans = snapshot.mutableBytes;
+    if (count > 1) qsort(spans, count, sizeof(SETimelineSpan), SETimelineCompareSpans);
+
+    // timestamps of the format are in microseconds
+    NSNumber *processIdentifier = @(getpid());
+    NSMutableArray *events = [[NSMutableArray alloc] initWithCapacity:count];
+    for (NSUInteger i = 0; i < count; ++i)
+    {
+        SETimelineSpan *span = &spans[i];
+        NSString *name = @(span->name);
+        NSString *category = @(span->category);
+        NSNumber *threadIdentifier = @(span->threadIdentifier);
+        if (span->identifier == 0)
+        {
+            [events addObject:@{ @"name": name, @"cat": category, @"ph": @"X", @"ts": @(span->beginTime * 1e6), @"dur": @((span->endTime - span->beginTime) * 1e6), @"pid": processIdentifier, @"tid": threadIdentifier }];
+        }
+        else
+        {
+            // nestable async events of the same identifier share a track
+            NSString *identifier = [NSString stringWithFormat:@"0x%llx", span->identifier];
+            [events addObject:@{ @"name": name, @"cat": category, @"ph": @"b", @"id": identifier, @"ts": @(span->beginTime * 1e6), @"pid": processIdentifier, @"tid": threadIdentifier }];
+            [events addObject:@{ @"name": name, @"cat": category, @"ph": @"e", @"id": identifier, @"ts": @(span->endTime * 1e6), @"pid": processIdentifier, @"tid": threadIdentifier }];
+        }
+    }
+
+    return [NSJSONSerialization dataWithJSONObject:@{ @"traceEvents": events, @"displayTimeUnit": @"ms" } options:0 error:nil];
+}
+
+#pragma mark - Recording
+
+NSTimeInterval SETimelineBegin(void)
+{
+    SETimeline *timeline = [SETimeline sharedTimeline];
+    if (timeline->_enabled == 0) return 0;
+    return mach_absolute_time() * SETimelineSecondsPerTick;
+}
+
+void SETimelineEnd(NSTimeInterval beginTime, const char *name, const char *category, uint64_t identifier)
+{
+    if (beginTime <= 0) return;
+    SETimelineRecordSpan([SETimeline sharedTimeline], name, category, beginTime, mach_absolute_time() * SETimelineSecondsPerTick, identifier);
+}
+
+@end
@@ -0,0 +1,123 @@
+//
+//  SEDataRequestCircuitBreakersTests.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <XCTest/XCTest.h>
+#import "SEDataRequestCircuitBreakers.h"
+
+static NSString * const SETestEndpoint = @"api.service-essentials.com/items/{}";
+
+@interface SEDataRequestCircuitBreakersTests : XCTestCase
+@end
+
+@implementation SEDataRequestCircuitBreakersTests
+{
+    SEDataRequestCircuitBreakers *_breakers;
+}
+
+- (void)setUp
+{
+    [super setUp];
+    _breakers = [SEDataRequestCircuitBreakers new];
+    _breakers.windowSize = 4;
+    _breakers.minimumRequestCount = 4;
+    _breakers.failureRateThreshold = 0.5;
+    _breakers.openInterval = 0.05;
+}
+
+- (void)openCircuit
+{
+    for (int i = 0; i < 4; i++)
+    {
+        XCTAssertTrue([_breakers shouldAllowRequestToEndpoint:SETestEndpoint]);
+        [_breakers recordFailureForEndpoint:SETestEndpoint];
+    }
+}
+
+- (void)testCircuitBreakersEndpointReplacesIdentifiers
+{
+    NSURL *url = [NSURL URLWithString:@"https://API.service-essentials.com/v2/items/12345/photos/3f2b8c1e-9a7d-4e2f-b1c3-5d6e7f8a9b0c?size=large"];
+    XCTAssertEqualObjects([SEDataRequestCircuitBreakers endpointForURL:url], @"api.service-essentials.com/v2/items/{}/photos/{}");
+}
+
+- (void)testCircuitBreakersOpenOnFailureRate
+{
+    XCTAssertTrue([_breakers shouldAllowRequestToEndpoint:SETestEndpoint]);
+    [_breakers recordFailureForEndpoint:SETestEndpoint];
+    [_breakers recordSuccessForEndpoint:SETestEndpoint duration:0.1];
+    [_breakers recordSuccessForEndpoint:SETestEndpoint duration:0.1];
+    XCTAssertEqual([_breakers stateForEndpoint:SETestEndpoint], SEDataRequestCircuitStateClosed);
+    
+    [_breakers recordFailureForEndpoint:SETestEndpoint];
+    XCTAssertEqual([_breakers stateForEndpoint:SETestEndpoint], SEDataRequestCircuitStateOpen);
+    XCTAssertFalse([_breakers shouldAllowRequestToEndpoint:SETestEndpoint]);
+    XCTAssertTrue([_breakers shouldAllowRequestToEndpoint:@"api.service-essentials.com/other"]);
+    XCTAssertEqualObjects([_breakers openCircuits], @{ SETestEndpoint: @(SEDataRequestCircuitStateOpen) });
+}
+
+- (void)testCircuitBreakersCountSlowRequestsAsFailures
+{
+    _breakers.slowRequestThreshold = 1.0;
+    for (int i = 0; i < 4; i++) [_breakers recordSuccessForEndpoint:SETestEndpoint duration:2.0];
+    XCTAssertEqual([_breakers stateForEndpoint:SETestEndpoint], SEDataRequestCircuitStateOpen);
+}
+
+- (void)testCircuitBreakersCloseAfterSuccessfulProbe
+{
+    [self openCircuit];
+    [NSThread sleepForTimeInterval:0.1];
+    
+    XCTAssertTrue([_breakers shouldAllowRequestToEndpoint:SETestEndpoint]);
+    XCTAssertEqual([_breakers stateForEndpoint:SETestEndpoint], SEDataRequestCircuitStateHalfOpen);
+    // only one probe at a time
+    XCTAssertFalse([_breakers shouldAllowRequestToEndpoint:SETestEndpoint]);
+    
+    [_breakers recordSuccessForEndpoint:SETestEndpoint duration:0.1];
+    XCTAssertEqual([_breakers stateForEndpoint:SETestEndpoint], SEDataRequestCircuitStateClosed);
+    XCTAssertTrue([_breakers shouldAllowRequestToEndpoint:SETestEndpoint]);
+}
+
+- (void)testCircuitBreakersReopenAfterFailedProbe
+{
+    [self openCircuit];
+    [NSThread sleepForTimeInterval:0.1];
+    
+    XCTAssertTrue([_breakers shouldAllowRequestToEndpoint:SETestEndpoint]);
+    [_breakers recordFailureForEndpoint:SETestEndpoint];
+    XCTAssertEqual([_breakers stateForEndpoint:SETestEndpoint], SEDataRequestCircuitStateOpen);
+    XCTAssertFalse([_breakers shouldAllowRequestToEndpoint:SETestEndpoint]);
+}
+
+- (void)testCircuitBreakersReleaseProbeWithoutOutcome
+{
+    [self openCircuit];
+    [NSThread sleepForTimeInterval:0.1];
+    
+    XCTAssertTrue([_breakers shouldAllowRequestToEndpoint:SETestEndpoint]);
+    [_breakers recordNoOutcomeForEndpoint:SETestEndpoint];
+    XCTAssertTrue([_breakers shouldAllowRequestToEndpoint:SETestEndpoint]);
+}
+
+- (void)testCircuitBreakersReportStateChanges
+{
+    NSMutableArray<NSNumber *> *states = [NSMutableArray new];
+    _breakers.stateChangeHandler = ^(NSString *endpoint, SEDataRequestCircuitState state) {
+        [states addObject:@(state)];
+    };
+    
+    [self openCircuit];
+    [NSThread sleepForTimeInterval:0.1];
+    [_breakers shouldAllowRequestToEndpoint:SETestEndpoint];
+    [_breakers recordSuccessForEndpoint:SETestEndpoint duration:0.1];
+    
+    NSArray *expected = @[ @(SEDataRequestCircuitStateOpen), @(SEDataRequestCircuitStateHalfOpen), @(SEDataRequestCircuitStateClosed) ];
+    XCTAssertEqualObjects(states, expected);
+}
+
+@end
@@ -0,0 +1,167 @@
+//
+//  SEDataRequestContentCacheTests.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <XCTest/XCTest.h>
+#import "SEDataRequestContentCache.h"
+
+static inline NSHTTPURLResponse *SEContentCacheTestResponse(NSURL *url, NSDictionary<NSString *, NSString *> *headers)
+{
+    return [[NSHTTPURLResponse alloc] initWithURL:url statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:headers];
+}
+
+static inline NSData *SEContentCacheTestData(NSUInteger length, uint8_t value)
+{
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    memset(data.mutableBytes, value, length);
+    return data;
+}
+
+@interface SEDataRequestContentCacheTests : XCTestCase
+@end
+
+@implementation SEDataRequestContentCacheTests
+{
+    NSURL *_directoryURL;
+}
+
+- (void)setUp
+{
+    [super setUp];
+    _directoryURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[NSUUID UUID].UUIDString isDirectory:YES];
+}
+
+- (void)tearDown
+{
+    [[NSFileManager defaultManager] removeItemAtURL:_directoryURL error:nil];
+    [super tearDown];
+}
+
+- (void)testContentCacheServesContentFromMemoryAndDisk
+{
+    NSURL *url = [NSURL URLWithString:@"https://cdn.awesomehost.com/avatar.png"];
+    NSData *data = SEContentCacheTestData(1024, 7);
+    NSDictionary *headers = @{ @"Cache-Control": @"public, max-age=60", @"Content-Type": @"image/png" };
+
+    SEDataRequestContentCache *cache = [[SEDataRequestContentCache alloc] initWithDirectoryURL:_directoryURL memoryCapacity:64 * 1024 diskCapacity:1024 * 1024];
+    XCTAssertNil([cache cachedContentForURL:url]);
+    [cache storeData:data response:SEContentCacheTestResponse(url, headers) forURL:url];
+
+    SEDataRequestCachedContent *content = [cache cachedContentForURL:url];
+    XCTAssertEqualObjects(content.data, data);
+    XCTAssertEqual(cache.memoryCost, data.length);
+    XCTAssertEqual(cache.hitCount, 1);
+    XCTAssertEqual(cache.missCount, 1);
+    [cache synchronize];
+    XCTAssertEqual(cache.diskSize, data.length);
+
+    // a new instance picks up the entries stored on disk
+    cache = [[SEDataRequestContentCache alloc] initWithDirectoryURL:_directoryURL memoryCapacity:64 * 1024 diskCapacity:1024 * 1024];
+    XCTAssertEqual(cache.memoryCost, 0);
+    content = [cache cachedContentForURL:url];
+    XCTAssertEqualObjects(content.data, data);
+    XCTAssertEqual(content.response.statusCode, 200);
+    XCTAssertEqualObjects(content.response.MIMEType, @"image/png");
+    XCTAssertGreaterThan(content.expirationDate.timeIntervalSinceNow, 50);
+    XCTAssertEqual(cache.memoryCost, data.length);
+
+    [cache removeContentForURL:url];
+    XCTAssertNil([cache cachedContentForURL:url]);
+    XCTAssertEqual(cache.diskSize, 0);
+}
+
+- (void)testContentCacheHonorsCacheControlAndExpiry
+{
+    NSURL *url = [NSURL URLWithString:@"https://cdn.awesomehost.com/image.jpg"];
+    NSData *data = SEContentCacheTestData(16, 1);
+    SEDataRequestContentCache *cache = [[SEDataRequestContentCache alloc] initWithDirectoryURL:_directoryURL memoryCapacity:64 * 1024 diskCapacity:1024 * 1024];
+
+    [cache storeData:data response:SEContentCacheTestResponse(url, @{ @"Cache-Control": @"no-store, max-age=60" }) forURL:url];
+    XCTAssertNil([cache cachedContentForURL:url]);
+    [cache storeData:data response:SEContentCacheTestResponse(url, @{ @"Cache-Control": @"no-cache" }) forURL:url];
+    XCTAssertNil([cache cachedContentForURL:url]);
+    [cache storeData:data response:SEContentCacheTestResponse(url, @{ @"Cache-Control": @"max-age=60", @"Age": @"60" }) forURL:url];
+    XCTAssertNil([cache cachedContentForURL:url]);
+    [cache storeData:data response:SEContentCacheTestResponse(url, @{ @"Expires": @"0" }) forURL:url];
+    XCTAssertNil([cache cachedContentForURL:url]);
+    NSHTTPURLResponse *notFound = [[NSHTTPURLResponse alloc] initWithURL:url statusCode:404 HTTPVersion:@"HTTP/1.1" headerFields:@{ @"Cache-Control": @"max-age=60" }];
+    [cache storeData:data response:notFound forURL:url];
+    XCTAssertNil([cache cachedContentForURL:url]);
+
+    // without freshness information, only the default time to live applies
+    [cache storeData:data response:SEContentCacheTestResponse(url, nil) forURL:url];
+    XCTAssertNil([cache cachedContentForURL:url]);
+    cache.defaultTimeToLive = 60;
+    [cache storeData:data response:SEContentCacheTestResponse(url, nil) forURL:url];
+    XCTAssertNotNil([cache cachedContentForURL:url]);
+
+    NSDateFormatter *formatter = [[NSDateFormatter alloc] init];
+    formatter.locale = [NSLocale localeWithLocaleIdentifier:@"en_US_POSIX"];
+    formatter.timeZone = [NSTimeZone timeZoneWithAbbreviation:@"GMT"];
+    formatter.dateFormat = @"EEE, dd MMM yyyy HH:mm:ss zzz";
+    NSDate *now = [NSDate date];
+    NSDictionary *headers = @{ @"Date": [formatter stringFromDate:now], @"Expires": [formatter stringFromDate:[now dateByAddingTimeInterval:1]] };
+    [cache storeData:data response:SEContentCacheTestResponse(url, headers) forURL:url];
+    XCTAssertNotNil([cache cachedContentForURL:url]);
+
+    // stale entries are removed rather than served
+    [NSThread sleepForTimeInterval:1.5];
+    XCTAssertNil([cache cachedContentForURL:url]);
+}
+
+- (void)testContentCacheKeepsWithinCapacity
+{
+    SEDataRequestContentCache *cache = [[SEDataRequestContentCache alloc] initWithDirectoryURL:_directoryURL memoryCapacity:400 diskCapacity:250];
+    NSDictionary *headers = @{ @"Cache-Control": @"max-age=60" };
+    NSMutableArray<NSURL *> *urls = [NSMutableArray new];
+    for (uint8_t i = 0; i < 5; ++i)
+    {
+        NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"https://cdn.awesomehost.com/%d.png", i]];
+        [urls addObject:url];
+        [cache storeData:SEContentCacheTestData(100, i) response:SEContentCacheTestResponse(url, headers) forURL:url];
+        // the first entry stays the most recently used one
+        [cache cachedContentForURL:urls.firstObject];
+    }
+    XCTAssertEqual(cache.memoryCost, 400);
+    XCTAssertNotNil([cache cachedContentForURL:urls.firstObject]);
+    XCTAssertNotNil([cache cachedContentForURL:urls.lastObject]);
+
+    // bodies over a quarter of the memory capacity go to the disk only
+    NSURL *largeURL = [NSURL URLWithString:@"https://cdn.awesomehost.com/large.png"];
+    [cache storeData:SEContentCacheTestData(101, 9) response:SEContentCacheTestResponse(largeURL, headers) forURL:largeURL];
+    XCTAssertEqual(cache.memoryCost, 400);
+
+    [cache synchronize];
+    XCTAssertLessThanOrEqual(cache.diskSize, 250);
+}
+
+- (void)testContentCacheDeduplicatesContent
+{
+    SEDataRequestContentCache *cache = [[SEDataRequestContentCache alloc] initWithDirectoryURL:_directoryURL memoryCapacity:0 diskCapacity:1024 * 1024];
+    cache.deduplicatesContent = YES;
+    NSData *data = SEContentCacheTestData(512, 3);
+    NSDictionary *headers = @{ @"Cache-Control": @"max-age=60" };
+    NSURL *url1 = [NSURL URLWithString:@"https://cdn.awesomehost.com/a.png"];
+    NSURL *url2 = [NSURL URLWithString:@"https://mirror.awesomehost.com/a.png"];
+
+    [cache storeData:data response:SEContentCacheTestResponse(url1, headers) forURL:url1];
+    [cache storeData:data response:SEContentCacheTestResponse(url2, headers) forURL:url2];
+    [cache synchronize];
+    XCTAssertEqual(cache.diskSize, data.length);
+
+    // the shared file stays while another entry references it
+    [cache removeContentForURL:url1];
+    XCTAssertEqual(cache.diskSize, data.length);
+    [cache synchronize];
+    cache = [[SEDataRequestContentCache alloc] initWithDirectoryURL:_directoryURL memoryCapacity:0 diskCapacity:1024 * 1024];
+    XCTAssertNil([cache cachedContentForURL:url1]);
+    XCTAssertEqualObjects([cache cachedContentForURL:url2].data, data);
+}
+
+@end
@@ -10,8 +10,11 @@
 
 #import <XCTest/XCTest.h>
 #import <OCMock/OCMock.h>
+#import "SEDataRequestContext.h"
 #import "SEDataRequestFactory.h"
 #import "SEInternalDataRequestBuilder.h"
+#import "SEInternalDataRequestTemplate.h"
+#import <ServiceEssentials/SEDataRequestPreparation.h>
 #import <ServiceEssentials/SEJSONDataSerializer.h>
 
 static NSString *const MethodGET = @"GET";
@@ -19,6 +22,21 @@ static NSString *const MethodPOST = @"POST";
 static NSString *const MethodPUT = @"PUT";
 static NSString *const MethodHEAD = @"HEAD";
 
+/** Caching delegate that returns one preparation for all GET requests to `users*` */
+@interface SETestCachingPreparationDelegate : NSObject<SEDataRequestCachingPreparationDelegate>
+@property (nonatomic, assign) NSUInteger preparationCount;
+@end
+
+@implementation SETestCachingPreparationDelegate
+
+- (SEDataRequestPreparation *)dataRequestService:(id<SEDataRequestService>)dataRequestService preparationForRequestMethod:(NSString *)method path:(NSString *)path
+{
+    ++self.preparationCount;
+    return [[SEDataRequestPreparation alloc] initWithHeaders:@{ @"X-Session" : @"abc" } parameters:@{ @"token" : @"xyz" } method:MethodGET pathPattern:@"users*" validityInterval:60];
+}
+
+@end
+
 
 @interface SEDataRequestFactoryTests : XCTestCase
 
@@ -31,6 +49,7 @@ static NSString *const MethodHEAD = @"HEAD";
     
     NSString *_userAgentString;
     NSURL *_baseURL;
+    SEDataRequestContext *_context;
 }
 
 - (void)setUp
@@ -42,6 +61,7 @@ static NSString *const MethodHEAD = @"HEAD";
     _preparationDelegateMock = [OCMockObject mockForProtocol:@protocol(SEDataRequestPreparationDelegate)];
     _userAgentString = @"Mock user agent";
     _baseURL = [NSURL URLWithString:@"https://service.essentials.com"];
+    _context = [[SEDataRequestContext alloc] initWithBaseURL:_baseURL authorizationHeader:nil pinningType:SEDataRequestCertificatePinningTypeNone];
 }
 
 - (void)tearDown
@@ -65,14 +85,14 @@ static NSString *const MethodHEAD = @"HEAD";
     SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:NO userAgent:_userAgentString requestPreparationDelegate:nil];
     
     NSError *error = nil;
-    XCTAssertThrows([factory createRequestWithMethod:@"GET" baseURL:_baseURL path:@"my_path/method" body:nil mimeType:nil error:&error]);
+    XCTAssertThrows([factory createRequestWithMethod:@"GET" context:_context path:@"my_path/method" body:nil mimeType:nil error:&error]);
 
-    XCTAssertThrows([factory createDownloadRequestWithBaseURL:_baseURL path:@"path" body:nil error:&error]);
+    XCTAssertThrows([factory createDownloadRequestWithContext:_context path:@"path" body:nil error:&error]);
 
     SEInternalDataRequestBuilder *builder = [[SEInternalDataRequestBuilder alloc] initWithDataRequestService:_serviceMock];
-    XCTAssertThrows([factory createRequestWithBuilder:builder baseURL:_baseURL error:&error]);
+    XCTAssertThrows([factory createRequestWithBuilder:builder context:_context error:&error]);
 
-    XCTAssertThrows([factory createMultipartRequestWithBuilder:builder baseURL:_baseURL boundary:@"boundary" error:&error]);
+    XCTAssertThrows([factory createMultipartRequestWithBuilder:builder context:_context boundary:@"boundary" error:&error]);
 
     [self veriyAllMocks];
 }
@@ -101,7 +121,7 @@ static NSString *const MethodHEAD = @"HEAD";
     SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:nil];
 
     NSError *error = nil;
-    NSURLRequest *request = [factory createRequestWithMethod:method baseURL:_baseURL path:path body:nil mimeType:nil error:&error];
+    NSURLRequest *request = [factory createRequestWithMethod:method context:_context path:path body:nil mimeType:nil error:&error];
 
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -146,7 +166,7 @@ static NSString *const MethodHEAD = @"HEAD";
     SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:nil];
 
     NSError *error = nil;
-    NSURLRequest *request = [factory createRequestWithMethod:method baseURL:_baseURL path:path body:parameters mimeType:nil error:&error];
+    NSURLRequest *request = [factory createRequestWithMethod:method context:_context path:path body:parameters mimeType:nil error:&error];
 
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -182,7 +202,7 @@ static NSString *const MethodHEAD = @"HEAD";
     SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:nil];
 
     NSError *error = nil;
-    NSURLRequest *request = [factory createRequestWithMethod:method baseURL:_baseURL path:path body:parameters mimeType:nil error:&error];
+    NSURLRequest *request = [factory createRequestWithMethod:method context:_context path:path body:parameters mimeType:nil error:&error];
 
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -228,7 +248,7 @@ static NSString *const MethodHEAD = @"HEAD";
     SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:nil];
     
     NSError *error = nil;
-    NSURLRequest *request = [factory createRequestWithMethod:method baseURL:_baseURL path:path body:parameters mimeType:mimeType error:&error];
+    NSURLRequest *request = [factory createRequestWithMethod:method context:_context path:path body:parameters mimeType:mimeType error:&error];
     
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -276,7 +296,7 @@ static NSString *const MethodHEAD = @"HEAD";
     SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:nil];
     
     NSError *error = nil;
-    NSURLRequest *request = [factory createRequestWithMethod:MethodPOST baseURL:_baseURL path:path body:mockData mimeType:mimeType error:&error];
+    NSURLRequest *request = [factory createRequestWithMethod:MethodPOST context:_context path:path body:mockData mimeType:mimeType error:&error];
     
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -313,7 +333,7 @@ static NSString *const MethodHEAD = @"HEAD";
     SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:nil];
     
     NSError *error = nil;
-    NSURLRequest *request = [factory createRequestWithMethod:MethodPOST baseURL:_baseURL path:path body:mockData mimeType:mimeType error:&error];
+    NSURLRequest *request = [factory createRequestWithMethod:MethodPOST context:_context path:path body:mockData mimeType:mimeType error:&error];
     
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -342,7 +362,7 @@ static NSString *const MethodHEAD = @"HEAD";
     SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:nil];
     
     NSError *error = nil;
-    NSURLRequest *request = [factory createRequestWithMethod:MethodPOST baseURL:_baseURL path:path body:mockData mimeType:nil error:&error];
+    NSURLRequest *request = [factory createRequestWithMethod:MethodPOST context:_context path:path body:mockData mimeType:nil error:&error];
     
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -371,7 +391,7 @@ static NSString *const MethodHEAD = @"HEAD";
     SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:nil];
     
     NSError *error = nil;
-    NSURLRequest *request = [factory createRequestWithMethod:MethodPOST baseURL:_baseURL path:path body:unrecognizedData mimeType:nil error:&error];
+    NSURLRequest *request = [factory createRequestWithMethod:MethodPOST context:_context path:path body:unrecognizedData mimeType:nil error:&error];
     
     XCTAssertNil(request);
     XCTAssertNotNil(error);
@@ -391,7 +411,7 @@ static NSString *const MethodHEAD = @"HEAD";
     [[[_preparationDelegateMock expect] andReturn:nil] dataRequestService:(id)_serviceMock additionalHeadersForRequestMethod:MethodGET path:path];
 
     NSError *error = nil;
-    NSURLRequest *request = [factory createRequestWithMethod:MethodGET baseURL:_baseURL path:path body:requestParameters mimeType:nil error:&error];
+    NSURLRequest *request = [factory createRequestWithMethod:MethodGET context:_context path:path body:requestParameters mimeType:nil error:&error];
 
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -423,7 +443,7 @@ static NSString *const MethodHEAD = @"HEAD";
     [[[_preparationDelegateMock expect] andReturn:delegateHeaders] dataRequestService:(id)_serviceMock additionalHeadersForRequestMethod:MethodGET path:path];
 
     NSError *error = nil;
-    NSURLRequest *request = [factory createRequestWithMethod:MethodGET baseURL:_baseURL path:path body:requestParameters mimeType:nil error:&error];
+    NSURLRequest *request = [factory createRequestWithMethod:MethodGET context:_context path:path body:requestParameters mimeType:nil error:&error];
 
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -449,10 +469,10 @@ static NSString *const MethodHEAD = @"HEAD";
     NSDictionary *const requestParameters = @{ @"request" : @"request-value" };
 
     SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:nil];
-    factory.authorizationHeader = @"Token: my-awesome-token";
+    SEDataRequestContext *context = [_context contextWithAuthorizationHeader:@"Token: my-awesome-token"];
 
     NSError *error = nil;
-    NSURLRequest *request = [factory createRequestWithMethod:MethodGET baseURL:_baseURL path:path body:requestParameters mimeType:nil error:&error];
+    NSURLRequest *request = [factory createRequestWithMethod:MethodGET context:context path:path body:requestParameters mimeType:nil error:&error];
 
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -491,7 +511,7 @@ static NSString *const MethodHEAD = @"HEAD";
     [[[_preparationDelegateMock expect] andReturn:delegateHeaders] dataRequestService:(id)_serviceMock additionalHeadersForRequestMethod:MethodGET path:path];
 
     NSError *error = nil;
-    XCTAssertThrows([factory createRequestWithMethod:MethodGET baseURL:_baseURL path:path body:requestParameters mimeType:nil error:&error]);
+    XCTAssertThrows([factory createRequestWithMethod:MethodGET context:_context path:path body:requestParameters mimeType:nil error:&error]);
 
     [self veriyAllMocks];
 }
@@ -522,7 +542,7 @@ static NSString *const MethodHEAD = @"HEAD";
     [[[serializerMock expect] andReturn:serializedData] serializeObject:expectedObjectToSerialize mimeType:mimeType error:[OCMArg anyObjectRef]];
 
     NSError *error = nil;
-    NSURLRequest *request = [factory createRequestWithMethod:MethodPOST baseURL:_baseURL path:path body:requestParameters mimeType:mimeType error:&error];
+    NSURLRequest *request = [factory createRequestWithMethod:MethodPOST context:_context path:path body:requestParameters mimeType:mimeType error:&error];
 
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -563,7 +583,7 @@ static NSString *const MethodHEAD = @"HEAD";
     [[[_preparationDelegateMock expect] andReturn:delegateHeaders] dataRequestService:(id)_serviceMock additionalHeadersForRequestMethod:MethodPOST path:path];
 
     NSError *error = nil;
-    NSURLRequest *request = [factory createRequestWithMethod:MethodPOST baseURL:_baseURL path:path body:requestParameters mimeType:nil error:&error];
+    NSURLRequest *request = [factory createRequestWithMethod:MethodPOST context:_context path:path body:requestParameters mimeType:nil error:&error];
 
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -607,7 +627,7 @@ static NSString *const MethodHEAD = @"HEAD";
     [[[serializerMock expect] andReturn:serializedData] serializeObject:expectedObjectToSerialize mimeType:mimeType error:[OCMArg anyObjectRef]];
 
     NSError *error = nil;
-    NSURLRequest *request = [factory createRequestWithMethod:MethodPOST baseURL:_baseURL path:path body:requestParameters mimeType:mimeType error:&error];
+    NSURLRequest *request = [factory createRequestWithMethod:MethodPOST context:_context path:path body:requestParameters mimeType:mimeType error:&error];
 
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -662,7 +682,7 @@ static NSString *const MethodHEAD = @"HEAD";
     SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:nil];
 
     NSError *error = nil;
-    NSURLRequest *request = [factory createDownloadRequestWithBaseURL:_baseURL path:path body:nil error:&error];
+    NSURLRequest *request = [factory createDownloadRequestWithContext:_context path:path body:nil error:&error];
 
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -691,7 +711,7 @@ static NSString *const MethodHEAD = @"HEAD";
     [[[_preparationDelegateMock expect] andReturn:delegateHeaders] dataRequestService:(id)_serviceMock additionalHeadersForRequestMethod:MethodGET path:path];
 
     NSError *error = nil;
-    NSURLRequest *request = [factory createDownloadRequestWithBaseURL:_baseURL path:path body:nil error:&error];
+    NSURLRequest *request = [factory createDownloadRequestWithContext:_context path:path body:nil error:&error];
 
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -725,7 +745,7 @@ static NSString *const MethodHEAD = @"HEAD";
     SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:nil];
 
     NSError *error = nil;
-    NSURLRequest *request = [factory createRequestWithBuilder:requestBuilder baseURL:_baseURL error:&error];
+    NSURLRequest *request = [factory createRequestWithBuilder:requestBuilder context:_context error:&error];
 
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -770,7 +790,7 @@ static NSString *const MethodHEAD = @"HEAD";
     SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:nil];
 
     NSError *error = nil;
-    NSURLRequest *request = [factory createRequestWithBuilder:requestBuilder baseURL:_baseURL error:&error];
+    NSURLRequest *request = [factory createRequestWithBuilder:requestBuilder context:_context error:&error];
 
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -812,7 +832,7 @@ static NSString *const MethodHEAD = @"HEAD";
     SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:nil];
 
     NSError *error = nil;
-    NSURLRequest *request = [factory createRequestWithBuilder:requestBuilder baseURL:_baseURL error:&error];
+    NSURLRequest *request = [factory createRequestWithBuilder:requestBuilder context:_context error:&error];
 
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -851,7 +871,7 @@ static NSString *const MethodHEAD = @"HEAD";
     SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:nil];
 
     NSError *error = nil;
-    NSURLRequest *request = [factory createRequestWithBuilder:requestBuilder baseURL:_baseURL error:&error];
+    NSURLRequest *request = [factory createRequestWithBuilder:requestBuilder context:_context error:&error];
 
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -894,7 +914,7 @@ static NSString *const MethodHEAD = @"HEAD";
     SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:nil];
 
     NSError *error = nil;
-    NSURLRequest *request = [factory createRequestWithBuilder:requestBuilder baseURL:_baseURL error:&error];
+    NSURLRequest *request = [factory createRequestWithBuilder:requestBuilder context:_context error:&error];
 
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -941,7 +961,7 @@ static NSString *const MethodHEAD = @"HEAD";
 
     SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:nil];
 
-    NSURLRequest *request = [factory createMultipartRequestWithBuilder:requestBuilder baseURL:_baseURL boundary:boundary error:&error];
+    NSURLRequest *request = [factory createMultipartRequestWithBuilder:requestBuilder context:_context boundary:boundary error:&error];
 
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -988,7 +1008,7 @@ static NSString *const MethodHEAD = @"HEAD";
 
     SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:_preparationDelegateMock];
 
-    NSURLRequest *request = [factory createMultipartRequestWithBuilder:requestBuilder baseURL:_baseURL boundary:boundary error:&error];
+    NSURLRequest *request = [factory createMultipartRequestWithBuilder:requestBuilder context:_context boundary:boundary error:&error];
 
     XCTAssertNil(error);
     XCTAssertNotNil(request);
@@ -1011,4 +1031,136 @@ static NSString *const MethodHEAD = @"HEAD";
 }
 
 
+#pragma mark - Request templates
+
+- (void)testRequestFactoryCreateRequestWithTemplateSubstitutesPathAndQuery
+{
+    SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:nil];
+    SEInternalDataRequestTemplate *requestTemplate = [factory createTemplateWithMethod:MethodGET pathPattern:@"users/{userId}/feed/{feedId}" headers:@{ @"X-Static" : @"static" } contentEncoding:nil deserializeClass:nil qualityOfService:SEDataRequestQOSDefault];
+
+    XCTAssertEqualObjects(requestTemplate.placeholders, (@[ @"userId", @"feedId" ]));
+
+    NSError *error = nil;
+    NSURLRequest *request = [factory createRequestWithTemplate:requestTemplate context:_context pathParameters:@{ @"userId" : @"a/b c", @"feedId" : @42 } parameters:@{ @"page" : @"2" } error:&error];
+
+    XCTAssertNil(error);
+    XCTAssertEqualObjects(request.URL.absoluteString, @"https://service.essentials.com/users/a%2Fb%20c/feed/42?page=2");
+    XCTAssertEqualObjects(request.HTTPMethod, MethodGET);
+    XCTAssertNil(request.HTTPBody);
+
+    NSDictionary<NSString *, NSString *> *expectedHeaders = @{
+                                                              @"User-Agent" : _userAgentString,
+                                                              @"Accept" : @"application/json; charset=utf-8",
+                                                              @"X-Static" : @"static"
+                                                              };
+    XCTAssertEqualObjects(request.allHTTPHeaderFields, expectedHeaders);
+
+    // second request reuses the resolved URL
+    SEDataRequestTemplateURL *resolvedURL = requestTemplate.resolvedURL;
+    XCTAssertNotNil(resolvedURL);
+    request = [factory createRequestWithTemplate:requestTemplate context:_context pathParameters:@{ @"userId" : @"1", @"feedId" : @"2" } parameters:nil error:&error];
+    XCTAssertEqualObjects(request.URL.absoluteString, @"https://service.essentials.com/users/1/feed/2");
+    XCTAssertEqual(requestTemplate.resolvedURL, resolvedURL);
+
+    // base URL change resolves the URL again
+    request = [factory createRequestWithTemplate:requestTemplate context:[_context contextWithBaseURL:[NSURL URLWithString:@"https://other.essentials.com/api/"]] pathParameters:@{ @"userId" : @"1", @"feedId" : @"2" } parameters:nil error:&error];
+    XCTAssertEqualObjects(request.URL.absoluteString, @"https://other.essentials.com/api/users/1/feed/2");
+    XCTAssertNotEqual(requestTemplate.resolvedURL, resolvedURL);
+
+    [self veriyAllMocks];
+}
+
+- (void)testRequestFactoryCreateRequestWithTemplateSerializesBodyDefaultMimeType
+{
+    SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:nil];
+    SEDataRequestContext *context = [_context contextWithAuthorizationHeader:@"Bearer token"];
+    SEInternalDataRequestTemplate *requestTemplate = [factory createTemplateWithMethod:MethodPOST pathPattern:@"events/{kind}" headers:nil contentEncoding:nil deserializeClass:nil qualityOfService:SEDataRequestQOSPriorityLow];
+
+    NSDictionary *const parameters = @{ @"value" : @1 };
+    NSError *error = nil;
+    NSURLRequest *request = [factory createRequestWithTemplate:requestTemplate context:context pathParameters:@{ @"kind" : @"tap" } parameters:parameters error:&error];
+
+    XCTAssertNil(error);
+    XCTAssertEqualObjects(request.URL.absoluteString, @"https://service.essentials.com/events/tap");
+    XCTAssertEqualObjects(request.HTTPMethod, MethodPOST);
+    XCTAssertEqualObjects(request.HTTPBody, [SEJSONDataSerializer serializeObject:parameters error:nil]);
+
+    NSDictionary<NSString *, NSString *> *expectedHeaders = @{
+                                                              @"User-Agent" : _userAgentString,
+                                                              @"Accept" : @"application/json; charset=utf-8",
+                                                              @"Authorization" : @"Bearer token",
+                                                              @"Content-Type" : @"application/json; charset=utf-8"
+                                                              };
+    XCTAssertEqualObjects(request.allHTTPHeaderFields, expectedHeaders);
+
+    [self veriyAllMocks];
+}
+
+- (void)testRequestFactoryCreateRequestWithTemplateMissingPlaceholderProducesError
+{
+    SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:nil];
+    SEInternalDataRequestTemplate *requestTemplate = [factory createTemplateWithMethod:MethodGET pathPattern:@"users/{userId}" headers:nil contentEncoding:nil deserializeClass:nil qualityOfService:SEDataRequestQOSDefault];
+
+    NSError *error = nil;
+    NSURLRequest *request = [factory createRequestWithTemplate:requestTemplate context:_context pathParameters:nil parameters:nil error:&error];
+
+    XCTAssertNil(request);
+    XCTAssertEqualObjects(error.domain, SEErrorDomain);
+    XCTAssertEqual(error.code, SEDataRequestServiceRequestSubmissuionFailure);
+
+    XCTAssertThrows([factory createTemplateWithMethod:MethodGET pathPattern:@"users/{userId" headers:nil contentEncoding:nil deserializeClass:nil qualityOfService:SEDataRequestQOSDefault]);
+
+    [self veriyAllMocks];
+}
+
+- (void)testRequestFactoryWithDelegateCreateRequestWithTemplateIncludesParametersAndHeaders
+{
+    NSDictionary *const delegateParameters = @{ @"session" : @"abc" };
+    NSDictionary *const delegateHeaders = @{ @"X-Mega-Header" : @"my mega value" };
+
+    [[[_preparationDelegateMock expect] andReturn:delegateParameters] dataRequestService:(id)_serviceMock additionalParametersForRequestMethod:MethodGET path:@"users/7"];
+    [[[_preparationDelegateMock expect] andReturn:delegateHeaders] dataRequestService:(id)_serviceMock additionalHeadersForRequestMethod:MethodGET path:@"users/7"];
+
+    SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:_preparationDelegateMock];
+    SEInternalDataRequestTemplate *requestTemplate = [factory createTemplateWithMethod:MethodGET pathPattern:@"users/{userId}" headers:nil contentEncoding:nil deserializeClass:nil qualityOfService:SEDataRequestQOSDefault];
+
+    NSError *error = nil;
+    NSURLRequest *request = [factory createRequestWithTemplate:requestTemplate context:_context pathParameters:@{ @"userId" : @7 } parameters:nil error:&error];
+
+    XCTAssertNil(error);
+    XCTAssertEqualObjects(request.URL.absoluteString, @"https://service.essentials.com/users/7?session=abc");
+    XCTAssertEqualObjects([request valueForHTTPHeaderField:@"X-Mega-Header"], @"my mega value");
+
+    [self veriyAllMocks];
+}
+
+- (void)testRequestFactoryWithCachingDelegateReusesPreparationUntilInvalidated
+{
+    SETestCachingPreparationDelegate *delegate = [SETestCachingPreparationDelegate new];
+    SEDataRequestFactory *factory = [[SEDataRequestFactory alloc] initWithService:_serviceMock secure:YES userAgent:_userAgentString requestPreparationDelegate:delegate];
+
+    NSError *error = nil;
+    NSURLRequest *request = [factory createRequestWithMethod:MethodGET context:_context path:@"users/1" body:nil mimeType:nil error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqualObjects(request.URL.absoluteString, @"https://service.essentials.com/users/1?token=xyz");
+    XCTAssertEqualObjects([request valueForHTTPHeaderField:@"X-Session"], @"abc");
+
+    // headers and parameters of the same request and of the following ones in the scope come from a single preparation
+    request = [factory createRequestWithMethod:MethodGET context:_context path:@"users/2" body:nil mimeType:nil error:&error];
+    XCTAssertEqualObjects(request.URL.absoluteString, @"https://service.essentials.com/users/2?token=xyz");
+    XCTAssertEqual(delegate.preparationCount, 1);
+
+    // out of the scope: asked once for the whole request, and the preparation is not cached for other requests
+    [factory createRequestWithMethod:MethodGET context:_context path:@"items" body:nil mimeType:nil error:&error];
+    XCTAssertEqual(delegate.preparationCount, 2);
+    [factory createRequestWithMethod:MethodGET context:_context path:@"users/4" body:nil mimeType:nil error:&error];
+    XCTAssertEqual(delegate.preparationCount, 2);
+
+    [factory invalidatePreparations];
+    [factory createRequestWithMethod:MethodGET context:_context path:@"users/3" body:nil mimeType:nil error:&error];
+    XCTAssertEqual(delegate.preparationCount, 3);
+
+    [self veriyAllMocks];
+}
+
 @end
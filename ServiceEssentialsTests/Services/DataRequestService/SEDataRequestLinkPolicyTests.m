@@ -0,0 +1,60 @@
+//
+//  SEDataRequestLinkPolicyTests.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <XCTest/XCTest.h>
+#import "SEDataRequestLinkPolicy.h"
+
+@interface SEDataRequestLinkPolicyTests : XCTestCase
+@end
+
+@implementation SEDataRequestLinkPolicyTests
+
+- (void)testDefaultLinkPolicyIsConservativeOnWWAN
+{
+    SEDefaultDataRequestLinkPolicy *policy = [SEDefaultDataRequestLinkPolicy new];
+    SEDataRequestLinkParameters *wifi = [policy linkParametersForStatus:SENetworkReachabilityStatusReachableViaWiFi throughput:0];
+    SEDataRequestLinkParameters *wwan = [policy linkParametersForStatus:SENetworkReachabilityStatusReachableViaWWAN throughput:0];
+
+    XCTAssertLessThan(wwan.maxConcurrentRequests, wifi.maxConcurrentRequests);
+    XCTAssertLessThan(wwan.prefetchDepth, wifi.prefetchDepth);
+    XCTAssertLessThan(wwan.compressionThreshold, wifi.compressionThreshold);
+}
+
+- (void)testDefaultLinkPolicyTreatsUnknownStatusAsFastLink
+{
+    SEDefaultDataRequestLinkPolicy *policy = [SEDefaultDataRequestLinkPolicy new];
+    SEDataRequestLinkParameters *wifi = [policy linkParametersForStatus:SENetworkReachabilityStatusReachableViaWiFi throughput:0];
+    SEDataRequestLinkParameters *unknown = [policy linkParametersForStatus:SENetworkReachabilityStatusUnknown throughput:0];
+    SEDataRequestLinkParameters *unavailable = [policy linkParametersForStatus:SENetworkReachabilityStatusUnavailable throughput:0];
+
+    XCTAssertEqual(unknown.maxConcurrentRequests, wifi.maxConcurrentRequests);
+    XCTAssertEqual(unavailable.maxConcurrentRequests, wifi.maxConcurrentRequests);
+}
+
+- (void)testDefaultLinkPolicyThrottlesSlowLinks
+{
+    SEDefaultDataRequestLinkPolicy *policy = [SEDefaultDataRequestLinkPolicy new];
+    policy.slowLinkThroughput = 100000;
+    SEDataRequestLinkParameters *fast = [policy linkParametersForStatus:SENetworkReachabilityStatusReachableViaWiFi throughput:1000000];
+    SEDataRequestLinkParameters *slow = [policy linkParametersForStatus:SENetworkReachabilityStatusReachableViaWiFi throughput:10000];
+    SEDataRequestLinkParameters *wwan = [policy linkParametersForStatus:SENetworkReachabilityStatusReachableViaWWAN throughput:0];
+
+    XCTAssertEqual(slow.prefetchDepth, 0);
+    XCTAssertLessThan(slow.maxConcurrentRequests, fast.maxConcurrentRequests);
+    XCTAssertLessThanOrEqual(slow.maxConcurrentRequests, wwan.maxConcurrentRequests);
+}
+
+- (void)testLinkParametersAllowAtLeastOneRequest
+{
+    SEDataRequestLinkParameters *parameters = [[SEDataRequestLinkParameters alloc] initWithMaxConcurrentRequests:0 prefetchDepth:0 compressionThreshold:0];
+    XCTAssertEqual(parameters.maxConcurrentRequests, 1);
+}
+
+@end
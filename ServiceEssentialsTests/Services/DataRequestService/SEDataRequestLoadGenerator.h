@@ -0,0 +1,132 @@
+//
+//  SEDataRequestLoadGenerator.h
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+@import Foundation;
+
+#import "SEDataRequestService.h"
+#import "SETestLoopbackTransport.h"
+
+/** Kinds of requests generated by the load generator */
+typedef NS_ENUM(NSInteger, SEDataRequestLoadKind)
+{
+    /** `GET` with a JSON response */
+    SEDataRequestLoadKindGET = 0,
+    /** `POST`, `PUT` or `PATCH` with a JSON body and a JSON response */
+    SEDataRequestLoadKindPOST,
+    /** `POST` with a multipart body and a JSON response */
+    SEDataRequestLoadKindMultipart,
+    /** Download to a temporary file */
+    SEDataRequestLoadKindDownload
+};
+
+/** Captured request of a traffic trace */
+@interface SEDataRequestTraceEntry : NSObject
+
+- (nonnull instancetype) initWithOffset: (NSTimeInterval) offset kind: (SEDataRequestLoadKind) kind method: (nonnull NSString *) method path: (nonnull NSString *) path requestLength: (NSUInteger) requestLength responseLength: (NSUInteger) responseLength;
+
+/**
+ Reads a trace written as JSON lines, one request per line, such as
+ `{"offset": 0.25, "method": "POST", "path": "items", "requestLength": 512, "responseLength": 2048}`.
+ Optional `"kind"` is either `"multipart"` or `"download"`, otherwise the kind follows from the method.
+ Entries are sorted by offset.
+ */
++ (nullable NSArray<SEDataRequestTraceEntry *> *) traceWithContentsOfURL: (nonnull NSURL *) url error: (NSError * __autoreleasing _Nullable * _Nullable) error;
+
+/** Time from the start of the trace the request has been sent at */
+@property (nonatomic, readonly, assign) NSTimeInterval offset;
+@property (nonatomic, readonly, assign) SEDataRequestLoadKind kind;
+@property (nonatomic, readonly, strong, nonnull) NSString *method;
+@property (nonatomic, readonly, strong, nonnull) NSString *path;
+/** Approximate size of the request body */
+@property (nonatomic, readonly, assign) NSUInteger requestLength;
+/** Approximate size of the response body */
+@property (nonatomic, readonly, assign) NSUInteger responseLength;
+
+@end
+
+/** Results of a load run */
+@interface SEDataRequestLoadReport : NSObject
+
+@property (nonatomic, readonly, assign) NSUInteger requestCount;
+@property (nonatomic, readonly, assign) NSUInteger failureCount;
+/** Time from the first request to the last response */
+@property (nonatomic, readonly, assign) NSTimeInterval duration;
+/** Completed requests per second */
+@property (nonatomic, readonly, assign) double throughput;
+
+/** Latency percentiles of successful requests, from submission to the success callback */
+@property (nonatomic, readonly, assign) NSTimeInterval latencyP50;
+@property (nonatomic, readonly, assign) NSTimeInterval latencyP95;
+@property (nonatomic, readonly, assign) NSTimeInterval latencyP99;
+@property (nonatomic, readonly, assign) NSTimeInterval latencyP999;
+
+/** Mean number of requests the generator has been waiting for, sampled during the run */
+@property (nonatomic, readonly, assign) double meanOutstandingRequests;
+/**
+ Mean number of requests registered in the service, sampled during the run. 0 for services other than `SEDataRequestServiceImpl`.
+ Requests leave the registry before their callbacks, so it stays below `meanOutstandingRequests` unless the service is late to clean up.
+ */
+@property (nonatomic, readonly, assign) double meanRegisteredRequests;
+/** Mean time a request stays registered in the service, derived from `meanRegisteredRequests` and `throughput` (Little's law) */
+@property (nonatomic, readonly, assign) NSTimeInterval registryResidency;
+
+/** User and system CPU time of the process during the run */
+@property (nonatomic, readonly, assign) NSTimeInterval CPUTime;
+/** Peak physical memory footprint of the process during the run, in bytes */
+@property (nonatomic, readonly, assign) uint64_t peakMemoryFootprint;
+
+/** Report as a property list, to be stored and compared across library versions */
+- (nonnull NSDictionary<NSString *, NSNumber *> *) dictionaryRepresentation;
+
+@end
+
+/**
+ Drives a data request service with generated or replayed traffic and measures how it copes.
+
+ Requests are served by a loopback transport that stands in for the server: the generator installs
+ `defaultHandler` of the transport, which responds with JSON bodies of the requested size. The service
+ must be created with `sessionConfiguration` of the same transport. Latency and bandwidth of the transport
+ apply as usual, so the load can be shaped like a real network or run as fast as the service can go.
+
+ Since the server runs in the process, CPU time and memory include its cost. Compare runs of the same workload,
+ for example before and after a change or across library versions, rather than reading absolute numbers.
+
+ A generator runs one workload at a time. Properties are read when a run starts.
+ */
+@interface SEDataRequestLoadGenerator : NSObject
+
+- (nonnull instancetype) initWithDataRequestService: (nonnull id<SEDataRequestService>) dataRequestService transport: (nonnull SETestLoopbackTransport *) transport;
+
+/** Path of generated requests. Defaults to `load`. */
+@property (atomic, copy, nonnull) NSString *path;
+/** Approximate size of generated request bodies. Defaults to 1 KB. */
+@property (atomic, assign) NSUInteger requestLength;
+/** Approximate size of generated response bodies. Defaults to 4 KB. */
+@property (atomic, assign) NSUInteger responseLength;
+
+/**
+ Sets a share of requests of a kind in the generated mix, relative to the other kinds.
+ The default mix is 60% GET, 25% POST, 10% multipart and 5% download.
+ */
+- (void) setWeight: (double) weight forKind: (SEDataRequestLoadKind) kind;
+
+/** Sends requests at a fixed rate for the duration, regardless of how many are in flight (open loop) */
+- (void) runWithRequestsPerSecond: (double) requestsPerSecond duration: (NSTimeInterval) duration completion: (nonnull void (^)(SEDataRequestLoadReport * _Nonnull report)) completion completionQueue: (nullable dispatch_queue_t) completionQueue;
+
+/** Keeps a fixed number of requests in flight for the duration, sending a new one when one completes (closed loop) */
+- (void) runWithConcurrency: (NSUInteger) concurrency duration: (NSTimeInterval) duration completion: (nonnull void (^)(SEDataRequestLoadReport * _Nonnull report)) completion completionQueue: (nullable dispatch_queue_t) completionQueue;
+
+/**
+ Replays a captured trace, sending each request at its offset
+ @param speed time scale of the replay, 2 sends requests twice as fast as captured
+ */
+- (void) replayTrace: (nonnull NSArray<SEDataRequestTraceEntry *> *) trace speed: (double) speed completion: (nonnull void (^)(SEDataRequestLoadReport * _Nonnull report)) completion completionQueue: (nullable dispatch_queue_t) completionQueue;
+
+@end
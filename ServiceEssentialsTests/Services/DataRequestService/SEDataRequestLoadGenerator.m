@@ -0,0 +1,579 @@
+//
+//  SEDataRequestLoadGenerator.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import "SEDataRequestLoadGenerator.h"
+
+#include <math.h>
+#include <mach/mach.h>
+#include <sys/resource.h>
+#include <libkern/OSAtomic.h>
+
+#import "SETools.h"
+#import "SEDataRequestServicePrivate.h"
+
+// Query parameter that tells the stand-in server the size of the response
+static NSString * const SEDataRequestLoadResponseLengthParameter = @"responseLength";
+// Interval of memory footprint sampling and the shortest interval of request scheduling
+static NSTimeInterval const SEDataRequestLoadSamplingInterval = 0.01;
+
+static inline NSTimeInterval SEDataRequestLoadCPUTime(void)
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static inline uint64_t SEDataRequestLoadMemoryFootprint(void)
+{
+    task_vm_info_data_t info;
+    mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+    if (task_info(mach_task_self(), TASK_VM_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) return 0;
+    return info.phys_footprint;
+}
+
+// Nearest-rank percentile of sorted values
+static inline NSTimeInterval SEDataRequestLoadPercentile(const double *sortedValues, NSUInteger count, double percentile)
+{
+    if (count == 0) return 0;
+    NSUInteger rank = (NSUInteger)ceil(percentile * count);
+    return sortedValues[MIN(MAX(rank, 1), count) - 1];
+}
+
+static int SEDataRequestLoadCompareDoubles(const void *a, const void *b)
+{
+    double left = *(const double *)a, right = *(const double *)b;
+    return (left < right) ? -1 : (left > right) ? 1 : 0;
+}
+
+// JSON array of small objects, close to the length, so that responses cost about as much to parse as real ones
+static NSData *SEDataRequestLoadJSONBody(NSUInteger length)
+{
+    NSMutableData *body = [[NSMutableData alloc] initWithCapacity:length + 64];
+    [body appendBytes:"[" length:1];
+    for (NSUInteger index = 0; body.length + 1 < length || index == 0; index++)
+    {
+        NSString *item = [NSString stringWithFormat:@"%@{\"id\":%lu,\"name\":\"item %lu\",\"active\":true}", (index > 0) ? @"," : @"", (unsigned long)index, (unsigned long)index];
+        [body appendData:[item dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+    [body appendBytes:"]" length:1];
+    return body;
+}
+
+static inline NSError *SEDataRequestLoadTraceError(NSURL *url, NSUInteger line)
+{
+    return [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadCorruptFileError userInfo:@{ NSURLErrorKey: url, NSLocalizedDescriptionKey: [NSString stringWithFormat:@"Invalid trace entry at line %lu", (unsigned long)line] }];
+}
+
+@implementation SEDataRequestTraceEntry
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithOffset:(NSTimeInterval)offset kind:(SEDataRequestLoadKind)kind method:(NSString *)method path:(NSString *)path requestLength:(NSUInteger)requestLength responseLength:(NSUInteger)responseLength
+{
+    if (method == nil) THROW_INVALID_PARAM(method, nil);
+    if (path == nil) THROW_INVALID_PARAM(path, nil);
+
+    self = [super init];
+    if (self)
+    {
+        _offset = offset;
+        _kind = kind;
+        _method = [method uppercaseString];
+        _path = [path copy];
+        _requestLength = requestLength;
+        _responseLength = responseLength;
+    }
+    return self;
+}
+
++ (NSArray<SEDataRequestTraceEntry *> *)traceWithContentsOfURL:(NSURL *)url error:(NSError * _Nullable __autoreleasing *)error
+{
+    NSString *contents = [NSString stringWithContentsOfURL:url encoding:NSUTF8StringEncoding error:error];
+    if (contents == nil) return nil;
+
+    NSMutableArray<SEDataRequestTraceEntry *> *trace = [NSMutableArray new];
+    __block NSUInteger lineNumber = 0;
+    __block NSError *lineError = nil;
+    [contents enumerateLinesUsingBlock:^(NSString *line, BOOL *stop) {
+        lineNumber++;
+        if ([line stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]].length == 0) return;
+
+        NSDictionary *object = [NSJSONSerialization JSONObjectWithData:[line dataUsingEncoding:NSUTF8StringEncoding] options:0 error:nil];
+        NSString *method = [object isKindOfClass:[NSDictionary class]] ? [object objectForKey:@"method"] : nil;
+        NSString *path = [object objectForKey:@"path"];
+        if (![method isKindOfClass:[NSString class]] || ![path isKindOfClass:[NSString class]])
+        {
+            lineError = SEDataRequestLoadTraceError(url, lineNumber);
+            *stop = YES;
+            return;
+        }
+
+        NSString *kindName = [object objectForKey:@"kind"];
+        SEDataRequestLoadKind kind = [method caseInsensitiveCompare:SEDataRequestMethodGET] == NSOrderedSame ? SEDataRequestLoadKindGET : SEDataRequestLoadKindPOST;
+        if ([kindName isEqual:@"multipart"]) kind = SEDataRequestLoadKindMultipart;
+        else if ([kindName isEqual:@"download"]) kind = SEDataRequestLoadKindDownload;
+
+        [trace addObject:[[SEDataRequestTraceEntry alloc] initWithOffset:[[object objectForKey:@"offset"] doubleValue]
+                                                                    kind:kind
+                                                                  method:method
+                                                                    path:path
+                                                           requestLength:[[object objectForKey:@"requestLength"] unsignedIntegerValue]
+                                                          responseLength:[[object objectForKey:@"responseLength"] unsignedIntegerValue]]];
+    }];
+
+    if (lineError != nil)
+    {
+        if (error != NULL) *error = lineError;
+        return nil;
+    }
+
+    [trace sortWithOptions:NSSortStable usingComparator:^NSComparisonResult(SEDataRequestTraceEntry *left, SEDataRequestTraceEntry *right) {
+        return (left.offset < right.offset) ? NSOrderedAscending : (left.offset > right.offset) ? NSOrderedDescending : NSOrderedSame;
+    }];
+    return trace;
+}
+
+@end
+
+@interface SEDataRequestLoadReport ()
+- (instancetype) initWithRequestCount: (NSUInteger) requestCount failureCount: (NSUInteger) failureCount duration: (NSTimeInterval) duration latencies: (NSMutableData *) latencies meanOutstandingRequests: (double) meanOutstandingRequests meanRegisteredRequests: (double) meanRegisteredRequests CPUTime: (NSTimeInterval) CPUTime peakMemoryFootprint: (uint64_t) peakMemoryFootprint;
+@end
+
+@implementation SEDataRequestLoadReport
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithRequestCount:(NSUInteger)requestCount failureCount:(NSUInteger)failureCount duration:(NSTimeInterval)duration latencies:(NSMutableData *)latencies meanOutstandingRequests:(double)meanOutstandingRequests meanRegisteredRequests:(double)meanRegisteredRequests CPUTime:(NSTimeInterval)CPUTime peakMemoryFootprint:(uint64_t)peakMemoryFootprint
+{
+    self = [super init];
+    if (self)
+    {
+        _requestCount = requestCount;
+        _failureCount = failureCount;
+        _duration = duration;
+        _throughput = (duration > 0) ? requestCount / duration : 0;
+        _meanOutstandingRequests = meanOutstandingRequests;
+        _meanRegisteredRequests = meanRegisteredRequests;
+        _registryResidency = (_throughput > 0) ? meanRegisteredRequests / _throughput : 0;
+        _CPUTime = CPUTime;
+        _peakMemoryFootprint = peakMemoryFootprint;
+
+        // latencies are sorted in place, they are not used afterwards
+        double *values = latencies.mutableBytes;
+        NSUInteger count = latencies.length / sizeof(double);
+        qsort(values, count, sizeof(double), SEDataRequestLoadCompareDoubles);
+        _latencyP50 = SEDataRequestLoadPercentile(values, count, 0.5);
+        _latencyP95 = SEDataRequestLoadPercentile(values, count, 0.95);
+        _latencyP99 = SEDataRequestLoadPercentile(values, count, 0.99);
+        _latencyP999 = SEDataRequestLoadPercentile(values, count, 0.999);
+    }
+    return self;
+}
+
+- (NSDictionary<NSString *,NSNumber *> *)dictionaryRepresentation
+{
+    return @{ @"requestCount": @(_requestCount),
+              @"failureCount": @(_failureCount),
+              @"duration": @(_duration),
+              @"throughput": @(_throughput),
+              @"latencyP50": @(_latencyP50),
+              @"latencyP95": @(_latencyP95),
+              @"latencyP99": @(_latencyP99),
+              @"latencyP999": @(_latencyP999),
+              @"meanOutstandingRequests": @(_meanOutstandingRequests),
+              @"meanRegisteredRequests": @(_meanRegisteredRequests),
+              @"registryResidency": @(_registryResidency),
+              @"CPUTime": @(_CPUTime),
+              @"peakMemoryFootprint": @(_peakMemoryFootprint) };
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %lu requests, %lu failed in %.3fs, %.1f req/s, latency p50 %.2fms p95 %.2fms p99 %.2fms p999 %.2fms, registry residency %.2fms, CPU %.3fs, peak memory %.1f MB>",
+            NSStringFromClass([self class]), (unsigned long)_requestCount, (unsigned long)_failureCount, _duration, _throughput,
+            _latencyP50 * 1000, _latencyP95 * 1000, _latencyP99 * 1000, _latencyP999 * 1000, _registryResidency * 1000, _CPUTime, _peakMemoryFootprint / (1024.0 * 1024.0)];
+}
+
+@end
+
+#define RUNNING_GENERATOR_BIT 0
+
+@implementation SEDataRequestLoadGenerator
+{
+    id<SEDataRequestService> _service;
+    id<SEDataRequestServicePrivate> _registry; // the service, if its registry can be sampled
+    dispatch_queue_t _queue;
+    volatile uint32_t _running;
+
+    // only accessed on the queue
+    double _weights[SEDataRequestLoadKindDownload + 1];
+    NSURL *_downloadDirectoryURL;
+    NSMutableDictionary<NSNumber *, NSDictionary *> *_payloads;
+
+    // state of the current run, only accessed on the queue
+    NSTimeInterval _runStart;
+    NSTimeInterval _lastCompletion;
+    NSTimeInterval _CPUStart;
+    uint64_t _peakMemoryFootprint;
+    NSUInteger _issuedCount;
+    NSUInteger _outstandingCount;
+    NSUInteger _failureCount;
+    BOOL _issuing;
+    NSMutableData *_latencies;
+    NSUInteger _sampleCount;
+    double _outstandingSum;
+    double _registeredSum;
+    dispatch_source_t _samplingTimer;
+    dispatch_block_t _tick;
+    void (^_completion)(SEDataRequestLoadReport *);
+    dispatch_queue_t _completionQueue;
+}
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithDataRequestService:(id<SEDataRequestService>)dataRequestService transport:(SETestLoopbackTransport *)transport
+{
+    if (dataRequestService == nil) THROW_INVALID_PARAM(dataRequestService, nil);
+    if (transport == nil) THROW_INVALID_PARAM(transport, nil);
+
+    self = [super init];
+    if (self)
+    {
+        _service = dataRequestService;
+        if ([dataRequestService conformsToProtocol:@protocol(SEDataRequestServicePrivate)]) _registry = (id<SEDataRequestServicePrivate>)dataRequestService;
+        _queue = dispatch_queue_create("SEDataRequestLoadGenerator", DISPATCH_QUEUE_SERIAL);
+        _path = @"load";
+        _requestLength = 1024;
+        _responseLength = 4 * 1024;
+        _weights[SEDataRequestLoadKindGET] = 0.6;
+        _weights[SEDataRequestLoadKindPOST] = 0.25;
+        _weights[SEDataRequestLoadKindMultipart] = 0.1;
+        _weights[SEDataRequestLoadKindDownload] = 0.05;
+        _payloads = [NSMutableDictionary new];
+        _downloadDirectoryURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[NSString stringWithFormat:@"SEDataRequestLoadGenerator-%@", [NSUUID UUID].UUIDString]];
+
+        // the stand-in server does not reference the generator, it only needs the bodies it has already made
+        NSCache<NSNumber *, NSData *> *bodies = [NSCache new];
+        transport.defaultHandler = ^SETestLoopbackResponse *(NSURLRequest *request) {
+            NSUInteger length = 0;
+            for (NSURLQueryItem *item in [NSURLComponents componentsWithURL:request.URL resolvingAgainstBaseURL:NO].queryItems)
+            {
+                if ([item.name isEqualToString:SEDataRequestLoadResponseLengthParameter]) length = (NSUInteger)item.value.integerValue;
+            }
+
+            NSData *body = [bodies objectForKey:@(length)];
+            if (body == nil)
+            {
+                body = SEDataRequestLoadJSONBody(length);
+                [bodies setObject:body forKey:@(length)];
+            }
+            return [SETestLoopbackResponse responseWithStatusCode:200 headers:@{ @"Content-Type": SEDataRequestServiceContentTypeJSON } body:body];
+        };
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [[NSFileManager defaultManager] removeItemAtURL:_downloadDirectoryURL error:nil];
+}
+
+- (void)setWeight:(double)weight forKind:(SEDataRequestLoadKind)kind
+{
+    if (kind < SEDataRequestLoadKindGET || kind > SEDataRequestLoadKindDownload) THROW_INVALID_PARAM(kind, nil);
+    if (weight < 0) THROW_INVALID_PARAM(weight, nil);
+
+    dispatch_async(_queue, ^{
+        _weights[kind] = weight;
+    });
+}
+
+#pragma mark - Runs
+
+- (void)runWithRequestsPerSecond:(double)requestsPerSecond duration:(NSTimeInterval)duration completion:(void (^)(SEDataRequestLoadReport *))completion completionQueue:(dispatch_queue_t)completionQueue
+{
+    if (requestsPerSecond <= 0) THROW_INVALID_PARAM(requestsPerSecond, nil);
+    [self beginRunWithCompletion:completion completionQueue:completionQueue];
+
+    NSString *path = self.path;
+    NSUInteger requestLength = self.requestLength, responseLength = self.responseLength;
+    dispatch_async(_queue, ^{
+        [self startRun];
+
+        // request N is due at N / rate. Timers are coalesced under load, so each tick sends every request that is due by now.
+        NSUInteger totalCount = (NSUInteger)ceil(duration * requestsPerSecond);
+        __weak SEDataRequestLoadGenerator *weakSelf = self;
+        _tick = ^{
+            SEDataRequestLoadGenerator *strongSelf = weakSelf;
+            if (strongSelf == nil) return;
+
+            NSTimeInterval elapsed = [NSProcessInfo processInfo].systemUptime - strongSelf->_runStart;
+            NSUInteger dueCount = MIN((NSUInteger)(elapsed * requestsPerSecond) + 1, totalCount);
+            while (strongSelf->_issuedCount < dueCount)
+            {
+                [strongSelf sendRequestOfKind:[strongSelf randomKind] method:SEDataRequestMethodPOST path:path requestLength:requestLength responseLength:responseLength];
+            }
+            if (strongSelf->_issuedCount == totalCount) [strongSelf stopIssuing];
+        };
+        [self startTimerWithInterval:MAX(1.0 / requestsPerSecond, SEDataRequestLoadSamplingInterval)];
+    });
+}
+
+- (void)runWithConcurrency:(NSUInteger)concurrency duration:(NSTimeInterval)duration completion:(void (^)(SEDataRequestLoadReport *))completion completionQueue:(dispatch_queue_t)completionQueue
+{
+    if (concurrency == 0) THROW_INVALID_PARAM(concurrency, nil);
+    [self beginRunWithCompletion:completion completionQueue:completionQueue];
+
+    NSString *path = self.path;
+    NSUInteger requestLength = self.requestLength, responseLength = self.responseLength;
+    dispatch_async(_queue, ^{
+        [self startRun];
+
+        // completions are checked on every tick as well, so the run stops on time even when responses are slow
+        __weak SEDataRequestLoadGenerator *weakSelf = self;
+        _tick = ^{
+            SEDataRequestLoadGenerator *strongSelf = weakSelf;
+            if (strongSelf == nil || !strongSelf->_issuing) return;
+
+            if ([NSProcessInfo processInfo].systemUptime - strongSelf->_runStart >= duration)
+            {
+                [strongSelf stopIssuing];
+                return;
+            }
+            while (strongSelf->_outstandingCount < concurrency)
+            {
+                [strongSelf sendRequestOfKind:[strongSelf randomKind] method:SEDataRequestMethodPOST path:path requestLength:requestLength responseLength:responseLength];
+            }
+        };
+        [self startTimerWithInterval:SEDataRequestLoadSamplingInterval];
+    });
+}
+
+- (void)replayTrace:(NSArray<SEDataRequestTraceEntry *> *)trace speed:(double)speed completion:(void (^)(SEDataRequestLoadReport *))completion completionQueue:(dispatch_queue_t)completionQueue
+{
+    if (trace == nil) THROW_INVALID_PARAM(trace, nil);
+    if (speed <= 0) THROW_INVALID_PARAM(speed, nil);
+    [self beginRunWithCompletion:completion completionQueue:completionQueue];
+
+    NSArray<SEDataRequestTraceEntry *> *entries = [trace sortedArrayWithOptions:NSSortStable usingComparator:^NSComparisonResult(SEDataRequestTraceEntry *left, SEDataRequestTraceEntry *right) {
+        return (left.offset < right.offset) ? NSOrderedAscending : (left.offset > right.offset) ? NSOrderedDescending : NSOrderedSame;
+    }];
+    dispatch_async(_queue, ^{
+        [self startRun];
+
+        // entries are sorted, so the next one to send is always at the issued count
+        __weak SEDataRequestLoadGenerator *weakSelf = self;
+        _tick = ^{
+            SEDataRequestLoadGenerator *strongSelf = weakSelf;
+            if (strongSelf == nil) return;
+
+            NSTimeInterval elapsed = ([NSProcessInfo processInfo].systemUptime - strongSelf->_runStart) * speed;
+            while (strongSelf->_issuedCount < entries.count && [entries objectAtIndex:strongSelf->_issuedCount].offset <= elapsed)
+            {
+                SEDataRequestTraceEntry *entry = [entries objectAtIndex:strongSelf->_issuedCount];
+                [strongSelf sendRequestOfKind:entry.kind method:entry.method path:entry.path requestLength:entry.requestLength responseLength:entry.responseLength];
+            }
+            if (strongSelf->_issuedCount == entries.count) [strongSelf stopIssuing];
+        };
+        [self startTimerWithInterval:SEDataRequestLoadSamplingInterval];
+    });
+}
+
+#pragma mark - Internal methods
+
+- (void)beginRunWithCompletion:(void (^)(SEDataRequestLoadReport *))completion completionQueue:(dispatch_queue_t)completionQueue
+{
+    if (completion == nil) THROW_INVALID_PARAM(completion, nil);
+    if (OSAtomicTestAndSet(RUNNING_GENERATOR_BIT, &_running)) THROW_INCONSISTENCY(@{ NSLocalizedDescriptionKey: @"Load generator is already running." });
+
+    _completion = [completion copy];
+    _completionQueue = completionQueue;
+}
+
+// Called on the queue
+- (void)startRun
+{
+    [[NSFileManager defaultManager] createDirectoryAtURL:_downloadDirectoryURL withIntermediateDirectories:YES attributes:nil error:nil];
+
+    _issuedCount = 0;
+    _outstandingCount = 0;
+    _failureCount = 0;
+    _issuing = YES;
+    _latencies = [NSMutableData new];
+    _sampleCount = 0;
+    _outstandingSum = 0;
+    _registeredSum = 0;
+    _peakMemoryFootprint = SEDataRequestLoadMemoryFootprint();
+    _CPUStart = SEDataRequestLoadCPUTime();
+    _runStart = [NSProcessInfo processInfo].systemUptime;
+    _lastCompletion = _runStart;
+}
+
+// Called on the queue. The timer both schedules requests and samples the memory footprint and the registry of the service.
+- (void)startTimerWithInterval:(NSTimeInterval)interval
+{
+    _samplingTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _queue);
+    dispatch_source_set_timer(_samplingTimer, DISPATCH_TIME_NOW, (uint64_t)(interval * NSEC_PER_SEC), (uint64_t)(interval * NSEC_PER_SEC / 10));
+
+    __weak SEDataRequestLoadGenerator *weakSelf = self;
+    dispatch_source_set_event_handler(_samplingTimer, ^{
+        SEDataRequestLoadGenerator *strongSelf = weakSelf;
+        if (strongSelf == nil) return;
+
+        strongSelf->_peakMemoryFootprint = MAX(strongSelf->_peakMemoryFootprint, SEDataRequestLoadMemoryFootprint());
+        // requests are sent and completed on the queue, so the registry is read while the outstanding count holds
+        strongSelf->_sampleCount++;
+        strongSelf->_outstandingSum += strongSelf->_outstandingCount;
+        strongSelf->_registeredSum += [strongSelf->_registry registeredRequestCount];
+        if (strongSelf->_issuing) strongSelf->_tick();
+    });
+    dispatch_resume(_samplingTimer);
+}
+
+// Called on the queue
+- (void)stopIssuing
+{
+    _issuing = NO;
+    [self finishRunIfDone];
+}
+
+// Called on the queue
+- (void)finishRunIfDone
+{
+    if (_issuing || _outstandingCount > 0 || _completion == nil) return;
+
+    dispatch_source_cancel(_samplingTimer);
+    _samplingTimer = nil;
+    _tick = nil;
+
+    _peakMemoryFootprint = MAX(_peakMemoryFootprint, SEDataRequestLoadMemoryFootprint());
+    SEDataRequestLoadReport *report = [[SEDataRequestLoadReport alloc] initWithRequestCount:_issuedCount
+                                                                               failureCount:_failureCount
+                                                                                   duration:_lastCompletion - _runStart
+                                                                                  latencies:_latencies
+                                                                    meanOutstandingRequests:(_sampleCount > 0) ? _outstandingSum / _sampleCount : 0
+                                                                     meanRegisteredRequests:(_sampleCount > 0) ? _registeredSum / _sampleCount : 0
+                                                                                    CPUTime:SEDataRequestLoadCPUTime() - _CPUStart
+                                                                        peakMemoryFootprint:_peakMemoryFootprint];
+    void (^completion)(SEDataRequestLoadReport *) = _completion;
+    _completion = nil;
+    _latencies = nil;
+    [[NSFileManager defaultManager] removeItemAtURL:_downloadDirectoryURL error:nil];
+
+    OSAtomicTestAndClear(RUNNING_GENERATOR_BIT, &_running);
+    SEDataRequestDispatchCompletion(_completionQueue, ^{
+        completion(report);
+    });
+}
+
+// Called on the queue
+- (SEDataRequestLoadKind)randomKind
+{
+    double total = 0;
+    for (NSInteger kind = SEDataRequestLoadKindGET; kind <= SEDataRequestLoadKindDownload; kind++) total += _weights[kind];
+    if (total <= 0) return SEDataRequestLoadKindGET;
+
+    double value = arc4random_uniform(UINT32_MAX) / (double)UINT32_MAX * total;
+    for (NSInteger kind = SEDataRequestLoadKindGET; kind < SEDataRequestLoadKindDownload; kind++)
+    {
+        if (value < _weights[kind]) return kind;
+        value -= _weights[kind];
+    }
+    return SEDataRequestLoadKindDownload;
+}
+
+// Called on the queue. Body parameters are made once for each length.
+- (NSDictionary *)payloadWithLength:(NSUInteger)length
+{
+    NSDictionary *payload = [_payloads objectForKey:@(length)];
+    if (payload == nil)
+    {
+        payload = @{ @"data": [@"" stringByPaddingToLength:length withString:@"0123456789abcdef" startingAtIndex:0] };
+        [_payloads setObject:payload forKey:@(length)];
+    }
+    return payload;
+}
+
+// Called on the queue
+- (void)sendRequestOfKind:(SEDataRequestLoadKind)kind method:(NSString *)method path:(NSString *)path requestLength:(NSUInteger)requestLength responseLength:(NSUInteger)responseLength
+{
+    _issuedCount++;
+    _outstandingCount++;
+
+    NSTimeInterval start = [NSProcessInfo processInfo].systemUptime;
+    NSURL *fileURL = (kind == SEDataRequestLoadKindDownload) ? [_downloadDirectoryURL URLByAppendingPathComponent:[NSUUID UUID].UUIDString] : nil;
+    void (^completion)(BOOL) = ^(BOOL succeeded) {
+        NSTimeInterval now = [NSProcessInfo processInfo].systemUptime;
+        if (succeeded)
+        {
+            NSTimeInterval latency = now - start;
+            [_latencies appendBytes:&latency length:sizeof(latency)];
+        }
+        else
+        {
+            _failureCount++;
+        }
+        if (fileURL != nil) [[NSFileManager defaultManager] removeItemAtURL:fileURL error:nil];
+
+        _lastCompletion = now;
+        _outstandingCount--;
+        if (_issuing) _tick();
+        [self finishRunIfDone];
+    };
+    void (^success)(id, NSURLResponse *) = ^(id data, NSURLResponse *response) {
+        completion(YES);
+    };
+    void (^failure)(NSError *) = ^(NSError *error) {
+        completion(NO);
+    };
+
+    NSDictionary *lengthParameters = @{ SEDataRequestLoadResponseLengthParameter: @(responseLength) };
+    if (kind == SEDataRequestLoadKindGET)
+    {
+        [_service GET:path parameters:lengthParameters success:success failure:failure completionQueue:_queue];
+        return;
+    }
+    if (kind == SEDataRequestLoadKindDownload)
+    {
+        [_service download:path parameters:lengthParameters saveAs:fileURL success:success failure:failure progress:nil completionQueue:_queue];
+        return;
+    }
+
+    // builder requests take query parameters with the path
+    NSString *pathWithLength = [NSString stringWithFormat:@"%@%@%@=%lu", path, ([path rangeOfString:@"?"].location == NSNotFound) ? @"?" : @"&", SEDataRequestLoadResponseLengthParameter, (unsigned long)responseLength];
+    id<SEDataRequestBuilder> builder = [_service createRequestBuilder];
+    id<SEDataRequestCustomizer> customizer;
+    if (kind == SEDataRequestLoadKindPOST && [method isEqualToString:SEDataRequestMethodPUT]) customizer = [builder PUT:pathWithLength success:success failure:failure completionQueue:_queue];
+    else if (kind == SEDataRequestLoadKindPOST && [method isEqualToString:SEDataRequestMethodPATCH]) customizer = [builder PATCH:pathWithLength success:success failure:failure completionQueue:_queue];
+    else customizer = [builder POST:pathWithLength success:success failure:failure completionQueue:_queue];
+
+    if (kind == SEDataRequestLoadKindMultipart)
+    {
+        NSData *data = [[[self payloadWithLength:requestLength] objectForKey:@"data"] dataUsingEncoding:NSUTF8StringEncoding];
+        [customizer appendPartWithData:data name:@"file" fileName:@"load.bin" mimeType:SEDataRequestServiceContentTypeOctetStream error:nil];
+    }
+    else
+    {
+        [customizer setContentEncoding:SEDataRequestServiceContentTypeJSON];
+        [customizer setBodyParameters:[self payloadWithLength:requestLength]];
+    }
+    [customizer submit];
+}
+
+@end
@@ -0,0 +1,121 @@
+//
+//  SEDataRequestLoadGeneratorTests.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <XCTest/XCTest.h>
+#import <OCMock/OCMock.h>
+#import "SEDataRequestServiceImpl.h"
+#import "SEDataRequestLoadGenerator.h"
+#import "SEEnvironmentService.h"
+
+@interface SEDataRequestLoadGeneratorTests : XCTestCase
+@end
+
+@implementation SEDataRequestLoadGeneratorTests
+{
+    SETestLoopbackTransport *_transport;
+    SEDataRequestServiceImpl *_service;
+    SEDataRequestLoadGenerator *_generator;
+}
+
+- (void)setUp
+{
+    [super setUp];
+
+    _transport = [SETestLoopbackTransport new];
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+    _service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:_transport.sessionConfiguration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    _service.prewarmConnectionCount = 0;
+    _generator = [[SEDataRequestLoadGenerator alloc] initWithDataRequestService:_service transport:_transport];
+}
+
+- (void)tearDown
+{
+    _generator = nil;
+    _service = nil;
+    _transport = nil;
+    [super tearDown];
+}
+
+- (void)testLoadGeneratorSendsRequestsAtRate
+{
+    __block SEDataRequestLoadReport *report = nil;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"load run"];
+    [_generator runWithRequestsPerSecond:50 duration:0.4 completion:^(SEDataRequestLoadReport *result) {
+        report = result;
+        [expectation fulfill];
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    XCTAssertEqual(report.requestCount, 20);
+    XCTAssertEqual(report.failureCount, 0);
+    XCTAssertEqual(_transport.requestCount, 20);
+    XCTAssertGreaterThan(report.latencyP50, 0);
+    XCTAssertLessThanOrEqual(report.latencyP50, report.latencyP99);
+    XCTAssertLessThanOrEqual(report.latencyP99, report.latencyP999);
+    XCTAssertGreaterThan(report.peakMemoryFootprint, 0);
+}
+
+- (void)testLoadGeneratorKeepsConcurrency
+{
+    _transport.latency = 0.05;
+
+    __block SEDataRequestLoadReport *report = nil;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"load run"];
+    [_generator runWithConcurrency:4 duration:0.3 completion:^(SEDataRequestLoadReport *result) {
+        report = result;
+        [expectation fulfill];
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    // each of the slots completes a few round trips
+    XCTAssertGreaterThanOrEqual(report.requestCount, 8);
+    XCTAssertEqual(report.failureCount, 0);
+    XCTAssertGreaterThanOrEqual(report.latencyP50, 0.05);
+}
+
+- (void)testLoadGeneratorReplaysTrace
+{
+    NSURL *traceURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    NSString *trace = @"{\"offset\": 0.2, \"method\": \"GET\", \"path\": \"items\", \"responseLength\": 2048, \"kind\": \"download\"}\n"
+                      @"{\"offset\": 0, \"method\": \"GET\", \"path\": \"items\", \"responseLength\": 512}\n"
+                      @"\n"
+                      @"{\"offset\": 0.1, \"method\": \"put\", \"path\": \"items/1\", \"requestLength\": 256, \"responseLength\": 128}\n"
+                      @"{\"offset\": 0.1, \"method\": \"POST\", \"path\": \"files\", \"requestLength\": 4096, \"kind\": \"multipart\"}\n";
+    [trace writeToURL:traceURL atomically:YES encoding:NSUTF8StringEncoding error:nil];
+
+    NSError *error = nil;
+    NSArray<SEDataRequestTraceEntry *> *entries = [SEDataRequestTraceEntry traceWithContentsOfURL:traceURL error:&error];
+    [[NSFileManager defaultManager] removeItemAtURL:traceURL error:nil];
+    XCTAssertNil(error);
+    XCTAssertEqual(entries.count, 4);
+    XCTAssertEqual(entries.firstObject.kind, SEDataRequestLoadKindGET);
+    XCTAssertEqualObjects([entries objectAtIndex:1].method, @"PUT");
+    XCTAssertEqual([entries objectAtIndex:1].kind, SEDataRequestLoadKindPOST);
+    XCTAssertEqual([entries objectAtIndex:2].kind, SEDataRequestLoadKindMultipart);
+    XCTAssertEqual(entries.lastObject.kind, SEDataRequestLoadKindDownload);
+
+    __block SEDataRequestLoadReport *report = nil;
+    NSDate *start = [NSDate date];
+    XCTestExpectation *expectation = [self expectationWithDescription:@"replay"];
+    [_generator replayTrace:entries speed:2 completion:^(SEDataRequestLoadReport *result) {
+        report = result;
+        [expectation fulfill];
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    XCTAssertEqual(report.requestCount, 4);
+    XCTAssertEqual(report.failureCount, 0);
+    // the last request is sent at 0.1 seconds at double speed
+    XCTAssertGreaterThanOrEqual(-start.timeIntervalSinceNow, 0.1);
+    XCTAssertEqualObjects([report.dictionaryRepresentation objectForKey:@"requestCount"], @4);
+}
+
+@end
@@ -0,0 +1,76 @@
+//
+//  SEDataRequestNetworkEstimatorTests.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <XCTest/XCTest.h>
+#import "SEDataRequestNetworkEstimator.h"
+
+@interface SEDataRequestNetworkEstimatorTests : XCTestCase
+@end
+
+@implementation SEDataRequestNetworkEstimatorTests
+
+- (void)testNetworkEstimatorUsesDefaultTimeoutUntilEnoughSamples
+{
+    SEDataRequestNetworkEstimator *estimator = [SEDataRequestNetworkEstimator new];
+    estimator.minimumSampleCount = 3;
+    
+    XCTAssertEqual([estimator timeoutForExpectedBytes:1024 defaultTimeout:60.0], 60.0);
+    [estimator addRoundTripTimeSample:0.1];
+    [estimator addRoundTripTimeSample:0.1];
+    XCTAssertEqual([estimator timeoutForExpectedBytes:1024 defaultTimeout:60.0], 60.0);
+    [estimator addRoundTripTimeSample:0.1];
+    XCTAssertEqual([estimator timeoutForExpectedBytes:1024 defaultTimeout:60.0], estimator.minimumTimeout);
+}
+
+- (void)testNetworkEstimatorSmoothsRoundTripTime
+{
+    SEDataRequestNetworkEstimator *estimator = [SEDataRequestNetworkEstimator new];
+    [estimator addRoundTripTimeSample:1.0];
+    XCTAssertEqualWithAccuracy(estimator.roundTripTime, 1.0, 0.0001);
+    XCTAssertEqualWithAccuracy(estimator.roundTripTimeVariation, 0.5, 0.0001);
+    
+    [estimator addRoundTripTimeSample:2.0];
+    XCTAssertEqualWithAccuracy(estimator.roundTripTime, 1.125, 0.0001);
+    XCTAssertEqualWithAccuracy(estimator.roundTripTimeVariation, 0.625, 0.0001);
+    XCTAssertEqual(estimator.sampleCount, 2);
+}
+
+- (void)testNetworkEstimatorTimeoutGrowsWithPayloadOnSlowLinks
+{
+    SEDataRequestNetworkEstimator *estimator = [SEDataRequestNetworkEstimator new];
+    estimator.minimumSampleCount = 1;
+    estimator.minimumTimeout = 1.0;
+    estimator.maximumTimeout = 1000.0;
+    for (int i = 0; i < 5; i++) [estimator addRoundTripTimeSample:1.0];
+    [estimator addThroughputSampleWithBytes:10 * 1024 duration:1.0];
+    XCTAssertEqualWithAccuracy(estimator.throughput, 10 * 1024, 0.0001);
+    
+    NSTimeInterval smallPayloadTimeout = [estimator timeoutForExpectedBytes:1024 defaultTimeout:60.0];
+    NSTimeInterval largePayloadTimeout = [estimator timeoutForExpectedBytes:1024 * 1024 defaultTimeout:60.0];
+    XCTAssertLessThan(smallPayloadTimeout, 60.0);
+    XCTAssertGreaterThan(largePayloadTimeout, 60.0);
+    
+    estimator.maximumTimeout = 120.0;
+    XCTAssertEqual([estimator timeoutForExpectedBytes:1024 * 1024 defaultTimeout:60.0], 120.0);
+}
+
+- (void)testNetworkEstimatorResetForgetsSamples
+{
+    SEDataRequestNetworkEstimator *estimator = [SEDataRequestNetworkEstimator new];
+    [estimator addRoundTripTimeSample:1.0];
+    [estimator addThroughputSampleWithBytes:1024 duration:1.0];
+    [estimator reset];
+    
+    XCTAssertEqual(estimator.roundTripTime, 0);
+    XCTAssertEqual(estimator.throughput, 0);
+    XCTAssertEqual(estimator.sampleCount, 0);
+}
+
+@end
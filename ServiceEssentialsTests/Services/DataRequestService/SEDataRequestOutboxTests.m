@@ -0,0 +1,163 @@
+//
+//  SEDataRequestOutboxTests.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <XCTest/XCTest.h>
+#import "SEDataRequestOutbox.h"
+
+static NSURLRequest *SECreateOutboxTestRequest(NSString *path)
+{
+    NSMutableURLRequest *request = [[NSMutableURLRequest alloc] initWithURL:[NSURL URLWithString:[@"https://outbox.service-essentials.com/" stringByAppendingString:path]]];
+    request.HTTPMethod = @"POST";
+    request.HTTPBody = [path dataUsingEncoding:NSUTF8StringEncoding];
+    [request setValue:@"application/json" forHTTPHeaderField:@"Content-Type"];
+    [request setValue:@"Bearer secret" forHTTPHeaderField:@"Authorization"];
+    return request;
+}
+
+@interface SEDataRequestOutboxTests : XCTestCase
+@end
+
+@implementation SEDataRequestOutboxTests
+{
+    NSURL *_journalURL;
+}
+
+- (void)setUp
+{
+    [super setUp];
+    _journalURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]]];
+}
+
+- (void)tearDown
+{
+    [[NSFileManager defaultManager] removeItemAtURL:_journalURL error:nil];
+    [super tearDown];
+}
+
+- (void)testDataRequestOutboxRecordsSurviveReload
+{
+    SEDataRequestOutbox *outbox = [[SEDataRequestOutbox alloc] initWithJournalURL:_journalURL];
+    XCTAssertNotNil([outbox appendRequest:SECreateOutboxTestRequest(@"first") authorized:YES error:nil]);
+    XCTAssertNotNil([outbox appendRequest:SECreateOutboxTestRequest(@"second") authorized:NO error:nil]);
+    outbox = nil;
+    
+    SEDataRequestOutbox *reloaded = [[SEDataRequestOutbox alloc] initWithJournalURL:_journalURL];
+    XCTAssertEqual(reloaded.count, 2);
+    
+    NSArray<SEDataRequestOutboxRecord *> *batch = [reloaded dequeueBatch];
+    XCTAssertEqual(batch.count, 2);
+    XCTAssertEqualObjects(batch[0].request.URL.path, @"/first");
+    XCTAssertEqualObjects(batch[0].request.HTTPMethod, @"POST");
+    XCTAssertEqualObjects(batch[0].request.HTTPBody, [@"first" dataUsingEncoding:NSUTF8StringEncoding]);
+    XCTAssertEqualObjects([batch[0].request valueForHTTPHeaderField:@"Content-Type"], @"application/json");
+    XCTAssertTrue(batch[0].authorized);
+    XCTAssertTrue(batch[0].isRestored);
+    XCTAssertFalse(batch[1].authorized);
+}
+
+- (void)testDataRequestOutboxDoesNotStoreAuthorization
+{
+    SEDataRequestOutbox *outbox = [[SEDataRequestOutbox alloc] initWithJournalURL:_journalURL];
+    SEDataRequestOutboxRecord *record = [outbox appendRequest:SECreateOutboxTestRequest(@"first") authorized:YES error:nil];
+    XCTAssertNil([record.request valueForHTTPHeaderField:@"Authorization"]);
+    XCTAssertFalse(record.isRestored);
+    
+    NSData *journal = [NSData dataWithContentsOfURL:_journalURL];
+    XCTAssertEqual([journal rangeOfData:[@"secret" dataUsingEncoding:NSUTF8StringEncoding] options:0 range:NSMakeRange(0, journal.length)].location, NSNotFound);
+}
+
+- (void)testDataRequestOutboxDoesNotStoreCredentialHeaders
+{
+    NSMutableURLRequest *request = [SECreateOutboxTestRequest(@"first") mutableCopy];
+    [request setValue:@"session=cookie-secret" forHTTPHeaderField:@"Cookie"];
+    [request setValue:@"key-secret" forHTTPHeaderField:@"X-API-Key"];
+    [request setValue:@"42" forHTTPHeaderField:@"Idempotency-Key"];
+    
+    SEDataRequestOutbox *outbox = [[SEDataRequestOutbox alloc] initWithJournalURL:_journalURL];
+    SEDataRequestOutboxRecord *record = [outbox appendRequest:request authorized:YES error:nil];
+    // kept for the requests of this run
+    XCTAssertEqualObjects([record.request valueForHTTPHeaderField:@"X-API-Key"], @"key-secret");
+    outbox = nil;
+    
+    NSData *journal = [NSData dataWithContentsOfURL:_journalURL];
+    XCTAssertEqual([journal rangeOfData:[@"secret" dataUsingEncoding:NSUTF8StringEncoding] options:0 range:NSMakeRange(0, journal.length)].location, NSNotFound);
+    
+    SEDataRequestOutboxRecord *restored = [[[SEDataRequestOutbox alloc] initWithJournalURL:_journalURL] dequeueBatch].firstObject;
+    XCTAssertNil([restored.request valueForHTTPHeaderField:@"Cookie"]);
+    XCTAssertNil([restored.request valueForHTTPHeaderField:@"X-API-Key"]);
+    XCTAssertEqualObjects([restored.request valueForHTTPHeaderField:@"Idempotency-Key"], @"42");
+}
+
+- (void)testDataRequestOutboxAcknowledgedRecordsAreNotReloaded
+{
+    SEDataRequestOutbox *outbox = [[SEDataRequestOutbox alloc] initWithJournalURL:_journalURL];
+    SEDataRequestOutboxRecord *first = [outbox appendRequest:SECreateOutboxTestRequest(@"first") authorized:NO error:nil];
+    [outbox appendRequest:SECreateOutboxTestRequest(@"second") authorized:NO error:nil];
+    [outbox acknowledgeRecords:@[ first ]];
+    XCTAssertEqual(outbox.count, 1);
+    outbox = nil;
+    
+    SEDataRequestOutbox *reloaded = [[SEDataRequestOutbox alloc] initWithJournalURL:_journalURL];
+    XCTAssertEqual(reloaded.count, 1);
+    XCTAssertEqualObjects([reloaded dequeueBatch].firstObject.request.URL.path, @"/second");
+    
+    // identifiers are not reused after reload
+    SEDataRequestOutboxRecord *third = [reloaded appendRequest:SECreateOutboxTestRequest(@"third") authorized:NO error:nil];
+    XCTAssertGreaterThan(third.identifier, first.identifier + 1);
+}
+
+- (void)testDataRequestOutboxBatchesInOrder
+{
+    SEDataRequestOutbox *outbox = [[SEDataRequestOutbox alloc] initWithJournalURL:_journalURL];
+    outbox.batchSize = 2;
+    for (int i = 0; i < 5; i++) [outbox appendRequest:SECreateOutboxTestRequest([NSString stringWithFormat:@"%d", i]) authorized:NO error:nil];
+    
+    NSArray<SEDataRequestOutboxRecord *> *first = [outbox dequeueBatch];
+    NSArray<SEDataRequestOutboxRecord *> *second = [outbox dequeueBatch];
+    XCTAssertEqual(first.count, 2);
+    XCTAssertEqualObjects(first[0].request.URL.path, @"/0");
+    XCTAssertEqualObjects(first[1].request.URL.path, @"/1");
+    XCTAssertEqualObjects(second[0].request.URL.path, @"/2");
+    
+    // requeued records keep their position
+    [outbox requeueRecords:first];
+    [outbox acknowledgeRecords:second];
+    NSArray<SEDataRequestOutboxRecord *> *third = [outbox dequeueBatch];
+    XCTAssertEqualObjects(third[0].request.URL.path, @"/0");
+    XCTAssertEqualObjects(third[1].request.URL.path, @"/1");
+    XCTAssertEqual(outbox.count, 3);
+}
+
+- (void)testDataRequestOutboxTruncatesJournalWhenEmpty
+{
+    SEDataRequestOutbox *outbox = [[SEDataRequestOutbox alloc] initWithJournalURL:_journalURL];
+    [outbox appendRequest:SECreateOutboxTestRequest(@"first") authorized:NO error:nil];
+    [outbox acknowledgeRecords:[outbox dequeueBatch]];
+    
+    XCTAssertEqual(outbox.count, 0);
+    XCTAssertEqual([NSData dataWithContentsOfURL:_journalURL].length, 0);
+}
+
+- (void)testDataRequestOutboxDiscardsPartiallyWrittenRecord
+{
+    SEDataRequestOutbox *outbox = [[SEDataRequestOutbox alloc] initWithJournalURL:_journalURL];
+    [outbox appendRequest:SECreateOutboxTestRequest(@"first") authorized:NO error:nil];
+    [outbox appendRequest:SECreateOutboxTestRequest(@"second") authorized:NO error:nil];
+    outbox = nil;
+    
+    NSData *journal = [NSData dataWithContentsOfURL:_journalURL];
+    [[journal subdataWithRange:NSMakeRange(0, journal.length - 3)] writeToURL:_journalURL atomically:YES];
+    
+    SEDataRequestOutbox *reloaded = [[SEDataRequestOutbox alloc] initWithJournalURL:_journalURL];
+    XCTAssertEqual(reloaded.count, 1);
+    XCTAssertEqualObjects([reloaded dequeueBatch].firstObject.request.URL.path, @"/first");
+}
+
+@end
@@ -0,0 +1,145 @@
+//
+//  SEDataRequestPageSequenceTests.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <XCTest/XCTest.h>
+#import <OCMock/OCMock.h>
+#import "SEDataRequestServiceImpl.h"
+#import "SEDataRequestPageSequence.h"
+#import "SETestLoopbackTransport.h"
+#import "SEEnvironmentService.h"
+
+static inline NSDictionary<NSString *, NSString *> *SEPageSequenceTestQuery(NSURLRequest *request)
+{
+    NSMutableDictionary<NSString *, NSString *> *query = [NSMutableDictionary new];
+    for (NSURLQueryItem *item in [NSURLComponents componentsWithURL:request.URL resolvingAgainstBaseURL:NO].queryItems)
+    {
+        [query setObject:item.value ?: @"" forKey:item.name];
+    }
+    return query;
+}
+
+@interface SEDataRequestPageSequenceTests : XCTestCase
+@end
+
+@implementation SEDataRequestPageSequenceTests
+{
+    SETestLoopbackTransport *_transport;
+    SEDataRequestServiceImpl *_service;
+}
+
+- (void)setUp
+{
+    [super setUp];
+
+    _transport = [SETestLoopbackTransport new];
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+    _service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:_transport.sessionConfiguration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    _service.prewarmConnectionCount = 0;
+}
+
+- (void)tearDown
+{
+    _service = nil;
+    _transport = nil;
+    [super tearDown];
+}
+
+- (NSArray<SEDataRequestPage *> *)pullAllPagesOfSequence:(SEDataRequestPageSequence *)sequence
+{
+    NSMutableArray<SEDataRequestPage *> *pages = [NSMutableArray new];
+    __block BOOL isDone = NO;
+    while (!isDone)
+    {
+        XCTestExpectation *expectation = [self expectationWithDescription:@"page"];
+        [sequence nextPage:^(SEDataRequestPage *page, NSError *error) {
+            XCTAssertNil(error);
+            if (page != nil) [pages addObject:page];
+            else isDone = YES;
+            [expectation fulfill];
+        } completionQueue:dispatch_get_main_queue()];
+        [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    }
+    return pages;
+}
+
+- (void)testPageSequenceFollowsCursor
+{
+    [_transport setHandler:^SETestLoopbackResponse *(NSURLRequest *request) {
+        NSInteger page = [SEPageSequenceTestQuery(request)[@"cursor"] integerValue];
+        id next = (page < 2) ? [NSString stringWithFormat:@"%ld", (long)page + 1] : [NSNull null];
+        return [SETestLoopbackResponse responseWithStatusCode:200 JSONObject:@{ @"items": @[ @(page) ], @"paging": @{ @"next": next } }];
+    } forMethod:@"GET" path:@"/feed"];
+
+    SEDataRequestCursorPagination *pagination = [[SEDataRequestCursorPagination alloc] initWithCursorKeyPath:@"paging.next" parameterName:@"cursor"];
+    SEDataRequestPageSequence *sequence = [[SEDataRequestPageSequence alloc] initWithDataRequestService:_service path:@"feed" parameters:@{ @"cursor": @"0" } pagination:pagination deserializeToClass:nil];
+    NSArray<SEDataRequestPage *> *pages = [self pullAllPagesOfSequence:sequence];
+
+    XCTAssertEqual(pages.count, 3);
+    for (NSUInteger i = 0; i < pages.count; ++i)
+    {
+        XCTAssertEqual(pages[i].index, i);
+        XCTAssertEqualObjects(pages[i].data[@"items"], @[ @(i) ]);
+    }
+    XCTAssertTrue(sequence.isFinished);
+    XCTAssertEqual(_transport.requestCount, 3);
+}
+
+- (void)testPageSequenceFollowsLinkHeader
+{
+    [_transport setHandler:^SETestLoopbackResponse *(NSURLRequest *request) {
+        NSInteger page = [SEPageSequenceTestQuery(request)[@"page"] integerValue];
+        NSMutableDictionary *headers = [@{ @"Content-Type": @"application/json" } mutableCopy];
+        if (page < 3) headers[@"Link"] = [NSString stringWithFormat:@"<https://www.awesomehost.com/repos?page=%ld&per_page=1>; rel=\"next\", <https://www.awesomehost.com/repos?page=3&per_page=1>; rel=\"last\"", (long)page + 1];
+        NSData *body = [NSJSONSerialization dataWithJSONObject:@[ @(page) ] options:0 error:nil];
+        return [SETestLoopbackResponse responseWithStatusCode:200 headers:headers body:body];
+    } forMethod:@"GET" path:@"/repos"];
+
+    SEDataRequestPageSequence *sequence = [[SEDataRequestPageSequence alloc] initWithDataRequestService:_service path:@"repos" parameters:@{ @"page": @1, @"per_page": @1 } pagination:[SEDataRequestLinkHeaderPagination new] deserializeToClass:nil];
+    NSArray<SEDataRequestPage *> *pages = [self pullAllPagesOfSequence:sequence];
+
+    XCTAssertEqual(pages.count, 3);
+    XCTAssertEqualObjects(pages.lastObject.data, @[ @3 ]);
+    XCTAssertEqualObjects(pages.lastObject.parameters[@"page"], @"3");
+}
+
+- (void)testPageSequenceRequestsOffsetPagesAheadAndStopsWithConsumer
+{
+    _transport.latency = 0.05;
+    [_transport setHandler:^SETestLoopbackResponse *(NSURLRequest *request) {
+        NSDictionary<NSString *, NSString *> *query = SEPageSequenceTestQuery(request);
+        NSInteger offset = [query[@"offset"] integerValue];
+        NSInteger limit = [query[@"limit"] integerValue];
+        NSMutableArray *items = [NSMutableArray new];
+        for (NSInteger i = offset; i < MIN(offset + limit, 25); ++i) [items addObject:@(i)];
+        return [SETestLoopbackResponse responseWithStatusCode:200 JSONObject:items];
+    } forMethod:@"GET" path:@"/items"];
+
+    SEDataRequestOffsetPagination *pagination = [[SEDataRequestOffsetPagination alloc] initWithOffsetParameter:@"offset" limitParameter:@"limit" pageSize:10 itemsKeyPath:nil];
+    SEDataRequestPageSequence *sequence = [[SEDataRequestPageSequence alloc] initWithDataRequestService:_service path:@"items" parameters:nil pagination:pagination deserializeToClass:nil];
+    sequence.pagesAhead = 1;
+
+    // the consumer pulls one page and stops, so only one more is requested
+    XCTestExpectation *expectation = [self expectationWithDescription:@"first page"];
+    [sequence nextPage:^(SEDataRequestPage *page, NSError *error) {
+        XCTAssertEqual([page.data count], 10);
+        [expectation fulfill];
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.3]];
+    XCTAssertEqual(_transport.requestCount, 2);
+
+    NSArray<SEDataRequestPage *> *pages = [self pullAllPagesOfSequence:sequence];
+    XCTAssertEqual(pages.count, 2);
+    XCTAssertEqualObjects(pages.lastObject.data, (@[ @20, @21, @22, @23, @24 ]));
+    XCTAssertTrue(sequence.isFinished);
+}
+
+@end
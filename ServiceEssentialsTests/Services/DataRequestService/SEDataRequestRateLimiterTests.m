@@ -0,0 +1,127 @@
+//
+//  SEDataRequestRateLimiterTests.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <XCTest/XCTest.h>
+#import "SEDataRequestRateLimiter.h"
+
+static NSHTTPURLResponse *SECreateTestResponse(NSInteger statusCode, NSString *retryAfter)
+{
+    NSDictionary *headers = (retryAfter != nil) ? @{ @"Retry-After": retryAfter } : nil;
+    return [[NSHTTPURLResponse alloc] initWithURL:[NSURL URLWithString:@"https://www.awesomehost.com/items"] statusCode:statusCode HTTPVersion:@"HTTP/1.1" headerFields:headers];
+}
+
+@interface SEDataRequestRateLimiterTests : XCTestCase
+@end
+
+@implementation SEDataRequestRateLimiterTests
+
+- (void)testRateLimiterDoesNotDelayWithoutRate
+{
+    SEDataRequestRateLimiter *limiter = [SEDataRequestRateLimiter new];
+    for (NSUInteger i = 0; i < 100; ++i)
+    {
+        XCTAssertEqual([limiter reserveRequestForRouteGroup:@"a.com"], 0);
+    }
+}
+
+- (void)testRateLimiterAllowsBurstThenSpreadsRequests
+{
+    SEDataRequestRateLimiter *limiter = [SEDataRequestRateLimiter new];
+    limiter.requestsPerSecond = 10;
+    limiter.burstSize = 3;
+    
+    XCTAssertEqual([limiter reserveRequestForRouteGroup:@"a.com"], 0);
+    XCTAssertEqual([limiter reserveRequestForRouteGroup:@"a.com"], 0);
+    XCTAssertEqual([limiter reserveRequestForRouteGroup:@"a.com"], 0);
+    XCTAssertEqualWithAccuracy([limiter reserveRequestForRouteGroup:@"a.com"], 0.1, 0.01);
+    XCTAssertEqualWithAccuracy([limiter reserveRequestForRouteGroup:@"a.com"], 0.2, 0.01);
+    
+    // route groups have separate buckets
+    XCTAssertEqual([limiter reserveRequestForRouteGroup:@"b.com"], 0);
+}
+
+- (void)testRateLimiterUsesRouteGroupRate
+{
+    SEDataRequestRateLimiter *limiter = [SEDataRequestRateLimiter new];
+    [limiter setRequestsPerSecond:1 burstSize:1 forRouteGroup:@"a.com"];
+    
+    XCTAssertEqual([limiter reserveRequestForRouteGroup:@"a.com"], 0);
+    XCTAssertEqualWithAccuracy([limiter reserveRequestForRouteGroup:@"a.com"], 1.0, 0.01);
+    XCTAssertEqual([limiter reserveRequestForRouteGroup:@"b.com"], 0);
+    XCTAssertEqual([limiter reserveRequestForRouteGroup:@"b.com"], 0);
+}
+
+- (void)testRateLimiterGroupsByHostUnlessProvided
+{
+    SEDataRequestRateLimiter *limiter = [SEDataRequestRateLimiter new];
+    XCTAssertEqualObjects([limiter routeGroupForURL:[NSURL URLWithString:@"https://WWW.AwesomeHost.com/items/1"]], @"www.awesomehost.com");
+    
+    limiter.routeGroupProvider = ^NSString *(NSURL *url) {
+        return [url.path hasPrefix:@"/search"] ? @"search" : nil;
+    };
+    XCTAssertEqualObjects([limiter routeGroupForURL:[NSURL URLWithString:@"https://www.awesomehost.com/search?q=1"]], @"search");
+    XCTAssertEqualObjects([limiter routeGroupForURL:[NSURL URLWithString:@"https://www.awesomehost.com/items/1"]], @"www.awesomehost.com");
+}
+
+- (void)testRateLimiterDelaysRequestsWhilePaused
+{
+    SEDataRequestRateLimiter *limiter = [SEDataRequestRateLimiter new];
+    [limiter pauseRouteGroup:@"a.com" forInterval:2.0];
+    
+    XCTAssertEqualWithAccuracy([limiter remainingPauseForRouteGroup:@"a.com"], 2.0, 0.1);
+    XCTAssertEqualWithAccuracy([limiter reserveRequestForRouteGroup:@"a.com"], 2.0, 0.1);
+    XCTAssertEqual([limiter reserveRequestForRouteGroup:@"b.com"], 0);
+    
+    // shorter pause does not shorten the current one
+    [limiter pauseRouteGroup:@"a.com" forInterval:1.0];
+    XCTAssertEqualWithAccuracy([limiter remainingPauseForRouteGroup:@"a.com"], 2.0, 0.1);
+}
+
+- (void)testRateLimiterSpreadsRequestsAfterPause
+{
+    SEDataRequestRateLimiter *limiter = [SEDataRequestRateLimiter new];
+    limiter.requestsPerSecond = 10;
+    limiter.burstSize = 5;
+    [limiter pauseRouteGroup:@"a.com" forInterval:1.0];
+    
+    XCTAssertEqualWithAccuracy([limiter reserveRequestForRouteGroup:@"a.com"], 1.0, 0.01);
+    XCTAssertEqualWithAccuracy([limiter reserveRequestForRouteGroup:@"a.com"], 1.1, 0.01);
+}
+
+- (void)testRateLimiterParsesRetryAfter
+{
+    XCTAssertEqual([SEDataRequestRateLimiter retryAfterIntervalFromResponse:SECreateTestResponse(429, @"120")], 120);
+    XCTAssertEqual([SEDataRequestRateLimiter retryAfterIntervalFromResponse:SECreateTestResponse(429, nil)], -1);
+    XCTAssertEqual([SEDataRequestRateLimiter retryAfterIntervalFromResponse:SECreateTestResponse(429, @"soon")], -1);
+    
+    NSDateFormatter *formatter = [NSDateFormatter new];
+    formatter.locale = [NSLocale localeWithLocaleIdentifier:@"en_US_POSIX"];
+    formatter.timeZone = [NSTimeZone timeZoneWithAbbreviation:@"GMT"];
+    formatter.dateFormat = @"EEE',' dd MMM yyyy HH':'mm':'ss z";
+    NSString *date = [formatter stringFromDate:[NSDate dateWithTimeIntervalSinceNow:60]];
+    XCTAssertEqualWithAccuracy([SEDataRequestRateLimiter retryAfterIntervalFromResponse:SECreateTestResponse(503, date)], 60, 2);
+}
+
+- (void)testRateLimiterPausesOnThrottlingResponses
+{
+    SEDataRequestRateLimiter *limiter = [SEDataRequestRateLimiter new];
+    limiter.maximumPauseInterval = 10;
+    
+    XCTAssertEqual([limiter handleResponse:SECreateTestResponse(200, @"5") forRouteGroup:@"a.com"], 0);
+    XCTAssertEqual([limiter handleResponse:SECreateTestResponse(503, nil) forRouteGroup:@"a.com"], 0);
+    XCTAssertEqual([limiter remainingPauseForRouteGroup:@"a.com"], 0);
+    
+    XCTAssertEqual([limiter handleResponse:SECreateTestResponse(429, nil) forRouteGroup:@"a.com"], limiter.defaultPauseInterval);
+    XCTAssertEqual([limiter handleResponse:SECreateTestResponse(503, @"3") forRouteGroup:@"b.com"], 3);
+    XCTAssertEqual([limiter handleResponse:SECreateTestResponse(429, @"3600") forRouteGroup:@"c.com"], 10);
+    XCTAssertGreaterThan([limiter remainingPauseForRouteGroup:@"c.com"], 9);
+}
+
+@end
@@ -0,0 +1,296 @@
+//
+//  SEDataRequestResumableUploaderTests.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <XCTest/XCTest.h>
+#import <OCMock/OCMock.h>
+#include <CommonCrypto/CommonDigest.h>
+#import "SEDataRequestServiceImpl.h"
+#import "SEDataRequestResumableUploader.h"
+#import "SEEnvironmentService.h"
+
+// State of the stand-in upload server, guarded by the protocol class
+static NSMutableDictionary<NSString *, NSMutableData *> *SEUploadServerData = nil;
+static NSMutableDictionary<NSString *, NSNumber *> *SEUploadServerLengths = nil;
+static NSUInteger SEUploadServerNextIdentifier = 0;
+// PATCH requests accepted before the server starts failing them, `NSUIntegerMax` to accept all
+static NSUInteger SEUploadServerPatchesBeforeFailure = NSUIntegerMax;
+// PATCH requests answered with a checksum mismatch
+static NSUInteger SEUploadServerCorruptedPatches = 0;
+static int64_t SEUploadServerPatchedBytes = 0;
+// Final uploads are created and their parts released, but the connection is lost before the response
+static BOOL SEUploadServerLosesFinalResponses = NO;
+static NSUInteger SEUploadServerFinalUploads = 0;
+
+static NSData *SEReadRequestBody(NSURLRequest *request)
+{
+    if (request.HTTPBody != nil) return request.HTTPBody;
+    NSInputStream *stream = request.HTTPBodyStream;
+    if (stream == nil) return nil;
+
+    NSMutableData *body = [NSMutableData new];
+    uint8_t buffer[1024];
+    [stream open];
+    NSInteger read;
+    while ((read = [stream read:buffer maxLength:sizeof(buffer)]) > 0) [body appendBytes:buffer length:read];
+    [stream close];
+    return body;
+}
+
+/** Minimal tus server with the creation, checksum and concatenation extensions */
+@interface SEUploadServerURLProtocol : NSURLProtocol
+@end
+
+@implementation SEUploadServerURLProtocol
+
++ (BOOL)canInitWithRequest:(NSURLRequest *)request
+{
+    return YES;
+}
+
++ (NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request
+{
+    return request;
+}
+
+- (void)startLoading
+{
+    NSURLRequest *request = self.request;
+    NSString *method = request.HTTPMethod;
+    NSString *path = request.URL.path;
+    NSInteger status = 400;
+    NSMutableDictionary<NSString *, NSString *> *headers = [@{ @"Tus-Resumable": @"1.0.0" } mutableCopy];
+    BOOL losesResponse = NO;
+
+    @synchronized ([SEUploadServerURLProtocol class])
+    {
+        if ([method isEqualToString:@"POST"])
+        {
+            NSString *concat = [request valueForHTTPHeaderField:@"Upload-Concat"];
+            NSMutableData *data = [NSMutableData new];
+            int64_t length = [[request valueForHTTPHeaderField:@"Upload-Length"] longLongValue];
+            status = 201;
+            if ([concat hasPrefix:@"final;"])
+            {
+                for (NSString *part in [[concat substringFromIndex:6] componentsSeparatedByString:@" "])
+                {
+                    NSString *partPath = [NSURL URLWithString:part].path;
+                    NSData *partData = [SEUploadServerData objectForKey:partPath];
+                    if (partData == nil || partData.length != [[SEUploadServerLengths objectForKey:partPath] longLongValue]) status = 400;
+                    [data appendData:partData];
+                }
+                length = data.length;
+            }
+
+            if (status == 201)
+            {
+                NSString *uploadPath = [NSString stringWithFormat:@"/files/%lu", (unsigned long)++SEUploadServerNextIdentifier];
+                [SEUploadServerData setObject:data forKey:uploadPath];
+                [SEUploadServerLengths setObject:@(length) forKey:uploadPath];
+                [headers setObject:uploadPath forKey:@"Location"];
+                if ([concat hasPrefix:@"final;"])
+                {
+                    SEUploadServerFinalUploads++;
+                    losesResponse = SEUploadServerLosesFinalResponses;
+                    if (losesResponse)
+                    {
+                        for (NSString *part in [[concat substringFromIndex:6] componentsSeparatedByString:@" "]) [SEUploadServerData removeObjectForKey:[NSURL URLWithString:part].path];
+                    }
+                }
+            }
+        }
+        else if ([method isEqualToString:@"HEAD"])
+        {
+            NSData *data = [SEUploadServerData objectForKey:path];
+            status = (data != nil) ? 200 : 404;
+            if (data != nil) [headers setObject:[NSString stringWithFormat:@"%lu", (unsigned long)data.length] forKey:@"Upload-Offset"];
+        }
+        else if ([method isEqualToString:@"PATCH"])
+        {
+            NSMutableData *data = [SEUploadServerData objectForKey:path];
+            NSData *body = SEReadRequestBody(request);
+
+            unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+            CC_SHA256(body.bytes, (CC_LONG)body.length, digest);
+            NSString *checksum = [NSString stringWithFormat:@"sha256 %@", [[NSData dataWithBytes:digest length:CC_SHA256_DIGEST_LENGTH] base64EncodedStringWithOptions:0]];
+
+            if (data == nil) status = 404;
+            else if (SEUploadServerPatchesBeforeFailure == 0) status = 500;
+            else if ([[request valueForHTTPHeaderField:@"Upload-Offset"] longLongValue] != (int64_t)data.length) status = 409;
+            else if (SEUploadServerCorruptedPatches > 0 || ![[request valueForHTTPHeaderField:@"Upload-Checksum"] isEqualToString:checksum])
+            {
+                if (SEUploadServerCorruptedPatches > 0) SEUploadServerCorruptedPatches--;
+                status = 460;
+            }
+            else
+            {
+                if (SEUploadServerPatchesBeforeFailure != NSUIntegerMax) SEUploadServerPatchesBeforeFailure--;
+                [data appendData:body];
+                SEUploadServerPatchedBytes += body.length;
+                [headers setObject:[NSString stringWithFormat:@"%lu", (unsigned long)data.length] forKey:@"Upload-Offset"];
+                status = 204;
+            }
+        }
+    }
+
+    if (losesResponse)
+    {
+        [self.client URLProtocol:self didFailWithError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:nil]];
+        return;
+    }
+
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:request.URL statusCode:status HTTPVersion:@"HTTP/1.1" headerFields:headers];
+    [self.client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+    [self.client URLProtocolDidFinishLoading:self];
+}
+
+- (void)stopLoading
+{
+}
+
+@end
+
+@interface SEDataRequestResumableUploaderTests : XCTestCase
+@end
+
+@implementation SEDataRequestResumableUploaderTests
+{
+    SEDataRequestServiceImpl *_service;
+    NSURL *_directoryURL;
+    NSURL *_fileURL;
+    NSData *_fileData;
+}
+
+- (void)setUp
+{
+    [super setUp];
+
+    SEUploadServerData = [NSMutableDictionary new];
+    SEUploadServerLengths = [NSMutableDictionary new];
+    SEUploadServerPatchesBeforeFailure = NSUIntegerMax;
+    SEUploadServerCorruptedPatches = 0;
+    SEUploadServerPatchedBytes = 0;
+    SEUploadServerLosesFinalResponses = NO;
+    SEUploadServerFinalUploads = 0;
+
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[ [SEUploadServerURLProtocol class] ];
+    _service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:configuration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    _service.prewarmConnectionCount = 0;
+
+    _directoryURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    [[NSFileManager defaultManager] createDirectoryAtURL:_directoryURL withIntermediateDirectories:YES attributes:nil error:nil];
+    _fileURL = [_directoryURL URLByAppendingPathComponent:@"file.bin"];
+    _fileData = [@"0123456789" dataUsingEncoding:NSUTF8StringEncoding];
+    [_fileData writeToURL:_fileURL atomically:YES];
+}
+
+- (void)tearDown
+{
+    [[NSFileManager defaultManager] removeItemAtURL:_directoryURL error:nil];
+    _service = nil;
+    [super tearDown];
+}
+
+- (SEDataRequestResumableUploader *)createUploader
+{
+    SEDataRequestResumableUploader *uploader = [[SEDataRequestResumableUploader alloc] initWithDataRequestService:_service stateDirectoryURL:[_directoryURL URLByAppendingPathComponent:@"uploads"]];
+    uploader.chunkSize = 4;
+    return uploader;
+}
+
+- (void)testResumableUploaderResumesInterruptedUpload
+{
+    SEDataRequestResumableUploader *uploader = [self createUploader];
+    uploader.maxConcurrentChunks = 1;
+    uploader.maxChunkAttempts = 1;
+    SEUploadServerPatchesBeforeFailure = 1;
+
+    XCTestExpectation *expectation = [self expectationWithDescription:@"interrupted upload"];
+    [uploader uploadFileAtURL:_fileURL toPath:@"files" identifier:@"upload" success:^(NSURL *uploadURL) {
+        XCTFail(@"Should not succeed");
+    } failure:^(NSError *error) {
+        [expectation fulfill];
+    } progress:nil completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    XCTAssertEqualObjects([uploader pendingUploadIdentifiers], @[ @"upload" ]);
+
+    // a new uploader picks the progress up, as it would after a relaunch
+    SEUploadServerPatchesBeforeFailure = NSUIntegerMax;
+    SEUploadServerPatchedBytes = 0;
+    uploader = [self createUploader];
+
+    __block NSURL *resultURL = nil;
+    __block int64_t lastProgress = 0;
+    expectation = [self expectationWithDescription:@"resumed upload"];
+    [uploader uploadFileAtURL:_fileURL toPath:@"files" identifier:@"upload" success:^(NSURL *uploadURL) {
+        resultURL = uploadURL;
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } progress:^(int64_t bytesUploaded, int64_t totalBytes) {
+        XCTAssertEqual(totalBytes, 10);
+        lastProgress = bytesUploaded;
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    // the first chunk is not sent again
+    XCTAssertEqual(SEUploadServerPatchedBytes, 6);
+    XCTAssertEqual(lastProgress, 10);
+    XCTAssertEqualObjects([SEUploadServerData objectForKey:resultURL.path], _fileData);
+    XCTAssertEqual([uploader pendingUploadIdentifiers].count, 0);
+}
+
+- (void)testResumableUploaderResendsCorruptedChunk
+{
+    SEDataRequestResumableUploader *uploader = [self createUploader];
+    uploader.chunkSize = 64;
+    SEUploadServerCorruptedPatches = 1;
+
+    __block NSURL *resultURL = nil;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"upload"];
+    [uploader uploadFileAtURL:_fileURL toPath:@"files" identifier:@"upload" success:^(NSURL *uploadURL) {
+        resultURL = uploadURL;
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } progress:nil completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    // a file that fits in a chunk is uploaded without concatenation
+    XCTAssertEqualObjects(resultURL.path, @"/files/1");
+    XCTAssertEqualObjects([SEUploadServerData objectForKey:resultURL.path], _fileData);
+    XCTAssertEqual(SEUploadServerPatchedBytes, 10);
+}
+
+- (void)testResumableUploaderDoesNotResendFinalUploadAfterLostResponse
+{
+    SEDataRequestResumableUploader *uploader = [self createUploader];
+    SEUploadServerLosesFinalResponses = YES;
+
+    __block NSError *resultError = nil;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"upload"];
+    [uploader uploadFileAtURL:_fileURL toPath:@"files" identifier:@"upload" success:^(NSURL *uploadURL) {
+        XCTFail(@"Should not succeed");
+    } failure:^(NSError *error) {
+        resultError = error;
+        [expectation fulfill];
+    } progress:nil completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    // the released parts tell that the final upload exists, so it is neither created again nor resumed
+    XCTAssertEqualObjects(resultError.domain, SEErrorDomain);
+    XCTAssertEqual(resultError.code, SEDataRequestResumableUploadConcatenationUnconfirmed);
+    XCTAssertEqual(SEUploadServerFinalUploads, 1);
+    XCTAssertEqual([uploader pendingUploadIdentifiers].count, 0);
+}
+
+@end
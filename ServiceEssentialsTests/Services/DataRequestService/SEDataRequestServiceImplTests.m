@@ -9,8 +9,244 @@
 //
 
 #import <XCTest/XCTest.h>
+#import <OCMock/OCMock.h>
 #import "SEDataRequestServiceImpl.h"
 #import "SEDataRequestServicePrivate.h"
+#import "SEEnvironmentService.h"
+#import "SENetworkReachabilityTracker.h"
+#import "SEDataRequestLinkPolicy.h"
+#import "SEDataRequestCircuitBreakers.h"
+#import "SEDataRequestRateLimiter.h"
+#import "SEDataRequestScope.h"
+#import "SETestLoopbackTransport.h"
+#import "SEDataRequestLoadGenerator.h"
+#import "SETimeline.h"
+#import "SEDataRequestContentCache.h"
+#import "SEDataRequestOutbox.h"
+#import "SEDataRequestServerSentEvent.h"
+
+static NSMutableArray<NSURLRequest *> *SERecordedURLRequests = nil;
+
+/** URL protocol that records requests and replies with an empty 200 response */
+@interface SERecordingURLProtocol : NSURLProtocol
+@end
+
+@implementation SERecordingURLProtocol
+
++ (BOOL)canInitWithRequest:(NSURLRequest *)request
+{
+    return YES;
+}
+
++ (NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request
+{
+    return request;
+}
+
+- (void)startLoading
+{
+    @synchronized ([SERecordingURLProtocol class])
+    {
+        [SERecordedURLRequests addObject:self.request];
+    }
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:self.request.URL statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:nil];
+    [self.client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+    [self.client URLProtocolDidFinishLoading:self];
+}
+
+- (void)stopLoading
+{
+}
+
+@end
+
+/** URL protocol that records requests and only accepts the fresh authorization */
+@interface SEAuthorizingURLProtocol : NSURLProtocol
+@end
+
+@implementation SEAuthorizingURLProtocol
+
++ (BOOL)canInitWithRequest:(NSURLRequest *)request
+{
+    return YES;
+}
+
++ (NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request
+{
+    return request;
+}
+
+- (void)startLoading
+{
+    @synchronized ([SERecordingURLProtocol class])
+    {
+        [SERecordedURLRequests addObject:self.request];
+    }
+    BOOL authorized = [[self.request valueForHTTPHeaderField:@"Authorization"] isEqualToString:@"Bearer fresh"];
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:self.request.URL statusCode:(authorized ? 200 : 401) HTTPVersion:@"HTTP/1.1" headerFields:nil];
+    [self.client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+    [self.client URLProtocolDidFinishLoading:self];
+}
+
+- (void)stopLoading
+{
+}
+
+@end
+
+/** URL protocol that records requests and replies with 503 */
+@interface SEUnavailableURLProtocol : NSURLProtocol
+@end
+
+@implementation SEUnavailableURLProtocol
+
++ (BOOL)canInitWithRequest:(NSURLRequest *)request
+{
+    return YES;
+}
+
++ (NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request
+{
+    return request;
+}
+
+- (void)startLoading
+{
+    @synchronized ([SERecordingURLProtocol class])
+    {
+        [SERecordedURLRequests addObject:self.request];
+    }
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:self.request.URL statusCode:503 HTTPVersion:@"HTTP/1.1" headerFields:nil];
+    [self.client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+    [self.client URLProtocolDidFinishLoading:self];
+}
+
+- (void)stopLoading
+{
+}
+
+@end
+
+@interface SEThrottlingURLProtocol : NSURLProtocol
+@end
+
+@implementation SEThrottlingURLProtocol
+
++ (BOOL)canInitWithRequest:(NSURLRequest *)request
+{
+    return YES;
+}
+
++ (NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request
+{
+    return request;
+}
+
+- (void)startLoading
+{
+    @synchronized ([SERecordingURLProtocol class])
+    {
+        [SERecordedURLRequests addObject:self.request];
+    }
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:self.request.URL statusCode:429 HTTPVersion:@"HTTP/1.1" headerFields:@{ @"Retry-After": @"30" }];
+    [self.client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+    [self.client URLProtocolDidFinishLoading:self];
+}
+
+- (void)stopLoading
+{
+}
+
+@end
+
+// Never responds, requests stay in progress until cancelled
+@interface SEStallingURLProtocol : NSURLProtocol
+@end
+
+@implementation SEStallingURLProtocol
+
++ (BOOL)canInitWithRequest:(NSURLRequest *)request
+{
+    return YES;
+}
+
++ (NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request
+{
+    return request;
+}
+
+- (void)startLoading
+{
+}
+
+- (void)stopLoading
+{
+}
+
+@end
+
+@interface SEFakeAuthorizationRefresher : NSObject<SEDataRequestAuthorizationRefresher>
+@property (atomic, copy) NSString *authorizationHeader;
+@property (atomic, assign) NSUInteger refreshCount;
+@end
+
+@implementation SEFakeAuthorizationRefresher
+- (void)dataRequestService:(id<SEDataRequestService>)dataRequestService refreshAuthorizationWithCompletion:(void (^)(NSString * _Nullable, NSError * _Nullable))completion
+{
+    self.refreshCount++;
+    NSString *authorizationHeader = self.authorizationHeader;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.1 * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        completion(authorizationHeader, authorizationHeader == nil ? [NSError errorWithDomain:@"test" code:1 userInfo:nil] : nil);
+    });
+}
+@end
+
+/** Reachability source driven by the test */
+@interface SEFakeReachabilitySource : NSObject<SENetworkReachabilitySource>
+@property (nonatomic, assign) SENetworkReachabilityStatus reachability;
+- (void)updateStatus:(SENetworkReachabilityStatus)status;
+@end
+
+@implementation SEFakeReachabilitySource
+@synthesize delegate = _delegate;
+- (void)updateStatus:(SENetworkReachabilityStatus)status
+{
+    self.reachability = status;
+    [self.delegate networkReachabilityTracker:self didUpdateStatus:status];
+}
+@end
+
+@interface SESingleRequestLinkPolicy : NSObject<SEDataRequestLinkPolicy>
+@end
+
+@implementation SESingleRequestLinkPolicy
+- (SEDataRequestLinkParameters *)linkParametersForStatus:(SENetworkReachabilityStatus)status throughput:(double)throughput
+{
+    return [[SEDataRequestLinkParameters alloc] initWithMaxConcurrentRequests:1 prefetchDepth:0 compressionThreshold:NSUIntegerMax];
+}
+@end
+
+@interface SETwoRequestLinkPolicy : NSObject<SEDataRequestLinkPolicy>
+@end
+
+@implementation SETwoRequestLinkPolicy
+- (SEDataRequestLinkParameters *)linkParametersForStatus:(SENetworkReachabilityStatus)status throughput:(double)throughput
+{
+    return [[SEDataRequestLinkParameters alloc] initWithMaxConcurrentRequests:2 prefetchDepth:0 compressionThreshold:NSUIntegerMax];
+}
+@end
+
+/** Preparation delegate identifying the user by a header of its own */
+@interface SESessionHeaderDelegate : NSObject<SEDataRequestPreparationDelegate>
+@property (atomic, copy) NSString *session;
+@end
+
+@implementation SESessionHeaderDelegate
+- (NSDictionary<NSString *, NSString *> *)dataRequestService:(id<SEDataRequestService>)dataRequestService additionalHeadersForRequestMethod:(NSString *)method path:(NSString *)path
+{
+    return @{ @"X-Session": self.session };
+}
+@end
 
 @interface SEDataRequestServiceImplTests : XCTestCase
 @end
@@ -41,5 +277,1059 @@
     XCTAssertEqualObjects([NSURL URLWithString:@"https://www.awesomehost.com/api/method?firstParam=1&thirdParam=xyz"], result);
 }
 
+- (void)testDataRequestServicePrewarmSendsHEADRequestsToBaseURL
+{
+    NSURL *baseURL = [NSURL URLWithString:@"https://www.awesomehost.com/api/"];
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn(baseURL);
+
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[ [SERecordingURLProtocol class] ];
+    configuration.HTTPMaximumConnectionsPerHost = 2;
+    SERecordedURLRequests = [NSMutableArray new];
+
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:configuration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    service.prewarmConnectionCount = 5;
+    service.prewarmPath = @"ping";
+    [service prewarmConnections];
+
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:5.0];
+    while (SERecordedURLRequests.count < 2 && [deadline timeIntervalSinceNow] > 0)
+    {
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+
+    // Capped by the maximum number of connections per host
+    XCTAssertEqual(SERecordedURLRequests.count, 2);
+    for (NSURLRequest *request in SERecordedURLRequests)
+    {
+        XCTAssertEqualObjects(request.HTTPMethod, @"HEAD");
+        XCTAssertEqualObjects(request.URL.absoluteString, @"https://www.awesomehost.com/api/ping");
+        XCTAssertNil([request valueForHTTPHeaderField:@"Authorization"]);
+    }
+}
+
+- (void)testDataRequestServicePrewarmDisabledWithZeroConnections
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com"]);
+
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[ [SERecordingURLProtocol class] ];
+    SERecordedURLRequests = [NSMutableArray new];
+
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:configuration];
+    service.prewarmConnectionCount = 0;
+    [service prewarmConnections];
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.2]];
+
+    XCTAssertEqual(SERecordedURLRequests.count, 0);
+}
+
+- (void)testDataRequestServiceRequestsUseCurrentAuthorizationAndEnvironment
+{
+    __block NSURL *baseURL = [NSURL URLWithString:@"https://www.awesomehost.com/api/"];
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andDo(^(NSInvocation *invocation) {
+        __unsafe_unretained NSURL *value = baseURL;
+        [invocation setReturnValue:&value];
+    });
+
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[ [SERecordingURLProtocol class] ];
+    SERecordedURLRequests = [NSMutableArray new];
+
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:configuration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    service.prewarmConnectionCount = 0;
+    [service setAuthorizationHeader:@"Bearer first"];
+
+    XCTestExpectation *firstExpectation = [self expectationWithDescription:@"first request"];
+    [service GET:@"items" parameters:nil success:^(id data, NSURLResponse *response) { [firstExpectation fulfill]; } failure:^(NSError *error) { XCTFail(@"Should not fail: %@", error); } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    baseURL = [NSURL URLWithString:@"https://www.otherhost.com/"];
+    [[NSNotificationCenter defaultCenter] postNotificationName:SEEnvironmentChangedNotification object:environmentService];
+    [service clearAuthorization];
+
+    XCTestExpectation *secondExpectation = [self expectationWithDescription:@"second request"];
+    [service GET:@"items" parameters:nil success:^(id data, NSURLResponse *response) { [secondExpectation fulfill]; } failure:^(NSError *error) { XCTFail(@"Should not fail: %@", error); } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    XCTAssertEqual(SERecordedURLRequests.count, 2);
+    XCTAssertEqualObjects(SERecordedURLRequests[0].URL.absoluteString, @"https://www.awesomehost.com/api/items");
+    XCTAssertEqualObjects([SERecordedURLRequests[0] valueForHTTPHeaderField:@"Authorization"], @"Bearer first");
+    XCTAssertEqualObjects(SERecordedURLRequests[1].URL.absoluteString, @"https://www.otherhost.com/items");
+    XCTAssertNil([SERecordedURLRequests[1] valueForHTTPHeaderField:@"Authorization"]);
+}
+
+
+- (SEDataRequestServiceImpl *)createAuthorizingServiceWithRefresher:(SEFakeAuthorizationRefresher *)refresher
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[ [SEAuthorizingURLProtocol class] ];
+    SERecordedURLRequests = [NSMutableArray new];
+
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:configuration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    service.prewarmConnectionCount = 0;
+    service.authorizationRefresher = refresher;
+    [service setAuthorizationHeader:@"Bearer stale"];
+    return service;
+}
+
+- (void)testDataRequestServiceRefreshesAuthorizationOnceAndReplaysRequests
+{
+    SEFakeAuthorizationRefresher *refresher = [SEFakeAuthorizationRefresher new];
+    refresher.authorizationHeader = @"Bearer fresh";
+    SEDataRequestServiceImpl *service = [self createAuthorizingServiceWithRefresher:refresher];
+
+    for (NSUInteger i = 0; i < 3; ++i)
+    {
+        XCTestExpectation *expectation = [self expectationWithDescription:[NSString stringWithFormat:@"request %lu", (unsigned long)i]];
+        [service GET:[NSString stringWithFormat:@"items/%lu", (unsigned long)i] parameters:nil success:^(id data, NSURLResponse *response) {
+            XCTAssertEqual(((NSHTTPURLResponse *)response).statusCode, 200);
+            [expectation fulfill];
+        } failure:^(NSError *error) {
+            XCTFail(@"Should not fail: %@", error);
+        } completionQueue:dispatch_get_main_queue()];
+    }
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    XCTAssertEqual(refresher.refreshCount, 1);
+    NSUInteger freshCount = 0;
+    for (NSURLRequest *request in SERecordedURLRequests)
+    {
+        if ([[request valueForHTTPHeaderField:@"Authorization"] isEqualToString:@"Bearer fresh"]) freshCount++;
+    }
+    XCTAssertEqual(freshCount, 3);
+}
+
+- (void)testDataRequestServiceReportsUnauthorizedWhenRefreshFails
+{
+    SEFakeAuthorizationRefresher *refresher = [SEFakeAuthorizationRefresher new];
+    SEDataRequestServiceImpl *service = [self createAuthorizingServiceWithRefresher:refresher];
+
+    XCTestExpectation *expectation = [self expectationWithDescription:@"request"];
+    [service GET:@"items" parameters:nil success:^(id data, NSURLResponse *response) {
+        XCTFail(@"Should not succeed");
+    } failure:^(NSError *error) {
+        XCTAssertEqualObjects(error.domain, NSURLErrorDomain);
+        XCTAssertEqual(error.code, 401);
+        XCTAssertNotNil(error.userInfo[NSUnderlyingErrorKey]);
+        [expectation fulfill];
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    XCTAssertEqual(refresher.refreshCount, 1);
+    XCTAssertEqual(SERecordedURLRequests.count, 1);
+}
+
+- (void)testDataRequestServiceAdaptsLinkParametersToReachabilitySource
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:nil];
+    SEFakeReachabilitySource *reachabilitySource = [SEFakeReachabilitySource new];
+    reachabilitySource.reachability = SENetworkReachabilityStatusReachableViaWiFi;
+    service.reachabilitySource = reachabilitySource;
+
+    XCTAssertEqual(service.reachabilityStatus, SENetworkReachabilityStatusReachableViaWiFi);
+    NSUInteger wifiConcurrentRequests = service.linkParameters.maxConcurrentRequests;
+
+    [reachabilitySource updateStatus:SENetworkReachabilityStatusReachableViaWWAN];
+    XCTAssertEqual(service.reachabilityStatus, SENetworkReachabilityStatusReachableViaWWAN);
+    XCTAssertLessThan(service.linkParameters.maxConcurrentRequests, wifiConcurrentRequests);
+    XCTAssertLessThan(service.linkParameters.compressionThreshold, [SEDataRequestLinkParameters new].compressionThreshold);
+
+    service.linkPolicy = [SESingleRequestLinkPolicy new];
+    XCTAssertEqual(service.linkParameters.maxConcurrentRequests, 1);
+}
+
+- (void)testDataRequestServiceCompletesRequestsOverConcurrencyLimit
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[ [SERecordingURLProtocol class] ];
+    SERecordedURLRequests = [NSMutableArray new];
+
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:configuration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    service.prewarmConnectionCount = 0;
+    service.linkPolicy = [SESingleRequestLinkPolicy new];
+
+    for (NSUInteger i = 0; i < 4; ++i)
+    {
+        XCTestExpectation *expectation = [self expectationWithDescription:[NSString stringWithFormat:@"request %lu", (unsigned long)i]];
+        [service GET:[NSString stringWithFormat:@"items/%lu", (unsigned long)i] parameters:nil success:^(id data, NSURLResponse *response) {
+            [expectation fulfill];
+        } failure:^(NSError *error) {
+            XCTFail(@"Should not fail: %@", error);
+        } completionQueue:dispatch_get_main_queue()];
+    }
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    XCTAssertEqual(SERecordedURLRequests.count, 4);
+}
+
+- (void)testDataRequestServiceRemovesRequestBeforeCallback
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+
+    SETestLoopbackTransport *transport = [SETestLoopbackTransport new];
+    NSMutableArray *items = [NSMutableArray new];
+    for (NSUInteger i = 0; i < 2000; ++i) [items addObject:@{ @"id": @(i), @"name": @"item" }];
+    [transport setResponse:[SETestLoopbackResponse responseWithStatusCode:200 JSONObject:items] forMethod:@"GET" path:@"/items"];
+
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:transport.sessionConfiguration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    service.prewarmConnectionCount = 0;
+
+    // a request that has left the service has released its buffered response
+    XCTestExpectation *expectation = [self expectationWithDescription:@"request"];
+    [service GET:@"items" parameters:nil success:^(id data, NSURLResponse *response) {
+        XCTAssertEqual(service.bufferedResponseLength, 0);
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail: %@", error);
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    XCTAssertGreaterThan(service.bufferedResponseLengthHighWaterMark, 0);
+
+    // cancellation cleans up right away, on the calling thread
+    transport.bytesPerSecond = 16 * 1024;
+    id<SECancellableToken> token = [service GET:@"items" parameters:nil success:^(id data, NSURLResponse *response) {
+        XCTFail(@"Should not succeed");
+    } failure:nil completionQueue:dispatch_get_main_queue()];
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:5.0];
+    while (service.bufferedResponseLength == 0 && timeout.timeIntervalSinceNow > 0)
+    {
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+    XCTAssertGreaterThan(service.bufferedResponseLength, 0);
+    [token cancel];
+    XCTAssertEqual(service.bufferedResponseLength, 0);
+}
+
+// Compares inline completion cleanup with the hop to the low-priority queue it has replaced, with every core busy
+- (void)testDataRequestServiceCompletionCleanupBenchmark
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+
+    SETestLoopbackTransport *transport = [SETestLoopbackTransport new];
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:transport.sessionConfiguration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    service.prewarmConnectionCount = 0;
+    SEDataRequestLoadGenerator *generator = [[SEDataRequestLoadGenerator alloc] initWithDataRequestService:service transport:transport];
+
+    __block volatile BOOL loading = YES;
+    dispatch_group_t loadGroup = dispatch_group_create();
+    for (NSUInteger i = 0; i < [NSProcessInfo processInfo].activeProcessorCount; ++i)
+    {
+        dispatch_group_async(loadGroup, dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^{
+            while (loading) {}
+        });
+    }
+
+    SETimeline *timeline = [SETimeline sharedTimeline];
+    [timeline removeAllSpans];
+    timeline.enabled = YES;
+
+    __block SEDataRequestLoadReport *report = nil;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"load run"];
+    [generator runWithConcurrency:8 duration:1.0 completion:^(SEDataRequestLoadReport *result) {
+        report = result;
+        [expectation fulfill];
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:30.0 handler:nil];
+    timeline.enabled = NO;
+
+    // the replaced cleanup path: a hop to the low-priority global queue for every completed request
+    NSUInteger const hopCount = 200;
+    NSTimeInterval *hopDelays = calloc(hopCount, sizeof(NSTimeInterval));
+    dispatch_group_t hopGroup = dispatch_group_create();
+    for (NSUInteger i = 0; i < hopCount; ++i)
+    {
+        NSTimeInterval hopStart = [NSProcessInfo processInfo].systemUptime;
+        dispatch_group_async(hopGroup, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+            hopDelays[i] = [NSProcessInfo processInfo].systemUptime - hopStart;
+        });
+        usleep(1000);
+    }
+    dispatch_group_wait(hopGroup, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(30 * NSEC_PER_SEC)));
+    loading = NO;
+    dispatch_group_wait(loadGroup, DISPATCH_TIME_FOREVER);
+
+    NSMutableArray<NSNumber *> *hops = [[NSMutableArray alloc] initWithCapacity:hopCount];
+    for (NSUInteger i = 0; i < hopCount; ++i) [hops addObject:@(hopDelays[i])];
+    free(hopDelays);
+    [hops sortUsingSelector:@selector(compare:)];
+
+    // begin and end events of a span are exported next to each other
+    NSArray<NSDictionary *> *events = [[NSJSONSerialization JSONObjectWithData:[timeline chromeTraceData] options:0 error:nil] objectForKey:@"traceEvents"];
+    NSMutableArray<NSNumber *> *cleanups = [NSMutableArray new];
+    for (NSUInteger i = 0; i + 1 < events.count; ++i)
+    {
+        NSDictionary *event = [events objectAtIndex:i];
+        if (![[event objectForKey:@"name"] isEqual:@"cleanup"] || ![[event objectForKey:@"ph"] isEqual:@"b"]) continue;
+        NSDictionary *end = [events objectAtIndex:i + 1];
+        [cleanups addObject:@(([[end objectForKey:@"ts"] doubleValue] - [[event objectForKey:@"ts"] doubleValue]) / 1e6)];
+    }
+    [cleanups sortUsingSelector:@selector(compare:)];
+    [timeline removeAllSpans];
+
+    NSTimeInterval hopP50 = [hops objectAtIndex:hopCount / 2].doubleValue, hopP99 = [hops objectAtIndex:hopCount * 99 / 100].doubleValue;
+    NSTimeInterval cleanupP50 = [cleanups objectAtIndex:cleanups.count / 2].doubleValue, cleanupP99 = [cleanups objectAtIndex:cleanups.count * 99 / 100].doubleValue;
+    NSLog(@"%@; inline cleanup p50 %.3fms p99 %.3fms, %.2f registered of %.2f outstanding requests; queue hop p50 %.3fms p99 %.3fms",
+          report, cleanupP50 * 1000, cleanupP99 * 1000, report.meanRegisteredRequests, report.meanOutstandingRequests, hopP50 * 1000, hopP99 * 1000);
+
+    XCTAssertEqual(report.failureCount, 0);
+    XCTAssertGreaterThan(cleanups.count, 0);
+    // requests leave the registry before their callbacks, so the registry holds no more than the requests still outstanding
+    XCTAssertLessThanOrEqual(report.meanRegisteredRequests, report.meanOutstandingRequests + 0.5);
+    // cleaning up on the delegate queue holds it for less time than the hop would have kept requests registered
+    XCTAssertLessThan(cleanupP50, hopP50);
+}
+
+- (void)testDataRequestServiceFailsFastWhenCircuitIsOpen
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[ [SEUnavailableURLProtocol class] ];
+    SERecordedURLRequests = [NSMutableArray new];
+
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:configuration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    service.prewarmConnectionCount = 0;
+    service.circuitBreakers.minimumRequestCount = 2;
+    [self expectationForNotification:SEDataRequestServiceChangedCircuitStateNotification object:service handler:nil];
+
+    for (NSUInteger i = 0; i < 2; ++i)
+    {
+        XCTestExpectation *expectation = [self expectationWithDescription:[NSString stringWithFormat:@"request %lu", (unsigned long)i]];
+        [service GET:[NSString stringWithFormat:@"items/%lu", (unsigned long)i] parameters:nil success:^(id data, NSURLResponse *response) {
+            XCTFail(@"Should not succeed");
+        } failure:^(NSError *error) {
+            XCTAssertNotEqual(error.code, SEDataRequestServiceCircuitOpen);
+            [expectation fulfill];
+        } completionQueue:dispatch_get_main_queue()];
+    }
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    XCTAssertEqual([service.circuitBreakers stateForEndpoint:@"www.awesomehost.com/items/{}"], SEDataRequestCircuitStateOpen);
+
+    XCTestExpectation *expectation = [self expectationWithDescription:@"fast failure"];
+    [service GET:@"items/3" parameters:nil success:^(id data, NSURLResponse *response) {
+        XCTFail(@"Should not succeed");
+    } failure:^(NSError *error) {
+        XCTAssertEqualObjects(error.domain, SEErrorDomain);
+        XCTAssertEqual(error.code, SEDataRequestServiceCircuitOpen);
+        [expectation fulfill];
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    // without a completion queue the failure is still not reported inside the submitting call
+    expectation = [self expectationWithDescription:@"fast failure without a queue"];
+    [service GET:@"items/4" parameters:nil success:^(id data, NSURLResponse *response) {
+        XCTFail(@"Should not succeed");
+    } failure:^(NSError *error) {
+        XCTAssertFalse([NSThread isMainThread]);
+        XCTAssertEqual(error.code, SEDataRequestServiceCircuitOpen);
+        [expectation fulfill];
+    } completionQueue:nil];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    XCTAssertEqual(SERecordedURLRequests.count, 2);
+}
+
+- (void)testDataRequestServiceDelaysRequestsAfterRetryAfter
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[ [SEThrottlingURLProtocol class] ];
+    SERecordedURLRequests = [NSMutableArray new];
+
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:configuration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    service.prewarmConnectionCount = 0;
+
+    XCTestExpectation *expectation = [self expectationWithDescription:@"throttled request"];
+    [service GET:@"items" parameters:nil success:^(id data, NSURLResponse *response) {
+        XCTFail(@"Should not succeed");
+    } failure:^(NSError *error) {
+        [expectation fulfill];
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    XCTAssertGreaterThan([service.rateLimiter remainingPauseForRouteGroup:@"www.awesomehost.com"], 25);
+
+    // next request waits for the pause instead of being sent
+    id<SECancellableToken> token = [service GET:@"items" parameters:nil success:^(id data, NSURLResponse *response) {
+        XCTFail(@"Should not be sent");
+    } failure:nil completionQueue:dispatch_get_main_queue()];
+    XCTAssertNotNil(token);
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.3]];
+    XCTAssertEqual(SERecordedURLRequests.count, 1);
+    [token cancel];
+}
+
+- (void)testDataRequestServiceCancelsRequestsOfScope
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[ [SEStallingURLProtocol class] ];
+
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:configuration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    service.prewarmConnectionCount = 0;
+    void (^success)(id, NSURLResponse *) = ^(id data, NSURLResponse *response) {
+        XCTFail(@"Should not complete");
+    };
+
+    SEDataRequestScope *scope = [[SEDataRequestScope alloc] initWithDataRequestService:service];
+    [scope track:[service GET:@"items/1" parameters:nil success:success failure:nil completionQueue:dispatch_get_main_queue()]];
+    [scope track:[service GET:@"items/2" parameters:nil success:success failure:nil completionQueue:dispatch_get_main_queue()]];
+    id<SECancellableToken> unscoped = [service GET:@"items/3" parameters:nil success:success failure:nil completionQueue:dispatch_get_main_queue()];
+    XCTAssertEqual([[service valueForKey:@"_internalRequestsByKey"] count], 3);
+
+    [scope cancelAll];
+    XCTAssertEqual([[service valueForKey:@"_internalRequestsByKey"] count], 1);
+
+    // requests of a deallocated scope are cancelled too
+    @autoreleasepool
+    {
+        SEDataRequestScope *screenScope = [[SEDataRequestScope alloc] initWithDataRequestService:service];
+        [screenScope track:[service GET:@"items/4" parameters:nil success:success failure:nil completionQueue:dispatch_get_main_queue()]];
+        XCTAssertEqual([[service valueForKey:@"_internalRequestsByKey"] count], 2);
+        screenScope = nil;
+    }
+    XCTAssertEqual([[service valueForKey:@"_internalRequestsByKey"] count], 1);
+
+    [unscoped cancel];
+    XCTAssertEqual([[service valueForKey:@"_internalRequestsByKey"] count], 0);
+}
+
+- (void)testDataRequestServiceCancelsBuiltRequestsByTag
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+
+    SETestLoopbackTransport *transport = [SETestLoopbackTransport new];
+    transport.latency = 0.2;
+    [transport setResponse:[SETestLoopbackResponse responseWithStatusCode:200 JSONObject:@{}] forMethod:@"GET" path:@"/items"];
+
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:transport.sessionConfiguration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    service.prewarmConnectionCount = 0;
+
+    // the request is tagged by the time its token is returned
+    id<SEDataRequestCustomizer> request = [[service createRequestBuilder] GET:@"items" success:^(id data, NSURLResponse *response) {
+        XCTFail(@"Should not complete");
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+    [request setTag:@"screen"];
+    XCTAssertNotNil([request submit]);
+    [service cancelAllWithTag:@"screen"];
+
+    // nothing is left for the untagged request to wait for
+    XCTestExpectation *expectation = [self expectationWithDescription:@"untagged"];
+    [service GET:@"items" parameters:nil success:^(id data, NSURLResponse *response) {
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+}
+
+- (void)testDataRequestServiceCancelsDeliveriesOfScope
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+
+    SETestLoopbackTransport *transport = [SETestLoopbackTransport new];
+    transport.latency = 0.2;
+    NSDictionary *headers = @{ @"Content-Type": @"application/json", @"Cache-Control": @"max-age=60" };
+    [transport setResponse:[SETestLoopbackResponse responseWithStatusCode:200 headers:headers body:[@"{}" dataUsingEncoding:NSUTF8StringEncoding]] forMethod:nil path:@"/config.json"];
+    [transport setResponse:[SETestLoopbackResponse responseWithStatusCode:200 JSONObject:@[ @1, @2 ]] forMethod:@"GET" path:@"/items"];
+    [transport setResponse:[SETestLoopbackResponse responseWithStatusCode:200 JSONObject:@{ @"name": @"Sue" }] forMethod:@"GET" path:@"/profile"];
+
+    NSURL *directoryURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[NSUUID UUID].UUIDString isDirectory:YES];
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:transport.sessionConfiguration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    service.prewarmConnectionCount = 0;
+    service.contentCache = [[SEDataRequestContentCache alloc] initWithDirectoryURL:directoryURL memoryCapacity:64 * 1024 diskCapacity:1024 * 1024];
+    void (^success)(id, NSURLResponse *) = ^(id data, NSURLResponse *response) {
+        XCTFail(@"Should not complete");
+    };
+
+    NSURL *url = [NSURL URLWithString:@"https://cdn.awesomehost.com/config.json"];
+    XCTestExpectation *expectation = [self expectationWithDescription:@"config"];
+    [service URLGET:url parameters:nil success:^(id data, NSURLResponse *response) {
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    // a result delivered from the content cache
+    SEDataRequestScope *scope = [[SEDataRequestScope alloc] initWithDataRequestService:service];
+    [scope track:[service URLGET:url parameters:nil success:success failure:nil completionQueue:dispatch_get_main_queue()]];
+    XCTAssertEqual(service.contentCache.hitCount, 1);
+
+    // a result delivered from a prefetch in flight
+    [service prefetch:@"items" parameters:nil];
+    [scope track:[service GET:@"items" parameters:nil success:success failure:nil completionQueue:dispatch_get_main_queue()]];
+
+    // a prefetch itself
+    [scope track:[service prefetch:@"profile" parameters:nil]];
+
+    [scope cancelAll];
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
+
+    // the cancelled prefetch is not there to be claimed
+    NSUInteger requestCount = transport.requestCount;
+    expectation = [self expectationWithDescription:@"profile"];
+    [service GET:@"profile" parameters:nil success:^(id data, NSURLResponse *response) {
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    XCTAssertEqual(transport.requestCount, requestCount + 1);
+
+    [[NSFileManager defaultManager] removeItemAtURL:directoryURL error:nil];
+}
+
+- (void)testDataRequestServiceFailsRequestsPastDeadline
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[ [SEStallingURLProtocol class] ];
+
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:configuration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    service.prewarmConnectionCount = 0;
+
+    XCTestExpectation *expectation = [self expectationWithDescription:@"request past deadline"];
+    id<SEDataRequestCustomizer> customizer = [[service createRequestBuilder] POST:@"items" success:^(id data, NSURLResponse *response) {
+        XCTFail(@"Should not complete");
+    } failure:^(NSError *error) {
+        XCTAssertEqual(error.code, SEDataRequestServiceDeadlineExceeded);
+        [expectation fulfill];
+    } completionQueue:dispatch_get_main_queue()];
+    [customizer setDeadline:[NSDate dateWithTimeIntervalSinceNow:0.2]];
+    XCTAssertNotNil([customizer submit]);
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    XCTAssertEqual([[service valueForKey:@"_internalRequestsByKey"] count], 0);
+
+    // late requests are not sent at all
+    expectation = [self expectationWithDescription:@"late request"];
+    customizer = [[service createRequestBuilder] POST:@"items" success:^(id data, NSURLResponse *response) {
+        XCTFail(@"Should not complete");
+    } failure:^(NSError *error) {
+        XCTAssertEqual(error.code, SEDataRequestServiceDeadlineExceeded);
+        [expectation fulfill];
+    } completionQueue:dispatch_get_main_queue()];
+    [customizer setDeadline:[NSDate dateWithTimeIntervalSinceNow:-1.0]];
+    XCTAssertNil([customizer submit]);
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+}
+
+- (void)testDataRequestServiceAppliesDefaultTimeBudget
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[ [SERecordingURLProtocol class] ];
+    SERecordedURLRequests = [NSMutableArray new];
+
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:configuration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    service.prewarmConnectionCount = 0;
+    [service setDefaultTimeBudget:5.0 forQualityOfService:SEDataRequestQOSDefault];
+    XCTAssertEqual([service defaultTimeBudgetForQualityOfService:SEDataRequestQOSDefault], 5.0);
+    XCTAssertEqual([service defaultTimeBudgetForQualityOfService:SEDataRequestQOSPriorityLow], 0);
+
+    XCTestExpectation *expectation = [self expectationWithDescription:@"request with default budget"];
+    [service GET:@"items" parameters:nil success:^(id data, NSURLResponse *response) {
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    NSURLRequest *request = SERecordedURLRequests.firstObject;
+    NSInteger remaining = [[request valueForHTTPHeaderField:SEDataRequestServiceDeadlineHeader] integerValue];
+    XCTAssertGreaterThan(remaining, 0);
+    XCTAssertLessThanOrEqual(remaining, 5000);
+    XCTAssertLessThanOrEqual(request.timeoutInterval, 5.0);
+
+    // other hosts are not told about the deadline, it is only enforced locally
+    expectation = [self expectationWithDescription:@"request to another host"];
+    [service URLGET:[NSURL URLWithString:@"https://cdn.otherhost.com/items"] parameters:nil success:^(id data, NSURLResponse *response) {
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    request = SERecordedURLRequests.lastObject;
+    XCTAssertEqualObjects(request.URL.host, @"cdn.otherhost.com");
+    XCTAssertNil([request valueForHTTPHeaderField:SEDataRequestServiceDeadlineHeader]);
+    XCTAssertLessThanOrEqual(request.timeoutInterval, 5.0);
+}
+
+- (void)testDataRequestServiceKeepsResponsesWithinMemoryBudget
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+
+    SETestLoopbackTransport *transport = [SETestLoopbackTransport new];
+    NSMutableArray *items = [NSMutableArray new];
+    for (NSUInteger i = 0; i < 2000; ++i) [items addObject:@{ @"id": @(i), @"name": @"item" }];
+    SETestLoopbackResponse *itemsResponse = [SETestLoopbackResponse responseWithStatusCode:200 JSONObject:items];
+    [transport setResponse:itemsResponse forMethod:nil path:@"/items"];
+    // bodies arrive in several pieces, so both requests buffer data at the same time
+    transport.bytesPerSecond = 256 * 1024;
+
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:transport.sessionConfiguration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    service.prewarmConnectionCount = 0;
+    service.responseMemoryBudget = 20 * 1024;
+
+    for (NSNumber *qos in @[ @(SEDataRequestQOSPriorityLow), @(SEDataRequestQOSPriorityHigh) ])
+    {
+        XCTestExpectation *expectation = [self expectationWithDescription:@"large response"];
+        id<SEDataRequestCustomizer> customizer = [[service createRequestBuilder] POST:@"items" success:^(id data, NSURLResponse *response) {
+            XCTAssertEqual([data count], 2000);
+            [expectation fulfill];
+        } failure:^(NSError *error) {
+            XCTFail(@"Should not fail");
+        } completionQueue:dispatch_get_main_queue()];
+        [customizer setQualityOfService:qos.integerValue];
+        [customizer submit];
+    }
+    [self waitForExpectationsWithTimeout:10.0 handler:nil];
+
+    // suspended requests are resumed and complete, memory is released with them
+    XCTAssertEqual(service.bufferedResponseLength, 0);
+    XCTAssertGreaterThanOrEqual(service.bufferedResponseLengthHighWaterMark, (int64_t)itemsResponse.body.length);
+    [service resetBufferedResponseLengthHighWaterMark];
+    XCTAssertEqual(service.bufferedResponseLengthHighWaterMark, 0);
+}
+
+- (void)testDataRequestServiceAdmitsRequestsInPlaceOfSuspendedOnes
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+
+    SETestLoopbackTransport *transport = [SETestLoopbackTransport new];
+    NSMutableArray *items = [NSMutableArray new];
+    for (NSUInteger i = 0; i < 2000; ++i) [items addObject:@{ @"id": @(i), @"name": @"item" }];
+    [transport setResponse:[SETestLoopbackResponse responseWithStatusCode:200 JSONObject:items] forMethod:nil path:@"/items"];
+    [transport setResponse:[SETestLoopbackResponse responseWithStatusCode:200 JSONObject:@{}] forMethod:nil path:@"/ping"];
+    transport.bytesPerSecond = 32 * 1024;
+
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:transport.sessionConfiguration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    service.prewarmConnectionCount = 0;
+    service.linkPolicy = [SETwoRequestLinkPolicy new];
+    service.responseMemoryBudget = 8 * 1024;
+
+    NSMutableArray<NSString *> *completions = [NSMutableArray new];
+    for (NSNumber *qos in @[ @(SEDataRequestQOSPriorityLow), @(SEDataRequestQOSPriorityNormal) ])
+    {
+        XCTestExpectation *expectation = [self expectationWithDescription:@"large response"];
+        id<SEDataRequestCustomizer> customizer = [[service createRequestBuilder] GET:@"items" success:^(id data, NSURLResponse *response) {
+            [completions addObject:@"items"];
+            [expectation fulfill];
+        } failure:^(NSError *error) {
+            XCTFail(@"Should not fail");
+        } completionQueue:dispatch_get_main_queue()];
+        [customizer setQualityOfService:qos.integerValue];
+        [customizer submit];
+    }
+
+    // both slots are taken until the less urgent request is suspended for memory
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:5.0];
+    while (service.bufferedResponseLength <= service.responseMemoryBudget && timeout.timeIntervalSinceNow > 0)
+    {
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+
+    XCTestExpectation *expectation = [self expectationWithDescription:@"small response"];
+    id<SEDataRequestCustomizer> customizer = [[service createRequestBuilder] GET:@"ping" success:^(id data, NSURLResponse *response) {
+        [completions addObject:@"ping"];
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+    [customizer setQualityOfService:SEDataRequestQOSPriorityHigh];
+    [customizer submit];
+    [self waitForExpectationsWithTimeout:10.0 handler:nil];
+
+    XCTAssertEqualObjects(completions, (@[ @"ping", @"items", @"items" ]));
+    XCTAssertEqual(service.bufferedResponseLength, 0);
+}
+
+- (void)testDataRequestServiceServesUnsafeRequestsFromContentCache
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+
+    SETestLoopbackTransport *transport = [SETestLoopbackTransport new];
+    NSData *image = [@"not really an image" dataUsingEncoding:NSUTF8StringEncoding];
+    NSDictionary *headers = @{ @"Content-Type": @"image/png", @"Cache-Control": @"max-age=60" };
+    [transport setResponse:[SETestLoopbackResponse responseWithStatusCode:200 headers:headers body:image] forMethod:nil path:@"/avatar.png"];
+
+    NSURL *directoryURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[NSUUID UUID].UUIDString isDirectory:YES];
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:transport.sessionConfiguration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    service.prewarmConnectionCount = 0;
+    service.contentCache = [[SEDataRequestContentCache alloc] initWithDirectoryURL:directoryURL memoryCapacity:64 * 1024 diskCapacity:1024 * 1024];
+
+    NSURL *url = [NSURL URLWithString:@"https://cdn.awesomehost.com/avatar.png"];
+    for (NSUInteger i = 0; i < 2; ++i)
+    {
+        XCTestExpectation *expectation = [self expectationWithDescription:@"avatar"];
+        [service URLGET:url parameters:nil success:^(id data, NSURLResponse *response) {
+            XCTAssertEqualObjects(data, image);
+            XCTAssertEqualObjects(response.MIMEType, @"image/png");
+            [expectation fulfill];
+        } failure:^(NSError *error) {
+            XCTFail(@"Should not fail");
+        } completionQueue:dispatch_get_main_queue()];
+        [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    }
+    XCTAssertEqual(transport.requestCount, 1);
+
+    NSURL *saveAsURL = [directoryURL URLByAppendingPathComponent:@"avatar.png"];
+    XCTestExpectation *expectation = [self expectationWithDescription:@"download"];
+    [service URLDownload:url parameters:nil saveAs:saveAsURL success:^(id data, NSURLResponse *response) {
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } progress:nil completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    XCTAssertEqual(transport.requestCount, 1);
+    XCTAssertEqualObjects([NSData dataWithContentsOfURL:saveAsURL], image);
+    XCTAssertEqual(service.contentCache.hitCount, 2);
+
+    // cancelled deliveries never call back
+    id<SECancellableToken> token = [service URLGET:url parameters:nil success:^(id data, NSURLResponse *response) {
+        XCTFail(@"Should not be called");
+    } failure:nil completionQueue:dispatch_get_main_queue()];
+    [token cancel];
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.2]];
+
+    [[NSFileManager defaultManager] removeItemAtURL:directoryURL error:nil];
+}
+
+- (void)testDataRequestServicePrefetchIsClaimedByRequests
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+
+    SETestLoopbackTransport *transport = [SETestLoopbackTransport new];
+    transport.latency = 0.2;
+    [transport setResponse:[SETestLoopbackResponse responseWithStatusCode:200 JSONObject:@[ @1, @2 ]] forMethod:@"GET" path:@"/items"];
+    [transport setResponse:[SETestLoopbackResponse responseWithStatusCode:200 JSONObject:@{ @"name": @"Sue" }] forMethod:@"GET" path:@"/profile"];
+
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:transport.sessionConfiguration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    service.prewarmConnectionCount = 0;
+
+    // a request for a prefetch in flight attaches to it
+    id<SECancellableToken> token = [service prefetch:@"items" parameters:nil];
+    XCTAssertNotNil(token);
+    XCTAssertEqual([service prefetch:@"items" parameters:nil], token);
+    XCTestExpectation *expectation = [self expectationWithDescription:@"items"];
+    [service GET:@"items" parameters:nil success:^(id data, NSURLResponse *response) {
+        XCTAssertEqualObjects(data, (@[ @1, @2 ]));
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    XCTAssertEqual(transport.requestCount, 1);
+
+    // a completed prefetch is delivered once
+    [service prefetch:@"profile" parameters:nil];
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
+    XCTAssertEqual(transport.requestCount, 2);
+    expectation = [self expectationWithDescription:@"profile"];
+    [service GET:@"profile" parameters:nil success:^(id data, NSURLResponse *response) {
+        XCTAssertEqualObjects(data[@"name"], @"Sue");
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    XCTAssertEqual(transport.requestCount, 2);
+
+    // a link that affords no prefetches cancels those in flight and ignores new ones
+    [service prefetch:@"items" parameters:nil];
+    service.linkPolicy = [SESingleRequestLinkPolicy new];
+    XCTAssertNil([service prefetch:@"profile" parameters:nil]);
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
+    NSUInteger requestCount = transport.requestCount;
+    expectation = [self expectationWithDescription:@"items again"];
+    [service GET:@"items" parameters:nil success:^(id data, NSURLResponse *response) {
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    XCTAssertEqual(transport.requestCount, requestCount + 1);
+}
+
+- (void)testDataRequestServicePrefetchIsNotDeliveredAfterAuthorizationChanges
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+
+    SETestLoopbackTransport *transport = [SETestLoopbackTransport new];
+    transport.latency = 0.2;
+    NSMutableArray<NSString *> *sentAuthorizationHeaders = [NSMutableArray new];
+    [transport setHandler:^SETestLoopbackResponse *(NSURLRequest *request) {
+        @synchronized (sentAuthorizationHeaders)
+        {
+            [sentAuthorizationHeaders addObject:[request valueForHTTPHeaderField:@"Authorization"] ?: @""];
+        }
+        return [SETestLoopbackResponse responseWithStatusCode:200 JSONObject:@{ @"name": @"Sue" }];
+    } forMethod:@"GET" path:@"/profile"];
+
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:transport.sessionConfiguration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    service.prewarmConnectionCount = 0;
+
+    // a completed prefetch of the previous user is dropped
+    [service setAuthorizationHeader:@"Bearer sue"];
+    [service prefetch:@"profile" parameters:nil];
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
+    XCTAssertEqual(transport.requestCount, 1);
+
+    [service setAuthorizationHeader:@"Bearer bob"];
+    XCTestExpectation *expectation = [self expectationWithDescription:@"profile"];
+    [service GET:@"profile" parameters:nil success:^(id data, NSURLResponse *response) {
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    XCTAssertEqual(transport.requestCount, 2);
+
+    // a prefetch in flight, kept by a request of the previous user, is not attached to by the new one
+    [service prefetch:@"profile" parameters:nil];
+    XCTestExpectation *previousExpectation = [self expectationWithDescription:@"previous user"];
+    [service GET:@"profile" parameters:nil success:^(id data, NSURLResponse *response) {
+        [previousExpectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+    [service clearAuthorization];
+    expectation = [self expectationWithDescription:@"signed out"];
+    [service GET:@"profile" parameters:nil success:^(id data, NSURLResponse *response) {
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    XCTAssertEqual(transport.requestCount, 4);
+    XCTAssertEqualObjects([sentAuthorizationHeaders subarrayWithRange:NSMakeRange(0, 2)], (@[ @"Bearer sue", @"Bearer bob" ]));
+    XCTAssertEqualObjects([NSSet setWithArray:[sentAuthorizationHeaders subarrayWithRange:NSMakeRange(2, 2)]], ([NSSet setWithObjects:@"Bearer bob", @"", nil]));
+}
+
+- (void)testDataRequestServiceAdmitsRestoredOutboxRecords
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+
+    // records left by a previous run
+    NSURL *journalURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    SEDataRequestOutbox *outbox = [[SEDataRequestOutbox alloc] initWithJournalURL:journalURL];
+    for (NSString *path in @[ @"first", @"second" ])
+    {
+        NSMutableURLRequest *request = [[NSMutableURLRequest alloc] initWithURL:[NSURL URLWithString:[@"https://www.awesomehost.com/" stringByAppendingString:path]]];
+        request.HTTPMethod = @"POST";
+        [outbox appendRequest:request authorized:NO error:nil];
+    }
+    outbox = [[SEDataRequestOutbox alloc] initWithJournalURL:journalURL];
+
+    SETestLoopbackTransport *transport = [SETestLoopbackTransport new];
+    transport.latency = 0.3;
+    NSMutableArray<NSNumber *> *arrivals = [NSMutableArray new];
+    transport.defaultHandler = ^SETestLoopbackResponse *(NSURLRequest *request) {
+        @synchronized (arrivals)
+        {
+            [arrivals addObject:@([NSProcessInfo processInfo].systemUptime)];
+        }
+        return [SETestLoopbackResponse responseWithStatusCode:204 headers:nil body:nil];
+    };
+
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:transport.sessionConfiguration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    service.prewarmConnectionCount = 0;
+    SEFakeReachabilitySource *reachabilitySource = [SEFakeReachabilitySource new];
+    reachabilitySource.reachability = SENetworkReachabilityStatusReachableViaWiFi;
+    service.reachabilitySource = reachabilitySource;
+    service.linkPolicy = [SESingleRequestLinkPolicy new];
+
+    // the outbox would send both at once, the link only affords one at a time
+    service.outbox = outbox;
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:1.0]];
+
+    XCTAssertEqual(arrivals.count, 2);
+    XCTAssertGreaterThan(arrivals[1].doubleValue - arrivals[0].doubleValue, 0.2);
+    XCTAssertEqual(outbox.count, 0);
+
+    [[NSFileManager defaultManager] removeItemAtURL:journalURL error:nil];
+}
+
+- (void)testDataRequestServicePrefetchIsNotSharedAcrossDelegateSessions
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+
+    SETestLoopbackTransport *transport = [SETestLoopbackTransport new];
+    transport.latency = 0.2;
+    [transport setResponse:[SETestLoopbackResponse responseWithStatusCode:200 JSONObject:@{ @"name": @"Sue" }] forMethod:@"GET" path:@"/profile"];
+
+    SESessionHeaderDelegate *delegate = [SESessionHeaderDelegate new];
+    delegate.session = @"sue";
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:transport.sessionConfiguration qualityOfService:SEDataRequestQOSDefault pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO serializers:nil requestPreparationDelegate:delegate];
+    service.prewarmConnectionCount = 0;
+
+    // the session header of the delegate identifies the user as much as the authorization does
+    [service prefetch:@"profile" parameters:nil];
+    delegate.session = @"bob";
+    XCTestExpectation *expectation = [self expectationWithDescription:@"profile"];
+    [service GET:@"profile" parameters:nil success:^(id data, NSURLResponse *response) {
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    XCTAssertEqual(transport.requestCount, 2);
+}
+
+- (void)testDataRequestServiceStreamsResponseRecords
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+
+    SETestLoopbackTransport *transport = [SETestLoopbackTransport new];
+    NSData *export = [@"{\"id\":1}\r\n{\"id\":2}\n\n{\"id\":3}" dataUsingEncoding:NSUTF8StringEncoding];
+    __block NSString *acceptHeader = nil;
+    [transport setHandler:^SETestLoopbackResponse *(NSURLRequest *request) {
+        acceptHeader = [request valueForHTTPHeaderField:@"Accept"];
+        return [SETestLoopbackResponse responseWithStatusCode:200 headers:@{ @"Content-Type": @"application/x-ndjson" } body:export];
+    } forMethod:@"GET" path:@"/export"];
+    NSData *events = [@": keep-alive\nevent: update\nid: 7\ndata: {\"id\":1}\n\nretry: 1500\ndata: a\ndata: b\n\ndata: incomplete" dataUsingEncoding:NSUTF8StringEncoding];
+    [transport setResponse:[SETestLoopbackResponse responseWithStatusCode:200 headers:@{ @"Content-Type": @"text/event-stream" } body:events] forMethod:@"GET" path:@"/events"];
+    NSData *malformed = [@"{\"id\":1}\n{\"id\":\n" dataUsingEncoding:NSUTF8StringEncoding];
+    [transport setResponse:[SETestLoopbackResponse responseWithStatusCode:200 headers:@{ @"Content-Type": @"application/x-ndjson" } body:malformed] forMethod:@"GET" path:@"/malformed"];
+
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:transport.sessionConfiguration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    service.prewarmConnectionCount = 0;
+
+    // NDJSON records, including the last one without a line feed, come before the success with no data
+    NSMutableArray *records = [NSMutableArray new];
+    XCTestExpectation *expectation = [self expectationWithDescription:@"export"];
+    id<SEDataRequestCustomizer> request = [[service createRequestBuilder] GET:@"export" success:^(id data, NSURLResponse *response) {
+        XCTAssertNil(data);
+        XCTAssertEqualObjects(records, (@[ @{ @"id": @1 }, @{ @"id": @2 }, @{ @"id": @3 } ]));
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+    [request setStreamFormat:SEDataRequestStreamFormatNDJSON recordHandler:^(NSArray *batch) {
+        [records addObjectsFromArray:batch];
+    }];
+    [request submit];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    XCTAssertEqualObjects(acceptHeader, @"application/x-ndjson");
+
+    // events are dispatched at empty lines, comments and incomplete events are dropped
+    NSMutableArray<SEDataRequestServerSentEvent *> *serverEvents = [NSMutableArray new];
+    expectation = [self expectationWithDescription:@"events"];
+    request = [[service createRequestBuilder] GET:@"events" success:^(id data, NSURLResponse *response) {
+        XCTAssertEqual(serverEvents.count, 2);
+        XCTAssertEqualObjects(serverEvents[0].eventType, @"update");
+        XCTAssertEqualObjects(serverEvents[0].identifier, @"7");
+        XCTAssertEqualObjects(serverEvents[0].data, @"{\"id\":1}");
+        XCTAssertEqualObjects(serverEvents[1].eventType, @"message");
+        XCTAssertEqualObjects(serverEvents[1].identifier, @"7");
+        XCTAssertEqualObjects(serverEvents[1].data, @"a\nb");
+        XCTAssertEqual(serverEvents[1].retryInterval, 1.5);
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+    [request setStreamFormat:SEDataRequestStreamFormatServerSentEvents recordHandler:^(NSArray *batch) {
+        [serverEvents addObjectsFromArray:batch];
+    }];
+    [request submit];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    // a malformed record fails the request
+    expectation = [self expectationWithDescription:@"malformed"];
+    request = [[service createRequestBuilder] GET:@"malformed" success:^(id data, NSURLResponse *response) {
+        XCTFail(@"Should not succeed");
+    } failure:^(NSError *error) {
+        XCTAssertEqualObjects(error.domain, SEErrorDomain);
+        XCTAssertEqual(error.code, SEDataRequestServiceSerializationFailure);
+        [expectation fulfill];
+    } completionQueue:dispatch_get_main_queue()];
+    [request setStreamFormat:SEDataRequestStreamFormatNDJSON recordHandler:^(NSArray *batch) {
+    }];
+    [request submit];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+}
+
+- (void)testDataRequestServiceStreamsJSONBody
+{
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+
+    SETestLoopbackTransport *transport = [SETestLoopbackTransport new];
+    __block NSData *body = nil;
+    __block NSString *contentType = nil;
+    [transport setHandler:^SETestLoopbackResponse *(NSURLRequest *request) {
+        body = request.HTTPBody;
+        contentType = [request valueForHTTPHeaderField:@"Content-Type"];
+        return [SETestLoopbackResponse responseWithStatusCode:200 headers:@{ @"Content-Type": @"application/json" } body:[@"{}" dataUsingEncoding:NSUTF8StringEncoding]];
+    } forMethod:@"POST" path:@"/import"];
+
+    SEDataRequestServiceImpl *service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:transport.sessionConfiguration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    service.prewarmConnectionCount = 0;
+
+    // records are enumerated into a JSON array as the body is sent
+    NSArray *records = @[ @{ @"id": @1, @"path": @"a/b" }, @{ @"id": @2, @"path": @"c" } ];
+    XCTestExpectation *expectation = [self expectationWithDescription:@"import"];
+    id<SEDataRequestCustomizer> request = [[service createRequestBuilder] POST:@"import" success:^(id data, NSURLResponse *response) {
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+    [request setStreamedBodyRecords:^NSEnumerator *{
+        return records.objectEnumerator;
+    }];
+    [request submit];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    XCTAssertEqualObjects(body, [NSJSONSerialization dataWithJSONObject:records options:0 error:nil]);
+    XCTAssertTrue([contentType hasPrefix:@"application/json"]);
+
+    // streamed bodies do not mix with others
+    request = [[service createRequestBuilder] POST:@"import" success:^(id data, NSURLResponse *response) {
+    } failure:nil completionQueue:nil];
+    [request setStreamedBodyJSONObject:@{ @"id": @1 }];
+    XCTAssertThrows([request setBodyParameters:@{ @"id": @2 }]);
+    XCTAssertThrows([request setContentEncoding:@"application/x-www-form-urlencoded"]);
+    request = [[service createRequestBuilder] GET:@"import" success:^(id data, NSURLResponse *response) {
+    } failure:nil completionQueue:nil];
+    XCTAssertThrows([request setStreamedBodyJSONObject:@{ @"id": @1 }]);
+}
 
 @end
@@ -0,0 +1,101 @@
+//
+//  SEJSONStreamWriterTests.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <Foundation/Foundation.h>
+#import <XCTest/XCTest.h>
+
+#import "SEJSONStreamWriter.h"
+#import "SEDataRequestService.h"
+
+@interface SEJSONStreamWriterTests : XCTestCase
+
+@end
+
+@implementation SEJSONStreamWriterTests
+
+- (NSData *)readStream:(NSInputStream *)stream
+{
+    NSMutableData *data = [NSMutableData new];
+    uint8_t buffer[4096];
+    [stream open];
+    NSInteger length;
+    while ((length = [stream read:buffer maxLength:sizeof(buffer)]) > 0)
+    {
+        [data appendBytes:buffer length:length];
+    }
+    [stream close];
+    return data;
+}
+
+- (void)testEncodingMatchesJSONSerialization
+{
+    NSDictionary *object = @{ @"string": @"quote \" backslash \\ slash / tab \t line\n bell \a",
+                              @"unicode": @"příliš žluťoučký 🐎",
+                              @"numbers": @[ @0, @-42, @(UINT64_MAX), @(INT64_MIN), @1.5, @0.1, @1e100 ],
+                              @"flags": @[ @YES, @NO ],
+                              @"null": [NSNull null],
+                              @"nested": @{ @"empty": @{}, @"list": @[ @[], @{ @"a": @"b" } ] } };
+    NSError *error = nil;
+    NSData *data = [SEJSONStreamWriter dataWithJSONObject:object error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqualObjects(data, [NSJSONSerialization dataWithJSONObject:object options:0 error:nil]);
+}
+
+- (void)testInvalidObjectFails
+{
+    NSError *error = nil;
+    XCTAssertNil([SEJSONStreamWriter dataWithJSONObject:@{ @"url": [NSURL URLWithString:@"http://a.b/c"] } error:&error]);
+    XCTAssertEqualObjects(error.domain, SEErrorDomain);
+
+    error = nil;
+    XCTAssertNil([SEJSONStreamWriter dataWithJSONObject:@[ @(NAN) ] error:&error]);
+    XCTAssertNotNil(error);
+}
+
+- (void)testStreamsLargeObject
+{
+    // several times the buffer of the stream, so that the writer has to wait for the reader
+    NSMutableArray *items = [NSMutableArray new];
+    for (NSUInteger i = 0; i < 20000; ++i)
+    {
+        [items addObject:@{ @"index": @(i), @"name": [NSString stringWithFormat:@"item/%lu", (unsigned long)i] }];
+    }
+    NSDictionary *object = @{ @"items": items };
+
+    NSData *data = [self readStream:[SEJSONStreamWriter inputStreamWithJSONObject:object failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    }]];
+    XCTAssertEqualObjects(data, [NSJSONSerialization dataWithJSONObject:object options:0 error:nil]);
+}
+
+- (void)testStreamsRecords
+{
+    NSArray *records = @[ @{ @"id": @1 }, @"two", @3 ];
+    NSData *data = [self readStream:[SEJSONStreamWriter inputStreamWithRecords:records.objectEnumerator failure:nil]];
+    XCTAssertEqualObjects([[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding], @"[{\"id\":1},\"two\",3]");
+
+    data = [self readStream:[SEJSONStreamWriter inputStreamWithRecords:@[].objectEnumerator failure:nil]];
+    XCTAssertEqualObjects([[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding], @"[]");
+}
+
+- (void)testInvalidRecordIsReportedToFailure
+{
+    XCTestExpectation *expectation = [self expectationWithDescription:@"failure"];
+    NSArray *records = @[ @{ @"id": @1 }, [NSDate date] ];
+    NSInputStream *stream = [SEJSONStreamWriter inputStreamWithRecords:records.objectEnumerator failure:^(NSError *error) {
+        XCTAssertEqualObjects(error.domain, SEErrorDomain);
+        XCTAssertEqual(error.code, SEDataRequestServiceSerializationFailure);
+        [expectation fulfill];
+    }];
+    [self readStream:stream];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+}
+
+@end
@@ -0,0 +1,143 @@
+//
+//  SEServerTrustCacheTests.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <XCTest/XCTest.h>
+#import "SEServerTrustCache.h"
+
+// Self-signed certificates, only used as trust chain content
+static NSString *const SETestCertificateA = @"MIIBpTCCAUugAwIBAgIUH8usDEjx8NjCMpXBA/31hUfMApYwCgYIKoZIzj0EAwIwKDEmMCQGA1UEAwwddGVzdC1hLnNlcnZpY2UtZXNzZW50aWFscy5jb20wHhcNMjYxMDE4MTEyMTQxWhcNMzYxMDE1MTEyMTQxWjAoMSYwJAYDVQQDDB10ZXN0LWEuc2VydmljZS1lc3NlbnRpYWxzLmNvbTBZMBMGByqGSM49AgEGCCqGSM49AwEHA0IABGboHTUB9qQx2d5bPVV0ELiuRIcwxYraeTHxiI/2lZNJTNoFB2eTlEatrctoQKh4WHRbE7L4EfHVgYe6bkbbhMqjUzBRMB0GA1UdDgQWBBSSCKuu1bgHn+BacODgoT2pjVKXYDAfBgNVHSMEGDAWgBSSCKuu1bgHn+BacODgoT2pjVKXYDAPBgNVHRMBAf8EBTADAQH/MAoGCCqGSM49BAMCA0gAMEUCIQCptSEH83BYFPTlfu/bU8GE2x4jT/SPzfwR1NbjyvdMiQIgLFUybQCMlm2BOuLmg1oHRTzo6fPM4H5ioE3VjuMf980=";
+static NSString *const SETestCertificateB = @"MIIBpTCCAUugAwIBAgIUczDNKfFilF4krldVdb7a8xJOFr4wCgYIKoZIzj0EAwIwKDEmMCQGA1UEAwwddGVzdC1iLnNlcnZpY2UtZXNzZW50aWFscy5jb20wHhcNMjYxMDE4MTEyMTQxWhcNMzYxMDE1MTEyMTQxWjAoMSYwJAYDVQQDDB10ZXN0LWIuc2VydmljZS1lc3NlbnRpYWxzLmNvbTBZMBMGByqGSM49AgEGCCqGSM49AwEHA0IABKSffk9ovjfGFGgfvD5dSdLmgkauva5Ae7MtKdeq59Iivw+qDHBfsJtsKqGzF52mM9NSPpS0xl8gSJ9gfQ9bkW6jUzBRMB0GA1UdDgQWBBRdkQiqOjhQ1LwDuB6U9DveiueBDDAfBgNVHSMEGDAWgBRdkQiqOjhQ1LwDuB6U9DveiueBDDAPBgNVHRMBAf8EBTADAQH/MAoGCCqGSM49BAMCA0gAMEUCIDFxEZdsIsARJo/x1cjWxa4iNFFDt5cX2vccVM3IfEj/AiEAit26QWZRa5MrimVFZtAje3S7+6aFvRI4umlW/LQbXpg=";
+
+static SecTrustRef SECreateTestTrust(NSString *base64Certificate)
+{
+    NSData *data = [[NSData alloc] initWithBase64EncodedString:base64Certificate options:0];
+    SecCertificateRef certificate = SecCertificateCreateWithData(NULL, (__bridge CFDataRef)data);
+    SecPolicyRef policy = SecPolicyCreateBasicX509();
+    SecTrustRef trust = NULL;
+    SecTrustCreateWithCertificates(certificate, policy, &trust);
+    CFRelease(policy);
+    CFRelease(certificate);
+    return trust;
+}
+
+@interface SEFakeServerTrustEvaluator : NSObject<SEServerTrustEvaluator>
+@property (nonatomic, assign) BOOL result;
+@property (nonatomic, assign) NSUInteger evaluationCount;
+@end
+
+@implementation SEFakeServerTrustEvaluator
+- (BOOL)evaluateServerTrust:(SecTrustRef)serverTrust pinningType:(SEDataRequestCertificatePinningType)pinningType error:(NSError *__autoreleasing  _Nullable *)error
+{
+    _evaluationCount++;
+    if (!_result && error != nil) *error = [NSError errorWithDomain:SEErrorDomain code:SEDataRequestServiceTrustFailure userInfo:nil];
+    return _result;
+}
+@end
+
+@interface SEServerTrustCacheTests : XCTestCase
+@end
+
+@implementation SEServerTrustCacheTests
+{
+    SEFakeServerTrustEvaluator *_evaluator;
+    SecTrustRef _trustA;
+    SecTrustRef _trustB;
+}
+
+- (void)setUp
+{
+    [super setUp];
+    _evaluator = [SEFakeServerTrustEvaluator new];
+    _evaluator.result = YES;
+    _trustA = SECreateTestTrust(SETestCertificateA);
+    _trustB = SECreateTestTrust(SETestCertificateB);
+}
+
+- (void)tearDown
+{
+    CFRelease(_trustA);
+    CFRelease(_trustB);
+    _evaluator = nil;
+    [super tearDown];
+}
+
+- (void)testServerTrustCacheSkipsEvaluationForCachedChain
+{
+    SEServerTrustCache *cache = [[SEServerTrustCache alloc] initWithEvaluator:_evaluator capacity:4 timeToLive:60.0];
+
+    XCTAssertTrue([cache validateServerTrust:_trustA host:@"a.com" pinningType:SEDataRequestCertificatePinningTypeCertificate error:nil]);
+    XCTAssertTrue([cache validateServerTrust:_trustA host:@"a.com" pinningType:SEDataRequestCertificatePinningTypeCertificate error:nil]);
+    XCTAssertEqual(_evaluator.evaluationCount, 1);
+    XCTAssertEqual(cache.count, 1);
+}
+
+- (void)testServerTrustCacheKeysByHostPinningTypeAndCertificate
+{
+    SEServerTrustCache *cache = [[SEServerTrustCache alloc] initWithEvaluator:_evaluator capacity:8 timeToLive:60.0];
+
+    [cache validateServerTrust:_trustA host:@"a.com" pinningType:SEDataRequestCertificatePinningTypeCertificate error:nil];
+    [cache validateServerTrust:_trustA host:@"a.com" pinningType:SEDataRequestCertificatePinningTypePublicKey error:nil];
+    [cache validateServerTrust:_trustA host:@"b.com" pinningType:SEDataRequestCertificatePinningTypeCertificate error:nil];
+    [cache validateServerTrust:_trustB host:@"a.com" pinningType:SEDataRequestCertificatePinningTypeCertificate error:nil];
+
+    XCTAssertEqual(_evaluator.evaluationCount, 4);
+    XCTAssertEqual(cache.count, 4);
+}
+
+- (void)testServerTrustCacheDoesNotCacheFailures
+{
+    SEServerTrustCache *cache = [[SEServerTrustCache alloc] initWithEvaluator:_evaluator capacity:4 timeToLive:60.0];
+    _evaluator.result = NO;
+
+    NSError *error = nil;
+    XCTAssertFalse([cache validateServerTrust:_trustA host:@"a.com" pinningType:SEDataRequestCertificatePinningTypeCertificate error:&error]);
+    XCTAssertNotNil(error);
+    XCTAssertFalse([cache validateServerTrust:_trustA host:@"a.com" pinningType:SEDataRequestCertificatePinningTypeCertificate error:nil]);
+
+    XCTAssertEqual(_evaluator.evaluationCount, 2);
+    XCTAssertEqual(cache.count, 0);
+}
+
+- (void)testServerTrustCacheEvictsOldestEntryWhenFull
+{
+    SEServerTrustCache *cache = [[SEServerTrustCache alloc] initWithEvaluator:_evaluator capacity:1 timeToLive:60.0];
+
+    [cache validateServerTrust:_trustA host:@"a.com" pinningType:SEDataRequestCertificatePinningTypeCertificate error:nil];
+    [cache validateServerTrust:_trustB host:@"a.com" pinningType:SEDataRequestCertificatePinningTypeCertificate error:nil];
+    XCTAssertEqual(cache.count, 1);
+
+    [cache validateServerTrust:_trustA host:@"a.com" pinningType:SEDataRequestCertificatePinningTypeCertificate error:nil];
+    XCTAssertEqual(_evaluator.evaluationCount, 3);
+}
+
+- (void)testServerTrustCacheEntriesExpire
+{
+    SEServerTrustCache *cache = [[SEServerTrustCache alloc] initWithEvaluator:_evaluator capacity:4 timeToLive:0.05];
+
+    [cache validateServerTrust:_trustA host:@"a.com" pinningType:SEDataRequestCertificatePinningTypeCertificate error:nil];
+    [NSThread sleepForTimeInterval:0.1];
+    [cache validateServerTrust:_trustA host:@"a.com" pinningType:SEDataRequestCertificatePinningTypeCertificate error:nil];
+
+    XCTAssertEqual(_evaluator.evaluationCount, 2);
+}
+
+- (void)testServerTrustCacheInvalidateRemovesEntries
+{
+    SEServerTrustCache *cache = [[SEServerTrustCache alloc] initWithEvaluator:_evaluator capacity:4 timeToLive:60.0];
+
+    [cache validateServerTrust:_trustA host:@"a.com" pinningType:SEDataRequestCertificatePinningTypeCertificate error:nil];
+    [cache invalidate];
+    XCTAssertEqual(cache.count, 0);
+
+    [cache validateServerTrust:_trustA host:@"a.com" pinningType:SEDataRequestCertificatePinningTypeCertificate error:nil];
+    XCTAssertEqual(_evaluator.evaluationCount, 2);
+}
+
+@end
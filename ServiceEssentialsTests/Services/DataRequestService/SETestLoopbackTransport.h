@@ -0,0 +1,78 @@
+//
+//  SETestLoopbackTransport.h
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+@import Foundation;
+
+/** Response served by the loopback transport. Immutable. */
+@interface SETestLoopbackResponse : NSObject
+
++ (nonnull instancetype) responseWithStatusCode: (NSInteger) statusCode headers: (nullable NSDictionary<NSString *, NSString *> *) headers body: (nullable NSData *) body;
+/** Response with a JSON body and `Content-Type: application/json` */
++ (nonnull instancetype) responseWithStatusCode: (NSInteger) statusCode JSONObject: (nonnull id) object;
+/** Transport failure, such as `NSURLErrorTimedOut`, delivered instead of a response */
++ (nonnull instancetype) responseWithError: (nonnull NSError *) error;
+
+@property (nonatomic, readonly, assign) NSInteger statusCode;
+@property (nonatomic, readonly, strong, nullable) NSDictionary<NSString *, NSString *> *headers;
+@property (nonatomic, readonly, strong, nullable) NSData *body;
+@property (nonatomic, readonly, strong, nullable) NSError *error;
+
+@end
+
+/**
+ Returns a response for a request, or `nil` to leave the request to the next handler.
+ The request passed to handlers has its body in `HTTPBody`, even when it has been sent as a stream.
+ Handlers are invoked on a private queue of the transport, concurrently for concurrent requests.
+ */
+typedef SETestLoopbackResponse * _Nullable (^SETestLoopbackHandler)(NSURLRequest * _Nonnull request);
+
+/**
+ Test scaffolding that serves canned or generated responses instead of the network,
+ with configurable latency and bandwidth. Nothing leaves the process.
+
+ It is not a transport layer of the data request service: the service always uses its own `NSURLSession`,
+ and the transport is plugged into it as a URL protocol of the `sessionConfiguration` the service is created with.
+ Besides tests, it lets the load generator profile the cost of the service itself (request building, bookkeeping,
+ parsing and callbacks) deterministically: with no latency and no bandwidth limit, responses are served as fast as the URL loading system takes them.
+
+ Responses are looked up by method and path first, then by path for any method, then `defaultHandler` is asked.
+ Requests nobody responds to get an empty HTTP 404.
+ The transport is thread-safe.
+ */
+@interface SETestLoopbackTransport : NSObject
+
+/**
+ Session configuration which requests are served by the transport. Based on the ephemeral configuration.
+ The transport must be kept alive while the configuration is in use, requests fail with `NSURLErrorCannotConnectToHost` afterwards.
+ */
+@property (nonatomic, readonly, strong, nonnull) NSURLSessionConfiguration *sessionConfiguration;
+
+/** Time from a request to its response. Defaults to 0. */
+@property (atomic, assign) NSTimeInterval latency;
+/** Rate at which response bodies are delivered, in bytes per second. 0, the default, means no limit. */
+@property (atomic, assign) double bytesPerSecond;
+/** Handler of requests without a response set for their path */
+@property (atomic, copy, nullable) SETestLoopbackHandler defaultHandler;
+
+/** Number of requests the transport has received */
+@property (atomic, readonly, assign) NSUInteger requestCount;
+
+/**
+ Sets a response for requests with the method and path
+ @param response response served to every such request, `nil` removes the response
+ @param method HTTP method, `nil` for any method
+ @param path URL path, such as `/items`
+ */
+- (void) setResponse: (nullable SETestLoopbackResponse *) response forMethod: (nullable NSString *) method path: (nonnull NSString *) path;
+
+/** Sets a handler that generates responses for requests with the method and path, `nil` removes the handler */
+- (void) setHandler: (nullable SETestLoopbackHandler) handler forMethod: (nullable NSString *) method path: (nonnull NSString *) path;
+
+@end
@@ -0,0 +1,306 @@
+//
+//  SETestLoopbackTransport.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import "SETestLoopbackTransport.h"
+
+#include <pthread.h>
+#include <libkern/OSAtomic.h>
+
+#import "SETools.h"
+
+// Size of body pieces when bandwidth is limited
+static NSUInteger const SETestLoopbackChunkLength = 16 * 1024;
+
+// Session header that tells which transport serves a request, it is removed before handlers see the request
+static NSString * const SETestLoopbackTransportHeader = @"X-SE-Loopback-Transport";
+
+// Transport identifier -> transport. Values are weak, so a released transport stops serving its configuration.
+static pthread_mutex_t SETestLoopbackTransportsLock = PTHREAD_MUTEX_INITIALIZER;
+static NSMapTable<NSString *, SETestLoopbackTransport *> *SETestLoopbackTransports = nil;
+
+static inline SETestLoopbackTransport *SETestLoopbackTransportForRequest(NSURLRequest *request)
+{
+    NSString *identifier = [request valueForHTTPHeaderField:SETestLoopbackTransportHeader];
+    if (identifier == nil) return nil;
+
+    SETestLoopbackTransport *transport = nil;
+    pthread_mutex_lock(&SETestLoopbackTransportsLock);
+    transport = [SETestLoopbackTransports objectForKey:identifier];
+    pthread_mutex_unlock(&SETestLoopbackTransportsLock);
+    return transport;
+}
+
+// Handlers see the request as the service has built it, with the body as data regardless of how it has been sent
+static inline NSURLRequest *SETestLoopbackRequestForHandlers(NSURLRequest *request)
+{
+    NSMutableURLRequest *handlerRequest = [request mutableCopy];
+    [handlerRequest setValue:nil forHTTPHeaderField:SETestLoopbackTransportHeader];
+
+    NSInputStream *stream = request.HTTPBodyStream;
+    if (request.HTTPBody != nil || stream == nil) return handlerRequest;
+
+    NSMutableData *body = [NSMutableData new];
+    uint8_t buffer[4096];
+    [stream open];
+    NSInteger length;
+    while ((length = [stream read:buffer maxLength:sizeof(buffer)]) > 0) [body appendBytes:buffer length:(NSUInteger)length];
+    [stream close];
+
+    handlerRequest.HTTPBodyStream = nil;
+    handlerRequest.HTTPBody = body;
+    return handlerRequest;
+}
+
+@implementation SETestLoopbackResponse
+
+- (instancetype)init
+{
+    THROW_NOT_IMPLEMENTED(nil);
+}
+
+- (instancetype)initWithStatusCode:(NSInteger)statusCode headers:(NSDictionary<NSString *, NSString *> *)headers body:(NSData *)body error:(NSError *)error
+{
+    self = [super init];
+    if (self)
+    {
+        _statusCode = statusCode;
+        _headers = [headers copy];
+        _body = [body copy];
+        _error = error;
+    }
+    return self;
+}
+
++ (instancetype)responseWithStatusCode:(NSInteger)statusCode headers:(NSDictionary<NSString *,NSString *> *)headers body:(NSData *)body
+{
+    return [[self alloc] initWithStatusCode:statusCode headers:headers body:body error:nil];
+}
+
++ (instancetype)responseWithStatusCode:(NSInteger)statusCode JSONObject:(id)object
+{
+    NSError *error = nil;
+    NSData *body = [NSJSONSerialization dataWithJSONObject:object options:0 error:&error];
+    if (body == nil) THROW_INVALID_PARAM(object, @{ NSUnderlyingErrorKey: error });
+    return [[self alloc] initWithStatusCode:statusCode headers:@{ @"Content-Type": @"application/json" } body:body error:nil];
+}
+
++ (instancetype)responseWithError:(NSError *)error
+{
+    if (error == nil) THROW_INVALID_PARAM(error, nil);
+    return [[self alloc] initWithStatusCode:0 headers:nil body:nil error:error];
+}
+
+@end
+
+@interface SETestLoopbackTransport ()
+- (SETestLoopbackResponse *) responseForRequest: (NSURLRequest *) request;
+@end
+
+/**
+ Serves requests of all transports. The URL loading system instantiates protocols by class,
+ so a request finds its transport by the identifier its session configuration adds as a header.
+ Client callbacks are delivered on the thread that has started loading, as the URL loading system expects.
+ */
+@interface SETestLoopbackURLProtocol : NSURLProtocol
+@end
+
+@implementation SETestLoopbackURLProtocol
+{
+    volatile uint32_t _stopped;
+    CFRunLoopRef _clientRunLoop;
+    NSString *_clientRunLoopMode;
+}
+
++ (BOOL)canInitWithRequest:(NSURLRequest *)request
+{
+    return [request valueForHTTPHeaderField:SETestLoopbackTransportHeader] != nil;
+}
+
++ (NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request
+{
+    return request;
+}
+
+- (void)dealloc
+{
+    if (_clientRunLoop != NULL) CFRelease(_clientRunLoop);
+}
+
+- (void)startLoading
+{
+    _clientRunLoop = (CFRunLoopRef)CFRetain(CFRunLoopGetCurrent());
+    _clientRunLoopMode = CFBridgingRelease(CFRunLoopCopyCurrentMode(_clientRunLoop)) ?: NSDefaultRunLoopMode;
+
+    SETestLoopbackTransport *transport = SETestLoopbackTransportForRequest(self.request);
+    if (transport == nil)
+    {
+        [self.client URLProtocol:self didFailWithError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCannotConnectToHost userInfo:nil]];
+        return;
+    }
+
+    NSURLRequest *request = SETestLoopbackRequestForHandlers(self.request);
+    double bytesPerSecond = transport.bytesPerSecond;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(transport.latency * NSEC_PER_SEC)), dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        if (_stopped) return;
+        [self deliverResponse:[transport responseForRequest:request] forRequest:request bytesPerSecond:bytesPerSecond];
+    });
+}
+
+- (void)stopLoading
+{
+    OSAtomicTestAndSetBarrier(0, &_stopped);
+}
+
+- (void)deliverResponse:(SETestLoopbackResponse *)response forRequest:(NSURLRequest *)request bytesPerSecond:(double)bytesPerSecond
+{
+    NSError *error = response.error;
+    if (error != nil)
+    {
+        [self performOnClientThread:^{
+            [self.client URLProtocol:self didFailWithError:error];
+        }];
+        return;
+    }
+
+    NSHTTPURLResponse *httpResponse = [[NSHTTPURLResponse alloc] initWithURL:request.URL statusCode:response.statusCode HTTPVersion:@"HTTP/1.1" headerFields:response.headers];
+    [self performOnClientThread:^{
+        [self.client URLProtocol:self didReceiveResponse:httpResponse cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+    }];
+    [self deliverBody:response.body fromOffset:0 bytesPerSecond:bytesPerSecond];
+}
+
+- (void)deliverBody:(NSData *)body fromOffset:(NSUInteger)offset bytesPerSecond:(double)bytesPerSecond
+{
+    if (_stopped) return;
+
+    if (offset >= body.length)
+    {
+        [self performOnClientThread:^{
+            [self.client URLProtocolDidFinishLoading:self];
+        }];
+        return;
+    }
+
+    NSUInteger length = body.length - offset;
+    if (bytesPerSecond > 0) length = MIN(length, SETestLoopbackChunkLength);
+    NSData *data = [body subdataWithRange:NSMakeRange(offset, length)];
+    [self performOnClientThread:^{
+        [self.client URLProtocol:self didLoadData:data];
+    }];
+
+    if (bytesPerSecond <= 0)
+    {
+        [self deliverBody:body fromOffset:offset + length bytesPerSecond:bytesPerSecond];
+        return;
+    }
+
+    // the next piece is due when this one would have been transferred
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(length / bytesPerSecond * NSEC_PER_SEC)), dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        [self deliverBody:body fromOffset:offset + length bytesPerSecond:bytesPerSecond];
+    });
+}
+
+// Blocks are performed in the order they have been scheduled
+- (void)performOnClientThread:(dispatch_block_t)block
+{
+    CFRunLoopPerformBlock(_clientRunLoop, (__bridge CFStringRef)_clientRunLoopMode, ^{
+        if (!_stopped) block();
+    });
+    CFRunLoopWakeUp(_clientRunLoop);
+}
+
+@end
+
+@implementation SETestLoopbackTransport
+{
+    pthread_mutex_t _lock;
+    // "METHOD path" or " path" for any method -> handler
+    NSMutableDictionary<NSString *, SETestLoopbackHandler> *_handlersByRoute;
+    NSUInteger _requestCount;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self)
+    {
+        pthread_mutex_init(&_lock, NULL);
+        _handlersByRoute = [NSMutableDictionary new];
+
+        static volatile int32_t transportCount = 0;
+        NSString *identifier = [NSString stringWithFormat:@"%d", OSAtomicIncrement32(&transportCount)];
+
+        pthread_mutex_lock(&SETestLoopbackTransportsLock);
+        if (SETestLoopbackTransports == nil) SETestLoopbackTransports = [NSMapTable strongToWeakObjectsMapTable];
+        [SETestLoopbackTransports setObject:self forKey:identifier];
+        pthread_mutex_unlock(&SETestLoopbackTransportsLock);
+
+        _sessionConfiguration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+        _sessionConfiguration.protocolClasses = @[ [SETestLoopbackURLProtocol class] ];
+        _sessionConfiguration.HTTPAdditionalHeaders = @{ SETestLoopbackTransportHeader: identifier };
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&_lock);
+}
+
+- (NSUInteger)requestCount
+{
+    NSUInteger requestCount;
+    pthread_mutex_lock(&_lock);
+    requestCount = _requestCount;
+    pthread_mutex_unlock(&_lock);
+    return requestCount;
+}
+
+- (void)setResponse:(SETestLoopbackResponse *)response forMethod:(NSString *)method path:(NSString *)path
+{
+    [self setHandler:(response == nil) ? nil : ^SETestLoopbackResponse *(NSURLRequest *request) {
+        return response;
+    } forMethod:method path:path];
+}
+
+- (void)setHandler:(SETestLoopbackHandler)handler forMethod:(NSString *)method path:(NSString *)path
+{
+    if (path == nil) THROW_INVALID_PARAM(path, nil);
+
+    NSString *route = [NSString stringWithFormat:@"%@ %@", method.uppercaseString ?: @"", path];
+    pthread_mutex_lock(&_lock);
+    if (handler != nil) [_handlersByRoute setObject:[handler copy] forKey:route];
+    else [_handlersByRoute removeObjectForKey:route];
+    pthread_mutex_unlock(&_lock);
+}
+
+- (SETestLoopbackResponse *)responseForRequest:(NSURLRequest *)request
+{
+    NSString *path = (request.URL.path.length > 0) ? request.URL.path : @"/";
+    SETestLoopbackHandler methodHandler, pathHandler;
+    pthread_mutex_lock(&_lock);
+    _requestCount++;
+    methodHandler = [_handlersByRoute objectForKey:[NSString stringWithFormat:@"%@ %@", request.HTTPMethod.uppercaseString, path]];
+    pathHandler = [_handlersByRoute objectForKey:[@" " stringByAppendingString:path]];
+    pthread_mutex_unlock(&_lock);
+
+    // handlers are invoked outside of the lock, they may take their time to generate a response
+    SETestLoopbackResponse *response = nil;
+    if (methodHandler != nil) response = methodHandler(request);
+    if (response == nil && pathHandler != nil) response = pathHandler(request);
+    if (response == nil)
+    {
+        SETestLoopbackHandler defaultHandler = self.defaultHandler;
+        if (defaultHandler != nil) response = defaultHandler(request);
+    }
+    return response ?: [SETestLoopbackResponse responseWithStatusCode:404 headers:nil body:nil];
+}
+
+@end
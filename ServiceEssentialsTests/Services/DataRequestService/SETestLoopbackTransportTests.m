@@ -0,0 +1,140 @@
+//
+//  SETestLoopbackTransportTests.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <XCTest/XCTest.h>
+#import <OCMock/OCMock.h>
+#import "SEDataRequestServiceImpl.h"
+#import "SETestLoopbackTransport.h"
+#import "SEEnvironmentService.h"
+
+@interface SETestLoopbackTransportTests : XCTestCase
+@end
+
+@implementation SETestLoopbackTransportTests
+{
+    SETestLoopbackTransport *_transport;
+    SEDataRequestServiceImpl *_service;
+}
+
+- (void)setUp
+{
+    [super setUp];
+
+    _transport = [SETestLoopbackTransport new];
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+    _service = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:_transport.sessionConfiguration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    _service.prewarmConnectionCount = 0;
+}
+
+- (void)tearDown
+{
+    _service = nil;
+    _transport = nil;
+    [super tearDown];
+}
+
+- (void)testLoopbackTransportServesCannedAndGeneratedResponses
+{
+    [_transport setResponse:[SETestLoopbackResponse responseWithStatusCode:200 JSONObject:@{ @"id": @1 }] forMethod:@"GET" path:@"/items/1"];
+    [_transport setHandler:^SETestLoopbackResponse *(NSURLRequest *request) {
+        id body = [NSJSONSerialization JSONObjectWithData:request.HTTPBody options:0 error:nil];
+        return [SETestLoopbackResponse responseWithStatusCode:201 JSONObject:@{ @"received": body }];
+    } forMethod:nil path:@"/items"];
+
+    XCTestExpectation *canned = [self expectationWithDescription:@"canned response"];
+    [_service GET:@"items/1" parameters:nil success:^(id data, NSURLResponse *response) {
+        XCTAssertEqualObjects(data, @{ @"id": @1 });
+        [canned fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+
+    XCTestExpectation *generated = [self expectationWithDescription:@"generated response"];
+    [_service POST:@"items" parameters:@{ @"name": @"item" } contentEncoding:SEDataRequestServiceContentTypeJSON success:^(id data, NSURLResponse *response) {
+        XCTAssertEqualObjects(data, @{ @"received": @{ @"name": @"item" } });
+        [generated fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+
+    XCTestExpectation *missing = [self expectationWithDescription:@"missing response"];
+    [_service GET:@"other" parameters:nil success:^(id data, NSURLResponse *response) {
+        XCTFail(@"Should not succeed");
+    } failure:^(NSError *error) {
+        XCTAssertEqual(error.code, 404);
+        [missing fulfill];
+    } completionQueue:dispatch_get_main_queue()];
+
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    XCTAssertEqual(_transport.requestCount, 3);
+}
+
+- (void)testLoopbackTransportAppliesLatencyAndBandwidth
+{
+    NSString *payload = [@"" stringByPaddingToLength:40 * 1024 withString:@"a" startingAtIndex:0];
+    [_transport setResponse:[SETestLoopbackResponse responseWithStatusCode:200 JSONObject:@{ @"payload": payload }] forMethod:nil path:@"/large"];
+    _transport.latency = 0.2;
+    _transport.bytesPerSecond = 100 * 1024;
+
+    NSDate *start = [NSDate date];
+    XCTestExpectation *expectation = [self expectationWithDescription:@"slow response"];
+    [_service GET:@"large" parameters:nil success:^(id data, NSURLResponse *response) {
+        XCTAssertEqualObjects([data objectForKey:@"payload"], payload);
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    // latency, then about 0.4 seconds to transfer the body
+    XCTAssertGreaterThan(-start.timeIntervalSinceNow, 0.5);
+}
+
+- (void)testLoopbackTransportsServeTheirOwnSessions
+{
+    SETestLoopbackTransport *otherTransport = [SETestLoopbackTransport new];
+    id environmentService = OCMProtocolMock(@protocol(SEEnvironmentService));
+    OCMStub([environmentService environmentBaseURL]).andReturn([NSURL URLWithString:@"https://www.awesomehost.com/"]);
+    SEDataRequestServiceImpl *otherService = [[SEDataRequestServiceImpl alloc] initWithEnvironmentService:environmentService sessionConfiguration:otherTransport.sessionConfiguration pinningType:SEDataRequestCertificatePinningTypeNone applicationBackgroundDefault:NO];
+    otherService.prewarmConnectionCount = 0;
+
+    __block NSDictionary<NSString *, NSString *> *handlerHeaders = nil;
+    [_transport setHandler:^SETestLoopbackResponse *(NSURLRequest *request) {
+        handlerHeaders = request.allHTTPHeaderFields;
+        return [SETestLoopbackResponse responseWithStatusCode:200 JSONObject:@{ @"transport": @1 }];
+    } forMethod:@"GET" path:@"/items"];
+    [otherTransport setResponse:[SETestLoopbackResponse responseWithStatusCode:200 JSONObject:@{ @"transport": @2 }] forMethod:@"GET" path:@"/items"];
+
+    XCTestExpectation *first = [self expectationWithDescription:@"first transport"];
+    [_service GET:@"items" parameters:nil success:^(id data, NSURLResponse *response) {
+        XCTAssertEqualObjects(data, @{ @"transport": @1 });
+        [first fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+
+    XCTestExpectation *second = [self expectationWithDescription:@"second transport"];
+    [otherService GET:@"items" parameters:nil success:^(id data, NSURLResponse *response) {
+        XCTAssertEqualObjects(data, @{ @"transport": @2 });
+        [second fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"Should not fail");
+    } completionQueue:dispatch_get_main_queue()];
+
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    XCTAssertEqual(_transport.requestCount, 1);
+    XCTAssertEqual(otherTransport.requestCount, 1);
+    // handlers see requests as the service has built them
+    XCTAssertNotNil(handlerHeaders);
+    for (NSString *header in handlerHeaders) XCTAssertFalse([header hasPrefix:@"X-SE-Loopback"]);
+}
+
+@end
@@ -0,0 +1,224 @@
+//
+//  SEFutureTests.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+@import XCTest;
+@import OCMock;
+
+#import "SEFuture.h"
+#import "SEConstants.h"
+
+// Pending future with a resolver and a mock token standing for the underlying operation
+static SEFuture *SECreatePendingFuture(SEFutureResolver __strong *resolver, __strong id *token)
+{
+    id operationToken = OCMProtocolMock(@protocol(SECancellableToken));
+    if (token != NULL) *token = operationToken;
+    return [SEFuture futureWithBlock:^id<SECancellableToken>(SEFutureResolver resolve) {
+        *resolver = resolve;
+        return operationToken;
+    }];
+}
+
+@interface SEFutureTests : XCTestCase
+
+@end
+
+@implementation SEFutureTests
+
+- (void)testFutureResolvesOnce
+{
+    SEFutureResolver resolve = nil;
+    SEFuture *future = SECreatePendingFuture(&resolve, NULL);
+    XCTAssertFalse(future.isResolved);
+    
+    resolve(@1, nil);
+    resolve(@2, nil);
+    XCTAssertTrue(future.isResolved);
+    XCTAssertEqualObjects(future.result, @1);
+    XCTAssertNil(future.error);
+}
+
+- (void)testFutureMapRunsInline
+{
+    SEFutureResolver resolve = nil;
+    SEFuture *future = SECreatePendingFuture(&resolve, NULL);
+    SEFuture *mapped = [future map:^id(NSNumber *result) {
+        return @(result.integerValue * 2);
+    }];
+    
+    resolve(@21, nil);
+    XCTAssertEqualObjects(mapped.result, @42);
+}
+
+- (void)testFutureThenChainsOperationsAndPassesErrors
+{
+    SEFutureResolver resolveFirst = nil;
+    __block SEFutureResolver resolveSecond = nil;
+    SEFuture *first = SECreatePendingFuture(&resolveFirst, NULL);
+    SEFuture *chained = [first then:^SEFuture *(NSNumber *result) {
+        XCTAssertEqualObjects(result, @1);
+        return SECreatePendingFuture(&resolveSecond, NULL);
+    }];
+    
+    resolveFirst(@1, nil);
+    XCTAssertFalse(chained.isResolved);
+    resolveSecond(@2, nil);
+    XCTAssertEqualObjects(chained.result, @2);
+    
+    NSError *error = [NSError errorWithDomain:SEErrorDomain code:1 userInfo:nil];
+    SEFuture *failed = [[SEFuture futureWithError:error] then:^SEFuture *(id result) {
+        XCTFail(@"Should not be called");
+        return nil;
+    }];
+    XCTAssertEqualObjects(failed.error, error);
+}
+
+- (void)testFutureCancelCancelsWholeChain
+{
+    SEFutureResolver resolveFirst = nil;
+    __block SEFutureResolver resolveSecond = nil;
+    id firstToken = nil;
+    __block id secondToken = nil;
+    SEFuture *first = SECreatePendingFuture(&resolveFirst, &firstToken);
+    SEFuture *chained = [[first then:^SEFuture *(id result) {
+        return SECreatePendingFuture(&resolveSecond, &secondToken);
+    }] map:^id(id result) {
+        return result;
+    }];
+    
+    resolveFirst(@1, nil);
+    OCMExpect([secondToken cancel]);
+    [chained cancel];
+    
+    OCMVerifyAll(secondToken);
+    XCTAssertEqual(chained.error.code, SEFutureCancelled);
+    
+    // late outcome of a cancelled operation is ignored
+    resolveSecond(@2, nil);
+    XCTAssertNil(chained.result);
+}
+
+- (void)testFutureCancelBeforeResolutionCancelsOperation
+{
+    SEFutureResolver resolve = nil;
+    id token = nil;
+    SEFuture *future = SECreatePendingFuture(&resolve, &token);
+    SEFuture *mapped = [future map:^id(id result) {
+        XCTFail(@"Should not be called");
+        return result;
+    }];
+    
+    OCMExpect([token cancel]);
+    [mapped cancel];
+    OCMVerifyAll(token);
+    XCTAssertEqual(future.error.code, SEFutureCancelled);
+}
+
+- (void)testFutureSharedByDependentsIsCancelledByTheLastOne
+{
+    SEFutureResolver resolve = nil;
+    id token = nil;
+    SEFuture *future = SECreatePendingFuture(&resolve, &token);
+    SEFuture *first = [future map:^id(id result) { return result; }];
+    SEFuture *second = [future map:^id(id result) { return result; }];
+    
+    // the other dependent still waits for the operation
+    [[token reject] cancel];
+    [first cancel];
+    XCTAssertEqual(first.error.code, SEFutureCancelled);
+    XCTAssertFalse(future.isResolved);
+    
+    resolve(@1, nil);
+    XCTAssertEqualObjects(second.result, @1);
+}
+
+- (void)testFutureTimeoutOfSharedFutureOnlyFailsItsDependent
+{
+    SEFutureResolver resolve = nil;
+    id token = nil;
+    SEFuture *future = SECreatePendingFuture(&resolve, &token);
+    SEFuture *mapped = [future map:^id(id result) { return result; }];
+    [[token reject] cancel];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"timeout"];
+    [[future timeout:0.05] onSuccess:nil failure:^(NSError *error) {
+        XCTAssertEqual(error.code, SEFutureTimedOut);
+        [expectation fulfill];
+    } queue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+    
+    XCTAssertFalse(future.isResolved);
+    resolve(@1, nil);
+    XCTAssertEqualObjects(mapped.result, @1);
+}
+
+- (void)testFutureAllCollectsResultsInOrder
+{
+    SEFutureResolver resolveFirst = nil;
+    SEFutureResolver resolveSecond = nil;
+    SEFuture *all = [SEFuture all:@[ SECreatePendingFuture(&resolveFirst, NULL), SECreatePendingFuture(&resolveSecond, NULL), [SEFuture futureWithResult:nil] ]];
+    
+    resolveSecond(@2, nil);
+    XCTAssertFalse(all.isResolved);
+    resolveFirst(@1, nil);
+    XCTAssertEqualObjects(all.result, (@[ @1, @2, [NSNull null] ]));
+}
+
+- (void)testFutureAllFailsFastAndCancelsTheRest
+{
+    SEFutureResolver resolveFirst = nil;
+    SEFutureResolver resolveSecond = nil;
+    id secondToken = nil;
+    SEFuture *second = SECreatePendingFuture(&resolveSecond, &secondToken);
+    SEFuture *all = [SEFuture all:@[ SECreatePendingFuture(&resolveFirst, NULL), second ]];
+    
+    OCMExpect([secondToken cancel]);
+    NSError *error = [NSError errorWithDomain:SEErrorDomain code:1 userInfo:nil];
+    resolveFirst(nil, error);
+    
+    XCTAssertEqualObjects(all.error, error);
+    XCTAssertEqual(second.error.code, SEFutureCancelled);
+    OCMVerifyAll(secondToken);
+}
+
+- (void)testFutureAnyResolvesWithFirstResult
+{
+    SEFutureResolver resolveFirst = nil;
+    SEFutureResolver resolveSecond = nil;
+    SEFuture *any = [SEFuture any:@[ SECreatePendingFuture(&resolveFirst, NULL), SECreatePendingFuture(&resolveSecond, NULL) ]];
+    
+    resolveFirst(nil, [NSError errorWithDomain:SEErrorDomain code:1 userInfo:nil]);
+    XCTAssertFalse(any.isResolved);
+    resolveSecond(@2, nil);
+    XCTAssertEqualObjects(any.result, @2);
+}
+
+- (void)testFutureTimeoutCancelsOperation
+{
+    SEFutureResolver resolve = nil;
+    id token = nil;
+    SEFuture *future = SECreatePendingFuture(&resolve, &token);
+    OCMExpect([token cancel]);
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"timeout"];
+    [[future timeout:0.05] onSuccess:^(id result) {
+        XCTFail(@"Should not succeed");
+    } failure:^(NSError *error) {
+        XCTAssertEqual(error.code, SEFutureTimedOut);
+        [expectation fulfill];
+    } queue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    
+    // source is cancelled on the timer thread right after the timeout is reported
+    OCMVerifyAllWithDelay(token, 1.0);
+    XCTAssertEqual(future.error.code, SEFutureCancelled);
+}
+
+@end
@@ -0,0 +1,120 @@
+//
+//  SETimelineTests.m
+//  Service Essentials
+//
+//  Created by Anton Vaneev.
+//  Copyright (c) 2015 Anton Vaneev. All rights reserved.
+//
+//  Distributed under BSD license. See LICENSE for details.
+//
+
+#import <Foundation/Foundation.h>
+#import <XCTest/XCTest.h>
+
+#import "SETimeline.h"
+#import "SEServiceLocator.h"
+
+@protocol SETimelineTestService <NSObject>
+@end
+
+@interface SETimelineTestServiceImplementation : NSObject <SETimelineTestService>
+@end
+
+@implementation SETimelineTestServiceImplementation
+@end
+
+@interface SETimelineTests : XCTestCase
+
+@end
+
+@implementation SETimelineTests
+
+- (NSArray<NSDictionary *> *)eventsOfTimeline:(SETimeline *)timeline
+{
+    NSDictionary *trace = [NSJSONSerialization JSONObjectWithData:[timeline chromeTraceData] options:0 error:nil];
+    XCTAssertTrue([trace isKindOfClass:[NSDictionary class]]);
+    return trace[@"traceEvents"];
+}
+
+- (void)testRecordsSpansWhileEnabled
+{
+    SETimeline *timeline = [[SETimeline alloc] initWithCapacity:3];
+    XCTAssertEqual(timeline.capacity, 4);
+
+    [timeline recordSpanWithName:"ignored" category:"test" beginTime:1 endTime:2 identifier:0];
+    XCTAssertEqual([self eventsOfTimeline:timeline].count, 0);
+
+    timeline.enabled = YES;
+    [timeline recordSpanWithName:"work" category:"test" beginTime:1 endTime:1.5 identifier:0];
+    [timeline recordSpanWithName:"flow" category:"test" beginTime:2 endTime:3 identifier:42];
+
+    // thread spans are complete events, spans of a flow are pairs of async events
+    NSArray<NSDictionary *> *events = [self eventsOfTimeline:timeline];
+    XCTAssertEqual(events.count, 3);
+    XCTAssertEqualObjects(events[0][@"name"], @"work");
+    XCTAssertEqualObjects(events[0][@"ph"], @"X");
+    XCTAssertEqualObjects(events[0][@"ts"], @1000000);
+    XCTAssertEqualObjects(events[0][@"dur"], @500000);
+    XCTAssertEqualObjects(events[1][@"ph"], @"b");
+    XCTAssertEqualObjects(events[2][@"ph"], @"e");
+    XCTAssertEqualObjects(events[1][@"id"], @"0x2a");
+    XCTAssertEqualObjects(events[2][@"ts"], @3000000);
+
+    [timeline removeAllSpans];
+    XCTAssertEqual([self eventsOfTimeline:timeline].count, 0);
+}
+
+- (void)testKeepsLatestSpans
+{
+    SETimeline *timeline = [[SETimeline alloc] initWithCapacity:4];
+    timeline.enabled = YES;
+    for (NSUInteger i = 0; i < 10; ++i)
+    {
+        [timeline recordSpanWithName:"work" category:"test" beginTime:i + 1 endTime:i + 2 identifier:0];
+    }
+
+    NSArray<NSDictionary *> *events = [self eventsOfTimeline:timeline];
+    XCTAssertEqual(events.count, 4);
+    XCTAssertEqualObjects(events.firstObject[@"ts"], @7000000);
+    XCTAssertEqualObjects(events.lastObject[@"ts"], @10000000);
+}
+
+- (void)testConcurrentRecording
+{
+    SETimeline *timeline = [[SETimeline alloc] initWithCapacity:1024];
+    timeline.enabled = YES;
+    dispatch_apply(8, dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^(size_t iteration) {
+        for (NSUInteger i = 0; i < 1000; ++i)
+        {
+            [timeline recordSpanWithName:"work" category:"test" beginTime:1 endTime:2 identifier:iteration + 1];
+        }
+    });
+
+    // every slot has been written and is exported as a pair of events
+    XCTAssertEqual([self eventsOfTimeline:timeline].count, 2048);
+}
+
+- (void)testSharedTimelineRecordsServiceConstruction
+{
+    SETimeline *timeline = [SETimeline sharedTimeline];
+    [timeline removeAllSpans];
+    XCTAssertEqual(SETimelineBegin(), 0);
+
+    timeline.enabled = YES;
+    SEServiceLocator *serviceLocator = [[SEServiceLocator alloc] init];
+    [serviceLocator registerLazyEvaluatedServiceWithConstructionBlock:^id(SEServiceLocator *locator) {
+        return [SETimelineTestServiceImplementation new];
+    } forProtocol:@protocol(SETimelineTestService)];
+    XCTAssertNotNil([serviceLocator serviceForProtocol:@protocol(SETimelineTestService)]);
+    timeline.enabled = NO;
+
+    NSArray<NSDictionary *> *events = [self eventsOfTimeline:timeline];
+    NSUInteger index = [events indexOfObjectPassingTest:^BOOL(NSDictionary *event, NSUInteger idx, BOOL *stop) {
+        return [event[@"name"] isEqualToString:@"SETimelineTestService"];
+    }];
+    XCTAssertNotEqual(index, NSNotFound);
+    XCTAssertEqualObjects(events[index][@"cat"], @"service locator");
+    [timeline removeAllSpans];
+}
+
+@end